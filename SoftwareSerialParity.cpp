@@ -46,6 +46,7 @@ http://arduiniana.org.
 #include <avr/pgmspace.h>
 #include <Arduino.h>
 #include "SoftwareSerialParity.h"
+#include "timebase.h"
 #include <util/delay_basic.h>
 
 //
@@ -53,6 +54,9 @@ http://arduiniana.org.
 //
 SoftwareSerialParity *SoftwareSerialParity::active_object = 0;
 uint8_t SoftwareSerialParity::_receive_buffer[_SS_MAX_RX_BUFF]; 
+#ifdef ENABLE_RX_TIMESTAMPS
+uint16_t SoftwareSerialParity::_receive_time[_SS_MAX_RX_BUFF];
+#endif
 volatile uint8_t SoftwareSerialParity::_receive_buffer_tail = 0;
 volatile uint8_t SoftwareSerialParity::_receive_buffer_head = 0;
 
@@ -99,6 +103,7 @@ bool SoftwareSerialParity::listen()
       active_object->stopListening();
 
     _buffer_overflow = false;
+    _parity_errors = 0;
     _receive_buffer_head = _receive_buffer_tail = 0;
     active_object = this;
 
@@ -168,6 +173,24 @@ void SoftwareSerialParity::recv()
         d |= 0x80;
     }
 
+    // Sample the parity bit and check it. ISO7816 asks the receiver to
+    // signal a parity error by pulling the line low in the stop bit; we
+    // don't, we only count them.
+    if (Tparity != NONE)
+    {
+      tunedDelay(_rx_delay_intrabit);
+      DebugPulse(_DEBUG_PIN2, 1);
+      uint8_t p = d ^ (d >> 4);
+      p ^= (p >> 2);
+      p ^= (p >> 1);
+      p ^= rx_pin_read() ? 1 : 0;
+      if (_inverse_logic)
+        p ^= 1;
+      // Even parity: an even number of ones in the data and parity bits
+      if (((p & 1) != (Tparity == ODD)) && (_parity_errors != 0xFF))
+        _parity_errors++;
+    }
+
     if (_inverse_logic)
       d = ~d;
 
@@ -177,6 +200,14 @@ void SoftwareSerialParity::recv()
     {
       // save new data in buffer: tail points to where byte goes
       _receive_buffer[_receive_buffer_tail] = d; // save new byte
+#ifdef ENABLE_RX_TIMESTAMPS
+      // timestamp the byte -- this is just after the centre of the last
+      // bit sampled (the parity bit, or the last data bit). Only the low
+      // 16 bits are kept, read() fills in the rest.
+      // This delays the stop bit wait by a few dozen cycles, which is
+      // well inside the margin (it ends 1/4 of a bit into the stop bit).
+      _receive_time[_receive_buffer_tail] = (uint16_t)tbNow();
+#endif
       _receive_buffer_tail = next;
     } 
     else 
@@ -256,7 +287,8 @@ SoftwareSerialParity::SoftwareSerialParity(uint8_t receivePin, uint8_t transmitP
   _rx_delay_stopbit(0),
   _tx_delay(0),
   _buffer_overflow(false),
-  _inverse_logic(inverse_logic)
+  _inverse_logic(inverse_logic),
+  _parity_errors(0)
  
 {
   setTX(transmitPin);
@@ -357,8 +389,10 @@ void SoftwareSerialParity::begin(long speed, uint8_t parity, uint8_t stopbits)
     // time for ISR cleanup, which makes 115200 baud at 16Mhz work more
     // reliably
     
+	// With parity, the parity bit is read like a data bit (plus about 12
+	// cycles to check it) and the delay is from there.
 	if (Tparity != NONE)
-		_rx_delay_stopbit = subtract_cap(2 * bit_delay * 3 / 4, (37 + 11) / 4);
+		_rx_delay_stopbit = subtract_cap(bit_delay * 3 / 4, (37 + 11 + 12) / 4);
 	else
 		_rx_delay_stopbit = subtract_cap(bit_delay * 3 / 4, (37 + 11) / 4);
 	
@@ -423,6 +457,30 @@ int SoftwareSerialParity::read()
   return d;
 }
 
+// Read data from buffer, with the time it was received
+int SoftwareSerialParity::read(uint32_t *timestamp)
+{
+  if (!isListening())
+    return -1;
+
+  // Empty buffer?
+  if (_receive_buffer_head == _receive_buffer_tail)
+    return -1;
+
+  uint32_t now = tbNow();
+
+#ifdef ENABLE_RX_TIMESTAMPS
+  // The ISR only keeps the low 16 bits. The byte can't have been waiting
+  // for more than 2^16 clocks (18ms) unless the caller was very slow.
+  *timestamp = now - (uint16_t)((uint16_t)now - _receive_time[_receive_buffer_head]);
+#else
+  // No receive timestamps, use the time we picked it up
+  *timestamp = now;
+#endif
+
+  return read();
+}
+
 int SoftwareSerialParity::available()
 {
   if (!isListening())
@@ -38,6 +38,7 @@ http://arduiniana.org.
 
 #include <inttypes.h>
 #include <Stream.h>
+#include "config.h"
 
 /******************************************************************************
 * Definitions
@@ -73,9 +74,13 @@ private:
 
   uint16_t _buffer_overflow:1;
   uint16_t _inverse_logic:1;
+  volatile uint8_t _parity_errors;
 
   // static data
   static uint8_t _receive_buffer[_SS_MAX_RX_BUFF]; 
+#ifdef ENABLE_RX_TIMESTAMPS
+  static uint16_t _receive_time[_SS_MAX_RX_BUFF];
+#endif
   static volatile uint8_t _receive_buffer_tail;
   static volatile uint8_t _receive_buffer_head;
   static SoftwareSerialParity *active_object;
@@ -103,10 +108,14 @@ public:
   bool isListening() { return this == active_object; }
   bool stopListening();
   bool overflow() { bool ret = _buffer_overflow; if (ret) _buffer_overflow = false; return ret; }
+  // Characters received with bad parity since the last call (stops at 255)
+  uint8_t parityErrors() { uint8_t ret = _parity_errors; _parity_errors = 0; return ret; }
   int peek();
 
   virtual size_t write(uint8_t byte);
   virtual int read();
+  // Read, and return the time the byte was received (tbNow() clocks, see timebase.h)
+  int read(uint32_t *timestamp);
   virtual int available();
   virtual void flush();
   operator bool() { return true; }
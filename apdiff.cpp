@@ -0,0 +1,350 @@
+#include <util/crc16.h>
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "timebase.h"
+#include "hostlink.h"
+#include "utils.h"
+
+#ifdef ENABLE_DIFF
+
+/// Most APDUs in a sequence
+#define DIFF_MAX_STEPS		16
+
+/// Command data for the whole sequence
+#define DIFF_DATA_POOL		128
+
+/// Default timing tolerance, card clocks (2 Etu at the standard rate)
+#define DIFF_TOLERANCE		744
+
+// Step difference flags
+#define DIFF_SW				0x01	///< Different SW1SW2 (or ATR convention)
+#define DIFF_DATA			0x02	///< Different response data
+#define DIFF_CHARS			0x04	///< Different number of characters received
+#define DIFF_TIME			0x08	///< Response time outside the tolerance
+
+
+// One step of the sequence
+typedef struct {
+	uint8_t hdr[5];			///< CLA, INS, P1, P2, LEN
+	bool isSend;			///< Command sends data (else receives)
+	uint8_t dataOfs;		///< Command data, in gDiffData
+} DIFF_STEP;
+
+// The result of a step, hashed so it is cheap to keep and compare
+typedef struct {
+	uint16_t sw;			///< SW1SW2; for the ATR, the convention
+	uint16_t crc;			///< CRC16 of the response data (or ATR)
+	uint16_t nChars;		///< Characters received (or ATR length)
+	uint32_t t;				///< SW1 time (or reset release to TS), card clocks
+} DIFF_RESULT;
+
+static DIFF_STEP gDiffSteps[DIFF_MAX_STEPS];
+static uint8_t gDiffData[DIFF_DATA_POOL];
+static uint8_t gDiffNumSteps = 0;
+static uint8_t gDiffDataUsed = 0;
+
+// Golden results. Step 0 is the ATR, step n is APDU n-1.
+static DIFF_RESULT gDiffGolden[DIFF_MAX_STEPS + 1];
+static uint32_t gDiffGoldenSteps = 0;		///< Bit n set: step n's golden result is recorded or loaded
+
+
+/// Are there golden results for every step, the ATR included?
+static bool diffHaveGolden(void)
+{
+	return gDiffGoldenSteps == ((2UL << gDiffNumSteps) - 1);
+}
+
+
+/**
+ * Power up the card and get the ATR result (step 0).
+ *
+ * @return <b>false</b> if there was no ATR
+ */
+static bool diffReset(uint8_t *buf, DIFF_RESULT *res)
+{
+	ATR_TIMING timing;
+	uint32_t tRelease;
+	uint8_t len;
+
+	cardColdReset(true);
+	tRelease = tbNow();
+	SCRST(1);
+
+	len = cardGetAtr(buf, true, ATR_TIMEOUT_MS, &timing);
+	if (len == 0) {
+		return false;
+	}
+	cardProfileApply(buf, len, true);
+
+	res->sw = scGetInverseConvention();
+	res->crc = 0xFFFF;
+	for (uint8_t i = 0; i < len; i++) {
+		res->crc = _crc16_update(res->crc, buf[i]);
+	}
+	res->nChars = len;
+	res->t = timing.tFirst - tRelease;
+
+	return true;
+}
+
+
+/**
+ * Run one step of the sequence.
+ */
+static void diffStep(const DIFF_STEP *step, uint8_t *buf, DIFF_RESULT *res)
+{
+	APDU_TIMING timing;
+	uint8_t len = step->hdr[4];
+
+	timing.rxTimes = NULL;
+	timing.rxTimesMax = 0;
+
+	if (step->isSend) {
+		memcpy(buf, &gDiffData[step->dataOfs], len);
+	} else {
+		memset(buf, 0, len);
+	}
+
+	res->sw = cardSendApdu(step->hdr[0], step->hdr[1], step->hdr[2], step->hdr[3], len, buf, step->isSend, NULL, false, &timing);
+	res->crc = 0xFFFF;
+	if (!step->isSend) {
+		for (uint8_t i = 0; i < len; i++) {
+			res->crc = _crc16_update(res->crc, buf[i]);
+		}
+	}
+	res->nChars = timing.nChars;
+	res->t = timing.tSw1;
+
+	delay(gCardProfile.cmdGap);
+}
+
+
+/**
+ * Compare a result with the golden one.
+ *
+ * @return DIFF_xxx flags
+ */
+static uint8_t diffCompare(const DIFF_RESULT *res, const DIFF_RESULT *golden, const uint32_t tolerance)
+{
+	uint8_t flags = 0;
+	uint32_t dt = (res->t > golden->t) ? (res->t - golden->t) : (golden->t - res->t);
+
+	if (res->sw != golden->sw)			flags |= DIFF_SW;
+	if (res->crc != golden->crc)		flags |= DIFF_DATA;
+	if (res->nChars != golden->nChars)	flags |= DIFF_CHARS;
+	if (dt > tolerance)					flags |= DIFF_TIME;
+
+	return flags;
+}
+
+
+/**
+ * Report a step result.
+ *
+ * FRAME_DIFF payload:
+ *   u8 step, u8 flags, u16 sw, u16 crc, u16 nChars, u32 t, u8 nData, u8 data[nData]
+ *
+ * @param	data	Response data (nData bytes), if it should be sent
+ */
+static void diffReport(const uint8_t step, const uint8_t flags, const DIFF_RESULT *res, const DIFF_RESULT *golden, const uint8_t *data, const uint8_t nData)
+{
+	if (gBinaryFrames) {
+		hostFrameBegin(FRAME_DIFF, 13 + nData);
+		hostFrameWriteByte(step);
+		hostFrameWriteByte(flags);
+		hostFrameWriteU16(res->sw);
+		hostFrameWriteU16(res->crc);
+		hostFrameWriteU16(res->nChars);
+		hostFrameWriteU32(res->t);
+		hostFrameWriteByte(nData);
+		hostFrameWrite(data, nData);
+		hostFrameEnd();
+		return;
+	}
+
+	// Only print what differs, as golden/this
+	Serial.print(F("Step "));
+	Serial.print(step);
+	Serial.print(':');
+	if (flags & DIFF_SW) {
+		Serial.print(F(" SW "));
+		Serial.print(golden->sw, HEX);
+		Serial.print('/');
+		Serial.print(res->sw, HEX);
+	}
+	if (flags & DIFF_CHARS) {
+		Serial.print(F(" Chars "));
+		Serial.print(golden->nChars);
+		Serial.print('/');
+		Serial.print(res->nChars);
+	}
+	if (flags & DIFF_TIME) {
+		Serial.print(F(" T "));
+		Serial.print(golden->t);
+		Serial.print('/');
+		Serial.print(res->t);
+	}
+	if (flags & DIFF_DATA) {
+		Serial.print(F(" Data "));
+		printHexBuf(data, nData);
+	}
+	Serial.println();
+}
+
+
+/**
+ * Run the sequence.
+ *
+ * @param	golden		Record the golden results rather than comparing
+ * @param	tolerance	Timing tolerance, card clocks
+ */
+static void diffRun(const bool golden, const uint32_t tolerance)
+{
+	uint8_t buf[256];
+	DIFF_RESULT res;
+	uint8_t flags;
+	uint8_t nDiff = 0;
+
+	for (uint8_t step = 0; step <= gDiffNumSteps; step++) {
+		uint8_t nData;
+
+		if (step == 0) {
+			if (!diffReset(buf, &res)) {
+				Serial.println(F("**ERROR: No ATR"));
+				cardPower(0);
+				return;
+			}
+			nData = res.nChars;
+		} else {
+			diffStep(&gDiffSteps[step - 1], buf, &res);
+			nData = gDiffSteps[step - 1].isSend ? 0 : gDiffSteps[step - 1].hdr[4];
+		}
+
+		if (golden) {
+			gDiffGolden[step] = res;
+			if (gBinaryFrames) {
+				diffReport(step, 0, &res, &res, buf, nData);
+			}
+		} else {
+			flags = diffCompare(&res, &gDiffGolden[step], tolerance);
+			if (flags != 0) {
+				nDiff++;
+				diffReport(step, flags, &res, &gDiffGolden[step], buf, nData);
+			}
+		}
+	}
+
+	if (golden) {
+		gDiffGoldenSteps = (2UL << gDiffNumSteps) - 1;
+		Serial.print(F("Recorded "));
+		Serial.print(gDiffNumSteps);
+		Serial.println(F(" steps"));
+	} else {
+		Serial.print(F("Steps differing: "));
+		Serial.print(nDiff);
+		Serial.print('/');
+		Serial.println(gDiffNumSteps + 1);
+	}
+
+	cardPower(0);
+}
+
+
+void handle_diff(String *cmdline)
+{
+	String sub;
+	long val;
+
+	if (!popWord(cmdline, &sub)) {
+		Serial.print(gDiffNumSteps);
+		Serial.print(F(" steps, golden "));
+		Serial.println(diffHaveGolden() ? F("recorded") : F("not recorded"));
+		for (uint8_t i = 0; i < gDiffNumSteps; i++) {
+			const DIFF_STEP *step = &gDiffSteps[i];
+
+			Serial.print(i + 1);
+			Serial.print(step->isSend ? F(": S ") : F(": R "));
+			printHexBuf(step->hdr, 5);
+			if (step->isSend) {
+				Serial.print(' ');
+				printHexBuf(&gDiffData[step->dataOfs], step->hdr[4]);
+			}
+			Serial.println();
+		}
+
+	} else if (sub.equals(F("add"))) {
+		DIFF_STEP *step = &gDiffSteps[gDiffNumSteps];
+		String dir;
+		int n;
+
+		if (gDiffNumSteps >= DIFF_MAX_STEPS) {
+			Serial.println(F("**ERROR: Too many steps"));
+			return;
+		}
+		if (!popWord(cmdline, &dir) || !(dir.equals(F("send")) || dir.equals(F("recv")))) {
+			Serial.println(F("**ERROR: Syntax = diff add send|recv <cla> <ins> <p1> <p2> <len> [data...]"));
+			return;
+		}
+		step->isSend = dir.equals(F("send"));
+
+		for (uint8_t i = 0; i < 5; i++) {
+			if (!popArg(cmdline, &val)) {
+				Serial.println(F("**ERROR: Need <cla> <ins> <p1> <p2> <len>"));
+				return;
+			}
+			step->hdr[i] = val;
+		}
+
+		step->dataOfs = gDiffDataUsed;
+		n = popHexBytes(cmdline, &gDiffData[gDiffDataUsed], DIFF_DATA_POOL - gDiffDataUsed);
+		if ((n < 0) || (step->isSend && (n != step->hdr[4])) || (!step->isSend && (n != 0))) {
+			Serial.println(F("**ERROR: Send data must match <len>, and fit in the data pool"));
+			return;
+		}
+		gDiffDataUsed += n;
+		gDiffNumSteps++;
+		gDiffGoldenSteps = 0;
+
+	} else if (sub.equals(F("golden"))) {
+		diffRun(true, 0);
+
+	} else if (sub.equals(F("load"))) {
+		// Golden results from the host, one step at a time
+		long step, sw, crc, nChars, t;
+
+		if (!popArg(cmdline, &step, 10) || !popArg(cmdline, &sw) || !popArg(cmdline, &crc) ||
+				!popArg(cmdline, &nChars, 10) || !popArg(cmdline, &t, 10) ||
+				(step < 0) || (step > gDiffNumSteps)) {
+			Serial.println(F("**ERROR: Syntax = diff load <step> <sw> <crc> <chars> <time>"));
+			return;
+		}
+
+		gDiffGolden[step].sw = sw;
+		gDiffGolden[step].crc = crc;
+		gDiffGolden[step].nChars = nChars;
+		gDiffGolden[step].t = t;
+		gDiffGoldenSteps |= 1UL << step;
+
+	} else if (sub.equals(F("run"))) {
+		if (!diffHaveGolden()) {
+			Serial.println(F("**ERROR: Record or load the golden results first, for every step"));
+			return;
+		}
+		if (!popArg(cmdline, &val, 10)) {
+			val = DIFF_TOLERANCE;
+		}
+		diffRun(false, val);
+
+	} else if (sub.equals(F("clear"))) {
+		gDiffNumSteps = gDiffDataUsed = 0;
+		gDiffGoldenSteps = 0;
+		Serial.println(F("Cleared"));
+
+	} else {
+		Serial.println(F("**ERROR: Syntax = diff [add ... | golden | load ... | run [<tolerance>] | clear]"));
+	}
+}
+
+#endif // ENABLE_DIFF
@@ -0,0 +1,17 @@
+#ifndef APDIFF_H
+#define APDIFF_H
+
+#ifdef ENABLE_DIFF
+
+/**
+ * Command handler: diff [add send|recv <apdu...> | golden | load <step> <sw> <crc> <chars> <time> | run [<tolerance>] | clear]
+ *
+ * Differential execution: run an APDU sequence on a golden card (or load
+ * its results from the host), then run it on another card and report only
+ * the steps which differ.
+ */
+void handle_diff(String *cmdline);
+
+#endif // ENABLE_DIFF
+
+#endif // APDIFF_H
@@ -0,0 +1,401 @@
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "timebase.h"
+#include "hostlink.h"
+#include "glitchkernel.h"
+#include "bench.h"
+#include "utils.h"
+
+#ifdef ENABLE_BENCH
+
+/// Payload bytes per FRAME_BENCH_DATA frame for the host link benchmark
+#define BENCH_LINK_CHUNK	250
+
+/// Warm reset: reset held low for this many card clocks (ISO7816 minimum)
+#define BENCH_WARM_HOLD		400
+
+// In glitcher.ino
+void handle_scan_cla(String *cmdline);
+
+
+/// Benchmark result, see bench.h
+typedef struct {
+	uint32_t n;
+	uint32_t nFail;
+	uint32_t elapsed;		///< Microseconds
+	uint32_t tMin;			///< Per-operation times, card clocks
+	uint32_t tMax;
+	uint64_t tSum;
+	uint32_t nTimed;		///< Operations in tSum
+} BENCH_RESULT;
+
+
+static void benchStart(BENCH_RESULT *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->tMin = 0xFFFFFFFF;
+}
+
+
+/// Add one operation's time to the result
+static void benchTime(BENCH_RESULT *r, const uint32_t t)
+{
+	r->tMin = min(r->tMin, t);
+	r->tMax = max(r->tMax, t);
+	r->tSum += t;
+	r->nTimed++;
+}
+
+
+/**
+ * Print a result, and send it as a FRAME_BENCH frame in binary mode.
+ *
+ * @param	test	BENCH_xxx
+ * @param	unit	What n counts, for the text
+ */
+static void benchReport(const uint8_t test, BENCH_RESULT *r, const __FlashStringHelper *unit)
+{
+	uint32_t tMean = 0;
+
+	if (r->nTimed == 0) {
+		r->tMin = 0;
+	} else {
+		tMean = r->tSum / r->nTimed;
+	}
+
+	if (gBinaryFrames) {
+		hostFrameBegin(FRAME_BENCH, 25);
+		hostFrameWriteByte(test);
+		hostFrameWriteU32(r->n);
+		hostFrameWriteU32(r->nFail);
+		hostFrameWriteU32(r->elapsed);
+		hostFrameWriteU32(r->tMin);
+		hostFrameWriteU32(tMean);
+		hostFrameWriteU32(r->tMax);
+		hostFrameEnd();
+	}
+
+	Serial.println();
+	Serial.print(r->n);
+	Serial.print(' ');
+	Serial.print(unit);
+	Serial.print(F(" in "));
+	Serial.print(r->elapsed);
+	Serial.print(F("us = "));
+	Serial.print((r->n * 1000000.0) / max(r->elapsed, 1UL), 1);
+	Serial.print(F("/sec, "));
+	Serial.print(r->nFail);
+	Serial.println(F(" failed"));
+
+	if (r->nTimed > 0) {
+		Serial.print(F("Each: min "));
+		Serial.print(r->tMin);
+		Serial.print(F(", mean "));
+		Serial.print(tMean);
+		Serial.print(F(", max "));
+		Serial.print(r->tMax);
+		Serial.println(F(" clocks"));
+	}
+}
+
+
+/**
+ * Cold-reset the card with gResetTiming and read the ATR.
+ *
+ * @param[out]	latency		Reset release to TS, card clocks
+ * @return ATR length
+ */
+static uint8_t benchColdReset(uint8_t *atrbuf, uint32_t *latency)
+{
+	ATR_TIMING timing;
+	uint32_t tRelease;
+	uint8_t len;
+
+	cardColdReset(true);
+	tRelease = tbNow();
+	SCRST(1);
+
+	len = cardGetAtr(atrbuf, true, gResetTiming.atrTimeout, &timing);
+	*latency = timing.tFirst - tRelease;
+	return len;
+}
+
+
+/**
+ * Warm-reset the card (reset low with power and clock left on) and read the
+ * ATR.
+ */
+static uint8_t benchWarmReset(uint8_t *atrbuf, uint32_t *latency)
+{
+	ATR_TIMING timing;
+	uint32_t tRelease;
+	uint8_t len;
+
+	SCRST(0);
+	scDelayClocks(BENCH_WARM_HOLD);
+	tRelease = tbNow();
+	SCRST(1);
+
+	len = cardGetAtr(atrbuf, true, gResetTiming.atrTimeout, &timing);
+	*latency = timing.tFirst - tRelease;
+	return len;
+}
+
+
+/**
+ * Power up the card for the APDU benchmarks, and set it up from its profile.
+ */
+static bool benchPowerUp(void)
+{
+	uint8_t atrbuf[32];
+	uint32_t latency;
+	uint8_t len = benchColdReset(atrbuf, &latency);
+
+	if (len == 0) {
+		Serial.println(F("**ERROR: No ATR"));
+		cardPower(0);
+		return false;
+	}
+	cardProfileApply(atrbuf, len, true);
+	return true;
+}
+
+
+static void benchApdu(String *cmdline, const bool isSend)
+{
+	uint8_t buf[256];
+	APDU_TIMING timing;
+	BENCH_RESULT r;
+	long n, cla, ins, p1, p2, len;
+	uint16_t sw0 = 0;
+
+	if (!popArg(cmdline, &n, 10) || !popArg(cmdline, &cla) || !popArg(cmdline, &ins) ||
+			!popArg(cmdline, &p1) || !popArg(cmdline, &p2) || !popArg(cmdline, &len) ||
+			(n < 1) || (len < 0) || (len > 255)) {
+		Serial.println(F("**ERROR: Syntax = bench apdu recv|send <n> <cla> <ins> <p1> <p2> <len>"));
+		return;
+	}
+
+	if (!benchPowerUp()) {
+		return;
+	}
+
+	timing.rxTimes = NULL;
+	timing.rxTimesMax = 0;
+	benchStart(&r);
+	unsigned long tStart = micros();
+
+	for (long i = 0; i < n; i++) {
+		uint32_t t = tbNow();
+
+		memset(buf, 0, len);
+		uint16_t sw = cardSendApdu(cla, ins, p1, p2, len, buf, isSend, NULL, false, &timing);
+		benchTime(&r, tbNow() - t);
+
+		// A failure is a comms error or a different answer from the first one
+		if (i == 0) {
+			sw0 = sw;
+		}
+		if ((sw >= 0xFFF0) || (sw != sw0)) {
+			r.nFail++;
+		}
+		r.n++;
+
+		delay(gCardProfile.cmdGap);
+	}
+
+	r.elapsed = micros() - tStart;
+	cardPower(0);
+
+	Serial.print(F("SW "));
+	Serial.println(sw0, HEX);
+	benchReport(isSend ? BENCH_APDU_SEND : BENCH_APDU_RECV, &r, F("APDUs"));
+}
+
+
+static void benchReset(String *cmdline, const bool warm)
+{
+	uint8_t atrbuf[32], atr0[32];
+	uint8_t len, len0;
+	uint32_t latency;
+	BENCH_RESULT r;
+	long n;
+
+	if (!popArg(cmdline, &n, 10) || (n < 1)) {
+		Serial.println(F("**ERROR: Syntax = bench reset cold|warm <n>"));
+		return;
+	}
+
+	// The first ATR is the one the others must match. For warm resets this
+	// also powers the card up.
+	len0 = benchColdReset(atr0, &latency);
+	if (len0 == 0) {
+		Serial.println(F("**ERROR: No ATR"));
+		cardPower(0);
+		return;
+	}
+
+	benchStart(&r);
+	unsigned long tStart = micros();
+
+	for (long i = 0; i < n; i++) {
+		len = warm ? benchWarmReset(atrbuf, &latency) : benchColdReset(atrbuf, &latency);
+
+		if ((len == 0) || (len != len0) || (memcmp(atrbuf, atr0, len) != 0)) {
+			r.nFail++;
+		} else {
+			benchTime(&r, latency);
+		}
+		r.n++;
+	}
+
+	r.elapsed = micros() - tStart;
+	cardPower(0);
+
+	benchReport(warm ? BENCH_RESET_WARM : BENCH_RESET_COLD, &r, F("resets"));
+}
+
+
+static void benchScanCla(String *cmdline)
+{
+	BENCH_RESULT r;
+	long cla;
+	String args;
+
+	if (!popArg(cmdline, &cla) || (cla < 0) || (cla > 0xFF)) {
+		Serial.println(F("**ERROR: Syntax = bench scancla <cla>"));
+		return;
+	}
+
+	// scancla does its own reset, and uses the scan cache as usual
+	args = String(cla, HEX);
+	benchStart(&r);
+	unsigned long tStart = micros();
+	handle_scan_cla(&args);
+	r.elapsed = micros() - tStart;
+	r.n = 1;
+
+	benchReport(BENCH_SCANCLA, &r, F("scans"));
+}
+
+
+static void benchLink(String *cmdline)
+{
+	BENCH_RESULT r;
+	long n;
+
+	if (!popArg(cmdline, &n, 10) || (n < 1)) {
+		Serial.println(F("**ERROR: Syntax = bench link <bytes>"));
+		return;
+	}
+	if (!gBinaryFrames) {
+		Serial.println(F("**ERROR: Turn binary frames on first ('binary 1')"));
+		return;
+	}
+
+	benchStart(&r);
+	Serial.flush();
+	unsigned long tStart = micros();
+
+	// Counting pattern, in frames of up to BENCH_LINK_CHUNK bytes. n counts
+	// every byte on the wire, framing included.
+	uint8_t val = 0;
+	while ((long)r.n < n) {
+		uint16_t len = min((long)BENCH_LINK_CHUNK, n - (long)r.n);
+
+		hostFrameBegin(FRAME_BENCH_DATA, len);
+		for (uint16_t i = 0; i < len; i++) {
+			hostFrameWriteByte(val++);
+		}
+		hostFrameEnd();
+		r.n += len + 5;
+	}
+	Serial.flush();
+	r.elapsed = micros() - tStart;
+
+	benchReport(BENCH_LINK, &r, F("bytes"));
+}
+
+
+#ifdef ENABLE_GLITCH
+static void benchGlitch(String *cmdline)
+{
+	uint8_t atrbuf[32];
+	ATR_TIMING timing;
+	BENCH_RESULT r;
+	long n, offset, width;
+
+	if (!popArg(cmdline, &n, 10) || !popArg(cmdline, &offset, 10) || !popArg(cmdline, &width, 10) ||
+			(n < 1) || (offset < 0) || (width < GK_WIDTH_MIN) || (width > GK_WIDTH_MAX)) {
+		Serial.println(F("**ERROR: Syntax = bench glitch <n> <offset> <width>"));
+		return;
+	}
+
+	benchStart(&r);
+	unsigned long tStart = micros();
+
+	// The same reset, glitch and ATR read as each 'gatr' attempt
+	for (long i = 0; i < n; i++) {
+		uint32_t tRelease;
+
+		cardColdReset(true);
+		noInterrupts();
+		tRelease = tbNow();
+		SCRST(1);
+		gkGlitch(offset, width);
+		tbCatchUp(tRelease, (offset + width) / 4);
+		interrupts();
+
+		if (cardGetAtr(atrbuf, true, gResetTiming.atrTimeout, &timing) == 0) {
+			r.nFail++;
+		} else {
+			benchTime(&r, timing.tFirst - tRelease);
+		}
+		r.n++;
+	}
+
+	r.elapsed = micros() - tStart;
+	cardPower(0);
+
+	benchReport(BENCH_GLITCH, &r, F("attempts"));
+}
+#endif // ENABLE_GLITCH
+
+
+void handle_bench(String *cmdline)
+{
+	String sub, arg;
+
+	popWord(cmdline, &sub);
+
+	if (sub.equals(F("apdu"))) {
+		popWord(cmdline, &arg);
+		if (arg.equals(F("recv")) || arg.equals(F("send"))) {
+			benchApdu(cmdline, arg.equals(F("send")));
+			return;
+		}
+	} else if (sub.equals(F("reset"))) {
+		popWord(cmdline, &arg);
+		if (arg.equals(F("cold")) || arg.equals(F("warm"))) {
+			benchReset(cmdline, arg.equals(F("warm")));
+			return;
+		}
+	} else if (sub.equals(F("scancla"))) {
+		benchScanCla(cmdline);
+		return;
+	} else if (sub.equals(F("link"))) {
+		benchLink(cmdline);
+		return;
+#ifdef ENABLE_GLITCH
+	} else if (sub.equals(F("glitch"))) {
+		benchGlitch(cmdline);
+		return;
+#endif
+	}
+
+	Serial.println(F("**ERROR: Syntax = bench apdu|reset|scancla|link|glitch ..."));
+}
+
+#endif // ENABLE_BENCH
@@ -0,0 +1,48 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/***
+ * Benchmarks
+ *
+ * Each benchmark prints its result and sends it as a FRAME_BENCH frame:
+ *
+ *   u8 test, u32 n, u32 nFail, u32 elapsed, u32 tMin, u32 tMean, u32 tMax
+ *
+ * n is the number of operations (bytes for the host link), nFail how many of
+ * them failed, and elapsed the time they took in microseconds. tMin, tMean
+ * and tMax are per-operation times in card clocks: the whole exchange for an
+ * APDU, reset release to TS for a reset. They are zero where they don't
+ * apply.
+ *
+ * tools/bench.py runs a set of benchmarks and writes the results as JSON
+ * lines.
+ */
+
+// Benchmarks (the test byte of FRAME_BENCH)
+#define BENCH_APDU_RECV		0x01	///< Case 2 APDU: card sends data
+#define BENCH_APDU_SEND		0x02	///< Case 3 APDU: card receives data
+#define BENCH_RESET_COLD	0x03	///< Cold reset to ATR
+#define BENCH_RESET_WARM	0x04	///< Warm reset to ATR
+#define BENCH_SCANCLA		0x05	///< 'scancla' over one class
+#define BENCH_LINK			0x06	///< Host link throughput
+#define BENCH_GLITCH		0x07	///< Glitched cold resets, as 'gatr' does them
+
+#ifdef ENABLE_BENCH
+
+/**
+ * Command handler: bench apdu recv|send <n> <cla> <ins> <p1> <p2> <len>
+ *                  bench reset cold|warm <n>
+ *                  bench scancla <cla>
+ *                  bench link <bytes>
+ *                  bench glitch <n> <offset> <width>
+ *
+ * Throughput and latency benchmarks.
+ */
+void handle_bench(String *cmdline);
+
+#endif // ENABLE_BENCH
+
+#endif // BENCH_H
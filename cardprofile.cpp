@@ -0,0 +1,307 @@
+#include <EEPROM.h>
+#include <avr/pgmspace.h>
+#include "config.h"
+#include "cardprofile.h"
+#include "smartcard.h"
+#include "timebase.h"
+#include "utils.h"
+
+
+/**
+ * Built-in profiles. The last one is the default, and matches any card.
+ */
+static const CARD_PROFILE PROFILES[] PROGMEM = {
+	// CryptoWorks: C4 at ATR[6], 8F F1 at ATR[9..10]. The card advertises
+	// TA1=0x12 (19200bd) but expects 9600 after the ATR, and needs a short
+	// gap between SELECT RECORD and READ RECORD. ROM 05 takes almost a full
+	// second to send its ATR.
+	{
+		{ 'C','r','y','p','t','o','W','k' },
+		{ 0, 0, 0, 0, 0, 0, 0xFF, 0, 0, 0xFF, 0xFF, 0 },
+		{ 0, 0, 0, 0, 0, 0, 0xC4, 0, 0, 0x8F, 0xF1, 0 },
+		11, PROFILE_BAUD_FIXED, 9600,
+		0, 0, 1,
+		{ 0, 0, ATR_TIMEOUT_MS },
+		0xA4
+	},
+
+	// Default. Sky VideoCrypt cards need at least 10ms between commands, so
+	// this is 50ms to be safe for unknown cards.
+	{
+		{ 'd','e','f','a','u','l','t',0 },
+		{ 0 },
+		{ 0 },
+		0, PROFILE_BAUD_TA1, 0,
+		0, 0, 50,
+		{ 0, 0, 0 },
+		PROFILE_CLA_NONE
+	},
+};
+
+#define N_PROFILES (sizeof(PROFILES) / sizeof(PROFILES[0]))
+
+static_assert(sizeof(CARD_PROFILE) <= PROFILE_EE_SLOT, "CARD_PROFILE doesn't fit in an EEPROM slot");
+
+
+// Active profile
+CARD_PROFILE gCardProfile;
+
+
+/**
+ * Read a user profile from EEPROM.
+ *
+ * @return <b>false</b> if the slot is empty.
+ */
+static bool profileRead(const uint8_t slot, CARD_PROFILE *p)
+{
+	EEPROM.get(PROFILE_EE_BASE + (slot * PROFILE_EE_SLOT), *p);
+
+	// Erased EEPROM is 0xFF
+	return (uint8_t)p->name[0] != 0xFF;
+}
+
+
+/**
+ * Check whether a profile matches an ATR.
+ */
+static bool profileMatch(const CARD_PROFILE *p, const uint8_t *atr, const uint8_t len)
+{
+	if (len < p->atrLenMin) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < PROFILE_ATR_LEN; i++) {
+		if (p->atrMask[i] == 0) {
+			continue;
+		}
+		if ((i >= len) || ((atr[i] & p->atrMask[i]) != p->atrValue[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void cardProfileRestore(void)
+{
+	switch (gCardProfile.baudPolicy) {
+		case PROFILE_BAUD_ATR:
+			cardBaud(CARD_CLOCK_HZ / cardGetAtrEtu());
+			break;
+		case PROFILE_BAUD_FIXED:
+			cardBaud(gCardProfile.baud);
+			break;
+	}
+
+	// cardBaud() resets the guard time
+	if (gCardProfile.guardTime != 0) {
+		cardSetGuardTime(gCardProfile.guardTime);
+	}
+	if (gCardProfile.waitTime != 0) {
+		cardSetWaitTime(gCardProfile.waitTime);
+	}
+}
+
+
+static void printName(const CARD_PROFILE *p)
+{
+	for (uint8_t i = 0; (i < PROFILE_NAME_LEN) && (p->name[i] != '\0'); i++) {
+		Serial.print(p->name[i]);
+	}
+}
+
+
+static void printProfile(const CARD_PROFILE *p)
+{
+	printName(p);
+	Serial.print(F(" ATR="));
+	for (uint8_t i = 0; i < PROFILE_ATR_LEN; i++) {
+		if (p->atrMask[i] == 0) {
+			Serial.print(F("??"));
+		} else {
+			printHex(p->atrValue[i]);
+		}
+	}
+	Serial.print(F(" Baud="));
+	switch (p->baudPolicy) {
+		case PROFILE_BAUD_TA1:	Serial.print(F("TA1")); break;
+		case PROFILE_BAUD_ATR:	Serial.print(F("ATR")); break;
+		default:				Serial.print(p->baud); break;
+	}
+	Serial.print(F(" Guard="));
+	Serial.print(p->guardTime);
+	Serial.print(F("us Wait="));
+	Serial.print(p->waitTime);
+	Serial.print(F("ms Gap="));
+	Serial.print(p->cmdGap);
+	Serial.print(F("ms Reset="));
+	Serial.print(p->reset.offTime);
+	Serial.print('/');
+	Serial.print(p->reset.holdClocks);
+	Serial.print('/');
+	Serial.print(p->reset.atrTimeout);
+	Serial.print(F(" CLA="));
+	printHex(p->cla);
+	Serial.println();
+}
+
+
+void cardProfileApply(const uint8_t *atr, const uint8_t len, const bool quiet)
+{
+	CARD_PROFILE p;
+	uint8_t i;
+	bool found = false;
+
+	for (i = 0; (i < PROFILE_EE_SLOTS) && !found; i++) {
+		found = profileRead(i, &p) && profileMatch(&p, atr, len);
+	}
+
+	for (i = 0; (i < N_PROFILES) && !found; i++) {
+		memcpy_P(&p, &PROFILES[i], sizeof(p));
+		found = profileMatch(&p, atr, len);
+	}
+
+	gCardProfile = p;
+	cardProfileRestore();
+
+	// Start from the safe timing, so timing learned for another card doesn't
+	// carry over to this one
+	const CARD_RESET_TIMING safe = CARD_RESET_TIMING_DEFAULT;
+	gResetTiming = safe;
+	if (p.reset.offTime != 0) {
+		gResetTiming.offTime = p.reset.offTime;
+	}
+	if (p.reset.holdClocks != 0) {
+		gResetTiming.holdClocks = p.reset.holdClocks;
+	}
+	if (p.reset.atrTimeout != 0) {
+		gResetTiming.atrTimeout = p.reset.atrTimeout;
+	}
+
+	if (!quiet) {
+		Serial.print(F("Profile: "));
+		printName(&gCardProfile);
+		Serial.println();
+	}
+}
+
+
+void handle_profile(String *cmdline)
+{
+	CARD_PROFILE p;
+	String sub;
+	long val;
+
+	if (!popWord(cmdline, &sub)) {
+		Serial.print(F("Active: "));
+		printProfile(&gCardProfile);
+
+		for (uint8_t i = 0; i < PROFILE_EE_SLOTS; i++) {
+			if (profileRead(i, &p)) {
+				Serial.print(F("User "));
+				Serial.print(i);
+				Serial.print(F(": "));
+				printProfile(&p);
+			}
+		}
+		for (uint8_t i = 0; i < N_PROFILES; i++) {
+			memcpy_P(&p, &PROFILES[i], sizeof(p));
+			Serial.print(F("Built-in: "));
+			printProfile(&p);
+		}
+
+	} else if (sub.equals(F("set"))) {
+		String field;
+
+		// Baud takes 'ta1', 'atr' or a rate; CLA is hex; the rest are decimal
+		if (!popWord(cmdline, &field) || (cmdline->length() == 0)) {
+			Serial.println(F("**ERROR: Syntax = profile set <baud|guard|wait|gap|cla> <value>"));
+			return;
+		}
+
+		if (field.equals(F("baud"))) {
+			if (cmdline->equals(F("ta1"))) {
+				gCardProfile.baudPolicy = PROFILE_BAUD_TA1;
+			} else if (cmdline->equals(F("atr"))) {
+				gCardProfile.baudPolicy = PROFILE_BAUD_ATR;
+			} else {
+				popArg(cmdline, &val, 10);
+				gCardProfile.baudPolicy = PROFILE_BAUD_FIXED;
+				gCardProfile.baud = val;
+			}
+		} else if (field.equals(F("cla"))) {
+			popArg(cmdline, &val);
+			gCardProfile.cla = val;
+		} else {
+			popArg(cmdline, &val, 10);
+			if (field.equals(F("guard"))) {
+				gCardProfile.guardTime = val;
+			} else if (field.equals(F("wait"))) {
+				gCardProfile.waitTime = val;
+			} else if (field.equals(F("gap"))) {
+				gCardProfile.cmdGap = val;
+			} else {
+				Serial.println(F("**ERROR: Unknown field"));
+				return;
+			}
+		}
+
+		// A TA1 baud rate only takes effect at the next ATR
+		cardProfileRestore();
+		printProfile(&gCardProfile);
+
+	} else if (sub.equals(F("save"))) {
+		String name;
+		uint8_t mask[PROFILE_ATR_LEN];
+		int n;
+
+		if (!popArg(cmdline, &val, 10) || (val < 0) || (val >= PROFILE_EE_SLOTS) || !popWord(cmdline, &name)) {
+			Serial.println(F("**ERROR: Syntax = profile save <slot> <name> [<mask...>]"));
+			return;
+		}
+		if (atrLen == 0) {
+			Serial.println(F("**ERROR: No ATR -- reset the card first"));
+			return;
+		}
+
+		// Match the whole of the current ATR unless told otherwise
+		memset(mask, 0xFF, sizeof(mask));
+		n = popHexBytes(cmdline, mask, sizeof(mask));
+		if (n < 0) {
+			Serial.println(F("**ERROR: Too many mask bytes"));
+			return;
+		}
+
+		// Save the active settings, including the learned reset timing
+		p = gCardProfile;
+		memset(p.name, 0, sizeof(p.name));
+		strncpy(p.name, name.c_str(), sizeof(p.name) - 1);
+		p.name[sizeof(p.name) - 1] = '\0';
+		for (uint8_t i = 0; i < PROFILE_ATR_LEN; i++) {
+			if (i >= atrLen) {
+				mask[i] = 0;
+			}
+			p.atrMask[i] = mask[i];
+			p.atrValue[i] = atr[i] & mask[i];
+		}
+		p.atrLenMin = atrLen;
+		p.reset = gResetTiming;
+
+		EEPROM.put(PROFILE_EE_BASE + (val * PROFILE_EE_SLOT), p);
+		gCardProfile = p;
+		Serial.print(F("Saved: "));
+		printProfile(&p);
+
+	} else if (sub.equals(F("del"))) {
+		if (!popArg(cmdline, &val, 10) || (val < 0) || (val >= PROFILE_EE_SLOTS)) {
+			Serial.println(F("**ERROR: Syntax = profile del <slot>"));
+			return;
+		}
+		EEPROM.update(PROFILE_EE_BASE + (val * PROFILE_EE_SLOT), 0xFF);
+		Serial.println(F("Deleted"));
+
+	} else {
+		Serial.println(F("**ERROR: Syntax = profile [set <field> <value> | save <slot> <name> [<mask...>] | del <slot>]"));
+	}
+}
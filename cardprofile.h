@@ -0,0 +1,76 @@
+#ifndef CARDPROFILE_H
+#define CARDPROFILE_H
+
+#include <Arduino.h>
+#include "smartcard.h"
+
+/***
+ * Card profiles
+ *
+ * Card-specific settings (baud rate policy, guard and waiting times, the gap
+ * between commands, cold reset timing and the card's CLA), picked by matching
+ * the ATR against a mask. Built-in profiles live in flash; user profiles are
+ * saved in EEPROM and are checked first, so they can override a built-in one.
+ * The last built-in profile matches any card.
+ */
+
+/// Number of ATR bytes a profile can match on
+#define PROFILE_ATR_LEN		12
+
+/// Profile name length (not NUL terminated if it is this long)
+#define PROFILE_NAME_LEN	8
+
+/// User profiles in EEPROM: PROFILE_EE_SLOTS slots of PROFILE_EE_SLOT bytes
+#define PROFILE_EE_BASE		0x000
+#define PROFILE_EE_SLOT		64
+#define PROFILE_EE_SLOTS	4
+
+/// Baud rate policy
+#define PROFILE_BAUD_TA1	0		///< Use the rate from TA1 (cardGetAtr() default)
+#define PROFILE_BAUD_ATR	1		///< Ignore TA1, stay at the ATR rate
+#define PROFILE_BAUD_FIXED	2		///< Use the rate in 'baud'
+
+/// No known CLA
+#define PROFILE_CLA_NONE	0xFF
+
+typedef struct {
+	char name[PROFILE_NAME_LEN];
+	uint8_t atrMask[PROFILE_ATR_LEN];	///< ATR bits which must match
+	uint8_t atrValue[PROFILE_ATR_LEN];	///< ATR value, after masking
+	uint8_t atrLenMin;					///< Shortest ATR which can match
+	uint8_t baudPolicy;					///< PROFILE_BAUD_xxx
+	uint32_t baud;						///< Baud rate for PROFILE_BAUD_FIXED
+	uint16_t guardTime;					///< Guard time in us, 0 for 5 Etu
+	uint16_t waitTime;					///< Waiting time in ms, 0 for WT from the ATR
+	uint16_t cmdGap;					///< Delay between commands, ms
+	CARD_RESET_TIMING reset;			///< Cold reset timing, zero fields take the safe default
+	uint8_t cla;						///< The card's CLA, or PROFILE_CLA_NONE
+} CARD_PROFILE;
+
+/// The active profile, set by cardProfileApply()
+extern CARD_PROFILE gCardProfile;
+
+/**
+ * Find the profile for a card and apply it. Call after cardGetAtr().
+ *
+ * @param	atr		ATR
+ * @param	len		ATR length
+ * @param	quiet	Don't print the profile name
+ */
+void cardProfileApply(const uint8_t *atr, const uint8_t len, const bool quiet = false);
+
+/**
+ * Set the card interface up from the active profile again, after
+ * cardGetAtr() has set it up from the ATR. Used by campaigns, which reset the
+ * card many times and don't need to look the profile up every time.
+ */
+void cardProfileRestore(void);
+
+/**
+ * Command handler: profile [set <field> <value> | save <slot> <name> [<mask...>] | del <slot>]
+ *
+ * Show, change and save card profiles.
+ */
+void handle_profile(String *cmdline);
+
+#endif // CARDPROFILE_H
@@ -0,0 +1,422 @@
+#include <EEPROM.h>
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "hostlink.h"
+#include "cardscript.h"
+#include "utils.h"
+
+#ifdef ENABLE_CARDSCRIPT
+
+/// Bytes uploaded by one 'cscript load'
+#define CS_LOAD_MAX			32
+
+/// Address of script byte n
+#define CS_ADDR(n)			(CSCRIPT_EE_BASE + 1 + (n))
+
+/// Operand bytes for each opcode (DATA has its data as well)
+static const PROGMEM uint8_t CS_OPERANDS[CS_NOPS] = {
+	0,		// END
+	6,		// SEND
+	6,		// RECV
+	2,		// DATA
+	2,		// EXPECT
+	3,		// JSW
+	3,		// JNSW
+	4,		// JBYTE
+	1,		// JMP
+	1,		// LOOP
+	0,		// NEXT
+	2,		// DELAY
+	0,		// RESET
+	3,		// EMIT
+	1,		// FAIL
+};
+
+
+/// Script length, 0 if there isn't a valid one
+static uint8_t csLength(void)
+{
+	uint8_t len = EEPROM.read(CSCRIPT_EE_BASE);
+	return (len > CS_MAX_LEN) ? 0 : len;
+}
+
+
+/// Read script byte n
+static inline uint8_t csByte(const uint8_t n)
+{
+	return EEPROM.read(CS_ADDR(n));
+}
+
+
+/// Length of the instruction at pc, including its opcode
+static uint8_t csInsnLen(const uint8_t pc)
+{
+	uint8_t op = csByte(pc);
+	uint8_t len = 1 + pgm_read_byte(&CS_OPERANDS[op]);
+
+	if (op == CS_DATA) {
+		len += csByte(pc + 2);
+	}
+	return len;
+}
+
+
+/// Is this a buffer range the script may use?
+static inline bool csBufOk(const uint8_t off, const uint8_t n)
+{
+	return ((uint16_t)off + n) <= CS_BUF_SIZE;
+}
+
+
+/**
+ * Check a script is safe to run: known opcodes, instructions which don't run
+ * off the end, buffer ranges inside the buffer, and jumps to the start of an
+ * instruction.
+ *
+ * @param[out]	errPc	Where the problem is
+ * @return NULL if the script is OK, otherwise an error message.
+ */
+static const __FlashStringHelper *csValidate(const uint8_t len, uint8_t *errPc)
+{
+	uint8_t starts[(CS_MAX_LEN + 8) / 8];
+	uint16_t pc;
+
+	// Pass 1: instructions, and where they start
+	memset(starts, 0, sizeof(starts));
+	for (pc = 0; pc < len; pc += csInsnLen(pc)) {
+		uint8_t op = csByte(pc);
+
+		*errPc = pc;
+		if (op >= CS_NOPS) {
+			return F("Bad opcode");
+		}
+		if ((pc + 1 + pgm_read_byte(&CS_OPERANDS[op]) > len) || (pc + csInsnLen(pc) > len)) {
+			return F("Instruction runs off the end");
+		}
+		starts[pc / 8] |= 1 << (pc % 8);
+
+		switch (op) {
+			case CS_SEND:
+			case CS_RECV:
+				if (!csBufOk(csByte(pc + 6), csByte(pc + 5))) {
+					return F("Data outside the buffer");
+				}
+				break;
+
+			case CS_DATA:
+				if (!csBufOk(csByte(pc + 1), csByte(pc + 2))) {
+					return F("Data outside the buffer");
+				}
+				break;
+
+			case CS_JBYTE:
+				if (csByte(pc + 1) >= CS_BUF_SIZE) {
+					return F("Data outside the buffer");
+				}
+				break;
+
+			case CS_EMIT:
+				if (!csBufOk(csByte(pc + 2), csByte(pc + 3))) {
+					return F("Data outside the buffer");
+				}
+				break;
+		}
+	}
+
+	// Pass 2: jump targets
+	for (pc = 0; pc < len; pc += csInsnLen(pc)) {
+		uint8_t op = csByte(pc);
+		uint8_t target;
+
+		switch (op) {
+			case CS_JSW:
+			case CS_JNSW:	target = csByte(pc + 3); break;
+			case CS_JBYTE:	target = csByte(pc + 4); break;
+			case CS_JMP:	target = csByte(pc + 1); break;
+			default:		continue;
+		}
+
+		// Jumping to the end is allowed: it stops the script
+		if ((target != len) && ((target > len) || !(starts[target / 8] & (1 << (target % 8))))) {
+			*errPc = pc;
+			return F("Bad jump target");
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Run the script once.
+ *
+ * @param	len		Script length (checked by csValidate())
+ * @param[out]	errPc	Where it stopped, if it failed
+ * @param[out]	failCode	The code, if it stopped at a FAIL
+ * @return NULL if the script ran to the end, otherwise an error message.
+ */
+static const __FlashStringHelper *csRun(const uint8_t len, uint8_t *errPc, int16_t *failCode)
+{
+	uint8_t buf[CS_BUF_SIZE];
+	uint8_t loopStart[CS_MAX_LOOPS];
+	uint16_t loopCount[CS_MAX_LOOPS];
+	uint8_t nLoops = 0;
+	uint16_t sw = 0;
+	uint8_t pc = 0;
+
+	memset(buf, 0, sizeof(buf));
+
+	while (pc < len) {
+		uint8_t op = csByte(pc);
+		uint8_t next = pc + csInsnLen(pc);
+		bool jump = false;
+
+		*errPc = pc;
+
+		// Stop if the host sends anything
+		if (Serial.available()) {
+			return F("Stopped");
+		}
+
+		switch (op) {
+			case CS_END:
+				return NULL;
+
+			case CS_SEND:
+			case CS_RECV:
+				sw = cardSendApdu(csByte(pc + 1), csByte(pc + 2), csByte(pc + 3), csByte(pc + 4),
+						csByte(pc + 5), &buf[csByte(pc + 6)], (op == CS_SEND));
+
+				// Only a status word test can deal with a comms error
+				if (sw >= 0xFFF0) {
+					uint8_t nextOp = (next < len) ? csByte(next) : CS_END;
+					if ((nextOp != CS_JSW) && (nextOp != CS_JNSW)) {
+						return F("Comms error");
+					}
+				}
+				break;
+
+			case CS_DATA:
+				for (uint8_t i = 0; i < csByte(pc + 2); i++) {
+					buf[csByte(pc + 1) + i] = csByte(pc + 3 + i);
+				}
+				break;
+
+			case CS_EXPECT:
+				if (sw != (((uint16_t)csByte(pc + 1) << 8) | csByte(pc + 2))) {
+					return F("Unexpected SW");
+				}
+				break;
+
+			case CS_JSW:
+			case CS_JNSW:
+				jump = (sw == (((uint16_t)csByte(pc + 1) << 8) | csByte(pc + 2)));
+				if (op == CS_JNSW) {
+					jump = !jump;
+				}
+				if (jump) {
+					next = csByte(pc + 3);
+				}
+				break;
+
+			case CS_JBYTE:
+				if ((buf[csByte(pc + 1)] & csByte(pc + 2)) == csByte(pc + 3)) {
+					next = csByte(pc + 4);
+				}
+				break;
+
+			case CS_JMP:
+				next = csByte(pc + 1);
+				break;
+
+			case CS_LOOP:
+				if (nLoops == CS_MAX_LOOPS) {
+					return F("Loops nested too deep");
+				}
+				loopStart[nLoops] = next;
+				loopCount[nLoops] = csByte(pc + 1) ? csByte(pc + 1) : 256;
+				nLoops++;
+				break;
+
+			case CS_NEXT:
+				if (nLoops == 0) {
+					return F("NEXT without LOOP");
+				}
+				if (--loopCount[nLoops - 1] != 0) {
+					next = loopStart[nLoops - 1];
+				} else {
+					nLoops--;
+				}
+				break;
+
+			case CS_DELAY:
+				delay(csByte(pc + 1) | ((uint16_t)csByte(pc + 2) << 8));
+				break;
+
+			case CS_RESET: {
+				uint8_t atrLen;
+
+				memset(buf, 0, sizeof(buf));
+				cardPower(0);
+				cardPower(1);
+				atrLen = cardGetAtr(buf, true);
+				if (atrLen == 0) {
+					cardPower(0);
+					return F("No ATR");
+				}
+				cardProfileApply(buf, atrLen, true);
+				sw = 0;
+				break;
+			}
+
+			case CS_EMIT: {
+				uint8_t off = csByte(pc + 2), n = csByte(pc + 3);
+
+				if (gBinaryFrames) {
+					hostFrameBegin(FRAME_CSCRIPT, 4 + n);
+					hostFrameWriteByte(csByte(pc + 1));
+					hostFrameWriteU16(sw);
+					hostFrameWriteByte(n);
+					hostFrameWrite(&buf[off], n);
+					hostFrameEnd();
+				}
+
+				Serial.print(F("EMIT "));
+				Serial.print(csByte(pc + 1));
+				Serial.print(F(" SW="));
+				Serial.print(sw, HEX);
+				Serial.print(F(": "));
+				printHexBuf(&buf[off], n);
+				Serial.println();
+				break;
+			}
+
+			case CS_FAIL:
+				*failCode = csByte(pc + 1);
+				return F("FAIL");
+		}
+
+		pc = next;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Command handler: cscript [load <offset> <bytes...> | save <length> | run [<count>] | clear]
+ *
+ * With no arguments, shows the stored card script.
+ *
+ *   load	Write script bytes (hex) at an offset (hex). Normally done by
+ *   		tools/csasm.py.
+ *   save	Check the script and make it the stored script. Until then,
+ *   		loading has marked the script as invalid.
+ *   run	Run the script, <count> times (decimal, default once). Send any
+ *   		character to stop it.
+ *   clear	Delete the script.
+ */
+void handle_cscript(String *cmdline)
+{
+	String sub;
+	long val;
+	uint8_t len = csLength();
+	uint8_t errPc;
+	const __FlashStringHelper *err;
+
+	if (!popWord(cmdline, &sub)) {
+		Serial.print(len);
+		Serial.print(F(" bytes: "));
+		for (uint8_t i = 0; i < len; i++) {
+			printHex(csByte(i));
+			Serial.print(' ');
+		}
+		Serial.println();
+
+	} else if (sub.equals(F("load"))) {
+		uint8_t buf[CS_LOAD_MAX];
+		int n;
+
+		if (!popArg(cmdline, &val) || (val < 0) || ((n = popHexBytes(cmdline, buf, sizeof(buf))) <= 0) ||
+				(val + n > CS_MAX_LEN)) {
+			Serial.println(F("**ERROR: Syntax = cscript load <offset> <bytes...> (up to 32 bytes, inside the script area)"));
+			return;
+		}
+
+		// The script isn't valid until it has been saved
+		EEPROM.update(CSCRIPT_EE_BASE, 0xFF);
+		for (int i = 0; i < n; i++) {
+			EEPROM.update(CS_ADDR(val + i), buf[i]);
+		}
+		Serial.print(F("Loaded "));
+		Serial.print(n);
+		Serial.println(F(" bytes"));
+
+	} else if (sub.equals(F("save"))) {
+		if (!popArg(cmdline, &val, 10) || (val < 1) || (val > CS_MAX_LEN)) {
+			Serial.println(F("**ERROR: Syntax = cscript save <length>"));
+			return;
+		}
+
+		err = csValidate(val, &errPc);
+		if (err != NULL) {
+			Serial.print(F("**ERROR: At "));
+			printHex(errPc);
+			Serial.print(F(": "));
+			Serial.println(err);
+			return;
+		}
+
+		EEPROM.update(CSCRIPT_EE_BASE, val);
+		Serial.print(F("Saved "));
+		Serial.print(val);
+		Serial.println(F(" bytes"));
+
+	} else if (sub.equals(F("run"))) {
+		long count = 1;
+		int16_t failCode = -1;
+
+		popArg(cmdline, &count, 10);
+		if (len == 0) {
+			Serial.println(F("**ERROR: No script"));
+			return;
+		}
+		if (count < 1) {
+			Serial.println(F("**ERROR: Syntax = cscript run [<count>]"));
+			return;
+		}
+
+		// The stored script was checked when it was saved, but the EEPROM
+		// could have been written since by something else
+		err = csValidate(len, &errPc);
+
+		for (long i = 0; (i < count) && (err == NULL); i++) {
+			err = csRun(len, &errPc, &failCode);
+		}
+
+		if (err == NULL) {
+			Serial.println(F("Script OK"));
+		} else {
+			Serial.print(F("**ERROR: At "));
+			printHex(errPc);
+			Serial.print(F(": "));
+			Serial.print(err);
+			if (failCode >= 0) {
+				Serial.print(' ');
+				Serial.print(failCode);
+			}
+			Serial.println();
+		}
+
+	} else if (sub.equals(F("clear"))) {
+		EEPROM.update(CSCRIPT_EE_BASE, 0xFF);
+		Serial.println(F("Cleared"));
+
+	} else {
+		Serial.println(F("**ERROR: Syntax = cscript [load <offset> <bytes...> | save <length> | run [<count>] | clear]"));
+	}
+}
+
+#endif // ENABLE_CARDSCRIPT
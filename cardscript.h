@@ -0,0 +1,90 @@
+#ifndef CARDSCRIPT_H
+#define CARDSCRIPT_H
+
+/***
+ * Card scripts
+ *
+ * A card script is a short bytecode program which talks to the card: it
+ * sends APDUs, checks and branches on the status words and the data, loops,
+ * and sends results to the host. Scripts are uploaded by the host into
+ * EEPROM and run from there by 'cscript run', so a new card flow runs at
+ * full speed without a firmware rebuild or a round trip to the host for each
+ * APDU.
+ *
+ * The script has a 64-byte data buffer: APDU data is sent from it and
+ * received into it, and the ATR is read into it by RESET. The buffer starts
+ * out zeroed. 'addr' is a byte offset from the start of the script.
+ *
+ *   Op		Operands					Description
+ *   END	-							Stop
+ *   SEND	cla ins p1 p2 len off		Send an APDU with len bytes of data from buf[off]
+ *   RECV	cla ins p1 p2 len off		Send an APDU and receive len bytes into buf[off]
+ *   DATA	off n bytes[n]				Copy n bytes into buf[off]
+ *   EXPECT	sw1 sw2						Fail unless the last SW was sw1 sw2
+ *   JSW	sw1 sw2 addr				Jump if the last SW was sw1 sw2
+ *   JNSW	sw1 sw2 addr				Jump unless the last SW was sw1 sw2
+ *   JBYTE	off mask val addr			Jump if (buf[off] & mask) == val
+ *   JMP	addr						Jump
+ *   LOOP	n							Run up to the matching NEXT n times (0 means 256)
+ *   NEXT	-							End of loop
+ *   DELAY	ms_l ms_h					Wait
+ *   RESET	-							Cold reset the card, read the ATR into buf[0]
+ *   										and apply its profile. Fail if there is no ATR.
+ *   EMIT	tag off n					Send buf[off] to buf[off+n-1] to the host
+ *   FAIL	code						Stop with an error code
+ *
+ * A comms error (SW FFFx) fails the script, unless the next instruction is a
+ * JSW or JNSW which can deal with it. Loops nest up to CS_MAX_LOOPS deep.
+ *
+ * EMIT prints the data, and sends a FRAME_CSCRIPT frame if binary frames
+ * are on:
+ *
+ *   u8 tag, u16 sw, u8 len, u8 data[len]
+ *
+ * EEPROM layout: a length byte at CSCRIPT_EE_BASE (0xFF: no script), then
+ * the script. tools/csasm.py assembles, checks and uploads scripts.
+ */
+
+// Opcodes -- keep in sync with tools/csasm.py
+#define CS_END		0x00
+#define CS_SEND		0x01
+#define CS_RECV		0x02
+#define CS_DATA		0x03
+#define CS_EXPECT	0x04
+#define CS_JSW		0x05
+#define CS_JNSW		0x06
+#define CS_JBYTE	0x07
+#define CS_JMP		0x08
+#define CS_LOOP		0x09
+#define CS_NEXT		0x0A
+#define CS_DELAY	0x0B
+#define CS_RESET	0x0C
+#define CS_EMIT		0x0D
+#define CS_FAIL		0x0E
+#define CS_NOPS		0x0F
+
+/// EEPROM space for the script, including the length byte
+#define CSCRIPT_EE_BASE		0x300
+#define CSCRIPT_EE_SIZE		0x100
+
+/// Longest script, bytes (a length of 0xFF means no script)
+#define CS_MAX_LEN			(CSCRIPT_EE_SIZE - 2)
+
+/// Data buffer size
+#define CS_BUF_SIZE			64
+
+/// Deepest loop nesting
+#define CS_MAX_LOOPS		4
+
+#ifdef ENABLE_CARDSCRIPT
+
+#include <Arduino.h>
+
+/**
+ * Command handler: cscript [load <offset> <bytes...> | save <length> | run [<count>] | clear]
+ */
+void handle_cscript(String *cmdline);
+
+#endif // ENABLE_CARDSCRIPT
+
+#endif // CARDSCRIPT_H
@@ -2,8 +2,39 @@
 #define CONFIG_H
 
 
+// Timestamp received characters in the soft serial ISR (128 bytes of RAM).
+// Without this, characters are timestamped when they are read.
+#define ENABLE_RX_TIMESTAMPS
+
 // Enable (limited) support for Cryptoworks
 //#define ENABLE_CRYPTOWORKS
 
+// Enable power trace capture on the current sense input ('ptrace')
+//#define ENABLE_POWERTRACE
+
+// Enable the timing side channel scanner ('tscan')
+//#define ENABLE_TIMESCAN
+
+// Enable glitch campaigns ('gatr', 'gread') and glitch programs ('gprog')
+//#define ENABLE_GLITCH
+
+// Enable the mutational APDU fuzzer ('fuzz')
+//#define ENABLE_FUZZ
+
+// Enable differential execution against a golden card ('diff')
+//#define ENABLE_DIFF
+
+// Enable session record and replay ('session')
+//#define ENABLE_SESSION
+
+// Enable throughput and latency benchmarks ('bench')
+//#define ENABLE_BENCH
+
+// Enable runtime statistics: timeouts, errors and where the time goes ('stats')
+//#define ENABLE_STATS
+
+// Enable card scripts: APDU sequences uploaded to EEPROM and run on the board ('cscript')
+//#define ENABLE_CARDSCRIPT
+
 
 #endif // CONFIG_H
@@ -1,6 +1,7 @@
 #include "config.h"
 #include "hardware.h"
 #include "smartcard.h"
+#include "cardprofile.h"
 #include "utils.h"
 
 #ifdef ENABLE_CRYPTOWORKS
@@ -68,8 +69,8 @@ static int read_record(const uint8_t rec, uint8_t *buf, const uint8_t buf_len)
 	}
 
 	// Yet Another Cryptoworks Hack (tm)
-	// Sending the 
-	delay(1);
+	// The card needs a short gap before READ RECORD (see cardprofile.cpp)
+	delay(gCardProfile.cmdGap);
 
 	// SW1SW2 = 9Fxx where xx = length
 	lc = (sw1sw2 & 0xFF);
@@ -97,8 +98,6 @@ static int read_record(const uint8_t rec, uint8_t *buf, const uint8_t buf_len)
  */
 void handle_cwinfo(String *cmdline)
 {
-	extern uint8_t atr[32];
-	extern uint8_t atrLen;
 	uint8_t buf[25];
 	uint16_t sw1sw2;
 
@@ -107,6 +106,10 @@ void handle_cwinfo(String *cmdline)
 	cardPower(1);
 	atrLen = cardGetAtr(atr);
 
+	// The CryptoWorks profile forces 9600 Baud: the card advertises
+	// TA1=0x12 = 19200bd but expects 9600 after ATR
+	cardProfileApply(atr, atrLen);
+
 	// print ATR
 	Serial.print(F("ATR: "));
 	printHexBuf(atr, atrLen);
@@ -124,10 +127,6 @@ void handle_cwinfo(String *cmdline)
 
 	delay(100);
 
-	// CryptoWorks hack: force 9600 Baud
-	// the card advertises TA1=0x12 = 19200bd but expects 9600 after ATR
-	cardBaud(9600);
-
 
 	///
 	int i;
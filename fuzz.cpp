@@ -0,0 +1,455 @@
+#include <util/crc16.h>
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "scancache.h"
+#include "hostlink.h"
+#include "utils.h"
+#include "stats.h"
+
+#ifdef ENABLE_FUZZ
+
+/// Number of seeds kept (host seeds plus the ones the fuzzer finds)
+#define FUZZ_MAX_SEEDS		8
+
+/// Seeds the host can give; the rest are kept for the ones the fuzzer finds
+#define FUZZ_MAX_HOST_SEEDS	(FUZZ_MAX_SEEDS / 2)
+
+/// Data bytes kept for each seed. Longer commands are padded with zeros.
+#define FUZZ_MAX_DATA		16
+
+/// Size of the response class coverage map, in bits (power of 2)
+#define FUZZ_MAP_BITS		512
+
+/// Most mutations applied to one case
+#define FUZZ_MAX_MUTATIONS	4
+
+
+// A fuzzer input -- one APDU
+typedef struct {
+	uint8_t hdr[5];					///< CLA, INS, P1, P2, LEN
+	bool isSend;					///< Command sends data (else receives)
+	uint8_t data[FUZZ_MAX_DATA];	///< Command data, for send commands
+} FUZZ_INPUT;
+
+// Procedure byte behaviour, for the response class
+typedef enum {
+	FP_NONE,		///< No procedure byte (or none needed)
+	FP_ACK,			///< ACK, all data at once
+	FP_ONE,			///< ~INS, one byte at a time
+	FP_SW,			///< SW1 straight away
+	FP_OTHER		///< Anything else
+} FUZZ_PROC;
+
+static FUZZ_INPUT gFuzzSeeds[FUZZ_MAX_SEEDS];
+static uint8_t gFuzzNumSeeds = 0;		///< Seeds in use
+static uint8_t gFuzzHostSeeds = 0;		///< Seeds from the host, never replaced
+static uint8_t gFuzzNextSeed = 0;		///< Next slot for a new seed
+
+static uint8_t gFuzzMap[FUZZ_MAP_BITS / 8];
+static uint16_t gFuzzClasses = 0;		///< Response classes seen
+
+static uint32_t gFuzzRng = 1;
+
+
+/**
+ * xorshift32 PRNG
+ */
+static uint32_t fuzzRand(void)
+{
+	uint32_t x = gFuzzRng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	gFuzzRng = x;
+
+	return x;
+}
+
+
+/**
+ * Bucket a value by its bit length, so the class doesn't change with jitter
+ */
+static uint8_t fuzzLog2(uint32_t v)
+{
+	uint8_t n = 0;
+
+	while (v != 0) {
+		v >>= 1;
+		n++;
+	}
+
+	return n;
+}
+
+
+/**
+ * Make a mutated copy of an input
+ */
+static void fuzzMutate(const FUZZ_INPUT *seed, FUZZ_INPUT *in)
+{
+	static const uint8_t INTERESTING[] = { 0x00, 0x01, 0x7F, 0x80, 0xFE, 0xFF };
+	uint8_t nMut = 1 + (fuzzRand() % FUZZ_MAX_MUTATIONS);
+
+	*in = *seed;
+
+	while (nMut--) {
+		uint32_t r = fuzzRand();
+		uint8_t nFields = 5;
+		uint8_t *p;
+
+		// Mutate the data too, if there is any
+		if (in->isSend) {
+			nFields += min(in->hdr[4], FUZZ_MAX_DATA);
+		}
+
+		uint8_t pos = r % nFields;
+		p = (pos < 5) ? &in->hdr[pos] : &in->data[pos - 5];
+		r >>= 8;
+
+		switch (r & 3) {
+			case 0:		*p ^= _BV((r >> 2) & 7); break;							// flip a bit
+			case 1:		*p = r >> 8; break;										// random byte
+			case 2:		*p = INTERESTING[(r >> 8) % sizeof(INTERESTING)]; break;
+			default:	*p += (r & 0x100) ? 1 : -1; break;						// step
+		}
+	}
+
+	// CLA FF is PPS. INS must be even, and 6x/9x are procedure bytes.
+	if (in->hdr[0] == 0xFF) {
+		in->hdr[0] = 0xFE;
+	}
+	in->hdr[1] &= 0xFE;
+	if (((in->hdr[1] >> 4) == 6) || ((in->hdr[1] >> 4) == 9)) {
+		in->hdr[1] ^= 0x20;
+	}
+
+	// Padding past the kept data is zero
+	if (in->isSend) {
+		for (uint8_t i = in->hdr[4]; i < FUZZ_MAX_DATA; i++) {
+			in->data[i] = 0;
+		}
+	}
+}
+
+
+/**
+ * Work out the response class of a result.
+ *
+ * The class is the SW, the number of characters received (bucketed), the
+ * response time (bucketed) and how the card used procedure bytes.
+ *
+ * @return Index into the coverage map
+ */
+static uint16_t fuzzClass(const FUZZ_INPUT *in, const uint16_t sw, const uint8_t proc, const APDU_TIMING *timing)
+{
+	uint16_t crc = 0xFFFF;
+	FUZZ_PROC pc;
+	uint8_t ins = in->hdr[1];
+
+	if (proc == 0xFF) {
+		pc = FP_NONE;
+	} else if ((proc == ins) || (proc == (uint8_t)(ins + 1))) {
+		pc = FP_ACK;
+	} else if ((proc == (uint8_t)~ins) || (proc == (uint8_t)~(ins + 1))) {
+		pc = FP_ONE;
+	} else if (((proc & 0xF0) == 0x60) || ((proc & 0xF0) == 0x90)) {
+		pc = FP_SW;
+	} else {
+		pc = FP_OTHER;
+	}
+
+	crc = _crc16_update(crc, sw >> 8);
+	crc = _crc16_update(crc, sw & 0xFF);
+	crc = _crc16_update(crc, fuzzLog2(timing->nChars));
+	crc = _crc16_update(crc, fuzzLog2(timing->tSw1));
+	crc = _crc16_update(crc, pc);
+
+	return crc & (FUZZ_MAP_BITS - 1);
+}
+
+
+/**
+ * Mark a response class as seen.
+ *
+ * @return <b>true</b> if it hadn't been seen before.
+ */
+static bool fuzzMapSet(const uint16_t cls)
+{
+	uint8_t bit = _BV(cls & 7);
+
+	if (gFuzzMap[cls >> 3] & bit) {
+		return false;
+	}
+
+	gFuzzMap[cls >> 3] |= bit;
+	gFuzzClasses++;
+	return true;
+}
+
+
+/**
+ * Send a fuzzer input to the card.
+ *
+ * @param[out]	proc	Last procedure byte, 0xFF if none
+ * @return SW1SW2
+ */
+static uint16_t fuzzSend(const FUZZ_INPUT *in, uint8_t *buf, uint8_t *proc, APDU_TIMING *timing)
+{
+	uint16_t sw;
+
+	if (in->isSend) {
+		memset(buf, 0, 256);
+		memcpy(buf, in->data, FUZZ_MAX_DATA);
+	}
+
+	*proc = 0xFF;
+	sw = cardSendApdu(in->hdr[0], in->hdr[1], in->hdr[2], in->hdr[3], in->hdr[4], buf, in->isSend, proc, false, timing);
+
+	if (sw >= 0xFFF0) {
+		// The card has stopped talking. Reboot it.
+		STATS_COUNT(commsResets);
+		cardColdReset();
+		cardGetAtr(buf, true, gResetTiming.atrTimeout);
+		cardProfileRestore();
+	}
+
+	delay(gCardProfile.cmdGap);
+	return sw;
+}
+
+
+static void fuzzPrintInput(const FUZZ_INPUT *in)
+{
+	Serial.print(in->isSend ? F("S ") : F("R "));
+	printHexBuf(in->hdr, 5);
+	if (in->isSend && (in->hdr[4] > 0)) {
+		Serial.print(' ');
+		printHexBuf(in->data, min(in->hdr[4], FUZZ_MAX_DATA));
+	}
+}
+
+
+/**
+ * Add a seed. Host seeds are kept, up to FUZZ_MAX_HOST_SEEDS; seeds found by
+ * the fuzzer replace each other, oldest first.
+ *
+ * @return <b>false</b> if there is no room.
+ */
+static bool fuzzAddSeed(const FUZZ_INPUT *in, const bool fromHost)
+{
+	if (fromHost) {
+		// Host seeds go before the fuzzer's, so drop those
+		if (gFuzzHostSeeds >= FUZZ_MAX_HOST_SEEDS) {
+			return false;
+		}
+		gFuzzSeeds[gFuzzHostSeeds++] = *in;
+		gFuzzNumSeeds = gFuzzNextSeed = gFuzzHostSeeds;
+		return true;
+	}
+
+	if (gFuzzNextSeed >= FUZZ_MAX_SEEDS) {
+		gFuzzNextSeed = gFuzzHostSeeds;
+	}
+	gFuzzSeeds[gFuzzNextSeed++] = *in;
+	if (gFuzzNumSeeds < gFuzzNextSeed) {
+		gFuzzNumSeeds = gFuzzNextSeed;
+	}
+	return true;
+}
+
+
+/**
+ * Run the fuzzer.
+ */
+static void fuzzRun(const uint32_t cases)
+{
+	uint8_t buf[256];
+	uint8_t proc;
+	uint16_t sw;
+	uint16_t cls;
+	uint32_t nNew = 0, nErrors = 0;
+	uint32_t n;
+	APDU_TIMING timing;
+	FUZZ_INPUT in;
+
+	timing.rxTimes = NULL;
+	timing.rxTimesMax = 0;
+
+	cardPower(0);
+	cardPower(1);
+	n = cardGetAtr(buf, true);
+	if (n == 0) {
+		Serial.println(F("**ERROR: No ATR"));
+		cardPower(0);
+		return;
+	}
+	cardProfileApply(buf, n, true);
+
+	// The seeds' own responses aren't news
+	for (uint8_t i = 0; i < gFuzzNumSeeds; i++) {
+		sw = fuzzSend(&gFuzzSeeds[i], buf, &proc, &timing);
+		fuzzMapSet(fuzzClass(&gFuzzSeeds[i], sw, proc, &timing));
+	}
+
+	for (n = 0; n < cases; n++) {
+		fuzzMutate(&gFuzzSeeds[fuzzRand() % gFuzzNumSeeds], &in);
+		sw = fuzzSend(&in, buf, &proc, &timing);
+		if (sw >= 0xFFF0) {
+			nErrors++;
+		}
+
+		cls = fuzzClass(&in, sw, proc, &timing);
+		if (fuzzMapSet(cls)) {
+			nNew++;
+			fuzzAddSeed(&in, false);
+
+			if (gBinaryFrames) {
+				hostFrameApdu(in.hdr, sw, proc, &timing);
+			} else {
+				Serial.print(F("NEW #"));
+				Serial.print(n);
+				Serial.print(' ');
+				fuzzPrintInput(&in);
+				Serial.print(F(" -- SW="));
+				Serial.print(sw, HEX);
+				Serial.print(F(" Proc="));
+				printHex(proc);
+				Serial.print(F(" Chars="));
+				Serial.print(timing.nChars);
+				Serial.print(F(" Tsw="));
+				Serial.println(timing.tSw1);
+			}
+		}
+
+		// Stop if the host sends anything
+		if (Serial.available()) {
+			n++;
+			break;
+		}
+	}
+
+	Serial.print(F("Cases="));
+	Serial.print(n);
+	Serial.print(F(" New="));
+	Serial.print(nNew);
+	Serial.print(F(" CommsErrors="));
+	Serial.print(nErrors);
+	Serial.print(F(" Classes="));
+	Serial.println(gFuzzClasses);
+}
+
+
+void handle_fuzz(String *cmdline)
+{
+	String sub;
+	long val;
+
+	if (!popWord(cmdline, &sub)) {
+		Serial.print(F("Seeds: "));
+		Serial.print(gFuzzNumSeeds);
+		Serial.print(F(" ("));
+		Serial.print(gFuzzHostSeeds);
+		Serial.print(F(" from host) Classes seen: "));
+		Serial.println(gFuzzClasses);
+		for (uint8_t i = 0; i < gFuzzNumSeeds; i++) {
+			fuzzPrintInput(&gFuzzSeeds[i]);
+			Serial.println();
+		}
+
+	} else if (sub.equals(F("seed"))) {
+		FUZZ_INPUT in;
+		String dir;
+		int n;
+
+		memset(&in, 0, sizeof(in));
+		if (!popWord(cmdline, &dir) || !(dir.equals(F("send")) || dir.equals(F("recv")))) {
+			Serial.println(F("**ERROR: Syntax = fuzz seed send|recv <cla> <ins> <p1> <p2> <len> [data...]"));
+			return;
+		}
+		in.isSend = dir.equals(F("send"));
+
+		for (uint8_t i = 0; i < 5; i++) {
+			if (!popArg(cmdline, &val)) {
+				Serial.println(F("**ERROR: Need <cla> <ins> <p1> <p2> <len>"));
+				return;
+			}
+			in.hdr[i] = val;
+		}
+
+		n = popHexBytes(cmdline, in.data, sizeof(in.data));
+		if (n < 0) {
+			Serial.println(F("**ERROR: Too much data, max 16 bytes"));
+			return;
+		}
+
+		if (!fuzzAddSeed(&in, true)) {
+			Serial.print(F("**ERROR: Too many seeds, max "));
+			Serial.println(FUZZ_MAX_HOST_SEEDS);
+			return;
+		}
+		Serial.print(F("Seeds: "));
+		Serial.println(gFuzzNumSeeds);
+
+	} else if (sub.equals(F("seedscan"))) {
+		// Seed from the scan cache for the last card reset
+		FUZZ_INPUT in;
+
+		if (!scacheOpen(atr, atrLen)) {
+			Serial.println(F("**ERROR: No scan results for this card -- run scancla"));
+			return;
+		}
+
+		memset(&in, 0, sizeof(in));
+		uint8_t i;
+		for (i = 0; i < scacheCount(); i++) {
+			SCACHE_ENTRY e;
+
+			scacheGet(i, &e);
+			in.hdr[0] = e.cla;
+			in.hdr[1] = e.ins;
+			in.hdr[4] = e.le;
+			if (!fuzzAddSeed(&in, true)) {
+				break;
+			}
+		}
+		Serial.print(F("Seeds: "));
+		Serial.print(gFuzzNumSeeds);
+		if (i < scacheCount()) {
+			Serial.print(F(" (no room for the last "));
+			Serial.print(scacheCount() - i);
+			Serial.print(F(" scan results)"));
+		}
+		Serial.println();
+
+	} else if (sub.equals(F("run"))) {
+		if (!popArg(cmdline, &val, 10) || (val < 1)) {
+			Serial.println(F("**ERROR: Syntax = fuzz run <cases> [<rng seed>]"));
+			return;
+		}
+		if (gFuzzNumSeeds == 0) {
+			Serial.println(F("**ERROR: No seeds"));
+			return;
+		}
+
+		long rngSeed;
+		if (popArg(cmdline, &rngSeed, 10) && (rngSeed != 0)) {
+			gFuzzRng = rngSeed;
+		}
+
+		fuzzRun(val);
+
+	} else if (sub.equals(F("clear"))) {
+		gFuzzNumSeeds = gFuzzHostSeeds = gFuzzNextSeed = 0;
+		memset(gFuzzMap, 0, sizeof(gFuzzMap));
+		gFuzzClasses = 0;
+		Serial.println(F("Cleared"));
+
+	} else {
+		Serial.println(F("**ERROR: Syntax = fuzz [seed ... | seedscan | run <cases> [<rng seed>] | clear]"));
+	}
+}
+
+#endif // ENABLE_FUZZ
@@ -0,0 +1,17 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#ifdef ENABLE_FUZZ
+
+/**
+ * Command handler: fuzz [seed send|recv <cla> <ins> <p1> <p2> <len> [data...] | seedscan | run <cases> [<rng seed>] | clear]
+ *
+ * Mutational APDU fuzzer. Seeds come from the host or the scan cache; cases
+ * which get a response the fuzzer hasn't seen before are reported and kept
+ * as new seeds.
+ */
+void handle_fuzz(String *cmdline);
+
+#endif // ENABLE_FUZZ
+
+#endif // FUZZ_H
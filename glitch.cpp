@@ -0,0 +1,676 @@
+// gotta go fast!
+#pragma GCC optimize ("-O3")
+
+#include <util/crc16.h>
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "timebase.h"
+#include "hostlink.h"
+#include "glitchprog.h"
+#include "glitchkernel.h"
+#include "utils.h"
+
+#ifdef ENABLE_GLITCH
+
+/// Glitch width which runs the uploaded glitch program ('gprog') instead
+#define GLITCH_WIDTH_PROG	-1
+
+/// Number of unglitched resets used to learn the golden ATR
+#define GATR_GOLDEN_RUNS	4
+
+// ATR deviation flags
+#define GATR_MUTE			0x01	///< No ATR at all
+#define GATR_LEN			0x02	///< Different length
+#define GATR_DATA			0x04	///< Different byte values
+#define GATR_CONV			0x08	///< Different convention
+#define GATR_TIMING			0x10	///< ATR started or finished at a different time
+
+/// Bytes of each glitched read response kept in RAM until we know it's interesting
+#define GREAD_BUF			64
+/// Streamed data chunk size (FRAME_GREAD_DATA)
+#define GREAD_CHUNK			16
+/// Longest response we'll capture
+#define GREAD_MAX_BYTES		32768U
+/// Time to wait for the first response byte, ms
+#define GREAD_FIRST_MS		1000
+/// Time to wait for further response bytes, ms
+#define GREAD_IDLE_MS		50
+/// The glitch must be over by this fraction (in 1/16ths) of the golden
+/// procedure byte latency
+#define GREAD_PROC_MARGIN	14
+
+// Read response deviation flags
+#define GREAD_MUTE			0x01	///< No response at all
+#define GREAD_LONG			0x02	///< More bytes than the golden response
+#define GREAD_SHORT			0x04	///< Fewer bytes than the golden response
+#define GREAD_SW			0x08	///< Final status word changed
+#define GREAD_DATA			0x10	///< Same length, different data
+
+// Golden (unglitched) ATR
+typedef struct {
+	uint8_t atr[32];
+	uint8_t len;
+	bool inverse;
+	uint32_t tFirst;		///< TS start, card clocks after reset release
+	uint32_t tLast;			///< Last character start, card clocks after reset release
+	uint32_t tolerance;		///< Allowed timing difference, card clocks
+	unsigned int timeout;	///< ATR start timeout, ms
+} GATR_GOLDEN;
+
+
+/**
+ * Wait, then fire a glitch: a plain pulse, or the uploaded glitch program.
+ *
+ * Call with interrupts off. The timebase is caught up afterwards (see
+ * tbCatchUp()), so the wait can be longer than a Timer0 overflow.
+ *
+ * @param	offset	Delay before the glitch, in CPU clocks
+ * @param	width	Glitch width in CPU clocks (see gkGlitch()), or
+ * 					GLITCH_WIDTH_PROG
+ */
+static inline void glitchFire(const uint32_t offset, const int width)
+{
+	uint32_t t = tbNow();
+
+	if (width == GLITCH_WIDTH_PROG) {
+		gkDelay(offset);
+		gpExecute();
+		tbCatchUp(t, (offset + gpClocks()) / 4);
+	} else {
+		gkGlitch(offset, width);
+		tbCatchUp(t, (offset + width) / 4);
+	}
+
+	tbEvent(TB_EV_GLITCH, t + (offset / 4));
+}
+
+
+/**
+ * Check a glitch width from the command line.
+ */
+static bool glitchWidthOk(const long width)
+{
+	return (width == GLITCH_WIDTH_PROG) || ((width >= GK_WIDTH_MIN) && (width <= GK_WIDTH_MAX));
+}
+
+
+/**
+ * Cold-reset the card, optionally glitching it, and read the ATR.
+ *
+ * @param	glitch		<b>true</b> to glitch the card
+ * @param	offset		Glitch offset in CPU clocks after reset release
+ * @param	width		Glitch width (see glitchFire())
+ * @param[out]	timing	ATR timing, relative to reset release
+ * @return ATR length
+ */
+static uint8_t gatrReset(uint8_t *atrbuf, const bool glitch, const uint32_t offset, const int width, const unsigned int timeout, ATR_TIMING *timing)
+{
+	uint32_t tRelease;
+	uint8_t len;
+
+	cardColdReset(true);
+
+	noInterrupts();
+	tRelease = tbNow();
+	SCRST(1);
+	if (glitch) {
+		glitchFire(offset, width);
+	}
+	interrupts();
+	tbEvent(TB_EV_RESET, tRelease);
+
+	timing->tFirst = timing->tLast = tRelease;
+	len = cardGetAtr(atrbuf, true, timeout, timing);
+
+	timing->tFirst -= tRelease;
+	timing->tLast -= tRelease;
+
+	return len;
+}
+
+
+/**
+ * Compare an ATR with the golden ATR.
+ *
+ * @return Deviation flags (GATR_xxx), zero if it matches
+ */
+static uint8_t gatrCompare(const GATR_GOLDEN *golden, const uint8_t *atrbuf, const uint8_t len, const ATR_TIMING *timing)
+{
+	uint8_t flags = 0;
+
+	if (len == 0) {
+		return GATR_MUTE;
+	}
+
+	if (len != golden->len) {
+		flags |= GATR_LEN;
+	}
+
+	for (uint8_t i = 0; i < min(len, golden->len); i++) {
+		if (atrbuf[i] != golden->atr[i]) {
+			flags |= GATR_DATA;
+			break;
+		}
+	}
+
+	if (scGetInverseConvention() != golden->inverse) {
+		flags |= GATR_CONV;
+	}
+
+	uint32_t dFirst = (timing->tFirst > golden->tFirst) ? (timing->tFirst - golden->tFirst) : (golden->tFirst - timing->tFirst);
+	uint32_t dLast  = (timing->tLast  > golden->tLast)  ? (timing->tLast  - golden->tLast)  : (golden->tLast  - timing->tLast);
+	if ((dFirst > golden->tolerance) || (dLast > golden->tolerance)) {
+		flags |= GATR_TIMING;
+	}
+
+	return flags;
+}
+
+
+/**
+ * Print an ATR deviation, and send it to the host if binary frames are on.
+ *
+ * Binary frame: FRAME_GATR
+ *   u32 offset, u8 width (0xFF: glitch program), u16 attempt, u8 flags, u8 inverse,
+ *   u32 tFirst, u32 tLast, u8 len, u8 atr[len]
+ */
+static void gatrReport(const uint32_t offset, const uint8_t width, const uint16_t attempt, const uint8_t flags,
+		const uint8_t *atrbuf, const uint8_t len, const ATR_TIMING *timing)
+{
+	if (gBinaryFrames) {
+		hostFrameBegin(FRAME_GATR, 18 + len);
+		hostFrameWriteU32(offset);
+		hostFrameWriteByte(width);
+		hostFrameWriteU16(attempt);
+		hostFrameWriteByte(flags);
+		hostFrameWriteByte(scGetInverseConvention());
+		hostFrameWriteU32(timing->tFirst);
+		hostFrameWriteU32(timing->tLast);
+		hostFrameWriteByte(len);
+		hostFrameWrite(atrbuf, len);
+		hostFrameEnd();
+	}
+
+	Serial.print(F("Offset "));
+	Serial.print(offset);
+	Serial.print(F(" try "));
+	Serial.print(attempt);
+	Serial.print(F(" --"));
+	if (flags & GATR_MUTE)   Serial.print(F(" MUTE"));
+	if (flags & GATR_LEN)    Serial.print(F(" LEN"));
+	if (flags & GATR_DATA)   Serial.print(F(" DATA"));
+	if (flags & GATR_CONV)   Serial.print(F(" CONV"));
+	if (flags & GATR_TIMING) Serial.print(F(" TIMING"));
+
+	if (!(flags & GATR_MUTE)) {
+		Serial.print(F(" Tts="));
+		Serial.print(timing->tFirst);
+		Serial.print(F(" Tend="));
+		Serial.print(timing->tLast);
+		Serial.print(F(" ATR: "));
+		printHexBuf(atrbuf, len);
+	}
+	Serial.println();
+}
+
+
+/**
+ * Command handler: gatr <start> <end> <step> <width> [<repeats>]
+ *
+ * Glitch-during-ATR campaign.
+ *
+ * Learns the golden ATR (bytes, convention and timing) from a few clean
+ * resets, which must all give the same ATR. Then cold-resets the card
+ * <repeats> times (1..65535) at each glitch offset from <start> to <end> CPU
+ * clocks (4 per card clock) after reset release, and compares each ATR
+ * against the golden one. Anything different -- no ATR, a different length,
+ * different bytes, a convention change, or the ATR starting or finishing at
+ * a different time -- is reported.
+ *
+ * The ATR timeout is cut down to just over the golden ATR start time, so a
+ * card which goes mute doesn't slow the campaign down.
+ *
+ * All parameters are decimal. The glitch width is in CPU clocks (see
+ * gkGlitch()); -1 runs the glitch program loaded with 'gprog' instead of a
+ * plain pulse. Send any character to stop early.
+ */
+void handle_gatr(String *cmdline)
+{
+	GATR_GOLDEN golden;
+	uint8_t atrbuf[32];
+	ATR_TIMING timing;
+	long start, end, step, width, repeats = 1;
+	uint32_t tFirstMin = 0xFFFFFFFF, tFirstMax = 0;
+	uint32_t nAttempts = 0, nDeviations = 0, nMute = 0;
+	unsigned long tStart;
+
+	if (!popArg(cmdline, &start, 10) || !popArg(cmdline, &end, 10) ||
+			!popArg(cmdline, &step, 10) || !popArg(cmdline, &width, 10)) {
+		Serial.println(F("**ERROR: Syntax = gatr <start> <end> <step> <width> [<repeats>]"));
+		return;
+	}
+	popArg(cmdline, &repeats, 10);
+
+	if ((start < 0) || (end < start) || (step < 1) || !glitchWidthOk(width) || (repeats < 1) || (repeats > 0xFFFF)) {
+		Serial.println(F("**ERROR: Bad parameters"));
+		return;
+	}
+
+	// Learn the golden ATR. Every run has to give the same one, or there's
+	// nothing to compare the glitched ATRs against.
+	for (uint8_t i = 0; i < GATR_GOLDEN_RUNS; i++) {
+		uint8_t len = gatrReset(atrbuf, false, 0, 0, ATR_TIMEOUT_MS, &timing);
+
+		if (len == 0) {
+			Serial.println(F("**ERROR: No ATR"));
+			cardPower(0);
+			return;
+		}
+
+		if (i == 0) {
+			memcpy(golden.atr, atrbuf, len);
+			golden.len = len;
+			golden.inverse = scGetInverseConvention();
+		} else if ((len != golden.len) || (memcmp(atrbuf, golden.atr, len) != 0) ||
+				(scGetInverseConvention() != golden.inverse)) {
+			Serial.print(F("**ERROR: The ATR isn't the same every time: "));
+			printHexBuf(atrbuf, len);
+			Serial.println();
+			cardPower(0);
+			return;
+		}
+
+		tFirstMin = min(tFirstMin, timing.tFirst);
+		tFirstMax = max(tFirstMax, timing.tFirst);
+	}
+	golden.tFirst = timing.tFirst;
+	golden.tLast = timing.tLast;
+
+	// Allow the reset-to-ATR jitter we saw, plus one Etu either way
+	golden.tolerance = (tFirstMax - tFirstMin) + 372;
+
+	// Give up waiting for the ATR to start at twice the golden time, plus 10ms
+	golden.timeout = ((tFirstMax * 2) / (CARD_CLOCK_HZ / 1000)) + 10;
+
+	Serial.print(F("Golden ATR: "));
+	printHexBuf(golden.atr, golden.len);
+	Serial.println();
+	Serial.print(F("Convention "));
+	Serial.print(golden.inverse ? F("inverse") : F("direct"));
+	Serial.print(F(", TS at "));
+	Serial.print(golden.tFirst);
+	Serial.print(F(" clocks (+/-"));
+	Serial.print(golden.tolerance);
+	Serial.print(F("), last byte at "));
+	Serial.println(golden.tLast);
+	Serial.println();
+
+	tStart = millis();
+
+	for (uint32_t offset = start; offset <= (uint32_t)end; offset += step) {
+		for (uint16_t attempt = 0; attempt < repeats; attempt++) {
+			uint8_t len, flags;
+
+			scSetInverseConvention(golden.inverse);
+			len = gatrReset(atrbuf, true, offset, width, golden.timeout, &timing);
+			flags = gatrCompare(&golden, atrbuf, len, &timing);
+			nAttempts++;
+
+			if (flags != 0) {
+				nDeviations++;
+				if (flags & GATR_MUTE) {
+					nMute++;
+				}
+				gatrReport(offset, width, attempt, flags, atrbuf, len, &timing);
+			}
+		}
+
+		if (Serial.available()) {
+			Serial.println(F("Stopped."));
+			break;
+		}
+	}
+
+	cardPower(0);
+	scSetInverseConvention(golden.inverse);
+
+	unsigned long elapsed = millis() - tStart;
+	Serial.print(F("\n"));
+	Serial.print(nAttempts);
+	Serial.print(F(" attempts, "));
+	Serial.print(nDeviations);
+	Serial.print(F(" deviations ("));
+	Serial.print(nMute);
+	Serial.print(F(" mute), "));
+	Serial.print((nAttempts * 1000.0) / max(elapsed, 1UL), 1);
+	Serial.println(F(" resets/sec"));
+}
+
+
+/**
+ * Glitched read response capture state.
+ *
+ * The first GREAD_BUF bytes are held in RAM. Once the response runs past the
+ * end of the golden response, everything is streamed to the host as it
+ * arrives, so an over-read of any length is saved.
+ */
+typedef struct {
+	uint16_t attempt;
+	uint16_t n;					///< Bytes received
+	uint16_t nSent;				///< Bytes sent to the host
+	uint16_t crc;				///< CRC16 of the bytes received
+	uint16_t sw;				///< Last two bytes received
+	uint32_t tFirst;			///< Start of the first byte, card clocks (tbNow())
+	bool streaming;				///< Forwarding bytes to the host
+	bool stopped;				///< Cut short because the host sent something
+	uint8_t buf[GREAD_BUF];
+	uint8_t chunk[GREAD_CHUNK];	///< Bytes waiting to go out as FRAME_GREAD_DATA
+	uint8_t nChunk;
+} GREAD_CAPTURE;
+
+
+/**
+ * Send the pending streamed bytes as a FRAME_GREAD_DATA frame.
+ *
+ * Binary frame: FRAME_GREAD_DATA
+ *   u16 attempt, u16 index of first byte, u8 data[]
+ */
+static void greadFlush(GREAD_CAPTURE *cap)
+{
+	if (cap->nChunk == 0) {
+		return;
+	}
+
+	hostFrameBegin(FRAME_GREAD_DATA, 4 + cap->nChunk);
+	hostFrameWriteU16(cap->attempt);
+	hostFrameWriteU16(cap->nSent - cap->nChunk);
+	hostFrameWrite(cap->chunk, cap->nChunk);
+	hostFrameEnd();
+
+	cap->nChunk = 0;
+}
+
+/**
+ * Forward one response byte to the host.
+ */
+static void greadSend(GREAD_CAPTURE *cap, const uint8_t val)
+{
+	if (gBinaryFrames) {
+		cap->chunk[cap->nChunk++] = val;
+		cap->nSent++;
+		if (cap->nChunk == GREAD_CHUNK) {
+			greadFlush(cap);
+		}
+	} else {
+		if ((cap->nSent % 16) == 0) {
+			Serial.println();
+			Serial.print(F("  "));
+		}
+		printHex(val);
+		Serial.print(' ');
+		cap->nSent++;
+	}
+}
+
+/**
+ * Start streaming a response to the host: send everything received so far.
+ */
+static void greadStartStreaming(GREAD_CAPTURE *cap)
+{
+	if (!gBinaryFrames) {
+		Serial.print(F("Try "));
+		Serial.print(cap->attempt);
+		Serial.print(F(" data:"));
+	}
+
+	cap->streaming = true;
+	for (uint16_t i = 0; i < min(cap->n, (uint16_t)GREAD_BUF); i++) {
+		greadSend(cap, cap->buf[i]);
+	}
+}
+
+/**
+ * Read the response to a read command, until the card goes quiet.
+ *
+ * @param	streamAfter	Start streaming when the response gets longer than
+ * 						this. 0xFFFF to never stream (golden run).
+ */
+static void greadCapture(GREAD_CAPTURE *cap, const uint16_t streamAfter)
+{
+	int val;
+	int timeout = GREAD_FIRST_MS;
+
+	cap->n = 0;
+	cap->nSent = 0;
+	cap->nChunk = 0;
+	cap->crc = 0xFFFF;
+	cap->sw = 0;
+	cap->streaming = false;
+	cap->stopped = false;
+
+	while (cap->n < GREAD_MAX_BYTES) {
+		val = scReadByte(timeout, (cap->n == 0) ? &cap->tFirst : NULL);
+		if (val == -1) {
+			break;
+		}
+		timeout = GREAD_IDLE_MS;
+
+		if (cap->n < GREAD_BUF) {
+			cap->buf[cap->n] = val;
+		}
+		cap->n++;
+		cap->crc = _crc16_update(cap->crc, val);
+		cap->sw = (cap->sw << 8) | val;
+
+		if (cap->streaming) {
+			greadSend(cap, val);
+		} else if (cap->n > streamAfter) {
+			// Over-read: save everything from here on
+			greadStartStreaming(cap);
+		}
+
+		// Bail out if the host wants us to stop (the card may never finish)
+		if (Serial.available()) {
+			cap->stopped = true;
+			break;
+		}
+	}
+
+	cardStopListening();
+}
+
+
+/**
+ * Command handler: gread <offset> <width> <attempts> <cla> <ins> <p1> <p2> <le>
+ *
+ * Glitch-assisted over-read.
+ *
+ * Sends a read command (no command data) and glitches the card <offset> CPU
+ * clocks after the end of the header, then keeps listening until the card
+ * goes quiet, however many bytes it sends. Each response is compared with the
+ * golden (unglitched) response: longer or shorter responses, a changed final
+ * status word and changed data are reported.
+ *
+ * As soon as a response runs past the end of the golden one, it is streamed
+ * to the host byte by byte (FRAME_GREAD_DATA in binary mode, hex text
+ * otherwise), so a long dump isn't limited by the RAM we have.
+ *
+ * offset, width and attempts are decimal, the APDU header is hex. The glitch
+ * width is in CPU clocks (see gkGlitch()); -1 runs the glitch program loaded
+ * with 'gprog'. Send any character to stop early.
+ *
+ * The glitch runs with interrupts off, and the card port receives by
+ * interrupt, so the glitch has to be over before the card starts to answer.
+ * The golden run measures when that is, and offsets which would still be
+ * glitching at 7/8 of that time are refused.
+ */
+void handle_gread(String *cmdline)
+{
+	GREAD_CAPTURE cap;
+	uint8_t atrbuf[32];
+	uint8_t n;
+	long offset, width, attempts;
+	long cla, ins, p1, p2, le;
+	uint16_t goldenN, goldenCrc, goldenSw;
+	uint32_t tHeader, maxEnd, glitchEnd;
+	uint32_t nDeviations = 0, nLong = 0;
+
+	if (!popArg(cmdline, &offset, 10) || !popArg(cmdline, &width, 10) || !popArg(cmdline, &attempts, 10) ||
+			!popArg(cmdline, &cla) || !popArg(cmdline, &ins) || !popArg(cmdline, &p1) ||
+			!popArg(cmdline, &p2) || !popArg(cmdline, &le)) {
+		Serial.println(F("**ERROR: Syntax = gread <offset> <width> <attempts> <cla> <ins> <p1> <p2> <le>"));
+		return;
+	}
+
+	if ((offset < 0) || !glitchWidthOk(width) || (attempts < 1) || (attempts > 0xFFFF)) {
+		Serial.println(F("**ERROR: Bad parameters"));
+		return;
+	}
+
+	// Golden response
+	cap.attempt = 0;
+	cardPower(0);
+	cardPower(1);
+	n = cardGetAtr(atrbuf, true);
+	if (n == 0) {
+		Serial.println(F("**ERROR: No ATR"));
+		cardPower(0);
+		return;
+	}
+	cardProfileApply(atrbuf, n, true);
+	cardSendCommand(cla, ins, p1, p2, le);
+	tHeader = tbNow();
+	greadCapture(&cap, 0xFFFF);
+	goldenN = cap.n;
+	goldenCrc = cap.crc;
+	goldenSw = cap.sw;
+
+	if (goldenN == 0) {
+		Serial.println(F("**ERROR: No response"));
+		cardPower(0);
+		return;
+	}
+
+	// Latest the glitch can finish, CPU clocks after the header
+	maxEnd = (((cap.tFirst - tHeader) * 4) / 16) * GREAD_PROC_MARGIN;
+	glitchEnd = offset + ((width == GLITCH_WIDTH_PROG) ? gpClocks() : (uint32_t)width);
+
+	Serial.print(F("Golden response: "));
+	Serial.print(goldenN);
+	Serial.print(F(" bytes, SW="));
+	Serial.print(goldenSw, HEX);
+	Serial.print(F(", first byte after "));
+	Serial.print(cap.tFirst - tHeader);
+	Serial.println(F(" clocks"));
+
+	if (glitchEnd > maxEnd) {
+		Serial.print(F("**ERROR: The glitch must be over by "));
+		Serial.print(maxEnd);
+		Serial.println(F(" CPU clocks, before the card answers"));
+		cardPower(0);
+		return;
+	}
+
+	for (uint16_t attempt = 0; attempt < attempts; attempt++) {
+		uint8_t flags = 0;
+
+		// Check here, as clean attempts skip the rest of the loop
+		if (Serial.available()) {
+			Serial.println(F("Stopped."));
+			break;
+		}
+
+		cardColdReset();
+		if (cardGetAtr(atrbuf, true, gResetTiming.atrTimeout) == 0) {
+			continue;
+		}
+		cardProfileRestore();
+
+		// Glitch timing is relative to the end of the header
+		noInterrupts();
+		cardSendCommand(cla, ins, p1, p2, le);
+		glitchFire(offset, width);
+		interrupts();
+
+		cap.attempt = attempt;
+		greadCapture(&cap, goldenN);
+
+		// A capture cut short isn't a deviation
+		if (cap.stopped) {
+			if (gBinaryFrames) {
+				greadFlush(&cap);
+			} else if (cap.nSent > 0) {
+				Serial.println();
+			}
+			Serial.println(F("Stopped."));
+			break;
+		}
+
+		if (cap.n == 0) {
+			flags |= GREAD_MUTE;
+		} else {
+			if (cap.n > goldenN) {
+				flags |= GREAD_LONG;
+				nLong++;
+			} else if (cap.n < goldenN) {
+				flags |= GREAD_SHORT;
+			} else if (cap.crc != goldenCrc) {
+				flags |= GREAD_DATA;
+			}
+			if (cap.sw != goldenSw) {
+				flags |= GREAD_SW;
+			}
+		}
+
+		if (flags == 0) {
+			continue;
+		}
+		nDeviations++;
+
+		// Interesting, but wasn't long enough to stream? Send what we kept.
+		if (!cap.streaming && !(flags & GREAD_MUTE)) {
+			greadStartStreaming(&cap);
+		}
+
+		/* Binary frame: FRAME_GREAD
+		 *   u16 attempt, u8 flags, u16 bytes received, u16 sw
+		 * Follows the FRAME_GREAD_DATA frames for the response.
+		 */
+		if (gBinaryFrames) {
+			greadFlush(&cap);
+			hostFrameBegin(FRAME_GREAD, 7);
+			hostFrameWriteU16(attempt);
+			hostFrameWriteByte(flags);
+			hostFrameWriteU16(cap.n);
+			hostFrameWriteU16(cap.sw);
+			hostFrameEnd();
+		} else if (cap.nSent > 0) {
+			Serial.println();
+		}
+
+		Serial.print(F("Try "));
+		Serial.print(attempt);
+		Serial.print(F(" --"));
+		if (flags & GREAD_MUTE)  Serial.print(F(" MUTE"));
+		if (flags & GREAD_LONG)  Serial.print(F(" LONG"));
+		if (flags & GREAD_SHORT) Serial.print(F(" SHORT"));
+		if (flags & GREAD_DATA)  Serial.print(F(" DATA"));
+		if (flags & GREAD_SW)    Serial.print(F(" SW"));
+		Serial.print(F(" len="));
+		Serial.print(cap.n);
+		Serial.print(F(" SW="));
+		Serial.println(cap.sw, HEX);
+	}
+
+	cardPower(0);
+
+	Serial.print(F("\n"));
+	Serial.print(nDeviations);
+	Serial.print(F(" deviations, "));
+	Serial.print(nLong);
+	Serial.println(F(" over-reads"));
+}
+
+#endif // ENABLE_GLITCH
@@ -0,0 +1,11 @@
+#ifndef GLITCH_H
+#define GLITCH_H
+
+#ifdef ENABLE_GLITCH
+
+void handle_gatr(String *cmdline);
+void handle_gread(String *cmdline);
+
+#endif // ENABLE_GLITCH
+
+#endif // GLITCH_H
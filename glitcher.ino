@@ -17,9 +17,24 @@
 #include "config.h"
 #include "hardware.h"
 #include "smartcard.h"
+#include "cardprofile.h"
+#include "scancache.h"
+#include "hostlink.h"
+#include "timebase.h"
 #include "utils.h"
 #include "videocrypt.h"
 #include "cryptoworks.h"
+#include "powertrace.h"
+#include "timescan.h"
+#include "glitch.h"
+#include "glitchprog.h"
+#include "resetrate.h"
+#include "fuzz.h"
+#include "apdiff.h"
+#include "session.h"
+#include "bench.h"
+#include "stats.h"
+#include "cardscript.h"
 
 //
 // next task -- 
@@ -32,7 +47,7 @@
 //
 // also todo
 //   - simple power analysis
-//       (try to find glitchable loops)
+//       (try to find glitchable loops -- capture with 'ptrace', see tools/ptrace.py)
 //   - ATR decode
 //   - try to find a way to get the hidden commands working? some might be glitchable?
 //
@@ -44,6 +59,12 @@ bool gCardPowerOn = false;
 // Debug enable/disable for SCAN
 bool gScanDebug = false;
 
+// Timing display enable/disable for SCAN
+bool gScanTiming = false;
+
+// Number of per-character times logged by the scanners
+#define SCAN_RX_TIMES 16
+
 // ATR buffer
 uint8_t atr[32];
 uint8_t atrLen = 0;
@@ -68,6 +89,9 @@ void doResetAndATR(bool silent=false)
 	// wait max of 12ms for ATR
 	atrLen = cardGetAtr(atr);
 
+	// Set up for this card: baud rate, timing, gap between commands
+	cardProfileApply(atr, atrLen, silent);
+
 	if (!silent) {
 		Serial.print(F("ATR Len="));
 		Serial.print(atrLen);
@@ -87,6 +111,25 @@ void doResetAndATR(bool silent=false)
 	gCardPowerOn = true;
 }
 
+/**
+ * Utility function: print APDU timing on the end of a scan result line.
+ */
+void printScanTiming(const APDU_TIMING *timing)
+{
+	Serial.print(F(" Tproc="));
+	Serial.print(timing->tProc);
+	if (timing->tLastData != 0) {
+		Serial.print(F(" Tdata="));
+		Serial.print(timing->tLastData);
+	}
+	Serial.print(F(" Tsw="));
+	Serial.print(timing->tSw1);
+	Serial.print(F(" Gap="));
+	Serial.print(timing->gapMax);
+	Serial.print('@');
+	Serial.print(timing->gapMaxIdx);
+}
+
 
 
 /************************************************************
@@ -138,9 +181,111 @@ void handle_scan_debug(String *cmdline)
 
 
 /**
- * Command handler: scancla <start> [<end>]
+ * Command handler: scantiming [i]
  * 
- * Scan instruction classes.
+ * Get/set scan timing display state
+ */
+void handle_scan_timing(String *cmdline)
+{
+	if (cmdline->length() > 0) {
+		gScanTiming = cmdline->toInt() != 0;
+	}
+	
+	Serial.print(F("Scan timing is "));
+	Serial.println(gScanTiming ? F("on") : F("off"));
+}
+
+
+/**
+ * Command handler: binary [i]
+ * 
+ * Get/set binary result frames state
+ */
+void handle_binary(String *cmdline)
+{
+	if (cmdline->length() > 0) {
+		gBinaryFrames = cmdline->toInt() != 0;
+	}
+	
+	Serial.print(F("Binary frames are "));
+	Serial.println(gBinaryFrames ? F("on") : F("off"));
+}
+
+
+/**
+ * Utility function: send one class scan APDU and print the result if it's
+ * interesting. Reboots the card on a comms error.
+ *
+ * @param	verify	Checking a cached result: print it even if the INS is bad,
+ * 					and mark it as changed if the SW isn't expectSw.
+ * @return SW1SW2
+ */
+static uint16_t scanClaIns(uint8_t cla, uint8_t ins, uint8_t *buf, APDU_TIMING *timing, bool verify = false, uint16_t expectSw = 0)
+{
+	uint8_t procByte;
+	String reason = "";
+
+	if (gScanDebug) {
+		Serial.println();
+	}
+
+	uint16_t sw1sw2 = cardSendApdu(cla, ins, 0, 0, SCACHE_SCAN_LE, buf, APDU_RECV, &procByte, gScanDebug, timing);
+
+	if (gBinaryFrames) {
+		const uint8_t hdr[5] = { cla, ins, 0, 0, SCACHE_SCAN_LE };
+		hostFrameApdu(hdr, sw1sw2, procByte, timing);
+	}
+
+	if (sw1sw2 >= 0xFFF0) {
+		reason = " (comms err, rebooting card) ";
+		STATS_COUNT(commsResets);
+		doResetAndATR(true);
+	} else if ((sw1sw2 == 0x6D00) && !verify) {
+		//reason = " (bad ins)";
+	} else if (sw1sw2 == 0x6E00) {
+		reason = " (bad cla)";
+	} else {
+		reason = verify ? ((sw1sw2 == expectSw) ? " KNOWN" : " CHANGED") : " FOUND";
+
+		switch (sw1sw2) {
+			case 0x6700: reason += " (BAD_LE)    "; break;
+			case 0x6B00: reason += " (BAD P1/P2) "; break;
+			case 0x9000: reason += " (SUCCESS)   "; break;
+		}
+	}
+
+	if (reason.length() > 0) {
+		Serial.print(F("CLA/INS "));
+		Serial.print(cla, HEX);
+		Serial.print('/');
+		Serial.print(ins, HEX);
+		Serial.print(F(" -- sw1sw2="));
+		Serial.print(sw1sw2, HEX);
+		Serial.print(reason);
+		Serial.print(F("Proc="));
+		printHex(procByte);
+		if (gScanTiming) {
+			printScanTiming(timing);
+		}
+		Serial.println();
+	}
+
+	// Some cards need a gap between commands (Sky needs 10ms)
+	delay(gCardProfile.cmdGap);
+
+	return sw1sw2;
+}
+
+
+/**
+ * Command handler: scancla [<start> [<end>]]
+ * 
+ * Scan instruction classes. With no arguments, scans the class from the
+ * card's profile.
+ *
+ * Results are cached in EEPROM for each card type (see scancache.h). Classes
+ * which have already been scanned are checked by sending the commands found
+ * last time; they are only scanned again if a result has changed.
  */
 void handle_scan_cla(String *cmdline)
 {
@@ -148,13 +293,22 @@ void handle_scan_cla(String *cmdline)
 	// CLA/INS SCAN
 
 	uint8_t buf[256];
-	uint8_t procByte;
 	uint8_t startClass;
 	uint8_t endClass;
+	uint16_t rxTimes[SCAN_RX_TIMES];
+	APDU_TIMING timing;
+
+	timing.rxTimes = rxTimes;
+	timing.rxTimesMax = SCAN_RX_TIMES;
 
 	if (cmdline->length() == 0) {
-		Serial.println(F("**ERROR: Need at least a starting classcode"));
-		return;
+		// Scan the class the card profile says the card uses
+		doResetAndATR();
+		if (gCardProfile.cla == PROFILE_CLA_NONE) {
+			Serial.println(F("**ERROR: Need at least a starting classcode"));
+			return;
+		}
+		startClass = endClass = gCardProfile.cla;
 	} else {
 		int ofs;
 		String val = *cmdline;
@@ -172,9 +326,15 @@ void handle_scan_cla(String *cmdline)
 			startClass = strtol(val.substring(0, ofs).c_str(), NULL, 16);
 			endClass = strtol(val.substring(ofs+1).c_str(), NULL, 16);
 		}
+
+		doResetAndATR();
 	}
 
-	doResetAndATR();
+	if (scacheOpen(atr, atrLen)) {
+		Serial.print(F("Scan cache: "));
+		Serial.print(scacheCount());
+		Serial.println(F(" known commands for this card"));
+	}
 
 	Serial.print(F("Scanning from classcode 0x"));
 	Serial.print(startClass, HEX);
@@ -182,12 +342,36 @@ void handle_scan_cla(String *cmdline)
 	Serial.print(endClass, HEX);
 	Serial.println(F(" inclusive.\n"));
 
-	String reason = "";
-
 	// CLA 0xFF is reserved for PTS
 	// Sky 07 cards don't seem to check the classcode. ???
 	for (int cla = startClass; cla <= endClass; cla++)
 	{
+		bool complete = true;
+
+		// Verify known: check the cached results for this class still hold
+		if (scacheClaDone(cla)) {
+			bool same = true;
+
+			for (uint8_t i = 0; (i < scacheCount()) && same; i++) {
+				SCACHE_ENTRY e;
+
+				scacheGet(i, &e);
+				if (e.cla == cla) {
+					same = (scanClaIns(cla, e.ins, buf, &timing, true, e.sw) == e.sw);
+				}
+			}
+
+			if (same) {
+				continue;
+			}
+
+			Serial.print(F("Class 0x"));
+			Serial.print(cla, HEX);
+			Serial.println(F(" has changed, scanning it again"));
+			scacheForgetCla(cla);
+		}
+
+		// Probe unknown
 		for (int ins=0; ins<=0xFF; ins += 2) {
 			// INS is only valid if LSBit = 0 and MSN is not 6 or 9
 			if ( ((ins >> 4) == 6) || ((ins >> 4) == 9) || (ins & 1)) {
@@ -196,52 +380,31 @@ void handle_scan_cla(String *cmdline)
 				continue;
 			}
 
-			if (gScanDebug) {
-				Serial.println();
-			}
-
-			uint16_t sw1sw2 = cardSendApdu(cla, ins, 0, 0, 0xff, buf, APDU_RECV, &procByte, gScanDebug);
+			uint16_t sw1sw2 = scanClaIns(cla, ins, buf, &timing);
 
 			if (sw1sw2 >= 0xFFF0) {
-				reason = " (comms err, rebooting card) ";
-				doResetAndATR(true);
-			} else if (sw1sw2 == 0x6D00) {
-				//reason = " (bad ins)";
-			} else if (sw1sw2 == 0x6E00) {
-				reason = " (bad cla)";
-			} else {
-				reason = " FOUND";
-
-				switch (sw1sw2) {
-					case 0x6700: reason += " (BAD_LE)    "; break;
-					case 0x6B00: reason += " (BAD P1/P2) "; break;
-					case 0x9000: reason += " (SUCCESS)   "; break;
+				// Don't know what this INS does
+				complete = false;
+			} else if ((sw1sw2 != 0x6D00) && (sw1sw2 != 0x6E00)) {
+				// 6Cxx gives the right Le
+				SCACHE_ENTRY e = { (uint8_t)cla, (uint8_t)ins, SCACHE_SCAN_LE, sw1sw2 };
+				if ((sw1sw2 >> 8) == 0x6C) {
+					e.le = sw1sw2 & 0xFF;
+				}
+				if (!scacheAdd(&e)) {
+					complete = false;
 				}
 			}
 
-			if (reason.length() > 0) {
-				Serial.print(F("CLA/INS "));
-				Serial.print(cla, HEX);
-				Serial.print('/');
-				Serial.print(ins, HEX);
-				Serial.print(F(" -- sw1sw2="));
-				Serial.print(sw1sw2, HEX);
-				Serial.print(reason);
-				Serial.print(F("Proc="));
-				printHex(procByte);
-				Serial.println();
-
-				reason = "";
-			}
-
-			// Sky card requires 10ms between commands
-			delay(50);
-
 			// If we got a Bad Class response, move to the next class
 			if (sw1sw2 == 0x6E00) {
 				break;
 			}
 		}
+
+		if (complete) {
+			scacheSetClaDone(cla);
+		}
 	}
 	Serial.println(F("\nAll done."));
 }
@@ -259,9 +422,15 @@ void handle_scan_len(String *cmdline)
 
 	uint8_t buf[256];
 	uint8_t procByte;
+	uint16_t rxTimes[SCAN_RX_TIMES];
+	APDU_TIMING timing;
 
 	uint8_t cla;
 	uint8_t ins;
+	bool leCached = false;
+
+	timing.rxTimes = rxTimes;
+	timing.rxTimesMax = SCAN_RX_TIMES;
 
 	Serial.print(F("CMD: ["));
 	Serial.print(cmdline->c_str());
@@ -285,6 +454,7 @@ void handle_scan_len(String *cmdline)
 	}
 
 	doResetAndATR();
+	scacheOpen(atr, atrLen);
 
 	Serial.print(F("Scanning valid lengths for CLA 0x"));
 	printHex(cla);
@@ -301,10 +471,16 @@ void handle_scan_len(String *cmdline)
 
 		procByte = 0xFF;
 
-		uint16_t sw1sw2 = cardSendApdu(cla, ins, 0, 0, len, buf, APDU_RECV, &procByte, gScanDebug);
+		uint16_t sw1sw2 = cardSendApdu(cla, ins, 0, 0, len, buf, APDU_RECV, &procByte, gScanDebug, &timing);
+
+		if (gBinaryFrames) {
+			const uint8_t hdr[5] = { cla, ins, 0, 0, (uint8_t)len };
+			hostFrameApdu(hdr, sw1sw2, procByte, &timing);
+		}
 		
 		if (sw1sw2 >= 0xFFF0) {
 			reason = " (comms err, rebooting card) ";
+			STATS_COUNT(commsResets);
 			doResetAndATR(true);
 		} else if (sw1sw2 == 0x6D00) {
 			//reason = " (bad ins)";
@@ -318,6 +494,16 @@ void handle_scan_len(String *cmdline)
 			}
 		}
 
+		// Remember the longest good Le for commands in the scan cache
+		if ((sw1sw2 == 0x9000) && !leCached) {
+			SCACHE_ENTRY e;
+			if (scacheFind(cla, ins, &e)) {
+				e.le = len;
+				scacheAdd(&e);
+			}
+			leCached = true;
+		}
+
 		if (reason.length() > 0) {
 			Serial.print("CLA/INS ");
 			printHex(cla);
@@ -335,13 +521,16 @@ void handle_scan_len(String *cmdline)
 				Serial.print(" (ACK    )");
 			} else if (procByte == (ins+1)) {
 				Serial.print(" (ACK+VPP)");
-			} else if (procByte == (~ins)) {
+			} else if (procByte == (uint8_t)~ins) {
 				Serial.print(" (one    )");
-			} else if (procByte == (~(ins+1))) {
+			} else if (procByte == (uint8_t)~(ins+1)) {
 				Serial.print(" (one+VPP)");
 			} else {
 				Serial.print("          ");
 			}
+			if (gScanTiming) {
+				printScanTiming(&timing);
+			}
 			if (sw1sw2 == 0x9000) {
 				Serial.print("  Data=");
 				printHexBuf(buf, len);
@@ -351,8 +540,8 @@ void handle_scan_len(String *cmdline)
 			reason = "";
 		}
 
-		// Sky card requires 10ms between commands
-		delay(50);
+		// Some cards need a gap between commands (Sky needs 10ms)
+		delay(gCardProfile.cmdGap);
 	}
 	
 	Serial.println(F("\nAll done."));
@@ -527,8 +716,16 @@ const CMD COMMANDS[] = {
 	{ "reset",		"Card power on (alias of 'on')",	handle_reset },			// Power on, Reset and ATR
 	
 	{ "scandebug",	"param 0/1: scan debugging off/on",	handle_scan_debug },	// scandebug <n> --> debug on/off
+	{ "scantiming",	"param 0/1: scan timing off/on",	handle_scan_timing },	// scantiming <n> --> timing display on/off
+	{ "binary",		"param 0/1: binary frames off/on",	handle_binary },		// binary <n> --> binary result frames on/off
+	{ "tbcal",		"Timebase calibration check",		handle_tbcal },			// Check the card clock timebase
+	{ "tbevents",	"Timebase event log",				handle_tbevents },		// Show timestamped events
+	{ "rlearn",		"Learn fast cold reset timing",		handle_rlearn },		// Learn the fastest safe cold reset timing
+	{ "rbench",		"Benchmark cold reset rate",		handle_rbench },		// Cold resets per second
+	{ "profile",	"Card profiles: show/set/save/del",	handle_profile },		// Card profile database
 	{ "scancla",	"Scan classcodes",					handle_scan_cla },		// Scan for classcodes
 	{ "scanlen",	"Scan instruction lengths",			handle_scan_len },		// Scan valid data lengths for command
+	{ "scache",		"Scan cache: show/clear",			handle_scache },		// Cached scan results
 	
 	{ "vcserial",	"VideoCrypt: card serial number",	handle_vcserial },		// VC: Read serial number and card issue
 	{ "vcosd",		"VideoCrypt: read OSD",				handle_vcosd },			// VC: Read OSD
@@ -540,6 +737,44 @@ const CMD COMMANDS[] = {
 #endif
 
 	{ "sle4432",	"SLE4432: ATR",						handle_sle4432 },
+
+#ifdef ENABLE_POWERTRACE
+	{ "ptrace",		"Power trace capture (averaged)",	handle_ptrace },
+#endif
+
+#ifdef ENABLE_TIMESCAN
+	{ "tscan",		"Timing side channel scan",			handle_tscan },
+#endif
+
+#ifdef ENABLE_GLITCH
+	{ "gatr",		"Glitch: during ATR",				handle_gatr },
+	{ "gread",		"Glitch: over-read capture",		handle_gread },
+	{ "gprog",		"Glitch: load/run glitch program",	handle_gprog },
+#endif
+
+#ifdef ENABLE_FUZZ
+	{ "fuzz",		"Mutational APDU fuzzer",			handle_fuzz },
+#endif
+
+#ifdef ENABLE_DIFF
+	{ "diff",		"Differential run vs golden card",	handle_diff },
+#endif
+
+#ifdef ENABLE_SESSION
+	{ "session",	"Session record/replay",			handle_session },
+#endif
+
+#ifdef ENABLE_BENCH
+	{ "bench",		"Throughput/latency benchmarks",	handle_bench },
+#endif
+
+#ifdef ENABLE_STATS
+	{ "stats",		"Runtime statistics: show/reset",	handle_stats },
+#endif
+
+#ifdef ENABLE_CARDSCRIPT
+	{ "cscript",	"Card script: load/save/run",		handle_cscript },
+#endif
 	
 	{ "", NULL }
 };
@@ -605,7 +840,13 @@ void menu(void)
 
 	// call the handler callback if the cmd was found
 	if (p->callback != NULL) {
+#ifdef ENABLE_STATS
+		statsCommandStart();
 		p->callback(&s);
+		statsCommandEnd();
+#else
+		p->callback(&s);
+#endif
 	} else {
 		Serial.print(F("Bad command '"));
 		Serial.print(cmp);
@@ -633,6 +874,9 @@ void setup() {
 
 	Serial.println(F(">> GLITCHER " __DATE__ " " __TIME__ ));
 
+	// init card clock timebase
+	tbInit();
+
 	// init card serial port
 	cardInit();	
 }
@@ -684,7 +928,7 @@ void glitchtest() {
 	//digitalWrite(CARD_CLKOUT_PIN, LOW);
 
 	// clock loop
-	scClockN(5);
+	gkClockN(5);
 
 	// gap
 	CLK(0);
@@ -0,0 +1,150 @@
+// gotta go fast!
+#pragma GCC optimize ("-O3")
+
+#include "config.h"
+#include "hardware.h"
+#include "glitchkernel.h"
+
+#ifdef ENABLE_GLITCH
+
+/// Kernel entry point
+typedef void (*GK_KERNEL)(void);
+
+/// Number of glitch widths
+#define GK_WIDTHS		(GK_WIDTH_MAX - GK_WIDTH_MIN + 1)
+
+
+/***
+ * Unrolled sequences
+ */
+
+/// N single-cycle NOPs
+template<uint8_t N> struct GkNops {
+	__attribute__((always_inline)) static inline void run(void)
+	{
+		asm volatile ("nop");
+		GkNops<N - 1>::run();
+	}
+};
+
+template<> struct GkNops<0> {
+	__attribute__((always_inline)) static inline void run(void) { }
+};
+
+/// N clock pulses, 4 CPU clocks each
+template<uint8_t N> struct GkClocks {
+	__attribute__((always_inline)) static inline void run(void)
+	{
+		CLKP1();
+		GkClocks<N - 1>::run();
+	}
+};
+
+template<> struct GkClocks<0> {
+	__attribute__((always_inline)) static inline void run(void) { }
+};
+
+
+/***
+ * Kernels
+ */
+
+/// Phase adjust (0-3 CPU clocks), then a glitch WIDTH CPU clocks wide
+template<uint8_t PHASE, uint8_t WIDTH> static void gkGlitchKernel(void)
+{
+	GkNops<PHASE>::run();
+	GLITCH(1);
+	GkNops<WIDTH - GK_WIDTH_MIN>::run();
+	GLITCH(0);
+}
+
+/// Phase adjust only (0-3 CPU clocks)
+template<uint8_t PHASE> static void gkPhaseKernel(void)
+{
+	GkNops<PHASE>::run();
+}
+
+/// N clock pulses
+template<uint8_t N> static void gkClockKernel(void)
+{
+	GkClocks<N>::run();
+}
+
+
+/***
+ * Jump tables, generated from an index sequence
+ */
+
+template<uint8_t... I> struct GkSeq { };
+template<uint8_t N, uint8_t... I> struct GkMakeSeq : GkMakeSeq<N - 1, N - 1, I...> { };
+template<uint8_t... I> struct GkMakeSeq<0, I...> { typedef GkSeq<I...> type; };
+
+template<typename S> struct GkTables;
+template<uint8_t... I> struct GkTables<GkSeq<I...> > {
+	/// Glitch kernels, indexed by (phase * GK_WIDTHS) + (width - GK_WIDTH_MIN)
+	static const GK_KERNEL glitch[sizeof...(I)];
+};
+
+template<uint8_t... I>
+const GK_KERNEL GkTables<GkSeq<I...> >::glitch[sizeof...(I)] PROGMEM = {
+	gkGlitchKernel<I / GK_WIDTHS, GK_WIDTH_MIN + (I % GK_WIDTHS)>...
+};
+
+typedef GkTables<GkMakeSeq<4 * GK_WIDTHS>::type> GK_TABLES;
+
+static const GK_KERNEL gkPhaseTable[4] PROGMEM = {
+	gkPhaseKernel<0>, gkPhaseKernel<1>, gkPhaseKernel<2>, gkPhaseKernel<3>
+};
+
+static const GK_KERNEL gkClockTable[GK_CLOCKS] PROGMEM = {
+	gkClockKernel<0>,  gkClockKernel<1>,  gkClockKernel<2>,  gkClockKernel<3>,
+	gkClockKernel<4>,  gkClockKernel<5>,  gkClockKernel<6>,  gkClockKernel<7>,
+	gkClockKernel<8>,  gkClockKernel<9>,  gkClockKernel<10>, gkClockKernel<11>,
+	gkClockKernel<12>, gkClockKernel<13>, gkClockKernel<14>, gkClockKernel<15>
+};
+
+
+/**
+ * Coarse part of a delay: whole card clocks, as one _delay_loop_2() run.
+ *
+ * _delay_loop_2() is 4 CPU clocks per iteration with no other per-iteration
+ * cost, and always runs at least once, so this is exactly linear up to
+ * GK_COARSE_MAX.
+ */
+__attribute__((always_inline)) static inline void gkCoarse(uint32_t clocks)
+{
+	if (clocks > GK_COARSE_MAX) {
+		scDelayClocks(clocks - GK_COARSE_MAX);
+		clocks = GK_COARSE_MAX;
+	}
+	_delay_loop_2(clocks + 1);
+}
+
+void gkGlitch(const uint32_t offset, const uint8_t width)
+{
+	uint8_t w = constrain(width, GK_WIDTH_MIN, GK_WIDTH_MAX) - GK_WIDTH_MIN;
+	GK_KERNEL k = (GK_KERNEL)pgm_read_word(&GK_TABLES::glitch[((offset & 3) * GK_WIDTHS) + w]);
+
+	gkCoarse(offset >> 2);
+	k();
+}
+
+void gkDelay(const uint32_t offset)
+{
+	GK_KERNEL k = (GK_KERNEL)pgm_read_word(&gkPhaseTable[offset & 3]);
+
+	gkCoarse(offset >> 2);
+	k();
+}
+
+void gkClockN(uint16_t n)
+{
+	GK_KERNEL k = (GK_KERNEL)pgm_read_word(&gkClockTable[n % GK_CLOCKS]);
+
+	for (n /= GK_CLOCKS; n > 0; n--) {
+		GkClocks<GK_CLOCKS>::run();
+	}
+	k();
+}
+
+#endif // ENABLE_GLITCH
@@ -0,0 +1,62 @@
+#ifndef GLITCHKERNEL_H
+#define GLITCHKERNEL_H
+
+#ifdef ENABLE_GLITCH
+
+/***
+ * Glitch and clock kernels
+ *
+ * Fully unrolled glitch pulses and clock bursts, generated at compile time
+ * for every phase/width (or pulse count) combination and picked at runtime
+ * through a jump table in flash. Every kernel is entered the same way, so
+ * the entry overhead doesn't depend on which one is picked, and there are
+ * no loops inside a kernel to add jitter.
+ */
+
+/// Narrowest glitch, in CPU clocks
+#define GK_WIDTH_MIN	2
+/// Widest glitch, in CPU clocks
+#define GK_WIDTH_MAX	17
+
+/// Longest coarse delay which is exactly linear, in card clocks (~18ms)
+#define GK_COARSE_MAX	65534
+
+/// Clock pulses per unrolled clock block
+#define GK_CLOCKS		16
+
+/**
+ * Wait, then fire a Vcc glitch.
+ *
+ * The glitch starts (offset + constant) CPU clocks after the call. Offsets
+ * up to GK_COARSE_MAX card clocks are exact to the CPU clock; longer ones are
+ * still repeatable, but have a few extra clocks of overhead. Disable
+ * interrupts first.
+ *
+ * @param	offset	Delay before the glitch, in CPU clocks (4 per card clock)
+ * @param	width	Glitch width, GK_WIDTH_MIN to GK_WIDTH_MAX CPU clocks
+ */
+void gkGlitch(const uint32_t offset, const uint8_t width);
+
+/**
+ * Wait for an exact number of CPU clocks (plus a constant).
+ *
+ * Takes the same time as gkGlitch() would to reach the glitch, so a glitch
+ * program run straight after starts at the same point.
+ *
+ * @param	offset	Delay, in CPU clocks
+ */
+void gkDelay(const uint32_t offset);
+
+/**
+ * Pulse the card clock n times (manual clock only).
+ *
+ * Clocks are sent in unrolled blocks of GK_CLOCKS pulses at F_CPU/4, with
+ * the same short gap between every block.
+ *
+ * @param	n	Number of clock pulses
+ */
+void gkClockN(uint16_t n);
+
+#endif // ENABLE_GLITCH
+
+#endif // GLITCHKERNEL_H
@@ -0,0 +1,212 @@
+#include "config.h"
+#include "hardware.h"
+#include "glitchprog.h"
+#include "timebase.h"
+#include "utils.h"
+
+#ifdef ENABLE_GLITCH
+
+/// The uploaded glitch program, always END-terminated
+static uint8_t gGlitchProg[(GP_MAX_OPS + 1) * 2] = { GP_END, 0 };
+
+/// Number of instructions in gGlitchProg, not counting the final END
+static uint8_t gGlitchProgOps = 0;
+
+/// Length of gGlitchProg, CPU clocks
+static uint32_t gGlitchProgClocks = 0;
+
+
+/**
+ * Work out how long a (valid) program takes to run. Must agree with the
+ * table in glitchprog.h, and with cycles() in tools/gpasm.py.
+ *
+ * @return CPU clocks
+ */
+static uint32_t gpCount(const uint8_t *prog, const uint8_t nOps)
+{
+	uint32_t total = 0, body = 0;
+	uint16_t loops = 0;
+	bool inLoop = false;
+
+	for (uint8_t i = 0; (i < nOps) && (prog[i * 2] != GP_END); i++) {
+		uint16_t n = prog[(i * 2) + 1] ? prog[(i * 2) + 1] : 256;
+		uint16_t c;
+
+		switch (prog[i * 2]) {
+			case GP_CLK:	c = (8 * n) + 13; break;
+			case GP_GLP:	c = (3 * n) + 17; break;
+			case GP_WAIT:	c = (3 * n) + 13; break;
+			case GP_WAIT1:	c = (3 * n) + 14; break;
+			case GP_WAIT2:	c = (3 * n) + 15; break;
+			case GP_CKM:
+			case GP_RST:	c = 19; break;
+			case GP_SMP:	c = 18; break;
+			case GP_LOOP:	c = 17; break;
+			default:		c = 16; break;
+		}
+
+		if (prog[i * 2] == GP_MARK) {
+			total += c;
+			loops = n;
+			body = 0;
+			inLoop = true;
+		} else if (prog[i * 2] == GP_LOOP) {
+			total += (body + c) * loops;
+			inLoop = false;
+		} else if (inLoop) {
+			body += c;
+		} else {
+			total += c;
+		}
+	}
+
+	return total;
+}
+
+
+/**
+ * Check a glitch program is safe to run.
+ *
+ * The interpreter doesn't check anything, so bad opcodes and unbalanced
+ * loops have to be caught here.
+ *
+ * @param	prog	Program
+ * @param	nOps	Number of instructions
+ * @return NULL if the program is OK, otherwise an error message.
+ */
+static const __FlashStringHelper *gpValidate(const uint8_t *prog, const uint8_t nOps)
+{
+	bool inLoop = false;
+
+	for (uint8_t i = 0; i < nOps; i++) {
+		switch (prog[i * 2]) {
+			case GP_MARK:
+				if (inLoop) {
+					return F("Loops can't be nested");
+				}
+				inLoop = true;
+				break;
+
+			case GP_LOOP:
+				if (!inLoop) {
+					return F("LOOP without MARK");
+				}
+				inLoop = false;
+				break;
+
+			case GP_END:
+				// Anything after this is never run
+				return inLoop ? F("MARK without LOOP") : NULL;
+
+			default:
+				if (prog[i * 2] >= GP_NOPS) {
+					return F("Bad opcode");
+				}
+				break;
+		}
+	}
+
+	return inLoop ? F("MARK without LOOP") : NULL;
+}
+
+
+uint16_t gpExecute(void)
+{
+	uint8_t tccr1a = TCCR1A;
+	uint16_t samples;
+
+	samples = gpRun(gGlitchProg);
+
+	// Put things back the way they were
+	TCCR1A = tccr1a;
+	GLITCH(0);
+
+	return samples;
+}
+
+
+uint32_t gpClocks(void)
+{
+	return gGlitchProgClocks;
+}
+
+
+/**
+ * Command handler: gprog [load <bytes...> | run | clear]
+ *
+ * With no arguments, shows the uploaded glitch program.
+ *
+ *   load	Upload a program: opcode and argument bytes, in hex.
+ *   		Normally done by tools/gpasm.py.
+ *   run	Run the program once, with interrupts off, and print the
+ *   		I/O samples.
+ *   clear	Delete the program.
+ *
+ * The glitch campaigns run the program in place of a plain glitch pulse
+ * when given a glitch width of -1.
+ */
+void handle_gprog(String *cmdline)
+{
+	String sub;
+
+	if (!popWord(cmdline, &sub)) {
+		Serial.print(gGlitchProgOps);
+		Serial.print(F(" ops: "));
+		printHexBuf(gGlitchProg, gGlitchProgOps * 2);
+		Serial.println();
+
+	} else if (sub.equals(F("load"))) {
+		uint8_t buf[GP_MAX_OPS * 2];
+		const __FlashStringHelper *err;
+		int n = popHexBytes(cmdline, buf, sizeof(buf));
+
+		if ((n <= 0) || (n & 1)) {
+			Serial.println(F("**ERROR: Program must be 1 to 48 opcode/argument pairs"));
+			return;
+		}
+
+		err = gpValidate(buf, n / 2);
+		if (err != NULL) {
+			Serial.print(F("**ERROR: "));
+			Serial.println(err);
+			return;
+		}
+
+		memcpy(gGlitchProg, buf, n);
+		gGlitchProg[n] = GP_END;
+		gGlitchProg[n + 1] = 0;
+		gGlitchProgOps = n / 2;
+		gGlitchProgClocks = gpCount(gGlitchProg, gGlitchProgOps);
+
+		Serial.print(F("Loaded "));
+		Serial.print(gGlitchProgOps);
+		Serial.println(F(" ops"));
+
+	} else if (sub.equals(F("run"))) {
+		uint16_t samples;
+		uint32_t t;
+
+		noInterrupts();
+		t = tbNow();
+		samples = gpExecute();
+		tbCatchUp(t, gpClocks() / 4);
+		interrupts();
+
+		Serial.print(F("Samples: "));
+		for (int8_t i = 15; i >= 0; i--) {
+			Serial.print((samples >> i) & 1);
+		}
+		Serial.println();
+
+	} else if (sub.equals(F("clear"))) {
+		gGlitchProg[0] = GP_END;
+		gGlitchProgOps = 0;
+		gGlitchProgClocks = 0;
+		Serial.println(F("Cleared"));
+
+	} else {
+		Serial.println(F("**ERROR: Syntax = gprog [load <bytes...> | run | clear]"));
+	}
+}
+
+#endif // ENABLE_GLITCH
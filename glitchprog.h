@@ -0,0 +1,94 @@
+#ifndef GLITCHPROG_H
+#define GLITCHPROG_H
+
+/***
+ * Glitch programs
+ *
+ * A glitch program is a list of two-byte instructions (opcode, argument)
+ * uploaded by the host and run from RAM by a hand-written interpreter
+ * (glitchprog.S). Every instruction takes a fixed number of CPU clocks, so
+ * a waveform can be changed without reflashing and without losing
+ * cycle-exact timing.
+ *
+ * Cycle costs are CPU clocks from the start of the instruction to the start
+ * of the next one, including the 14 clocks of fetch and dispatch. A count
+ * argument of zero means 256.
+ *
+ *   Op		Arg		CPU clocks	Description
+ *   END	-		-			Stop
+ *   CLK	n		8n+13		n card clock pulses (manual clock, F_CPU/8)
+ *   CKM	m		19			Clock mode: 0=manual, 1=free-running (Timer1)
+ *   GLH	-		16			Glitch pin high
+ *   GLL	-		16			Glitch pin low
+ *   GLP	n		3n+17		Glitch pulse, high for 3n+1 CPU clocks
+ *   WAIT	n		3n+13		Delay
+ *   WAIT1	n		3n+14		Delay
+ *   WAIT2	n		3n+15		Delay
+ *   TRIG	-		16			Toggle the scope trigger pin
+ *   SMP	-		18			Shift the card I/O pin into the sample register
+ *   MARK	n		16			Start a loop which runs n times
+ *   LOOP	-		17			End of loop
+ *   RST	b		19			Card reset pin: 0=reset, 1=run
+ *
+ * Loops can't be nested. tools/gpasm.py assembles and checks programs and
+ * works out their timelines.
+ */
+
+// Opcodes. The order must match the jump table in glitchprog.S.
+#define GP_END		0
+#define GP_CLK		1
+#define GP_CKM		2
+#define GP_GLH		3
+#define GP_GLL		4
+#define GP_GLP		5
+#define GP_WAIT		6
+#define GP_WAIT1	7
+#define GP_WAIT2	8
+#define GP_TRIG		9
+#define GP_SMP		10
+#define GP_MARK		11
+#define GP_LOOP		12
+#define GP_RST		13
+#define GP_NOPS		14
+
+/// Maximum program length, in instructions (not counting the final END)
+#define GP_MAX_OPS	48
+
+#if defined(ENABLE_GLITCH) && !defined(__ASSEMBLER__)
+
+#include <Arduino.h>
+
+/**
+ * Run a glitch program (glitchprog.S).
+ *
+ * The program must have been checked by gpValidate(). Disable interrupts
+ * first if the timing matters.
+ *
+ * @return The last 16 I/O samples taken by SMP, most recent in bit 0.
+ */
+extern "C" uint16_t gpRun(const uint8_t *prog);
+
+/**
+ * Run the uploaded glitch program.
+ *
+ * The card clock mode is restored and the glitch pin is turned off
+ * afterwards, whatever the program did.
+ *
+ * @return I/O samples (see gpRun())
+ */
+uint16_t gpExecute(void);
+
+/**
+ * Length of the uploaded program, in CPU clocks, as worked out from the
+ * cycle costs above.
+ */
+uint32_t gpClocks(void);
+
+/**
+ * Command handler: gprog [load <bytes...> | run | clear]
+ */
+void handle_gprog(String *cmdline);
+
+#endif // ENABLE_GLITCH && !__ASSEMBLER__
+
+#endif // GLITCHPROG_H
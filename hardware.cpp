@@ -4,6 +4,7 @@
 
 #include <Arduino.h>
 #include "hardware.h"
+#include "timebase.h"
 
 
 void glitcherInit() {
@@ -36,23 +37,18 @@ void scReset(bool val)
 {
 	if (val) {
 		// Put card in reset
-		digitalWrite(CARD_RESET_PIN, LOW);
+		SCRST(0);
 	} else {
 		// Release card from reset
-		digitalWrite(CARD_RESET_PIN, HIGH);
+		SCRST(1);
+		tbEvent(TB_EV_RESET, tbNow());
 	}
 }
 
 
 void scPower(bool val)
 {
-	if (val) {
-		// vcc on
-		digitalWrite(CARD_NVCCEN_PIN, LOW);
-	} else {
-		// vcc off
-		digitalWrite(CARD_NVCCEN_PIN, HIGH);
-	}
+	SCVCC(val);
 }
 
 
@@ -77,11 +73,11 @@ void scClockFreerun(bool on)
 		TCCR1A = _BV(COM1A1) | _BV(WGM11);
 		TCCR1B = _BV(CS10)   | _BV(WGM13) | _BV(WGM12);
 	} else {
-		// Wait for the card clock to go low
-		while (digitalRead(CARD_CLKOUT_PIN) == HIGH) {} ;
+		// Disconnect the PWM first. The pin goes straight to its PORTB
+		// state (low), so there's no need to wait for the clock to go low.
+		TCCR1A = 0;
 
 		// Timer off
-		TCCR1A = 0;
 		TCCR1B = 0;
 	}
 }
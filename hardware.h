@@ -1,7 +1,12 @@
 #ifndef HARDWARE_H
 #define HARDWARE_H
 
+// The pin definitions are also used by the assembler sources (glitchprog.S)
+#ifndef __ASSEMBLER__
 #include <Arduino.h>
+#include <util/delay_basic.h>
+#include "timebase.h"
+#endif
 
 // Card data receive
 #define CARD_DATA_RX_PIN		2
@@ -15,6 +20,8 @@
 
 // Card reset, 0=reset, 1=run
 #define CARD_RESET_PIN			4
+#define CARD_RESET_PORT			PORTD
+#define CARD_RESET_BIT			4
 
 // Card clock is assigned to OC1A (timer 1 PWM) so we have full control over card clocking
 // including switching this pin to I/O mode (PB1) and clocking manually
@@ -33,11 +40,15 @@
 
 // Test point on PD7, used for triggering an oscilloscope
 #define SCOPE_TRIGGER_PIN		7
+#define SCOPE_TRIGGER_TPORT		PIND
+#define SCOPE_TRIGGER_BIT		7
 
 // -- analog pins = 14 + A-number
 
 // CVCCEN (Card VCC Enable) is PC2, 0=on
 #define CARD_NVCCEN_PIN			A2
+#define CARD_NVCCEN_PORT		PORTC
+#define CARD_NVCCEN_BIT			2
 
 // CVCCGLITCH (Card VCC Glitch) is PC3, 1=glitch
 #define CARD_VCCGLITCH_PIN		A3
@@ -45,6 +56,10 @@
 #define CARD_VCCGLITCH_TPORT	PINC
 #define CARD_VCCGLITCH_BIT		3
 
+// Card current sense (shunt amplifier output) is ADC0 / PC0
+#define CARD_ISENSE_PIN			A0
+#define CARD_ISENSE_ADC			0
+
 
 // Smartcard RX/TX are on I/O 2 and 3 respectively
 // FIXME: 
@@ -52,6 +67,8 @@
 //SoftwareSerial cardSer(2,3);  // RX, TX
 
 
+#ifndef __ASSEMBLER__
+
 /***
  * Macros
  */
@@ -65,6 +82,12 @@
 /// Set data-out pin state
 #define SCDATA(x)	{ if (x) {CARD_DATA_TX_WPORT |= (1<<CARD_DATA_TX_BIT);} else {CARD_DATA_TX_WPORT &= ~(1<<CARD_DATA_TX_BIT);} }
 
+/// Set card Vcc state, 0=off, 1=on
+#define SCVCC(x)	{ if (x) {CARD_NVCCEN_PORT &= ~(1<<CARD_NVCCEN_BIT);} else {CARD_NVCCEN_PORT |= (1<<CARD_NVCCEN_BIT);} }
+
+/// Set reset pin state, 0=reset, 1=run
+#define SCRST(x)	{ if (x) {CARD_RESET_PORT |= (1<<CARD_RESET_BIT);} else {CARD_RESET_PORT &= ~(1<<CARD_RESET_BIT);} }
+
 
 
 
@@ -87,32 +110,23 @@
 #define CLKP8()		{ CLKP4(); CLKP4(); }
 
 
-inline static void scClockN(const int n)
+/**
+ * Busy-wait for a number of card clocks (free-running clock only).
+ *
+ * The card clock is the CPU clock divided by 4, and _delay_loop_2() takes
+ * 4 CPU clocks per iteration, so this waits one card clock per iteration
+ * plus a fixed overhead. Disable interrupts if the delay must be repeatable.
+ */
+inline static void scDelayClocks(uint32_t n)
 {
-	byte i = n >> 3;
-	byte j = n & 0x07;
-
-	// do blocks of 8
-	while (i--) {
-		CLKP8();
+	while (n > 0xFFFF) {
+		_delay_loop_2(0xFFFF);
+		n -= 0xFFFF;
 	}
 
-	// do individual pulses
-#if 0
-	asm ( \
-		"top: \n"
-		"sbi %[cktport], %[ckbit] \n"
-		"sbi %[cktport], %[ckbit] \n"
-		"subi %[j], 1 \n"
-		"brne top \n"
-		: : [j] "=r" (j), [cktport] "I" (_SFR_IO_ADDR(CARD_CLKOUT_TPORT)), [ckbit] "I" (CARD_CLKOUT_BIT)
-	);
-#else
-	while (j--) {
-		CLKP1();
+	if (n > 0) {
+		_delay_loop_2(n);
 	}
-#endif
-
 }
 
 /**
@@ -120,6 +134,7 @@ inline static void scClockN(const int n)
  */
 inline static void triggerPulse(void)
 {
+	tbEvent(TB_EV_TRIGGER, tbNow());
 	digitalWrite(SCOPE_TRIGGER_PIN, HIGH);
 	digitalWrite(SCOPE_TRIGGER_PIN, HIGH);
 	digitalWrite(SCOPE_TRIGGER_PIN, LOW);
@@ -164,4 +179,6 @@ void scClockFreerun(bool on);
  */
 void glitcherInit();
 
+#endif // __ASSEMBLER__
+
 #endif // HARDWARE_H
@@ -0,0 +1,77 @@
+#include <Arduino.h>
+#include "hostlink.h"
+
+
+// Send binary result frames from the scanners
+bool gBinaryFrames = false;
+
+// Running checksum of the frame being sent
+static uint8_t gFrameSum;
+
+
+void hostFrameBegin(const uint8_t type, const uint16_t len)
+{
+	Serial.write(FRAME_SOF);
+
+	gFrameSum = 0;
+	hostFrameWriteByte(type);
+	hostFrameWriteU16(len);
+}
+
+void hostFrameWrite(const void *buf, const uint16_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+
+	for (uint16_t i = 0; i < len; i++) {
+		hostFrameWriteByte(p[i]);
+	}
+}
+
+void hostFrameWriteByte(const uint8_t val)
+{
+	gFrameSum += val;
+	Serial.write(val);
+}
+
+void hostFrameWriteU16(const uint16_t val)
+{
+	hostFrameWriteByte(val & 0xFF);
+	hostFrameWriteByte(val >> 8);
+}
+
+void hostFrameWriteU32(const uint32_t val)
+{
+	hostFrameWriteU16(val & 0xFFFF);
+	hostFrameWriteU16(val >> 16);
+}
+
+void hostFrameEnd(void)
+{
+	Serial.write((uint8_t)(-gFrameSum));
+}
+
+void hostFrameApdu(const uint8_t *hdr, const uint16_t sw, const uint8_t procByte, const APDU_TIMING *timing)
+{
+	uint8_t nTimes = 0;
+
+	if (timing->rxTimes != NULL) {
+		uint16_t n = min(timing->nChars, timing->rxTimesMax);
+		nTimes = min(n, 255);
+	}
+
+	hostFrameBegin(FRAME_APDU, 27 + (nTimes * 2));
+	hostFrameWrite(hdr, 5);
+	hostFrameWriteU16(sw);
+	hostFrameWriteByte(procByte);
+	hostFrameWriteU32(timing->tProc);
+	hostFrameWriteU32(timing->tLastData);
+	hostFrameWriteU32(timing->tSw1);
+	hostFrameWriteU16(timing->gapMax);
+	hostFrameWriteU16(timing->gapMaxIdx);
+	hostFrameWriteU16(timing->nChars);
+	hostFrameWriteByte(nTimes);
+	for (uint8_t i = 0; i < nTimes; i++) {
+		hostFrameWriteU16(timing->rxTimes[i]);
+	}
+	hostFrameEnd();
+}
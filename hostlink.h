@@ -0,0 +1,80 @@
+#ifndef HOSTLINK_H
+#define HOSTLINK_H
+
+#include <Arduino.h>
+#include "smartcard.h"
+
+/***
+ * Binary frames to the host
+ *
+ * Bulk data (traces, captures) is sent to the host as binary frames mixed in
+ * with the normal text output. The console text is always 7-bit ASCII, so the
+ * host can find the start of a frame by looking for a byte with bit 7 set.
+ *
+ *   SOF  TYPE  LEN_L  LEN_H  PAYLOAD[LEN]  CHK
+ *
+ * CHK is chosen so the sum of TYPE through CHK is zero (mod 256).
+ * Multi-byte values in the payload are little endian.
+ *
+ * tools/glitcher.py contains the host side of this.
+ */
+
+/// Start-of-frame marker
+#define FRAME_SOF			0xA5
+
+// Frame types
+#define FRAME_PTRACE		0x01	///< Averaged power trace
+#define FRAME_TSCAN			0x02	///< Timing scan per-candidate statistics
+#define FRAME_APDU			0x03	///< APDU result with timing
+#define FRAME_GATR			0x04	///< Glitch-during-ATR deviation
+#define FRAME_GREAD_DATA	0x05	///< Glitched read response data (streamed)
+#define FRAME_GREAD			0x06	///< Glitched read response result
+#define FRAME_DIFF			0x07	///< Differential execution step result
+#define FRAME_SESSION		0x08	///< Recorded session events
+#define FRAME_BENCH			0x09	///< Benchmark result
+#define FRAME_BENCH_DATA	0x0A	///< Host link benchmark filler
+#define FRAME_STATS			0x0B	///< Runtime statistics counters
+#define FRAME_CSCRIPT		0x0C	///< Card script result (EMIT)
+#define FRAME_VCSEED		0x0D	///< VideoCrypt decoder emulation seed
+
+/// Send binary result frames from the scanners as well as text ('binary' command)
+extern bool gBinaryFrames;
+
+
+/**
+ * Start a binary frame.
+ *
+ * @param	type	Frame type (FRAME_xxx)
+ * @param	len		Payload length. Exactly this many bytes must be written
+ * 					before calling hostFrameEnd().
+ */
+void hostFrameBegin(const uint8_t type, const uint16_t len);
+
+/// Write payload bytes to the current frame
+void hostFrameWrite(const void *buf, const uint16_t len);
+
+/// Write one payload byte to the current frame
+void hostFrameWriteByte(const uint8_t val);
+
+/// Write a 16-bit payload value to the current frame
+void hostFrameWriteU16(const uint16_t val);
+
+/// Write a 32-bit payload value to the current frame
+void hostFrameWriteU32(const uint32_t val);
+
+/// Finish the current frame (sends the checksum)
+void hostFrameEnd(void);
+
+/**
+ * Send an APDU result as a FRAME_APDU frame.
+ *
+ *   u8 cla, u8 ins, u8 p1, u8 p2, u8 len, u16 sw, u8 proc,
+ *   u32 tProc, u32 tLastData, u32 tSw1, u16 gapMax, u16 gapMaxIdx,
+ *   u16 nChars, u8 nTimes, u16 rxTimes[nTimes]
+ *
+ * @param	hdr		APDU header (CLA, INS, P1, P2, LEN)
+ * @param	timing	Timing from cardSendApdu(). rxTimes may be NULL.
+ */
+void hostFrameApdu(const uint8_t *hdr, const uint16_t sw, const uint8_t procByte, const APDU_TIMING *timing);
+
+#endif // HOSTLINK_H
@@ -0,0 +1,215 @@
+// gotta go fast!
+#pragma GCC optimize ("-O3")
+
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "hostlink.h"
+#include "utils.h"
+
+#ifdef ENABLE_POWERTRACE
+
+/**
+ * Maximum number of samples per trace.
+ *
+ * The averaging buffer is 16 bits per sample and lives on the stack next to
+ * the APDU buffers -- 256 samples is 512 bytes.
+ */
+#define PT_MAX_SAMPLES		256
+
+/**
+ * Maximum number of traces to average. Samples are 8 bits, so this is the
+ * most which will fit in a 16-bit accumulator.
+ */
+#define PT_MAX_TRACES		256
+
+/// Maximum APDU data length for 'ptrace apdu'
+#define PT_MAX_DATA			32
+
+/**
+ * ADC clock prescaler.
+ *
+ * The ADC and the card clock are both derived from the CPU clock, so the
+ * sample clock is phase-locked to the card clock.
+ *
+ * ADPS=100 -> CPU/16. A conversion is 13 ADC clocks = 208 CPU clocks,
+ * which is 52 card clocks per sample (68.8kHz).
+ */
+#define PT_ADPS				(_BV(ADPS2))
+#define PT_CLOCKS_PER_SAMPLE	52
+
+// Trace synchronisation modes
+typedef enum {
+	PTM_ATR,		// Delay counts from the card being released from reset
+	PTM_APDU,		// Delay counts from the last byte of the command
+} PT_MODE;
+
+
+/**
+ * Capture one trace and add it to the accumulator.
+ *
+ * Must be called with interrupts disabled.
+ */
+static void ptCapture(uint16_t *acc, const uint16_t nSamples)
+{
+	// Restart the ADC so the first conversion starts here.
+	// ADATE with ADTS=000 is free-running mode.
+	ADCSRA = 0;
+	ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | PT_ADPS;
+
+	// The first conversion after enabling the ADC takes 25 ADC clocks instead
+	// of 13, so the sample spacing is off. Throw it away.
+	while (!(ADCSRA & _BV(ADIF))) {}
+	ADCSRA |= _BV(ADIF);
+
+	for (uint16_t i = 0; i < nSamples; i++) {
+		while (!(ADCSRA & _BV(ADIF))) {}
+		ADCSRA |= _BV(ADIF);
+		acc[i] += ADCH;
+	}
+
+	// ADC off
+	ADCSRA = 0;
+}
+
+
+/**
+ * Command handler: ptrace atr <traces> <delay> <samples>
+ *                  ptrace apdu <traces> <delay> <samples> <cla> <ins> <p1> <p2> <len> [data...]
+ *
+ * Capture and average power traces from the current sense input.
+ *
+ * The card is cold-reset before every trace. In 'atr' mode, capture starts
+ * <delay> card clocks after the card is released from reset. In 'apdu' mode,
+ * the card is sent the ATR and then the command; capture starts <delay> card
+ * clocks after the last byte of the command (header, or data if any was
+ * given). The card's response is ignored.
+ *
+ * Traces, delay and sample count are decimal, the APDU is hex. The averaged
+ * trace is sent to the host as a FRAME_PTRACE binary frame:
+ *
+ *   u8 mode, u16 traces, u32 delay, u16 clocks per sample, u16 samples,
+ *   u16 sample[samples]  -- average in 8.8 fixed point
+ *
+ * The oscilloscope trigger fires as each capture starts.
+ */
+void handle_ptrace(String *cmdline)
+{
+	uint16_t acc[PT_MAX_SAMPLES];
+	uint8_t data[PT_MAX_DATA];
+	uint8_t atrbuf[32];
+	String word;
+	PT_MODE mode;
+	long nTraces, delayClocks, nSamples;
+	long cla = 0, ins = 0, p1 = 0, p2 = 0, len = 0;
+	int dataLen = 0;
+	uint16_t nRejected = 0;
+
+	if (!popWord(cmdline, &word) ||
+			!popArg(cmdline, &nTraces, 10) || !popArg(cmdline, &delayClocks, 10) || !popArg(cmdline, &nSamples, 10)) {
+		Serial.println(F("**ERROR: Syntax = ptrace atr|apdu <traces> <delay> <samples> [<cla> <ins> <p1> <p2> <len> [data...]]"));
+		return;
+	}
+
+	if (word.equals("atr")) {
+		mode = PTM_ATR;
+	} else if (word.equals("apdu")) {
+		mode = PTM_APDU;
+		if (!popArg(cmdline, &cla) || !popArg(cmdline, &ins) || !popArg(cmdline, &p1) ||
+				!popArg(cmdline, &p2) || !popArg(cmdline, &len)) {
+			Serial.println(F("**ERROR: apdu mode needs <cla> <ins> <p1> <p2> <len>"));
+			return;
+		}
+		dataLen = popHexBytes(cmdline, data, sizeof(data));
+		if ((dataLen < 0) || ((dataLen > 0) && (dataLen != len))) {
+			Serial.println(F("**ERROR: data length must match <len>, max 32 bytes"));
+			return;
+		}
+	} else {
+		Serial.print(F("**ERROR: Unknown capture mode '"));
+		Serial.print(word);
+		Serial.println('\'');
+		return;
+	}
+
+	if ((nTraces < 1) || (nTraces > PT_MAX_TRACES) || (nSamples < 1) || (nSamples > PT_MAX_SAMPLES)) {
+		Serial.println(F("**ERROR: traces must be 1..256, samples 1..256"));
+		return;
+	}
+
+	memset(acc, 0, sizeof(acc));
+
+	// ADC reference = AVcc, left-adjusted (8-bit) result, current sense channel
+	ADMUX  = _BV(REFS0) | _BV(ADLAR) | CARD_ISENSE_ADC;
+	ADCSRB = 0;
+	DIDR0 |= _BV(CARD_ISENSE_ADC);
+
+	for (long t = 0; t < nTraces; t++) {
+		if (mode == PTM_ATR) {
+			cardColdReset(true);
+
+			noInterrupts();
+			SCRST(1);
+			scDelayClocks(delayClocks);
+			triggerPulse();
+			ptCapture(acc, nSamples);
+			interrupts();
+		} else {
+			cardColdReset();
+			if (cardGetAtr(atrbuf, true, gResetTiming.atrTimeout) == 0) {
+				Serial.println(F("**ERROR: No ATR"));
+				cardPower(0);
+				return;
+			}
+			cardProfileRestore();
+
+			if (!cardSendCommand(cla, ins, p1, p2, len, (dataLen > 0) ? data : NULL)) {
+				// Card refused the command -- the trace would be garbage
+				nRejected++;
+				t--;
+				if (nRejected > nTraces) {
+					Serial.println(F("**ERROR: Card keeps refusing the command"));
+					cardPower(0);
+					return;
+				}
+				continue;
+			}
+
+			noInterrupts();
+			scDelayClocks(delayClocks);
+			triggerPulse();
+			ptCapture(acc, nSamples);
+			interrupts();
+		}
+	}
+
+	cardPower(0);
+
+	// Send the averaged trace in 8.8 fixed point
+	hostFrameBegin(FRAME_PTRACE, 11 + (nSamples * 2));
+	hostFrameWriteByte(mode);
+	hostFrameWriteU16(nTraces);
+	hostFrameWriteU32(delayClocks);
+	hostFrameWriteU16(PT_CLOCKS_PER_SAMPLE);
+	hostFrameWriteU16(nSamples);
+	for (uint16_t i = 0; i < nSamples; i++) {
+		hostFrameWriteU16(((uint32_t)acc[i] << 8) / nTraces);
+	}
+	hostFrameEnd();
+
+	Serial.println();
+	Serial.print(F("Captured "));
+	Serial.print(nTraces);
+	Serial.print(F(" traces of "));
+	Serial.print(nSamples);
+	Serial.print(F(" samples"));
+	if (nRejected > 0) {
+		Serial.print(F(", "));
+		Serial.print(nRejected);
+		Serial.print(F(" rejected"));
+	}
+	Serial.println('.');
+}
+
+#endif // ENABLE_POWERTRACE
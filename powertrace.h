@@ -0,0 +1,10 @@
+#ifndef POWERTRACE_H
+#define POWERTRACE_H
+
+#ifdef ENABLE_POWERTRACE
+
+void handle_ptrace(String *cmdline);
+
+#endif // ENABLE_POWERTRACE
+
+#endif // POWERTRACE_H
@@ -0,0 +1,234 @@
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "timebase.h"
+#include "utils.h"
+
+/// Golden resets used to learn the ATR and its latency
+#define RL_GOLDEN_RUNS		4
+
+/// Default number of good resets needed to accept a timing
+#define RL_CHECKS			8
+
+/// Shortest Vcc off time tried, microseconds
+#define RL_OFF_MIN			50
+
+/// Search resolution for the Vcc off time (us) and reset hold (clocks)
+#define RL_OFF_STEP			50
+#define RL_HOLD_STEP		50
+
+
+// Golden ATR and reset-to-ATR latency, from the default timing
+typedef struct {
+	uint8_t atr[32];
+	uint8_t len;
+	uint32_t latMin;		///< Shortest reset release to TS time, card clocks
+	uint32_t latMax;		///< Longest reset release to TS time, card clocks
+	uint32_t tolerance;		///< Allowed latency difference, card clocks
+} RL_GOLDEN;
+
+
+/**
+ * Cold-reset the card with gResetTiming and read the ATR.
+ *
+ * @param[out]	latency		Reset release to TS, card clocks
+ * @return ATR length (0 if none)
+ */
+static uint8_t rlReset(uint8_t *atrbuf, uint32_t *latency)
+{
+	ATR_TIMING timing;
+	uint32_t tRelease;
+	uint8_t len;
+
+	cardColdReset(true);
+	tRelease = tbNow();
+	SCRST(1);
+
+	len = cardGetAtr(atrbuf, true, gResetTiming.atrTimeout, &timing);
+	*latency = timing.tFirst - tRelease;
+
+	return len;
+}
+
+
+/**
+ * Check the card resets properly with the current gResetTiming: the same ATR
+ * as the golden one, with the same latency, every time.
+ */
+static bool rlCheck(const RL_GOLDEN *golden, const uint8_t checks)
+{
+	uint8_t atrbuf[32];
+	uint32_t latency;
+
+	for (uint8_t i = 0; i < checks; i++) {
+		uint8_t len = rlReset(atrbuf, &latency);
+
+		if ((len != golden->len) || (memcmp(atrbuf, golden->atr, len) != 0)) {
+			return false;
+		}
+		if ((latency + golden->tolerance < golden->latMin) || (latency > golden->latMax + golden->tolerance)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void handle_rlearn(String *cmdline)
+{
+	const CARD_RESET_TIMING safe = CARD_RESET_TIMING_DEFAULT;
+	RL_GOLDEN golden;
+	uint32_t latency;
+	long checks = RL_CHECKS;
+	uint16_t lo, hi;
+
+	popArg(cmdline, &checks, 10);
+	if ((checks < 1) || (checks > 255)) {
+		Serial.println(F("**ERROR: Syntax = rlearn [<checks>]"));
+		return;
+	}
+
+	// Golden ATR and latency, with the safe timing
+	gResetTiming = safe;
+	golden.latMin = 0xFFFFFFFF;
+	golden.latMax = 0;
+	for (uint8_t i = 0; i < RL_GOLDEN_RUNS; i++) {
+		golden.len = rlReset(golden.atr, &latency);
+		if (golden.len == 0) {
+			Serial.println(F("**ERROR: No ATR"));
+			cardPower(0);
+			return;
+		}
+		golden.latMin = min(golden.latMin, latency);
+		golden.latMax = max(golden.latMax, latency);
+	}
+	golden.tolerance = (golden.latMax - golden.latMin) + (2 * cardGetAtrEtu());
+
+	// ATR timeout: 25% over the longest latency, plus 2ms
+	gResetTiming.atrTimeout = ((golden.latMax + (golden.latMax / 4)) / (CARD_CLOCK_HZ / 1000)) + 2;
+
+	Serial.print(F("ATR latency "));
+	Serial.print(golden.latMin);
+	Serial.print(F("-"));
+	Serial.print(golden.latMax);
+	Serial.print(F(" clocks, timeout "));
+	Serial.print(gResetTiming.atrTimeout);
+	Serial.println(F("ms"));
+
+	// Shortest Vcc off time which still gives a clean cold reset
+	lo = RL_OFF_MIN;
+	hi = safe.offTime;
+	gResetTiming.offTime = lo;
+	if (rlCheck(&golden, checks)) {
+		hi = lo;
+	}
+	while ((hi - lo) > RL_OFF_STEP) {
+		gResetTiming.offTime = lo + ((hi - lo) / 2);
+		if (rlCheck(&golden, checks)) {
+			hi = gResetTiming.offTime;
+		} else {
+			lo = gResetTiming.offTime;
+		}
+	}
+	// 25% margin
+	gResetTiming.offTime = min(hi + (hi / 4), safe.offTime);
+
+	Serial.print(F("Vcc off time "));
+	Serial.print(gResetTiming.offTime);
+	Serial.println(F("us"));
+
+	// Shortest reset hold
+	lo = 0;
+	hi = safe.holdClocks;
+	gResetTiming.holdClocks = lo;
+	if (rlCheck(&golden, checks)) {
+		hi = lo;
+	}
+	while ((hi - lo) > RL_HOLD_STEP) {
+		gResetTiming.holdClocks = lo + ((hi - lo) / 2);
+		if (rlCheck(&golden, checks)) {
+			hi = gResetTiming.holdClocks;
+		} else {
+			lo = gResetTiming.holdClocks;
+		}
+	}
+	gResetTiming.holdClocks = min(hi + (hi / 4), safe.holdClocks);
+
+	Serial.print(F("Reset hold "));
+	Serial.print(gResetTiming.holdClocks);
+	Serial.println(F(" clocks"));
+
+	// Final check, everything together
+	if (!rlCheck(&golden, checks)) {
+		Serial.println(F("**ERROR: Learned timing failed its final check, back to the safe timing"));
+		gResetTiming = safe;
+	}
+
+	cardPower(0);
+}
+
+
+void handle_rbench(String *cmdline)
+{
+	uint8_t atrbuf[32], atr0[32];
+	uint8_t len, len0 = 0;
+	uint32_t latency;
+	long resets = 50;
+	bool useDefault = false;
+	uint16_t nFail = 0;
+	String word;
+
+	while (popWord(cmdline, &word)) {
+		if (word.equals(F("default"))) {
+			useDefault = true;
+		} else {
+			resets = word.toInt();
+		}
+	}
+	if (resets < 1) {
+		Serial.println(F("**ERROR: Syntax = rbench [<resets>] [default]"));
+		return;
+	}
+
+	unsigned long tStart = millis();
+
+	for (long i = 0; i < resets; i++) {
+		if (useDefault) {
+			// The normal power-up path
+			cardPower(0);
+			cardPower(1);
+			len = cardGetAtr(atrbuf, true);
+		} else {
+			len = rlReset(atrbuf, &latency);
+		}
+
+		if (i == 0) {
+			memcpy(atr0, atrbuf, len);
+			len0 = len;
+		}
+		if ((len == 0) || (len != len0) || (memcmp(atrbuf, atr0, len) != 0)) {
+			nFail++;
+		}
+	}
+
+	unsigned long elapsed = millis() - tStart;
+	cardPower(0);
+
+	Serial.print(resets);
+	Serial.print(F(" resets in "));
+	Serial.print(elapsed);
+	Serial.print(F("ms = "));
+	Serial.print((resets * 1000.0) / max(elapsed, 1UL), 1);
+	Serial.print(F(" resets/sec, "));
+	Serial.print(nFail);
+	Serial.println(F(" bad ATRs"));
+
+	Serial.print(F("Timing: off "));
+	Serial.print(useDefault ? 12000 : gResetTiming.offTime);
+	Serial.print(F("us, hold "));
+	Serial.print(useDefault ? 0 : gResetTiming.holdClocks);
+	Serial.print(F(" clocks, ATR timeout "));
+	Serial.print(useDefault ? ATR_TIMEOUT_MS : gResetTiming.atrTimeout);
+	Serial.println(F("ms"));
+}
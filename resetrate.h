@@ -0,0 +1,20 @@
+#ifndef RESETRATE_H
+#define RESETRATE_H
+
+/**
+ * Command handler: rlearn [<checks>]
+ *
+ * Learn the fastest safe cold reset timing for the card (gResetTiming).
+ * The next ATR applies the card's profile, which resets the timing: keep it
+ * with 'profile save'.
+ */
+void handle_rlearn(String *cmdline);
+
+/**
+ * Command handler: rbench [<resets>] [default]
+ *
+ * Benchmark the cold reset rate.
+ */
+void handle_rbench(String *cmdline);
+
+#endif // RESETRATE_H
@@ -0,0 +1,193 @@
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include "config.h"
+#include "scancache.h"
+#include "utils.h"
+
+
+// Cache header, kept in RAM and written back whenever it changes
+typedef struct {
+	uint16_t atrHash;		///< CRC16 of the ATR
+	uint8_t count;			///< Number of entries
+	uint8_t reserved;
+	uint8_t claDone[32];	///< Bitmap of the classes which have been scanned
+} SCACHE_HEADER;
+
+/// Maximum number of entries
+#define SCACHE_MAX_ENTRIES	((SCACHE_EE_SIZE - sizeof(SCACHE_HEADER)) / sizeof(SCACHE_ENTRY))
+
+#define SCACHE_ENTRY_ADDR(n)	(SCACHE_EE_BASE + sizeof(SCACHE_HEADER) + ((n) * sizeof(SCACHE_ENTRY)))
+
+static SCACHE_HEADER gCache;
+
+
+static void headerWrite(void)
+{
+	// EEPROM.put() only writes the bytes which have changed
+	EEPROM.put(SCACHE_EE_BASE, gCache);
+}
+
+
+bool scacheOpen(const uint8_t *atr, const uint8_t len)
+{
+	uint16_t hash = 0xFFFF;
+
+	for (uint8_t i = 0; i < len; i++) {
+		hash = _crc16_update(hash, atr[i]);
+	}
+
+	EEPROM.get(SCACHE_EE_BASE, gCache);
+	if ((gCache.atrHash == hash) && (gCache.count <= SCACHE_MAX_ENTRIES)) {
+		return true;
+	}
+
+	memset(&gCache, 0, sizeof(gCache));
+	gCache.atrHash = hash;
+	return false;
+}
+
+
+uint8_t scacheCount(void)
+{
+	return gCache.count;
+}
+
+
+void scacheGet(const uint8_t idx, SCACHE_ENTRY *e)
+{
+	EEPROM.get(SCACHE_ENTRY_ADDR(idx), *e);
+}
+
+
+/**
+ * Find the index of a cached entry, or scacheCount() if it isn't cached.
+ */
+static uint8_t findEntry(const uint8_t cla, const uint8_t ins, SCACHE_ENTRY *e)
+{
+	uint8_t i;
+
+	for (i = 0; i < gCache.count; i++) {
+		scacheGet(i, e);
+		if ((e->cla == cla) && (e->ins == ins)) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+
+bool scacheFind(const uint8_t cla, const uint8_t ins, SCACHE_ENTRY *e)
+{
+	return findEntry(cla, ins, e) < gCache.count;
+}
+
+
+bool scacheAdd(const SCACHE_ENTRY *e)
+{
+	SCACHE_ENTRY old;
+	uint8_t i = findEntry(e->cla, e->ins, &old);
+
+	if (i == gCache.count) {
+		if (gCache.count >= SCACHE_MAX_ENTRIES) {
+			return false;
+		}
+		gCache.count++;
+		headerWrite();
+	}
+
+	EEPROM.put(SCACHE_ENTRY_ADDR(i), *e);
+	return true;
+}
+
+
+bool scacheClaDone(const uint8_t cla)
+{
+	return (gCache.claDone[cla >> 3] & _BV(cla & 7)) != 0;
+}
+
+
+void scacheSetClaDone(const uint8_t cla)
+{
+	gCache.claDone[cla >> 3] |= _BV(cla & 7);
+	headerWrite();
+}
+
+
+void scacheForgetCla(const uint8_t cla)
+{
+	SCACHE_ENTRY e;
+	uint8_t i = 0;
+
+	// Fill the holes from the end of the list
+	while (i < gCache.count) {
+		scacheGet(i, &e);
+		if (e.cla == cla) {
+			gCache.count--;
+			scacheGet(gCache.count, &e);
+			EEPROM.put(SCACHE_ENTRY_ADDR(i), e);
+		} else {
+			i++;
+		}
+	}
+
+	gCache.claDone[cla >> 3] &= ~_BV(cla & 7);
+	headerWrite();
+}
+
+
+void handle_scache(String *cmdline)
+{
+	String sub;
+
+	if (popWord(cmdline, &sub)) {
+		if (sub.equals(F("clear"))) {
+			// Invalidate the hash as well, so the next scan starts afresh
+			memset(&gCache, 0, sizeof(gCache));
+			gCache.atrHash = 0xFFFF;
+			headerWrite();
+			Serial.println(F("Cleared"));
+		} else {
+			Serial.println(F("**ERROR: Syntax = scache [clear]"));
+		}
+		return;
+	}
+
+	// Show whatever is in EEPROM, not just the current card's cache
+	EEPROM.get(SCACHE_EE_BASE, gCache);
+	if (gCache.count > SCACHE_MAX_ENTRIES) {
+		gCache.count = 0;
+	}
+
+	Serial.print(F("ATR hash="));
+	Serial.print(gCache.atrHash, HEX);
+	Serial.print(F(" entries="));
+	Serial.print(gCache.count);
+	Serial.print('/');
+	Serial.println(SCACHE_MAX_ENTRIES);
+
+	Serial.print(F("Classes scanned:"));
+	for (uint16_t cla = 0; cla < 256; cla++) {
+		if (scacheClaDone(cla)) {
+			Serial.print(' ');
+			printHex(cla);
+		}
+	}
+	Serial.println();
+
+	for (uint8_t i = 0; i < gCache.count; i++) {
+		SCACHE_ENTRY e;
+
+		scacheGet(i, &e);
+		Serial.print(F("CLA/INS "));
+		printHex(e.cla);
+		Serial.print('/');
+		printHex(e.ins);
+		Serial.print(F(" Le="));
+		printHex(e.le);
+		Serial.print(F(" SW="));
+		printHex(e.sw >> 8);
+		printHex(e.sw & 0xFF);
+		Serial.println();
+	}
+}
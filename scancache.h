@@ -0,0 +1,75 @@
+#ifndef SCANCACHE_H
+#define SCANCACHE_H
+
+#include <Arduino.h>
+
+/***
+ * Scan result cache
+ *
+ * The CLA/INS pairs found by 'scancla' are kept in EEPROM, keyed by a hash of
+ * the ATR, along with the classes which have been completely scanned. A scan
+ * of the same card type then only has to check the known commands still give
+ * the same answers, and probe the classes it hasn't seen before.
+ */
+
+/// EEPROM space for the cache
+#define SCACHE_EE_BASE		0x100
+#define SCACHE_EE_SIZE		0x200
+
+/// Le used by the class scan, and to check cached entries
+#define SCACHE_SCAN_LE		0xFF
+
+typedef struct {
+	uint8_t cla;
+	uint8_t ins;
+	uint8_t le;			///< Known-good Le, SCACHE_SCAN_LE if not known
+	uint16_t sw;		///< SW1SW2 when scanned with SCACHE_SCAN_LE
+} SCACHE_ENTRY;
+
+/**
+ * Load the cache for a card.
+ *
+ * If the cache belongs to a different card, it is emptied (the EEPROM isn't
+ * touched until something is added).
+ *
+ * @return <b>true</b> if there was a cache for this card.
+ */
+bool scacheOpen(const uint8_t *atr, const uint8_t len);
+
+/// Number of cached entries
+uint8_t scacheCount(void);
+
+/// Read a cached entry
+void scacheGet(const uint8_t idx, SCACHE_ENTRY *e);
+
+/**
+ * Find the cached entry for a CLA and INS.
+ *
+ * @return <b>false</b> if it isn't cached.
+ */
+bool scacheFind(const uint8_t cla, const uint8_t ins, SCACHE_ENTRY *e);
+
+/**
+ * Add an entry, or replace the cached entry with the same CLA and INS.
+ *
+ * @return <b>false</b> if the cache is full.
+ */
+bool scacheAdd(const SCACHE_ENTRY *e);
+
+/// Has this class been completely scanned?
+bool scacheClaDone(const uint8_t cla);
+
+/// Mark a class as completely scanned
+void scacheSetClaDone(const uint8_t cla);
+
+/// Drop all the entries for a class, and mark it as not scanned
+void scacheForgetCla(const uint8_t cla);
+
+/**
+ * Command handler: scache [clear]
+ *
+ * Show or clear the scan cache.
+ */
+void handle_scache(String *cmdline);
+
+#endif // SCANCACHE_H
@@ -0,0 +1,410 @@
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "session.h"
+#include "timebase.h"
+#include "hostlink.h"
+#include "utils.h"
+
+#ifdef ENABLE_SESSION
+
+/// Recording ring buffer. Must be a power of two.
+#define SESSION_BUF			128
+
+/// Longest event: type, value, 5-byte delta
+#define SESSION_EVENT_MAX	7
+
+/// Frame overhead: SOF, type, length, checksum
+#define SESSION_FRAME_OVERHEAD	5
+
+/// Smallest frame sessionDrain() sends
+#define SESSION_DRAIN_MIN	16
+
+/// Replay buffer. The host loads long sessions a piece at a time.
+#define SESSION_REPLAY_MAX	256
+
+/// Default replay timing tolerance, card clocks (2 Etu at the standard rate)
+#define SESSION_TOLERANCE	744
+
+
+bool gSessionRecording = false;
+
+static uint8_t gRecBuf[SESSION_BUF];
+static uint8_t gRecHead = 0;		///< Next byte written
+static uint8_t gRecTail = 0;		///< Next byte sent
+static uint32_t gRecPrev;			///< Time of the previous recorded event
+static bool gRecFirst;				///< Next event is the first one
+
+static uint8_t gReplay[SESSION_REPLAY_MAX];
+static uint16_t gReplayLen = 0;
+
+
+/// Bytes in the ring buffer
+static inline uint8_t recUsed(void)
+{
+	return (gRecHead - gRecTail) & (SESSION_BUF - 1);
+}
+
+
+/// Send the next len bytes from the ring buffer as one frame
+static void recSend(uint8_t len)
+{
+	hostFrameBegin(FRAME_SESSION, len);
+	while (len > 0) {
+		// Up to the end of the buffer at a time
+		uint8_t n = min((uint8_t)(SESSION_BUF - gRecTail), len);
+		hostFrameWrite(&gRecBuf[gRecTail], n);
+		gRecTail = (gRecTail + n) & (SESSION_BUF - 1);
+		len -= n;
+	}
+	hostFrameEnd();
+}
+
+
+void sessionFlush(void)
+{
+	uint8_t used = recUsed();
+
+	if (used > 0) {
+		recSend(used);
+	}
+}
+
+
+void sessionDrain(void)
+{
+	uint8_t used = recUsed();
+	int room = Serial.availableForWrite() - SESSION_FRAME_OVERHEAD;
+
+	if ((used == 0) || (room < min((int)used, SESSION_DRAIN_MIN))) {
+		return;
+	}
+	recSend(min((int)used, room));
+}
+
+
+/**
+ * Encode an event.
+ *
+ * @return Length, at most SESSION_EVENT_MAX
+ */
+static uint8_t recEncode(uint8_t *buf, const uint8_t type, const uint8_t val, uint32_t delta)
+{
+	uint8_t len = 0;
+
+	buf[len++] = type;
+	buf[len++] = val;
+	do {
+		buf[len] = delta & 0x7F;
+		delta >>= 7;
+		if (delta != 0) {
+			buf[len] |= 0x80;
+		}
+		len++;
+	} while (delta != 0);
+
+	return len;
+}
+
+
+void sessionLogEvent(const uint8_t type, const uint8_t val, const uint32_t t)
+{
+	uint8_t ev[SESSION_EVENT_MAX];
+	uint8_t len;
+	uint32_t delta = gRecFirst ? 0 : (t - gRecPrev);
+
+	// RX times are worked out after the fact, so could be a little early
+	if ((int32_t)delta < 0) {
+		delta = 0;
+	}
+	gRecPrev = t;
+	gRecFirst = false;
+
+	len = recEncode(ev, type, val, delta);
+	if (len > ((SESSION_BUF - 1) - recUsed())) {
+		sessionFlush();
+	}
+
+	for (uint8_t i = 0; i < len; i++) {
+		gRecBuf[gRecHead] = ev[i];
+		gRecHead = (gRecHead + 1) & (SESSION_BUF - 1);
+	}
+}
+
+
+/**
+ * Decode the replay event at *pos.
+ *
+ * @return <b>false</b> at the end of the buffer
+ */
+static bool replayEvent(uint16_t *pos, uint8_t *type, uint8_t *val, uint32_t *delta)
+{
+	uint8_t shift = 0;
+	uint8_t b;
+
+	if ((*pos + 2) >= gReplayLen) {
+		return false;
+	}
+
+	*type = gReplay[(*pos)++];
+	*val = gReplay[(*pos)++];
+	*delta = 0;
+	do {
+		b = gReplay[(*pos)++];
+		*delta |= (uint32_t)(b & 0x7F) << shift;
+		shift += 7;
+	} while ((b & 0x80) && (*pos < gReplayLen));
+
+	return true;
+}
+
+
+/**
+ * Replay the loaded events.
+ *
+ * @param	fast		Send as fast as possible, rather than with the
+ * 						recorded timing. Card timing isn't checked.
+ * @param	tolerance	Card timing tolerance, card clocks
+ */
+static void sessionReplay(const bool fast, const uint32_t tolerance)
+{
+	uint8_t atrbuf[32];
+	uint8_t atrLen = 0, atrPos = 0;
+	uint16_t pos = 0;
+	uint16_t ev = 0;
+	uint8_t type = 0, val = 0;
+	uint32_t delta, t;
+	uint32_t carry = 0;
+	uint32_t tPrev = tbNow();
+	bool listening = false;
+	int got = 0;
+	const __FlashStringHelper *err = NULL;
+
+	// Timing divergence summary -- printing as we go would upset the timing
+	uint16_t nLate = 0, worstEv = 0;
+	uint32_t worstDev = 0, worstRec = 0, worstAct = 0;
+
+	// Don't record the replay
+	bool wasRecording = gSessionRecording;
+	gSessionRecording = false;
+
+	while ((err == NULL) && replayEvent(&pos, &type, &val, &delta)) {
+		// Notes take up time in the recording, which belongs to the next event
+		delta += carry;
+		carry = 0;
+
+		switch (type) {
+			case SE_NOTE:
+				carry = delta;
+				break;
+
+			case SE_RESET:
+				{
+					ATR_TIMING timing;
+
+					cardColdReset();
+					atrLen = cardGetAtr(atrbuf, true, ATR_TIMEOUT_MS, &timing);
+					if (atrLen > 0) {
+						cardProfileApply(atrbuf, atrLen, true);
+						tPrev = timing.tLast;
+					}
+					atrPos = 0;
+					listening = false;
+				}
+				break;
+
+			case SE_TX:
+				// The ATR has to have been the one that was recorded
+				if (atrPos < atrLen) {
+					err = F("ATR longer than recorded");
+					break;
+				}
+
+				if (listening) {
+					cardStopListening();
+					listening = false;
+				}
+				if (fast) {
+					delayMicroseconds(cardGetGuardTime());
+				} else {
+					while ((tbNow() - tPrev) < delta) {
+						// wait
+					}
+				}
+				tPrev = tbNow();
+				scWriteByte(val);
+				break;
+
+			case SE_RX:
+				if (atrPos < atrLen) {
+					// ATR bytes were read by cardGetAtr()
+					got = atrbuf[atrPos++];
+					if (got != val) {
+						err = F("ATR differs");
+					}
+					break;
+				}
+
+				if (!listening) {
+					cardListen();
+					listening = true;
+				}
+				got = scReadByte(cardGetWaitTime(), &t);
+				if (got == -1) {
+					err = F("card timed out");
+					break;
+				}
+				if (got != val) {
+					err = F("card sent different data");
+					break;
+				}
+
+				if (!fast) {
+					uint32_t act = t - tPrev;
+					uint32_t dev = (act > delta) ? (act - delta) : (delta - act);
+					if (dev > tolerance) {
+						nLate++;
+						if (dev > worstDev) {
+							worstDev = dev;
+							worstEv = ev;
+							worstRec = delta;
+							worstAct = act;
+						}
+					}
+				}
+				tPrev = t;
+				break;
+
+			default:
+				err = F("bad event in session");
+				break;
+		}
+
+		if (err == NULL) {
+			ev++;
+		}
+	}
+
+	// Unread ATR bytes at the end count too
+	if ((err == NULL) && (atrPos < atrLen)) {
+		err = F("ATR longer than recorded");
+	}
+
+	if (listening) {
+		cardStopListening();
+	}
+	gSessionRecording = wasRecording;
+
+	Serial.print(F("Replayed "));
+	Serial.print(ev);
+	Serial.println(F(" events"));
+
+	if (!fast) {
+		Serial.print(F("Timing: "));
+		Serial.print(nLate);
+		Serial.print(F(" card characters outside +/-"));
+		Serial.print(tolerance);
+		if (nLate > 0) {
+			Serial.print(F(", worst at event "));
+			Serial.print(worstEv);
+			Serial.print(F(" (recorded "));
+			Serial.print(worstRec);
+			Serial.print(F(", now "));
+			Serial.print(worstAct);
+			Serial.print(')');
+		}
+		Serial.println();
+	}
+
+	if (err != NULL) {
+		Serial.print(F("DIVERGED at event "));
+		Serial.print(ev);
+		Serial.print(F(": "));
+		Serial.print(err);
+		if (type == SE_RX) {
+			Serial.print(F(" (expected "));
+			printHex(val);
+			if (got != -1) {
+				Serial.print(F(", got "));
+				printHex(got);
+			}
+			Serial.print(')');
+		}
+		Serial.println();
+	} else {
+		Serial.println(F("Replay OK"));
+	}
+}
+
+
+void handle_session(String *cmdline)
+{
+	String sub;
+	long val;
+
+	if (!popWord(cmdline, &sub)) {
+		Serial.print(F("Recording "));
+		Serial.print(gSessionRecording ? F("on") : F("off"));
+		Serial.print(F(", "));
+		Serial.print(gReplayLen);
+		Serial.print('/');
+		Serial.print(SESSION_REPLAY_MAX);
+		Serial.println(F(" replay bytes loaded"));
+
+	} else if (sub.equals(F("rec"))) {
+		String arg;
+
+		popWord(cmdline, &arg);
+		if (arg.equals(F("on"))) {
+			// The recording is only sent as binary frames
+			if (!gBinaryFrames) {
+				Serial.println(F("**ERROR: Turn binary frames on first ('binary 1')"));
+				return;
+			}
+			gRecHead = gRecTail = 0;
+			gRecFirst = true;
+			gSessionRecording = true;
+		} else if (arg.equals(F("off"))) {
+			sessionFlush();
+			gSessionRecording = false;
+		} else {
+			Serial.println(F("**ERROR: Syntax = session rec on|off"));
+			return;
+		}
+		Serial.print(F("Recording "));
+		Serial.println(gSessionRecording ? F("on") : F("off"));
+
+	} else if (sub.equals(F("load"))) {
+		int n = popHexBytes(cmdline, &gReplay[gReplayLen], SESSION_REPLAY_MAX - gReplayLen);
+		if (n < 0) {
+			Serial.println(F("**ERROR: Replay buffer full"));
+			return;
+		}
+		gReplayLen += n;
+		Serial.print(F("Loaded "));
+		Serial.println(gReplayLen);
+
+	} else if (sub.equals(F("replay"))) {
+		bool fast = false;
+
+		if (cmdline->startsWith(F("fast"))) {
+			String dummy;
+			popWord(cmdline, &dummy);
+			fast = true;
+		}
+		if (!popArg(cmdline, &val, 10)) {
+			val = SESSION_TOLERANCE;
+		}
+		sessionReplay(fast, val);
+
+	} else if (sub.equals(F("clear"))) {
+		gReplayLen = 0;
+		Serial.println(F("Cleared"));
+
+	} else {
+		Serial.println(F("**ERROR: Syntax = session [rec on|off | load <bytes...> | replay [fast] [<tolerance>] | clear]"));
+	}
+}
+
+#endif // ENABLE_SESSION
@@ -0,0 +1,89 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/***
+ * Session record and replay
+ *
+ * While recording, every character to and from the card is logged with its
+ * card clock timestamp (see timebase.h) and streamed to the host in
+ * FRAME_SESSION frames. The frame payloads, joined together, are the session:
+ * a list of events, each
+ *
+ *   u8 type, u8 value, delta
+ *
+ * where delta is the time since the previous event in card clocks, as an
+ * unsigned LEB128 varint (7 bits per byte, low bits first, bit 7 set on all
+ * but the last byte). Events can be split across frames.
+ *
+ * SE_NOTE events say what the characters before them were (value is a
+ * NOTE_xxx), so a recording can be read as a protocol trace. They have the
+ * time of the character they describe.
+ *
+ * Events go into a ring buffer, which is sent while the firmware waits for
+ * the card (as much as the UART has room for, so it never waits for the
+ * host), and in full when the card is idle. Recording is cheap enough to
+ * leave on for a whole scan. Only if the card sends faster than the host
+ * link can take it (long responses at high card rates) does the ring fill
+ * up; then it is sent there and then, as the UART allows.
+ *
+ * A session (or part of one) can be loaded back into the device and replayed:
+ * the host side is sent again, with the original timing or as fast as
+ * possible, and the card side is checked against the recording.
+ *
+ * tools/session.py records, dumps and replays sessions.
+ */
+
+// Event types
+#define SE_TX				0x00	///< Character sent to the card
+#define SE_RX				0x01	///< Character received from the card
+#define SE_RESET			0x02	///< Card reset (ATR read started). Value is zero.
+#define SE_NOTE				0x03	///< Annotation. Value is a NOTE_xxx.
+
+// Annotations (the value of SE_NOTE)
+#define NOTE_ATR			0x01	///< The characters since SE_RESET were the ATR
+#define NOTE_PROC			0x02	///< The last character received was a procedure byte (or NULL)
+#define NOTE_SW				0x03	///< The last two characters received were SW1 SW2
+#define NOTE_PPS			0x04	///< The characters since the ATR were a PPS exchange (reserved, there is no PPS yet)
+#define NOTE_TIMEOUT		0x05	///< The card didn't answer
+
+#ifdef ENABLE_SESSION
+
+/// Recording on/off
+extern bool gSessionRecording;
+
+/**
+ * Log an event. Events are buffered until sessionFlush() or the buffer fills.
+ *
+ * @param	t	Time of the event (leading edge of the start bit), card clocks
+ */
+void sessionLogEvent(const uint8_t type, const uint8_t val, const uint32_t t);
+
+/// Send all buffered events to the host. Call when the card is idle.
+void sessionFlush(void);
+
+/// Send what the UART has room for, without waiting. Call while waiting for the card.
+void sessionDrain(void);
+
+/**
+ * Command handler: session [rec on|off | load <bytes...> | replay [fast] [<tolerance>] | clear]
+ *
+ * Record and replay card sessions.
+ */
+void handle_session(String *cmdline);
+
+#define SESSION_LOG(type, val, t)	do { if (gSessionRecording) { sessionLogEvent((type), (val), (t)); } } while (0)
+#define SESSION_FLUSH()				do { if (gSessionRecording) { sessionFlush(); } } while (0)
+#define SESSION_DRAIN()				do { if (gSessionRecording) { sessionDrain(); } } while (0)
+
+#else
+
+#define SESSION_LOG(type, val, t)
+#define SESSION_FLUSH()
+#define SESSION_DRAIN()
+
+#endif // ENABLE_SESSION
+
+#endif // SESSION_H
@@ -0,0 +1,188 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+/***
+ * Host build: the parts of the Arduino core the firmware uses.
+ *
+ * Time is simulated (see sim.h) -- delay() and friends move the simulated
+ * clock on rather than sleeping, so the firmware runs as fast as the host
+ * can go.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define F_CPU			14318180UL
+
+#define HIGH			1
+#define LOW				0
+#define INPUT			0
+#define OUTPUT			1
+#define INPUT_PULLUP	2
+
+#define DEC				10
+#define HEX				16
+#define OCT				8
+#define BIN				2
+
+// Analog pins, as digital pin numbers
+#define A0				14
+#define A1				15
+#define A2				16
+#define A3				17
+#define A4				18
+#define A5				19
+
+#define min(a,b)		((a)<(b)?(a):(b))
+#define max(a,b)		((a)>(b)?(a):(b))
+#define constrain(amt,low,high)	((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define noInterrupts()
+#define interrupts()
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// Flash strings are ordinary strings on the host
+class __FlashStringHelper;
+#define F(s)			(reinterpret_cast<const __FlashStringHelper *>(s))
+
+
+/**
+ * Arduino String, on top of std::string.
+ */
+class String {
+public:
+	String(const char *s = "") : s(s) {}
+	String(const __FlashStringHelper *s) : s(reinterpret_cast<const char *>(s)) {}
+	String(const std::string &s) : s(s) {}
+	explicit String(char c) : s(1, c) {}
+	explicit String(long val, int base = DEC);
+
+	unsigned int length(void) const { return s.length(); }
+	const char *c_str(void) const { return s.c_str(); }
+	char charAt(unsigned int i) const { return (i < s.length()) ? s[i] : 0; }
+	char operator[](unsigned int i) const { return charAt(i); }
+
+	bool equals(const String &o) const { return s == o.s; }
+	bool operator==(const String &o) const { return s == o.s; }
+	bool operator!=(const String &o) const { return s != o.s; }
+	bool startsWith(const String &o) const { return s.compare(0, o.s.length(), o.s) == 0; }
+
+	int indexOf(char c, unsigned int from = 0) const;
+	int indexOf(const String &o, unsigned int from = 0) const;
+	String substring(unsigned int from) const;
+	String substring(unsigned int from, unsigned int to) const;
+
+	void remove(unsigned int idx);
+	void remove(unsigned int idx, unsigned int count);
+	void trim(void);
+	long toInt(void) const { return atol(s.c_str()); }
+
+	String &operator+=(const String &o) { s += o.s; return *this; }
+	String &operator+=(char c) { s += c; return *this; }
+	bool concat(const String &o) { s += o.s; return true; }
+	bool concat(char c) { s += c; return true; }
+
+private:
+	std::string s;
+};
+
+
+/**
+ * Print: number and string formatting on top of write().
+ */
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t b) = 0;
+	virtual size_t write(const uint8_t *buf, size_t len);
+	size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+	int getWriteError(void) { return writeError; }
+	void clearWriteError(void) { writeError = 0; }
+
+	size_t print(const __FlashStringHelper *s) { return write(reinterpret_cast<const char *>(s)); }
+	size_t print(const String &s) { return write(s.c_str()); }
+	size_t print(const char *s) { return write(s); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char n, int base = DEC) { return print((unsigned long long)n, base); }
+	size_t print(int n, int base = DEC) { return print((long long)n, base); }
+	size_t print(unsigned int n, int base = DEC) { return print((unsigned long long)n, base); }
+	size_t print(long n, int base = DEC) { return print((long long)n, base); }
+	size_t print(unsigned long n, int base = DEC) { return print((unsigned long long)n, base); }
+	size_t print(long long n, int base = DEC);
+	size_t print(unsigned long long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	template <typename T> size_t println(T val) { size_t n = print(val); return n + println(); }
+	template <typename T> size_t println(T val, int fmt) { size_t n = print(val, fmt); return n + println(); }
+	size_t println(void) { return write("\r\n"); }
+
+protected:
+	void setWriteError(int err = 1) { writeError = err; }
+
+private:
+	int writeError = 0;
+};
+
+
+/**
+ * Stream: Print plus reading.
+ */
+class Stream : public Print {
+public:
+	virtual int available(void) = 0;
+	virtual int read(void) = 0;
+	virtual int peek(void) = 0;
+	virtual void flush(void) {}
+
+	String readStringUntil(char terminator);
+};
+
+
+/**
+ * The host serial port. Commands come from stdin, output goes to stdout.
+ */
+class HardwareSerial : public Stream {
+public:
+	void begin(unsigned long baud) { this->baud = baud; }
+	void end(void) {}
+
+	int available(void);
+	int read(void);
+	int peek(void);
+	void flush(void);
+	int availableForWrite(void);
+	size_t write(uint8_t b);
+	using Print::write;
+
+	operator bool() { return true; }
+
+private:
+	unsigned long baud = 57600;
+	uint64_t txDone = 0;		///< When the UART will have sent everything written, CPU cycles
+	std::string rxBuf;
+	char last[3] = { 0, 0, 0 };	///< Last three characters sent, to spot the prompt
+};
+
+extern HardwareSerial Serial;
+
+#endif // SIM_ARDUINO_H
@@ -0,0 +1,46 @@
+#ifndef SIM_EEPROM_H
+#define SIM_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+/// EEPROM size, as the ATmega328P
+#define SIM_EEPROM_SIZE		1024
+
+/**
+ * EEPROM, kept in memory. simEepromLoad() and simEepromSave() (sim.h) keep
+ * it in a file between runs.
+ */
+class EEPROMClass {
+public:
+	uint8_t mem[SIM_EEPROM_SIZE];
+
+	EEPROMClass() { memset(mem, 0xFF, sizeof(mem)); }
+
+	uint8_t read(int idx) { return mem[idx % SIM_EEPROM_SIZE]; }
+	void write(int idx, uint8_t val) { mem[idx % SIM_EEPROM_SIZE] = val; }
+	void update(int idx, uint8_t val) { write(idx, val); }
+	uint16_t length(void) { return SIM_EEPROM_SIZE; }
+
+	template <typename T> T &get(int idx, T &t)
+	{
+		uint8_t *p = (uint8_t *)&t;
+		for (unsigned int i = 0; i < sizeof(T); i++) {
+			p[i] = read(idx + i);
+		}
+		return t;
+	}
+
+	template <typename T> const T &put(int idx, const T &t)
+	{
+		const uint8_t *p = (const uint8_t *)&t;
+		for (unsigned int i = 0; i < sizeof(T); i++) {
+			update(idx + i, p[i]);
+		}
+		return t;
+	}
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // SIM_EEPROM_H
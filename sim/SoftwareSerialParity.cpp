@@ -0,0 +1,286 @@
+/**
+ * Host build: SoftwareSerialParity on the simulated I/O line.
+ *
+ * Behaves like the real one (../SoftwareSerialParity.cpp): the receiver
+ * catches a falling edge, samples the data and parity bits in the middle of
+ * each bit at the configured baud rate, counts parity errors, and timestamps
+ * the byte in the middle of the last bit sampled. The transmitter drives the line for the
+ * length of the character and its stop bits. The "interrupt" is run every
+ * time the simulated clock moves (simSerialPoll()).
+ */
+
+#include <Arduino.h>
+#include "../SoftwareSerialParity.h"
+#include "../timebase.h"
+#include "sim.h"
+
+//
+// Statics
+//
+SoftwareSerialParity *SoftwareSerialParity::active_object = 0;
+uint8_t SoftwareSerialParity::_receive_buffer[_SS_MAX_RX_BUFF];
+#ifdef ENABLE_RX_TIMESTAMPS
+uint16_t SoftwareSerialParity::_receive_time[_SS_MAX_RX_BUFF];
+#endif
+volatile uint8_t SoftwareSerialParity::_receive_buffer_tail = 0;
+volatile uint8_t SoftwareSerialParity::_receive_buffer_head = 0;
+
+// Receiver state, card clocks
+static uint64_t gRxFrom = 0;			///< Start bits are looked for from here
+static uint64_t gRxFall = SIM_NEVER;	///< Next falling edge after gRxFrom
+static uint64_t gRxFallFrom = 0;		///< gRxFrom when gRxFall was found
+static uint32_t gRxLineGen = 0;			///< simLineGeneration() when gRxFall was found
+
+
+void simSerialPoll(void)
+{
+	SoftwareSerialParity::handle_interrupt();
+}
+
+//
+// Private methods
+//
+
+// The receiver. _tx_delay is the bit time in card clocks, as on the AVR
+// (4 CPU clocks per unit).
+void SoftwareSerialParity::recv()
+{
+	uint64_t now = simClocks();
+	uint16_t etu = _tx_delay;
+
+	for (;;) {
+		if ((gRxLineGen != simLineGeneration()) || (gRxFallFrom != gRxFrom)) {
+			gRxFall = simLineNextFall(gRxFrom);
+			gRxFallFrom = gRxFrom;
+			gRxLineGen = simLineGeneration();
+		}
+
+		// The interrupt handler samples up to the middle of the last data bit
+		// (or the parity bit), then skips 3/4 of a bit into the stop bit. The
+		// firmware doesn't run again until it's done.
+		if (gRxFall == SIM_NEVER) {
+			return;
+		}
+		uint64_t tLast = gRxFall + ((Tparity != NONE) ? ((19 * etu) / 2) : ((17 * etu) / 2));
+		uint64_t done = tLast + ((3 * etu) / 4);
+		if (done > now) {
+			return;
+		}
+
+		bool parity;
+		uint8_t d = simLineSample(gRxFall, etu, &parity);
+
+		if (Tparity != NONE) {
+			bool odd = (__builtin_popcount(d) + (parity ? 1 : 0)) & 1;
+			if ((odd != (Tparity == ODD)) && (_parity_errors != 0xFF)) {
+				_parity_errors++;
+			}
+		}
+
+		// if buffer full, set the overflow flag
+		uint8_t next = (_receive_buffer_tail + 1) % _SS_MAX_RX_BUFF;
+		if (next != _receive_buffer_head) {
+			_receive_buffer[_receive_buffer_tail] = d;
+#ifdef ENABLE_RX_TIMESTAMPS
+			_receive_time[_receive_buffer_tail] = (uint16_t)tLast;
+#endif
+			_receive_buffer_tail = next;
+		} else {
+			_buffer_overflow = true;
+		}
+
+		gRxFrom = done;
+	}
+}
+
+void SoftwareSerialParity::handle_interrupt()
+{
+	if (active_object) {
+		active_object->recv();
+	}
+}
+
+//
+// Constructor
+//
+SoftwareSerialParity::SoftwareSerialParity(uint8_t receivePin, uint8_t transmitPin, bool inverse_logic /* = false */) :
+	_receivePin(receivePin),
+	_rx_delay_centering(0),
+	_rx_delay_intrabit(0),
+	_rx_delay_stopbit(0),
+	_tx_delay(0),
+	_buffer_overflow(false),
+	_inverse_logic(inverse_logic),
+	_parity_errors(0)
+{
+	(void)transmitPin;
+}
+
+//
+// Destructor
+//
+SoftwareSerialParity::~SoftwareSerialParity()
+{
+	end();
+}
+
+//
+// Public methods
+//
+
+void SoftwareSerialParity::begin(long speed, uint8_t parity, uint8_t stopbits)
+{
+	// Bit time, in 4-cycle delays (which are card clocks)
+	uint16_t bit_delay = (F_CPU / speed) / 4;
+
+	Tparity = parity;
+	Tstopbits = (stopbits == 0) ? 1 : stopbits;
+
+	_tx_delay = bit_delay;
+	_rx_delay_centering = _rx_delay_intrabit = _rx_delay_stopbit = bit_delay;
+
+	simAdvance(4UL * bit_delay);
+	listen();
+}
+
+// This function sets the current object as the "listening"
+// one and returns true if it replaces another
+bool SoftwareSerialParity::listen()
+{
+	if (!_rx_delay_stopbit)
+		return false;
+
+	if (active_object != this) {
+		if (active_object)
+			active_object->stopListening();
+
+		_buffer_overflow = false;
+		_parity_errors = 0;
+		_receive_buffer_head = _receive_buffer_tail = 0;
+		active_object = this;
+
+		// Only start bits from now on are seen
+		gRxFrom = simClocks();
+		return true;
+	}
+
+	return false;
+}
+
+// Stop listening. Returns true if we were actually listening.
+bool SoftwareSerialParity::stopListening()
+{
+	if (active_object == this) {
+		active_object = NULL;
+		return true;
+	}
+	return false;
+}
+
+void SoftwareSerialParity::end()
+{
+	stopListening();
+}
+
+// Read data from buffer
+int SoftwareSerialParity::read()
+{
+	if (!isListening())
+		return -1;
+
+	// Empty buffer?
+	if (_receive_buffer_head == _receive_buffer_tail)
+		return -1;
+
+	// Read from "head"
+	uint8_t d = _receive_buffer[_receive_buffer_head]; // grab next byte
+	_receive_buffer_head = (_receive_buffer_head + 1) % _SS_MAX_RX_BUFF;
+	return d;
+}
+
+// Read data from buffer, with the time it was received
+int SoftwareSerialParity::read(uint32_t *timestamp)
+{
+	if (!isListening())
+		return -1;
+
+	// Empty buffer?
+	if (_receive_buffer_head == _receive_buffer_tail)
+		return -1;
+
+	uint32_t now = tbNow();
+
+#ifdef ENABLE_RX_TIMESTAMPS
+	*timestamp = now - (uint16_t)((uint16_t)now - _receive_time[_receive_buffer_head]);
+#else
+	*timestamp = now;
+#endif
+
+	return read();
+}
+
+int SoftwareSerialParity::available()
+{
+	if (!isListening())
+		return 0;
+
+	return (_receive_buffer_tail + _SS_MAX_RX_BUFF - _receive_buffer_head) % _SS_MAX_RX_BUFF;
+}
+
+size_t SoftwareSerialParity::write(uint8_t b)
+{
+	uint64_t t = simClocks();
+	uint16_t bits;
+	uint8_t nBits = 9;
+	uint8_t ones = 0;
+
+	if (_tx_delay == 0) {
+		setWriteError();
+		return 0;
+	}
+
+	// Start bit (0), then the data bits
+	bits = (uint16_t)b << 1;
+	for (uint8_t i = 0; i < 8; i++) {
+		ones += (b >> i) & 1;
+	}
+
+	if (Tparity == ODD) {
+		bits |= (uint16_t)((ones & 1) ? 0 : 1) << 9;
+		nBits++;
+	} else if (Tparity == EVEN) {
+		bits |= (uint16_t)(ones & 1) << 9;
+		nBits++;
+	}
+
+	simLineDrive(SIM_SRC_READER, t, _tx_delay, bits, nBits);
+
+	// Interrupts are off until the parity bit is done, and by then the line is
+	// high again, so the receiver doesn't hear its own character. It does
+	// hear anything after that -- a card signalling a parity error, say.
+	if (active_object == this) {
+		gRxFrom = max(gRxFrom, t + ((uint64_t)nBits * _tx_delay));
+	}
+	simAdvance(4UL * _tx_delay * (nBits + Tstopbits));
+	simReaderSent(t);
+
+	return 1;
+}
+
+void SoftwareSerialParity::flush()
+{
+	// There is no tx buffering, simply return
+}
+
+int SoftwareSerialParity::peek()
+{
+	if (!isListening())
+		return -1;
+
+	// Empty buffer?
+	if (_receive_buffer_head == _receive_buffer_tail)
+		return -1;
+
+	// Read from "head"
+	return _receive_buffer[_receive_buffer_head];
+}
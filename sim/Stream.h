@@ -0,0 +1,2 @@
+// Stream is in Arduino.h in the host build
+#include <Arduino.h>
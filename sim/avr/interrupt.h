@@ -0,0 +1,9 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+// Nothing interrupts the host build -- the card is simulated in step with
+// the firmware (see sim.h)
+#define cli()
+#define sei()
+
+#endif // SIM_AVR_INTERRUPT_H
@@ -0,0 +1,74 @@
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+/***
+ * Host build: the ATmega328P registers the firmware uses.
+ *
+ * Most are plain variables. The ones which reflect the outside world (pin
+ * inputs, timer counts, the clock loopback flag) are worked out from the
+ * simulation when they are read -- see sim.cpp.
+ */
+
+#include <stdint.h>
+
+/// A register which is worked out when it is read
+class SimReg {
+public:
+	typedef uint8_t (*ReadFn)(void);
+	typedef void (*WriteFn)(uint8_t val);
+
+	SimReg(ReadFn rd, WriteFn wr) : rd(rd), wr(wr) {}
+
+	operator uint8_t() const { return rd(); }
+	SimReg &operator=(uint8_t val) { wr(val); return *this; }
+	SimReg &operator|=(uint8_t val) { wr(rd() | val); return *this; }
+	SimReg &operator&=(uint8_t val) { wr(rd() & val); return *this; }
+
+private:
+	ReadFn rd;
+	WriteFn wr;
+};
+
+extern volatile uint8_t PORTB, PORTC, PORTD;
+extern volatile uint8_t DDRB, DDRC, DDRD;
+extern SimReg PINB, PINC, PIND;
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t GTCCR;
+
+extern SimReg TCNT0;
+extern volatile uint8_t TIFR0;
+
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint16_t ICR1, OCR1A;
+extern SimReg TIFR1;
+
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, TIMSK2;
+extern SimReg TCNT2;
+
+#define _BV(bit)		(1 << (bit))
+
+// GTCCR
+#define TSM				7
+#define PSRASY			1
+#define PSRSYNC			0
+
+// TIFR0
+#define TOV0			0
+
+// TCCR1A/B, TIFR1
+#define COM1A1			7
+#define WGM11			1
+#define ICES1			6
+#define WGM13			4
+#define WGM12			3
+#define CS12			2
+#define CS11			1
+#define CS10			0
+#define ICF1			5
+
+// TCCR2A/B
+#define WGM21			1
+#define CS20			0
+
+#endif // SIM_AVR_IO_H
@@ -0,0 +1,13 @@
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+// Flash is ordinary memory on the host
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define memcpy_P			memcpy
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+
+#endif // SIM_AVR_PGMSPACE_H
@@ -0,0 +1,111 @@
+/***
+ * Host build: built-in cards, for the card families the firmware knows.
+ *
+ * These are scripts (see simcard.h), so any of them can be copied to a file
+ * and changed.
+ */
+
+#include "simcard.h"
+
+
+/// VideoCrypt (CLA 53): enough for vcserial, vcosd, vcdecoem and vcsecret
+static const char CARD_VIDEOCRYPT[] = R"(
+# Inverse convention, TA1=13 (Fi 372, Di 4)
+atr 3F 78 13 25 04 40 B0 09 4A 50 01 4E 5A
+# TC1 asks for 4 Etu of extra guard time, but the firmware sends headers back
+# to back. The card copes here; 'guard 4' makes it strict.
+guard 0
+atr-delay 12000
+
+# Serial number: issue 9, serial 12345678
+cmd 53 70 recv data 09 00 BC 61 4E 00
+# Message from the old card, message from the decoder
+cmd 53 72 send len 10
+cmd 53 74 send len 20 delay 90000
+# Authorize
+cmd 53 76 send len 01
+# Seed
+cmd 53 78 recv delay 20000 data 4E 1D A2 97 0C 33 F8 65
+# OSD: priority 5, 16 characters
+cmd 53 7A recv len 19 data B0 53 49 4D 55 4C 41 54 45 44 20 43 41 52 44 20 20 20 20
+# Message for the next card
+cmd 53 7C recv data 11 22 33 44 55 66 77 88 99 AA BB CC DD EE FF 00
+
+# Secret class (~53): checksums
+cmd AC F0 p2 00 recv data 5A 3C
+cmd AC F0 p2 01 recv data 5A 2F
+)";
+
+
+/// Cryptoworks (CLA A4): enough for cwinfo
+static const char CARD_CRYPTOWORKS[] = R"(
+# C4 at ATR[6], 8F F1 at ATR[9..10]: version 5, 5 PIN tries
+atr 3B 78 12 00 00 65 C4 05 05 8F F1 90 00
+# TA1=12 is advertised, but the card stays at 9600 Baud
+ta1 ignore
+# Slow to start
+atr-delay 400000
+
+# Master file info: MFID 3F20
+cmd A4 C0 recv len 11 data DF 0F 00 00 00 00 3F 20 00 00 00 00 00 00 00 00 00
+# Select file
+cmd A4 A4 send len 02 sw 9F11
+# Serial / provider blocks: two providers, then the end
+cmd A4 B8 p1 00 p2 00 recv data DF 0A 00 00 1F 10 00 00 00 00 00 00
+cmd A4 B8 p1 FF p2 FF recv data DF 0A 00 00 1F 4A 00 00 00 00 00 00
+cmd A4 B8 p1 FF p2 FF sw 9404
+# Select record D1 (CAID), then 80 (serial)
+cmd A4 A2 send len 01 sw 9F04
+cmd A4 A2 send len 01 sw 9F07
+# Read record
+cmd A4 B2 recv data 0D 22 00 00
+cmd A4 B2 recv data 00 12 34 56 78 9A BC
+)";
+
+
+/// SLE4432 memory card: enough for sle4432
+static const char CARD_SLE4432[] = R"(
+type sle4432
+atr A2 13 10 91
+mem 04 46 FF 27 12 34 56 78
+mem 20 53 49 4D 55 4C 41 54 45 44 20 53 4C 45 34 34 33 32
+# First 8 bytes protected
+protect 00 FF FF FF
+)";
+
+
+typedef struct {
+	const char *name;
+	const char *script;
+} SIM_PERSONALITY;
+
+static const SIM_PERSONALITY PERSONALITIES[] = {
+	{ "videocrypt",		CARD_VIDEOCRYPT },
+	{ "cryptoworks",	CARD_CRYPTOWORKS },
+	{ "sle4432",		CARD_SLE4432 },
+};
+
+
+const char *simCardPersonality(const std::string &name)
+{
+	for (const SIM_PERSONALITY &p : PERSONALITIES) {
+		if (name == p.name) {
+			return p.script;
+		}
+	}
+	return NULL;
+}
+
+
+std::string simCardPersonalities(void)
+{
+	std::string s;
+
+	for (const SIM_PERSONALITY &p : PERSONALITIES) {
+		if (!s.empty()) {
+			s += ' ';
+		}
+		s += p.name;
+	}
+	return s;
+}
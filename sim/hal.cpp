@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "sim.h"
+
+/// Host serial transmit buffer size, as the Arduino core
+#define SIM_SERIAL_TX_BUF	64
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+
+/****************************************************************************
+ * Time
+ */
+
+unsigned long millis(void)
+{
+	simAdvance(SIM_POLL_CYCLES);
+	return (simCycles() * 1000) / F_CPU;
+}
+
+
+unsigned long micros(void)
+{
+	simAdvance(SIM_POLL_CYCLES);
+	return (simCycles() * 1000000) / F_CPU;
+}
+
+
+void delay(unsigned long ms)
+{
+	simAdvance(((uint64_t)ms * F_CPU) / 1000);
+}
+
+
+void delayMicroseconds(unsigned int us)
+{
+	simAdvance(((uint64_t)us * F_CPU) / 1000000);
+}
+
+
+/****************************************************************************
+ * Pins
+ */
+
+/// Port register for an Arduino pin number
+static volatile uint8_t *pinPort(uint8_t pin, uint8_t *bit)
+{
+	if (pin < 8) {
+		*bit = pin;
+		return &PORTD;
+	} else if (pin < 14) {
+		*bit = pin - 8;
+		return &PORTB;
+	} else {
+		*bit = pin - 14;
+		return &PORTC;
+	}
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	uint8_t bit;
+	volatile uint8_t *port = pinPort(pin, &bit);
+	volatile uint8_t *ddr = (port == &PORTD) ? &DDRD : (port == &PORTB) ? &DDRB : &DDRC;
+
+	if (mode == OUTPUT) {
+		*ddr |= _BV(bit);
+	} else {
+		*ddr &= ~_BV(bit);
+		if (mode == INPUT_PULLUP) {
+			*port |= _BV(bit);
+		}
+	}
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	uint8_t bit;
+	volatile uint8_t *port = pinPort(pin, &bit);
+
+	if (val) {
+		*port |= _BV(bit);
+	} else {
+		*port &= ~_BV(bit);
+	}
+}
+
+
+int digitalRead(uint8_t pin)
+{
+	uint8_t bit;
+	volatile uint8_t *port = pinPort(pin, &bit);
+	uint8_t val = (port == &PORTD) ? PIND : (port == &PORTB) ? PINB : PINC;
+
+	return (val & _BV(bit)) ? HIGH : LOW;
+}
+
+
+/****************************************************************************
+ * String
+ */
+
+String::String(long val, int base)
+{
+	char buf[40];
+
+	if (base == HEX) {
+		snprintf(buf, sizeof(buf), "%lX", val);
+	} else {
+		snprintf(buf, sizeof(buf), "%ld", val);
+	}
+	s = buf;
+}
+
+
+int String::indexOf(char c, unsigned int from) const
+{
+	size_t pos = s.find(c, from);
+	return (pos == std::string::npos) ? -1 : (int)pos;
+}
+
+
+int String::indexOf(const String &o, unsigned int from) const
+{
+	size_t pos = s.find(o.s, from);
+	return (pos == std::string::npos) ? -1 : (int)pos;
+}
+
+
+String String::substring(unsigned int from) const
+{
+	return (from < s.length()) ? String(s.substr(from)) : String();
+}
+
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+	if (from > to) {
+		unsigned int tmp = from;
+		from = to;
+		to = tmp;
+	}
+	if (from >= s.length()) {
+		return String();
+	}
+	return String(s.substr(from, to - from));
+}
+
+
+void String::remove(unsigned int idx)
+{
+	if (idx < s.length()) {
+		s.erase(idx);
+	}
+}
+
+
+void String::remove(unsigned int idx, unsigned int count)
+{
+	if (idx < s.length()) {
+		s.erase(idx, count);
+	}
+}
+
+
+void String::trim(void)
+{
+	const char *ws = " \t\r\n\f\v";
+	size_t first = s.find_first_not_of(ws);
+
+	if (first == std::string::npos) {
+		s.clear();
+	} else {
+		s = s.substr(first, s.find_last_not_of(ws) - first + 1);
+	}
+}
+
+
+/****************************************************************************
+ * Print and Stream
+ */
+
+size_t Print::write(const uint8_t *buf, size_t len)
+{
+	size_t n = 0;
+
+	while (len--) {
+		n += write(*buf++);
+	}
+	return n;
+}
+
+
+size_t Print::print(long long n, int base)
+{
+	if ((n < 0) && (base == DEC)) {
+		return print('-') + print((unsigned long long)-n, base);
+	}
+	return print((unsigned long long)n, base);
+}
+
+
+size_t Print::print(unsigned long long n, int base)
+{
+	char buf[66];
+	char *p = &buf[sizeof(buf) - 1];
+
+	if (base < 2) {
+		base = DEC;
+	}
+
+	*p = '\0';
+	do {
+		uint8_t digit = n % base;
+		*--p = (digit < 10) ? ('0' + digit) : ('A' + digit - 10);
+		n /= base;
+	} while (n != 0);
+
+	return write(p);
+}
+
+
+size_t Print::print(double n, int digits)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%.*f", digits, n);
+	return write(buf);
+}
+
+
+String Stream::readStringUntil(char terminator)
+{
+	String s;
+	int c;
+
+	while (((c = read()) != -1) && (c != terminator)) {
+		s += (char)c;
+	}
+	return s;
+}
+
+
+/****************************************************************************
+ * Host serial port
+ */
+
+int HardwareSerial::available(void)
+{
+	char line[512];
+
+	// Input is only taken when the firmware is sitting at its prompt, so
+	// commands piped in run one after the other and don't stop the one
+	// before (which real hosts avoid by waiting for the prompt)
+	if (rxBuf.empty() && (memcmp(last, "\n> ", 3) == 0)) {
+		fflush(stdout);
+		if (fgets(line, sizeof(line), stdin) == NULL) {
+			exit(0);
+		}
+		rxBuf = line;
+		if (rxBuf.back() != '\n') {
+			rxBuf += '\n';
+		}
+	}
+
+	return rxBuf.length();
+}
+
+
+int HardwareSerial::read(void)
+{
+	int c;
+
+	if (rxBuf.empty()) {
+		return -1;
+	}
+	c = (uint8_t)rxBuf[0];
+	rxBuf.erase(0, 1);
+	return c;
+}
+
+
+int HardwareSerial::peek(void)
+{
+	return rxBuf.empty() ? -1 : (uint8_t)rxBuf[0];
+}
+
+
+void HardwareSerial::flush(void)
+{
+	fflush(stdout);
+}
+
+
+int HardwareSerial::availableForWrite(void)
+{
+	uint64_t charCycles = (10 * (uint64_t)F_CPU) / baud;
+	uint64_t now = simCycles();
+	uint64_t queued = (txDone > now) ? (((txDone - now) + charCycles - 1) / charCycles) : 0;
+
+	return (queued >= SIM_SERIAL_TX_BUF) ? 0 : (SIM_SERIAL_TX_BUF - 1 - queued);
+}
+
+
+size_t HardwareSerial::write(uint8_t b)
+{
+	// The UART sends a character every 10 bit times, and write() waits while
+	// its buffer is full -- a firmware which prints a lot runs slower
+	uint64_t charCycles = (10 * (uint64_t)F_CPU) / baud;
+	uint64_t now = simCycles();
+
+	if (txDone < now) {
+		txDone = now;
+	}
+	txDone += charCycles;
+	if ((txDone - now) > (SIM_SERIAL_TX_BUF * charCycles)) {
+		simAdvance((txDone - now) - (SIM_SERIAL_TX_BUF * charCycles));
+	}
+
+	putchar(b);
+	last[0] = last[1];
+	last[1] = last[2];
+	last[2] = b;
+	return 1;
+}
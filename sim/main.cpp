@@ -0,0 +1,123 @@
+/***
+ * Host build of the firmware.
+ *
+ * Runs the firmware with its serial console on stdin/stdout, talking to a
+ * simulated card on a simulated I/O line (see sim.h, and simcard.h for the
+ * card scripts). Commands can be typed in or piped in; the program exits at
+ * the end of the input.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include "simcard.h"
+#include <Arduino.h>
+#include "sim.h"
+
+void setup();
+void loop();
+
+
+/// Read a whole file
+static bool readFile(const char *path, std::string *out)
+{
+	FILE *f = fopen(path, "r");
+	char buf[512];
+	size_t n;
+
+	if (f == NULL) {
+		return false;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		out->append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+
+static const char *gEepromFile = NULL;
+
+static void saveEeprom(void)
+{
+	if (gEepromFile != NULL) {
+		simEepromSave(gEepromFile);
+	}
+}
+
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c <card>] [-x <script line>]... [-a <ATR hex>] [-s <SW hex>]\n"
+		"          [-e <EEPROM file>]\n"
+		"\n"
+		"  -c   Insert a built-in card (%s) or a card script file\n"
+		"  -x   Add a line to the card's script, after the -c one (repeatable)\n"
+		"  -a   Same as -x 'atr <ATR hex>'\n"
+		"  -s   Same as -x 'default <SW hex>': the SW for unknown commands\n"
+		"  -e   Keep the EEPROM in this file\n"
+		"\n"
+		"With none of -c, -x, -a or -s there is no card.\n",
+		prog, simCardPersonalities().c_str());
+}
+
+
+int main(int argc, char **argv)
+{
+	std::string script, extra, err;
+	bool haveCard = false;
+	SimScriptCard *card;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:x:a:s:e:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				if (simCardPersonality(optarg) != NULL) {
+					script = simCardPersonality(optarg);
+				} else if (!readFile(optarg, &script)) {
+					fprintf(stderr, "No such card or script: %s\n", optarg);
+					return 1;
+				}
+				haveCard = true;
+				break;
+			case 'x':
+				extra += std::string(optarg) + "\n";
+				haveCard = true;
+				break;
+			case 'a':
+				extra += std::string("atr ") + optarg + "\n";
+				haveCard = true;
+				break;
+			case 's':
+				extra += std::string("default ") + optarg + "\n";
+				haveCard = true;
+				break;
+			case 'e':
+				gEepromFile = optarg;
+				simEepromLoad(gEepromFile);
+				atexit(saveEeprom);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (haveCard) {
+		if (!script.empty() && (script.back() != '\n')) {
+			script += '\n';
+		}
+		card = simCardLoad(script + extra, &err);
+		if (card == NULL) {
+			fprintf(stderr, "Card script: %s\n", err.c_str());
+			return 1;
+		}
+		simInsertCard(card);
+	}
+
+	setup();
+	for (;;) {
+		loop();
+	}
+}
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <vector>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "sim.h"
+#include "../hardware.h"
+
+
+/// Characters on the I/O line are forgotten this long after they end (card
+/// clocks). The receiver is run every time the clock moves, so it only needs
+/// to look back a character or two.
+#define SIM_LINE_HISTORY	(1UL << 16)
+
+/// A character (or any pulse) on the I/O line
+typedef struct {
+	uint8_t src;			///< SIM_SRC_xxx
+	uint8_t nBits;
+	uint16_t etu;
+	uint16_t bits;			///< Bit levels, first in bit 0
+	uint64_t t;				///< Leading edge of the first bit
+} SIM_LINE_CHAR;
+
+static uint64_t gCycles = 0;
+static std::vector<SIM_LINE_CHAR> gLine;
+static uint32_t gLineGen = 0;
+static SimCard *gCard = NULL;
+
+// Card contact state, as of the last simCardPoll()
+static bool gCardPowered = false;
+static bool gCardRunning = false;
+static bool gCardRst = false, gCardClk = false, gCardIo = true;
+static bool gCardHold = false;
+
+
+/****************************************************************************
+ * Registers
+ */
+
+volatile uint8_t PORTB, PORTC, PORTD;
+volatile uint8_t DDRB, DDRC, DDRD;
+volatile uint8_t SREG, GTCCR;
+volatile uint8_t TIFR0;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile uint16_t ICR1, OCR1A;
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, TIMSK2;
+
+// Timer0 overflow count, kept by the Arduino core's Timer0 ISR
+volatile unsigned long timer0_overflow_count;
+
+// The core's millis() count. millis() here comes from the cycle count, so
+// this is only for tbCatchUp() to write to.
+volatile unsigned long timer0_millis;
+
+/// Card clock running (Timer1 PWM started)
+static bool cardClockOn(void)
+{
+	return (TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) != 0;
+}
+
+static uint8_t readPinB(void)
+{
+	simAdvance(SIM_POLL_CYCLES);
+	// The card clock output reads back as the clock
+	return PORTB | (cardClockOn() && (gCycles & 2) ? _BV(CARD_CLKOUT_BIT) : 0);
+}
+
+static uint8_t readPinC(void)
+{
+	simAdvance(SIM_POLL_CYCLES);
+	return PORTC;
+}
+
+static uint8_t readPinD(void)
+{
+	uint8_t val;
+
+	simAdvance(SIM_POLL_CYCLES);
+	val = PORTD & ~_BV(CARD_DATA_RX_BIT);
+	if (simLineLevel(simClocks())) {
+		val |= _BV(CARD_DATA_RX_BIT);
+	}
+	return val;
+}
+
+// Writing a 1 to a PINx bit toggles the PORTx bit
+static void writePinB(uint8_t val) { PORTB ^= val; }
+static void writePinC(uint8_t val) { PORTC ^= val; }
+static void writePinD(uint8_t val) { PORTD ^= val; }
+
+// Timer0 and Timer2 count CPU clocks -- see timebase.cpp
+static uint8_t readTcnt0(void)
+{
+	simAdvance(SIM_POLL_CYCLES);
+	return (gCycles / 64) & 0xFF;
+}
+
+static uint8_t readTcnt2(void)
+{
+	return gCycles % 64;
+}
+
+// The card clock is looped back into ICP1, so the capture flag is always set
+// while it runs
+static uint8_t readTifr1(void)
+{
+	return cardClockOn() ? _BV(ICF1) : 0;
+}
+
+static void writeIgnore(uint8_t val)
+{
+	(void)val;
+}
+
+SimReg PINB(readPinB, writePinB);
+SimReg PINC(readPinC, writePinC);
+SimReg PIND(readPinD, writePinD);
+SimReg TCNT0(readTcnt0, writeIgnore);
+SimReg TCNT2(readTcnt2, writeIgnore);
+SimReg TIFR1(readTifr1, writeIgnore);
+
+
+/****************************************************************************
+ * Time
+ */
+
+uint64_t simCycles(void)
+{
+	return gCycles;
+}
+
+
+void simAdvance(uint64_t cycles)
+{
+	gCycles += cycles;
+	timer0_overflow_count = gCycles / (64 * 256);
+	simCardPoll();
+	simSerialPoll();
+}
+
+
+void _delay_loop_1(uint8_t count)
+{
+	simAdvance(3 * (count ? count : 256));
+}
+
+
+void _delay_loop_2(uint16_t count)
+{
+	simAdvance(4 * (count ? count : 65536UL));
+}
+
+
+/****************************************************************************
+ * I/O line
+ */
+
+void simLineDrive(uint8_t src, uint64_t t, uint16_t etu, uint16_t bits, uint8_t nBits)
+{
+	SIM_LINE_CHAR c = { src, nBits, etu, bits, t };
+	uint64_t now = simClocks();
+
+	// Forget old characters
+	for (size_t i = 0; i < gLine.size(); ) {
+		const SIM_LINE_CHAR *p = &gLine[i];
+		if ((p->t + ((uint64_t)p->nBits * p->etu) + SIM_LINE_HISTORY) < now) {
+			gLine.erase(gLine.begin() + i);
+		} else {
+			i++;
+		}
+	}
+
+	gLine.push_back(c);
+	gLineGen++;
+}
+
+
+void simLineHold(bool low)
+{
+	gCardHold = low;
+}
+
+
+uint32_t simLineGeneration(void)
+{
+	return gLineGen;
+}
+
+
+bool simLineLevel(uint64_t t)
+{
+	// The reader can hold the line low with its TX pin
+	if (!(PORTD & _BV(CARD_DATA_TX_BIT)) || gCardHold) {
+		return false;
+	}
+
+	// Open drain -- anyone sending a 0 pulls the line low
+	for (const SIM_LINE_CHAR &c : gLine) {
+		if ((t >= c.t) && (t < (c.t + ((uint64_t)c.nBits * c.etu)))) {
+			if (!((c.bits >> ((t - c.t) / c.etu)) & 1)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+uint64_t simLineNextFall(uint64_t from)
+{
+	uint64_t first = SIM_NEVER;
+
+	// Falling edges can only be at the start of a low bit
+	for (const SIM_LINE_CHAR &c : gLine) {
+		for (uint8_t i = 0; i < c.nBits; i++) {
+			uint64_t t = c.t + ((uint64_t)i * c.etu);
+
+			if ((t < from) || (t >= first) || ((c.bits >> i) & 1)) {
+				continue;
+			}
+			if (((i > 0) && !((c.bits >> (i - 1)) & 1)) || ((t > 0) && !simLineLevel(t - 1))) {
+				continue;
+			}
+			first = t;
+		}
+	}
+
+	return first;
+}
+
+
+uint8_t simLineSample(uint64_t t, uint16_t etu, bool *parity)
+{
+	uint8_t val = 0;
+
+	for (uint8_t i = 0; i < 8; i++) {
+		if (simLineLevel(t + ((i + 1) * etu) + (etu / 2))) {
+			val |= 1 << i;
+		}
+	}
+	*parity = simLineLevel(t + (9 * etu) + (etu / 2));
+
+	return val;
+}
+
+
+/****************************************************************************
+ * Card
+ */
+
+/// Bit-reverse and invert, for the inverse convention
+static uint8_t simInverse(uint8_t val)
+{
+	uint8_t c = 0;
+
+	for (uint8_t i = 0; i < 8; i++) {
+		if (!(val & (1 << i))) {
+			c |= 1 << (7 - i);
+		}
+	}
+	return c;
+}
+
+/// Number of 1 bits
+static uint8_t simOnes(uint8_t val)
+{
+	uint8_t n = 0;
+
+	for (; val != 0; val >>= 1) {
+		n += val & 1;
+	}
+	return n;
+}
+
+
+uint64_t SimCard::send(uint8_t val, uint64_t t, bool badParity)
+{
+	uint8_t raw = inverse ? simInverse(val) : val;
+
+	// Direct convention: an even number of 1s (high) in the data and parity.
+	// Inverse convention: an even number of 0s, so an odd number of 1s.
+	bool parity = ((simOnes(raw) & 1) != 0) ^ inverse ^ badParity;
+	uint64_t start = max(t, txFree);
+
+	// Start bit (0), data, parity
+	simLineDrive(SIM_SRC_CARD, start, etu, ((uint16_t)raw << 1) | ((uint16_t)parity << 9), 10);
+	txFree = start + ((12 + extraGuard) * (uint64_t)etu);
+
+	return start;
+}
+
+
+void SimCard::hold(bool low)
+{
+	simLineHold(low);
+}
+
+
+void simCardPoll(void)
+{
+	bool powered = !(CARD_NVCCEN_PORT & _BV(CARD_NVCCEN_BIT));
+	bool rst = (CARD_RESET_PORT & _BV(CARD_RESET_BIT)) != 0;
+	bool clk = !cardClockOn() && (CARD_CLKOUT_PORT & _BV(CARD_CLKOUT_BIT));
+	bool io = (PORTD & _BV(CARD_DATA_TX_BIT)) != 0;
+	bool running = powered && cardClockOn() && rst;
+	uint64_t now = simClocks();
+
+	if (gCard == NULL) {
+		return;
+	}
+
+	// Power down or reset: drop everything the card hasn't sent yet
+	if ((gCardPowered && !powered) || (gCardRunning && !running)) {
+		for (size_t i = 0; i < gLine.size(); ) {
+			if ((gLine[i].src == SIM_SRC_CARD) && (gLine[i].t >= now)) {
+				gLine.erase(gLine.begin() + i);
+			} else {
+				i++;
+			}
+		}
+		gLineGen++;
+		gCard->txFree = now;
+		gCardHold = false;
+		gCard->onPowerOff();
+	}
+
+	if (powered && ((rst != gCardRst) || (clk != gCardClk) || (io != gCardIo))) {
+		gCard->onContacts(rst, clk, io, now);
+	}
+	gCardRst = rst;
+	gCardClk = clk;
+	gCardIo = io;
+
+	gCardPowered = powered;
+	if (running && !gCardRunning) {
+		gCardRunning = true;
+		gCard->onReset(now);
+	}
+	gCardRunning = running;
+}
+
+
+void simReaderSent(uint64_t t)
+{
+	uint8_t raw;
+	bool parity, parityOk;
+
+	if ((gCard == NULL) || !gCardRunning) {
+		return;
+	}
+
+	// The card samples at its own Etu, so a reader at the wrong baud rate is
+	// heard as rubbish
+	raw = simLineSample(t, gCard->etu, &parity);
+	parityOk = (((simOnes(raw) & 1) != 0) ^ gCard->inverse) == parity;
+
+	gCard->onReceive(gCard->inverse ? simInverse(raw) : raw, parityOk, t);
+}
+
+
+void simInsertCard(SimCard *card)
+{
+	gCard = card;
+	gCardPowered = gCardRunning = false;
+	gCardHold = false;
+}
+
+
+/****************************************************************************
+ * EEPROM
+ */
+
+bool simEepromLoad(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL) {
+		return false;
+	}
+	fread(EEPROM.mem, 1, sizeof(EEPROM.mem), f);
+	fclose(f);
+	return true;
+}
+
+
+bool simEepromSave(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+
+	if (f == NULL) {
+		return false;
+	}
+	fwrite(EEPROM.mem, 1, sizeof(EEPROM.mem), f);
+	fclose(f);
+	return true;
+}
@@ -0,0 +1,152 @@
+#ifndef SIM_H
+#define SIM_H
+
+/***
+ * Host build: simulated time, card I/O line and card.
+ *
+ * Nothing runs in the background. Time only moves on when the firmware waits
+ * (delay(), busy-waits on millis() or tbNow(), polling a pin, sending a
+ * character), and the card is run in step with it: the port and timer
+ * registers are checked every time the clock moves, and the card is told
+ * when it is powered up and released from reset, or when the reader sends it
+ * a character. The card schedules its replies on the I/O line, and the
+ * firmware's receive code samples the line, so the timing the firmware sees
+ * is the timing the card asked for.
+ *
+ * All times on the line are in card clocks (CPU clocks / 4).
+ */
+
+#include <stdint.h>
+
+/// CPU clocks charged for each poll of a timer, pin or serial port -- a
+/// stand-in for the loop around it
+#define SIM_POLL_CYCLES		8
+
+/// Who is driving the I/O line
+#define SIM_SRC_READER		0
+#define SIM_SRC_CARD		1
+
+/// No falling edge, from simLineNextFall()
+#define SIM_NEVER			UINT64_MAX
+
+
+/**
+ * A simulated card. Override the event handlers and use send() to reply.
+ */
+class SimCard {
+public:
+	virtual ~SimCard() {}
+
+	/// Powered up and released from reset at t (card clocks). Send the ATR.
+	virtual void onReset(uint64_t t) = 0;
+
+	/// Character from the reader, in the card's convention. t is the leading
+	/// edge of its start bit.
+	virtual void onReceive(uint8_t val, bool parityOk, uint64_t t) = 0;
+
+	/**
+	 * Contacts changed while powered, for synchronous cards which are clocked
+	 * by hand. The clock is only seen while the card clock isn't running.
+	 *
+	 * @param	rst		Reset pin (true = high)
+	 * @param	clk		Clock pin
+	 * @param	io		Reader's I/O output (true = released)
+	 */
+	virtual void onContacts(bool rst, bool clk, bool io, uint64_t t)
+	{
+		(void)rst; (void)clk; (void)io; (void)t;
+	}
+
+	/// Powered down or put into reset. Anything not sent yet has been dropped.
+	virtual void onPowerOff(void) {}
+
+	uint16_t etu = 372;			///< Etu, card clocks
+	bool inverse = false;		///< Inverse convention
+	uint8_t extraGuard = 0;		///< Extra guard time between characters sent, Etu
+
+protected:
+	/**
+	 * Send a character, no earlier than t and no sooner than the guard time
+	 * after the last one.
+	 *
+	 * @param	badParity	Send the wrong parity bit
+	 * @return Time of the start bit
+	 */
+	uint64_t send(uint8_t val, uint64_t t, bool badParity = false);
+
+	/// Hold the I/O line low, or release it (synchronous cards)
+	void hold(bool low);
+
+	uint64_t txFree = 0;		///< Time the line is free for the next character
+
+	friend void simCardPoll(void);
+};
+
+
+/// Current time, CPU clocks
+uint64_t simCycles(void);
+
+/// Current time, card clocks
+inline uint64_t simClocks(void) { return simCycles() / 4; }
+
+/// Move time on, running the card
+void simAdvance(uint64_t cycles);
+
+/// Check the card's power, clock and reset, and tell the card what changed
+void simCardPoll(void);
+
+/**
+ * Drive a character onto the I/O line.
+ *
+ * @param	src		SIM_SRC_xxx
+ * @param	t		Leading edge of the start bit
+ * @param	etu		Bit time
+ * @param	bits	Bit levels, first bit (the start bit) in bit 0
+ * @param	nBits	Number of bits. The line is released (high) after them.
+ */
+void simLineDrive(uint8_t src, uint64_t t, uint16_t etu, uint16_t bits, uint8_t nBits);
+
+/// The card holds the I/O line low (true) or lets it go
+void simLineHold(bool low);
+
+/// Changes every time something is added to or dropped from the line
+uint32_t simLineGeneration(void);
+
+/// Line level at time t (true = high)
+bool simLineLevel(uint64_t t);
+
+/// First falling edge at or after 'from', or SIM_NEVER
+uint64_t simLineNextFall(uint64_t from);
+
+/**
+ * Sample a character from the line: 8 data bits then the parity bit, each in
+ * the middle of its bit time.
+ *
+ * @param		t		Leading edge of the start bit
+ * @param		etu		Bit time
+ * @param[out]	parity	Parity bit level
+ * @return Data bits, first in bit 0
+ */
+uint8_t simLineSample(uint64_t t, uint16_t etu, bool *parity);
+
+/**
+ * The reader has sent a character (SoftwareSerialParity::write()). Passes it
+ * to the card, sampled at the card's own Etu.
+ *
+ * @param	t		Leading edge of the start bit
+ */
+void simReaderSent(uint64_t t);
+
+/// Run the card serial port's receiver (SoftwareSerialParity) up to now
+void simSerialPoll(void);
+
+/// Insert a card (NULL to take it out). The card isn't deleted.
+void simInsertCard(SimCard *card);
+
+/// Load the EEPROM from a file. Missing files are fine (the EEPROM is blank).
+bool simEepromLoad(const char *path);
+
+/// Save the EEPROM to a file
+bool simEepromSave(const char *path);
+
+#endif // SIM_H
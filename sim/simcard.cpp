@@ -0,0 +1,790 @@
+/***
+ * Host build: scriptable simulated cards (see simcard.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simcard.h"
+
+
+/// Procedure byte: NULL, the card is still busy
+#define SIM_NULL			0x60
+
+/// SLE4432: clocks a write to memory takes, with the I/O line held low
+#define SLE_PROGRAM_CLOCKS	124
+
+
+/****************************************************************************
+ * Script parsing
+ */
+
+/// Parse a hex number of at most 'max'
+static bool parseHexNum(const std::string &s, uint32_t max, uint32_t *val)
+{
+	char *end;
+	unsigned long v = strtoul(s.c_str(), &end, 16);
+
+	if (s.empty() || (*end != '\0') || (v > max)) {
+		return false;
+	}
+	*val = v;
+	return true;
+}
+
+/// Parse a decimal number
+static bool parseDecNum(const std::string &s, uint32_t *val)
+{
+	char *end;
+	unsigned long v = strtoul(s.c_str(), &end, 10);
+
+	if (s.empty() || (*end != '\0')) {
+		return false;
+	}
+	*val = v;
+	return true;
+}
+
+/// Parse hex bytes from words[from] on. Words may hold several bytes ("3B00").
+static bool parseHexBytes(const std::vector<std::string> &words, size_t from, std::vector<uint8_t> *out)
+{
+	out->clear();
+	for (size_t i = from; i < words.size(); i++) {
+		const std::string &w = words[i];
+		uint32_t val;
+
+		if ((w.length() % 2) != 0) {
+			if ((w.length() != 1) || !parseHexNum(w, 0xFF, &val)) {
+				return false;
+			}
+			out->push_back(val);
+			continue;
+		}
+		for (size_t j = 0; j < w.length(); j += 2) {
+			if (!parseHexNum(w.substr(j, 2), 0xFF, &val)) {
+				return false;
+			}
+			out->push_back(val);
+		}
+	}
+	return true;
+}
+
+
+/****************************************************************************
+ * ISO7816 T=0 card
+ */
+
+/// Command data direction, as the firmware sees it
+#define SIM_DIR_NONE		0
+#define SIM_DIR_SEND		1
+#define SIM_DIR_RECV		2
+
+/// What to do about a wrong P3
+#define SIM_WRONGLEN_SW		0
+#define SIM_WRONGLEN_6C		1
+#define SIM_WRONGLEN_ACCEPT	2
+#define SIM_WRONGLEN_MUTE	3
+
+/// A command the card knows
+typedef struct {
+	uint8_t cla, ins;
+	int16_t p1, p2;				///< -1 = any
+	uint8_t dir;				///< SIM_DIR_xxx
+	int16_t len;				///< Expected P3, -1 = any
+	uint32_t delay;				///< Processing time, card clocks
+	uint16_t sw;
+	std::vector<uint8_t> data;
+	bool used;					///< Has answered since reset
+} SIM_CMD;
+
+
+class SimT0Card : public SimScriptCard {
+public:
+	std::string config(const std::vector<std::string> &words);
+	std::string finish(void);
+
+	void onReset(uint64_t t);
+	void onReceive(uint8_t val, bool parityOk, uint64_t t);
+	void onPowerOff(void) { state = ST_OFF; }
+
+private:
+	enum { ST_OFF, ST_HEADER, ST_DATA, ST_WEDGED };
+
+	/// Send a character, counting it for the parity fault
+	uint64_t tx(uint8_t val, uint64_t t);
+
+	/// Be busy for 'delay' from t, sending NULLs if they're on. Returns the end.
+	uint64_t busy(uint64_t t, uint32_t delay);
+
+	/// Send the status word, and go back to waiting for a header
+	void status(uint16_t sw, uint64_t t);
+
+	/// A whole header has arrived
+	void command(uint64_t t);
+
+	/// Find the command for the header
+	SIM_CMD *lookup(void);
+
+	// Settings
+	std::vector<uint8_t> atr;
+	uint32_t atrDelay = 10000;
+	uint16_t atrEtu = 372;
+	bool useTa1 = true;
+	int guard = -1;				///< -1 = from TC1
+	uint16_t turnaround = 16;
+	int64_t nullEvery = -1;		///< -1 = from TC2
+	bool ackOne = false;
+	uint8_t wrongLen = SIM_WRONGLEN_SW;
+	uint16_t wrongLenSw = 0x6700;
+	uint16_t claSw = 0x6E00;
+	uint16_t defaultSw = 0x6D00;
+	std::vector<SIM_CMD> cmds;
+	uint32_t faultMute = 0, faultWedge = 0, faultParity = 0;
+
+	// Worked out from the ATR
+	uint16_t runEtu = 372;		///< Etu after the ATR
+	uint8_t runGuard = 0;
+	uint64_t runNullEvery = 0;
+
+	// State since reset
+	uint8_t state = ST_OFF;
+	uint8_t hdr[5];
+	uint8_t nHdr = 0;
+	SIM_CMD *cur = NULL;		///< Command receiving data
+	uint16_t nData = 0, dataLen = 0;
+	uint32_t nCmds = 0;
+	uint32_t nSent = 0;
+	uint64_t lastRx = 0;		///< Start of the last character received
+	uint64_t quietUntil = 0;	///< Ignore the reader until the reply is done
+};
+
+
+std::string SimT0Card::config(const std::vector<std::string> &words)
+{
+	const std::string &key = words[0];
+	uint32_t val;
+
+	if (key == "atr") {
+		if (!parseHexBytes(words, 1, &atr) || (atr.size() < 2) || (atr.size() > 33) ||
+				((atr[0] != 0x3B) && (atr[0] != 0x3F))) {
+			return "bad ATR (2 to 33 bytes, starting 3B or 3F)";
+		}
+	} else if ((key == "atr-delay") && (words.size() == 2) && parseDecNum(words[1], &val)) {
+		atrDelay = val;
+	} else if ((key == "atr-etu") && (words.size() == 2) && parseDecNum(words[1], &val) && (val >= 31) && (val <= 1024)) {
+		atrEtu = val;
+	} else if ((key == "ta1") && (words.size() == 2) && ((words[1] == "use") || (words[1] == "ignore"))) {
+		useTa1 = (words[1] == "use");
+	} else if ((key == "guard") && (words.size() == 2) && parseDecNum(words[1], &val) && (val < 255)) {
+		guard = val;
+	} else if ((key == "turnaround") && (words.size() == 2) && parseDecNum(words[1], &val) && (val >= 11)) {
+		turnaround = val;
+	} else if ((key == "null") && (words.size() == 2) && parseDecNum(words[1], &val)) {
+		nullEvery = val;
+	} else if ((key == "ack") && (words.size() == 2) && ((words[1] == "all") || (words[1] == "one"))) {
+		ackOne = (words[1] == "one");
+	} else if ((key == "wrong-len") && (words.size() == 2)) {
+		if (words[1] == "6c") {
+			wrongLen = SIM_WRONGLEN_6C;
+		} else if (words[1] == "accept") {
+			wrongLen = SIM_WRONGLEN_ACCEPT;
+		} else if (words[1] == "mute") {
+			wrongLen = SIM_WRONGLEN_MUTE;
+		} else if (parseHexNum(words[1], 0xFFFF, &val)) {
+			wrongLen = SIM_WRONGLEN_SW;
+			wrongLenSw = val;
+		} else {
+			return "wrong-len must be a SW, 6c, accept or mute";
+		}
+	} else if ((key == "cla-sw") && (words.size() == 2) && parseHexNum(words[1], 0xFFFF, &val)) {
+		claSw = val;
+	} else if ((key == "default") && (words.size() == 2) && parseHexNum(words[1], 0xFFFF, &val)) {
+		defaultSw = val;
+	} else if (key == "fault") {
+		if ((words.size() != 3) || !parseDecNum(words[2], &val) || (val == 0)) {
+			return "fault needs a type and a count from 1";
+		}
+		if (words[1] == "mute") {
+			faultMute = val;
+		} else if (words[1] == "wedge") {
+			faultWedge = val;
+		} else if (words[1] == "parity") {
+			faultParity = val;
+		} else {
+			return "fault must be mute, wedge or parity";
+		}
+	} else if (key == "cmd") {
+		SIM_CMD c = { 0, 0, -1, -1, SIM_DIR_NONE, -1, 0, 0x9000, {}, false };
+		bool hasLen = false;
+		uint32_t cla, ins;
+		size_t i;
+
+		if ((words.size() < 3) || !parseHexNum(words[1], 0xFF, &cla) || !parseHexNum(words[2], 0xFF, &ins)) {
+			return "cmd needs a CLA and INS";
+		}
+		c.cla = cla;
+		c.ins = ins;
+
+		for (i = 3; i < words.size(); i++) {
+			const std::string &w = words[i];
+			bool hasArg = (i + 1) < words.size();
+
+			if (w == "send") {
+				c.dir = SIM_DIR_SEND;
+			} else if (w == "recv") {
+				c.dir = SIM_DIR_RECV;
+			} else if ((w == "p1") && hasArg && parseHexNum(words[i + 1], 0xFF, &val)) {
+				c.p1 = val;
+				i++;
+			} else if ((w == "p2") && hasArg && parseHexNum(words[i + 1], 0xFF, &val)) {
+				c.p2 = val;
+				i++;
+			} else if ((w == "len") && hasArg && (words[i + 1] == "*")) {
+				hasLen = true;
+				i++;
+			} else if ((w == "len") && hasArg && parseHexNum(words[i + 1], 0xFF, &val)) {
+				c.len = val;
+				hasLen = true;
+				i++;
+			} else if ((w == "delay") && hasArg && parseDecNum(words[i + 1], &val)) {
+				c.delay = val;
+				i++;
+			} else if ((w == "sw") && hasArg && parseHexNum(words[i + 1], 0xFFFF, &val)) {
+				c.sw = val;
+				i++;
+			} else if (w == "data") {
+				if (!parseHexBytes(words, i + 1, &c.data)) {
+					return "bad data bytes";
+				}
+				break;
+			} else {
+				return "don't understand '" + w + "'";
+			}
+		}
+
+		if (!c.data.empty() && (c.dir == SIM_DIR_NONE)) {
+			c.dir = SIM_DIR_RECV;
+		}
+		if (!hasLen && (c.dir == SIM_DIR_RECV)) {
+			c.len = c.data.size() & 0xFF;
+		}
+		cmds.push_back(c);
+	} else {
+		return "don't understand '" + key + "' (or its arguments)";
+	}
+
+	return "";
+}
+
+
+std::string SimT0Card::finish(void)
+{
+	// Interface bytes from the ATR
+	const uint16_t DI_TABLE[16] = { 0, 1, 2, 4, 8, 16, 32, 64, 12, 20, 0, 0, 0, 0, 0, 0 };
+	const uint16_t FI_TABLE[16] = { 372, 372, 558, 744, 1116, 1488, 1860, 0, 0, 512, 768, 1024, 1536, 2048, 0, 0 };
+	int ta1 = -1, tc1 = -1, tc2 = -1;
+	uint16_t fi = 372;
+
+	if (atr.empty()) {
+		return "no ATR";
+	}
+
+	for (size_t i = 1, level = 1; i < atr.size(); level++) {
+		uint8_t td = atr[i++];
+
+		if ((td & 0x10) && (i < atr.size())) {
+			if (level == 1) ta1 = atr[i];
+			i++;
+		}
+		if (td & 0x20) {
+			i++;
+		}
+		if ((td & 0x40) && (i < atr.size())) {
+			if (level == 1) tc1 = atr[i];
+			if (level == 2) tc2 = atr[i];
+			i++;
+		}
+		if (!(td & 0x80)) {
+			break;
+		}
+	}
+
+	runEtu = atrEtu;
+	if (useTa1 && (ta1 >= 0)) {
+		uint16_t di = DI_TABLE[ta1 & 0x0F];
+
+		fi = FI_TABLE[(ta1 >> 4) & 0x0F];
+		if ((di == 0) || (fi == 0)) {
+			return "ATR has an invalid TA1 (use 'ta1 ignore')";
+		}
+		runEtu = ((uint32_t)fi * atrEtu) / (di * 372UL);
+	}
+
+	runGuard = (guard >= 0) ? guard : ((tc1 >= 0) && (tc1 != 255)) ? tc1 : 0;
+
+	// WT = WI x 960 x Fi clocks -- stay well inside it
+	if (nullEvery >= 0) {
+		runNullEvery = nullEvery;
+	} else {
+		runNullEvery = ((uint64_t)((tc2 > 0) ? tc2 : 10) * 960 * ((fi * (uint32_t)atrEtu) / 372)) / 2;
+	}
+
+	return "";
+}
+
+
+uint64_t SimT0Card::tx(uint8_t val, uint64_t t)
+{
+	uint64_t start;
+
+	// A flipped bit, so the parity bit (worked out for the real value) is wrong
+	if (++nSent == faultParity) {
+		start = send(val ^ 0x10, t, true);
+	} else {
+		start = send(val, t);
+	}
+	quietUntil = start + (10 * (uint64_t)etu);
+	return start;
+}
+
+
+uint64_t SimT0Card::busy(uint64_t t, uint32_t delay)
+{
+	while ((runNullEvery > 0) && (delay > runNullEvery)) {
+		t += runNullEvery;
+		delay -= runNullEvery;
+		tx(SIM_NULL, t);
+	}
+	return t + delay;
+}
+
+
+void SimT0Card::status(uint16_t sw, uint64_t t)
+{
+	t = tx(sw >> 8, t);
+	tx(sw & 0xFF, t);
+	state = ST_HEADER;
+	nHdr = 0;
+}
+
+
+void SimT0Card::onReset(uint64_t t)
+{
+	etu = atrEtu;
+	inverse = (atr[0] == 0x3F);
+
+	for (SIM_CMD &c : cmds) {
+		c.used = false;
+	}
+	nHdr = 0;
+	nCmds = 0;
+	nSent = 0;
+	lastRx = 0;
+	cur = NULL;
+
+	t += atrDelay;
+	for (uint8_t b : atr) {
+		t = tx(b, t);
+	}
+
+	// The ATR is on the line at its own rate, everything after is at the new one
+	etu = runEtu;
+	state = ST_HEADER;
+}
+
+
+SIM_CMD *SimT0Card::lookup(void)
+{
+	SIM_CMD *last = NULL;
+
+	for (SIM_CMD &c : cmds) {
+		if ((c.cla != hdr[0]) || (c.ins != hdr[1]) ||
+				((c.p1 >= 0) && (c.p1 != hdr[2])) || ((c.p2 >= 0) && (c.p2 != hdr[3]))) {
+			continue;
+		}
+		if (!c.used) {
+			c.used = true;
+			return &c;
+		}
+		last = &c;
+	}
+
+	return last;
+}
+
+
+void SimT0Card::command(uint64_t t)
+{
+	SIM_CMD *c;
+	uint16_t len;
+	bool claKnown = false;
+
+	nCmds++;
+	if ((faultWedge > 0) && (nCmds >= faultWedge)) {
+		state = ST_WEDGED;
+		return;
+	}
+	nHdr = 0;
+	if (nCmds == faultMute) {
+		return;
+	}
+
+	// The reply starts 'turnaround' after the start of the last header byte
+	t += (uint64_t)turnaround * etu;
+
+	c = lookup();
+	if (c == NULL) {
+		for (const SIM_CMD &k : cmds) {
+			claKnown |= (k.cla == hdr[0]);
+		}
+		status((cmds.empty() || claKnown) ? defaultSw : claSw, t);
+		return;
+	}
+
+	// P3 = 0 asks for 256 bytes
+	len = ((c->dir == SIM_DIR_RECV) && (hdr[4] == 0)) ? 256 : hdr[4];
+	if ((c->dir != SIM_DIR_NONE) && (c->len >= 0) && (hdr[4] != c->len)) {
+		switch (wrongLen) {
+			case SIM_WRONGLEN_SW:		status(wrongLenSw, t); return;
+			case SIM_WRONGLEN_6C:		status(0x6C00 | c->len, t); return;
+			case SIM_WRONGLEN_MUTE:		return;
+			default:					break;
+		}
+	}
+
+	switch (c->dir) {
+		case SIM_DIR_NONE:
+			status(c->sw, busy(t, c->delay));
+			break;
+
+		case SIM_DIR_RECV:
+			t = busy(t, c->delay);
+			if (!ackOne) {
+				t = tx(hdr[1], t);
+			}
+			for (uint16_t i = 0; i < len; i++) {
+				if (ackOne) {
+					t = tx(~hdr[1], t);
+				}
+				t = tx((i < c->data.size()) ? c->data[i] : 0, t);
+			}
+			status(c->sw, t);
+			break;
+
+		case SIM_DIR_SEND:
+			cur = c;
+			nData = 0;
+			dataLen = len;
+			if (len == 0) {
+				status(c->sw, busy(t, c->delay));
+				break;
+			}
+			tx(ackOne ? ~hdr[1] : hdr[1], t);
+			state = ST_DATA;
+			break;
+	}
+}
+
+
+void SimT0Card::onReceive(uint8_t val, bool parityOk, uint64_t t)
+{
+	// Half an Etu of slack: the reader's rate comes from its own measurement
+	// of TS, which can be a clock or two out
+	bool tooClose = (lastRx > 0) && ((t + (etu / 2)) < (lastRx + ((12 + runGuard) * (uint64_t)etu)));
+
+	if ((state != ST_HEADER) && (state != ST_DATA)) {
+		return;
+	}
+
+	// Not listening while it's talking
+	if (t < quietUntil) {
+		return;
+	}
+	lastRx = t;
+
+	// Too soon after the last one, the card wasn't ready for it
+	if (tooClose) {
+		return;
+	}
+
+	// Error signal: hold the line low from 10.5 Etu for 1 Etu, and lose the
+	// character
+	if (!parityOk) {
+		simLineDrive(SIM_SRC_CARD, t + ((21 * (uint64_t)etu) / 2), etu, 0, 1);
+		return;
+	}
+
+	if (state == ST_HEADER) {
+		hdr[nHdr++] = val;
+		if (nHdr == 5) {
+			command(t);
+		}
+	} else {
+		nData++;
+		t += (uint64_t)turnaround * etu;
+		if (nData < dataLen) {
+			if (ackOne) {
+				tx(~hdr[1], t);
+			}
+		} else {
+			status(cur->sw, busy(t, cur->delay));
+		}
+	}
+}
+
+
+/****************************************************************************
+ * SLE4432 synchronous memory card
+ *
+ * Reset: RST high, a clock pulse, RST low. The card puts the first ATR bit
+ * on I/O at the falling edge of that clock, and the next bit at every
+ * falling edge after it.
+ *
+ * Commands: a start condition (I/O falls while CLK is high), 24 bits sampled
+ * at rising clock edges (control, address, data, LSB first), and a stop
+ * condition (I/O rises while CLK is high). Reads then output bits at each
+ * falling clock edge; writes hold I/O low while they program.
+ */
+
+#define SLE_READ_MAIN			0x30
+#define SLE_READ_PROTECTION		0x34
+#define SLE_UPDATE_MAIN			0x38
+#define SLE_WRITE_PROTECTION	0x3C
+
+class SimSle4432Card : public SimScriptCard {
+public:
+	SimSle4432Card()
+	{
+		memset(mem, 0xFF, sizeof(mem));
+		memset(prot, 0xFF, sizeof(prot));
+	}
+
+	std::string config(const std::vector<std::string> &words);
+
+	void onReset(uint64_t t) { (void)t; }
+	void onReceive(uint8_t val, bool parityOk, uint64_t t) { (void)val; (void)parityOk; (void)t; }
+	void onContacts(bool rst, bool clk, bool io, uint64_t t);
+	void onPowerOff(void);
+
+private:
+	enum { ST_IDLE, ST_COMMAND, ST_OUTPUT };
+
+	/// Output bytes, LSB first, from the next falling clock edge
+	void output(const uint8_t *buf, size_t len);
+
+	/// Run a command
+	void command(uint8_t control, uint8_t addr, uint8_t data);
+
+	uint8_t mem[256];
+	uint8_t prot[4];
+
+	uint8_t state = ST_IDLE;
+	bool rst = false, clk = false, io = true;
+	uint32_t cmdBits = 0;
+	uint8_t nCmdBits = 0;
+	std::vector<bool> out;
+	size_t outPos = 0;
+};
+
+
+std::string SimSle4432Card::config(const std::vector<std::string> &words)
+{
+	const std::string &key = words[0];
+	std::vector<uint8_t> bytes;
+	uint32_t addr;
+
+	if (key == "atr") {
+		if (!parseHexBytes(words, 1, &bytes) || (bytes.size() != 4)) {
+			return "an SLE4432 ATR is 4 bytes";
+		}
+		memcpy(mem, bytes.data(), 4);
+	} else if (key == "mem") {
+		if ((words.size() < 3) || !parseHexNum(words[1], 0xFF, &addr) || !parseHexBytes(words, 2, &bytes) ||
+				((addr + bytes.size()) > sizeof(mem))) {
+			return "mem needs an address and bytes which fit in 256";
+		}
+		memcpy(&mem[addr], bytes.data(), bytes.size());
+	} else if (key == "protect") {
+		if (!parseHexBytes(words, 1, &bytes) || (bytes.size() != 4)) {
+			return "protection memory is 4 bytes";
+		}
+		memcpy(prot, bytes.data(), 4);
+	} else {
+		return "don't understand '" + key + "' on an SLE4432";
+	}
+
+	return "";
+}
+
+
+void SimSle4432Card::output(const uint8_t *buf, size_t len)
+{
+	out.clear();
+	for (size_t i = 0; i < len; i++) {
+		for (uint8_t b = 0; b < 8; b++) {
+			out.push_back((buf[i] >> b) & 1);
+		}
+	}
+	outPos = 0;
+	state = ST_OUTPUT;
+}
+
+
+void SimSle4432Card::command(uint8_t control, uint8_t addr, uint8_t data)
+{
+	bool writable = (addr >= 32) || (prot[addr / 8] & (1 << (addr % 8)));
+
+	switch (control) {
+		case SLE_READ_MAIN:
+			output(&mem[addr], sizeof(mem) - addr);
+			break;
+
+		case SLE_READ_PROTECTION:
+			output(prot, sizeof(prot));
+			break;
+
+		case SLE_UPDATE_MAIN:
+		case SLE_WRITE_PROTECTION:
+			if (control == SLE_UPDATE_MAIN) {
+				if (writable) {
+					mem[addr] = data;
+				}
+			} else if ((addr < 32) && (mem[addr] == data)) {
+				prot[addr / 8] &= ~(1 << (addr % 8));
+			}
+			// Busy while it programs
+			out.assign(SLE_PROGRAM_CLOCKS, false);
+			outPos = 0;
+			state = ST_OUTPUT;
+			break;
+
+		default:
+			// No security memory on the 4432 -- I/O stays high
+			state = ST_IDLE;
+			break;
+	}
+}
+
+
+void SimSle4432Card::onContacts(bool newRst, bool newClk, bool newIo, uint64_t t)
+{
+	bool clkRise = newClk && !clk;
+	bool clkFall = !newClk && clk;
+	bool clkHigh = newClk && clk;
+
+	(void)t;
+
+	if (newRst) {
+		// Reset: the ATR comes out from the falling edge
+		if (clkFall) {
+			output(mem, 4);
+		}
+	} else if (clkHigh && io && !newIo) {
+		// Start condition, which also ends any output
+		state = ST_COMMAND;
+		cmdBits = 0;
+		nCmdBits = 0;
+		hold(false);
+	} else if (clkHigh && !io && newIo && (state == ST_COMMAND)) {
+		// Stop condition. The clock rising for it counts as a 25th bit.
+		if (nCmdBits >= 24) {
+			command(cmdBits & 0xFF, (cmdBits >> 8) & 0xFF, (cmdBits >> 16) & 0xFF);
+		} else {
+			state = ST_IDLE;
+		}
+	} else if (clkRise && (state == ST_COMMAND) && (nCmdBits < 32)) {
+		cmdBits |= (uint32_t)newIo << nCmdBits++;
+	}
+
+	if (clkFall && (state == ST_OUTPUT)) {
+		if (outPos < out.size()) {
+			hold(!out[outPos++]);
+		} else {
+			hold(false);
+			state = ST_IDLE;
+		}
+	}
+
+	rst = newRst;
+	clk = newClk;
+	io = newIo;
+}
+
+
+void SimSle4432Card::onPowerOff(void)
+{
+	state = ST_IDLE;
+	rst = clk = false;
+	io = true;
+}
+
+
+/****************************************************************************
+ * Loading
+ */
+
+SimScriptCard *simCardLoad(const std::string &script, std::string *err)
+{
+	std::vector<std::vector<std::string> > lines;
+	SimScriptCard *card;
+	size_t pos = 0;
+	std::string msg;
+
+	// Split into words, dropping comments
+	while (pos <= script.length()) {
+		size_t eol = script.find('\n', pos);
+		std::string line = script.substr(pos, (eol == std::string::npos) ? std::string::npos : eol - pos);
+		std::vector<std::string> words;
+		size_t i = 0;
+
+		pos = (eol == std::string::npos) ? script.length() + 1 : eol + 1;
+		line = line.substr(0, line.find('#'));
+		while ((i = line.find_first_not_of(" \t\r", i)) != std::string::npos) {
+			size_t end = line.find_first_of(" \t\r", i);
+			words.push_back(line.substr(i, end - i));
+			i = end;
+		}
+		lines.push_back(words);
+	}
+
+	// The type comes first, wherever it is
+	card = NULL;
+	for (const std::vector<std::string> &w : lines) {
+		if (!w.empty() && (w[0] == "type")) {
+			delete card;
+			if ((w.size() == 2) && (w[1] == "t0")) {
+				card = new SimT0Card();
+			} else if ((w.size() == 2) && (w[1] == "sle4432")) {
+				card = new SimSle4432Card();
+			} else {
+				*err = "type must be t0 or sle4432";
+				return NULL;
+			}
+		}
+	}
+	if (card == NULL) {
+		card = new SimT0Card();
+	}
+
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lines[i].empty() || (lines[i][0] == "type")) {
+			continue;
+		}
+		msg = card->config(lines[i]);
+		if (!msg.empty()) {
+			*err = "line " + std::to_string(i + 1) + ": " + msg;
+			delete card;
+			return NULL;
+		}
+	}
+
+	msg = card->finish();
+	if (!msg.empty()) {
+		*err = msg;
+		delete card;
+		return NULL;
+	}
+
+	return card;
+}
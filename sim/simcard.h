@@ -0,0 +1,97 @@
+#ifndef SIMCARD_H
+#define SIMCARD_H
+
+/***
+ * Host build: scriptable simulated cards.
+ *
+ * A card is described by a script, one setting per line ('#' starts a
+ * comment). Bytes, status words and lengths are hex; times and counts are
+ * decimal. Times are in card clocks unless they say Etu.
+ *
+ * ISO7816 T=0 cards (the default):
+ *
+ *   atr <bytes>          ATR, TS first (3B = direct, 3F = inverse convention)
+ *   atr-delay <clocks>   Reset released to the start of TS (default 10000)
+ *   atr-etu <clocks>     Etu the ATR is sent at (default 372)
+ *   ta1 use|ignore       Switch to TA1's rate after the ATR, as the firmware
+ *                        does, or stay at the ATR rate (default use)
+ *   guard <etu>          Extra guard time the card needs between the reader's
+ *                        characters; closer ones are lost (default TC1)
+ *   turnaround <etu>     Start of the reader's last character to the start of
+ *                        the card's reply (default 16)
+ *   null <clocks>        Send a NULL (60) this often while busy, 0 = never
+ *                        (default half the work waiting time, from TC2)
+ *   ack all|one          Procedure bytes: INS once, or ~INS before every
+ *                        data byte (default all)
+ *   wrong-len <sw>|6c|accept|mute
+ *                        P3 doesn't match the command's length: answer with
+ *                        this SW, 6C<length>, go ahead with P3 bytes, or say
+ *                        nothing (default 6700)
+ *   cla-sw <sw>          SW for a CLA no command uses, if there are any
+ *                        commands (default 6E00)
+ *   default <sw>         SW for any other unknown command (default 6D00)
+ *   cmd <cla> <ins> [p1 <xx>] [p2 <xx>] [send|recv] [len <xx>|*]
+ *       [delay <clocks>] [sw <sw>] [data <bytes>]
+ *                        A command. send/recv is the data direction as the
+ *                        firmware sees it (APDU_SEND/APDU_RECV); with neither
+ *                        the card answers with the SW straight after the
+ *                        header. len defaults to the data length (recv) or
+ *                        any (send). delay is the processing time: before the
+ *                        data (recv) or after it (send). sw defaults to 9000.
+ *                        If several commands match, the first one not used
+ *                        since reset answers, and the last one keeps answering.
+ *   fault mute <n>       Don't answer the n'th command after reset
+ *   fault wedge <n>      Stop answering from the n'th command until reset
+ *   fault parity <n>     Flip a bit in the n'th character sent after reset
+ *                        (TS is the first), which gives it a parity error
+ *
+ * The card also signals a parity error on characters it receives with one,
+ * and throws them away.
+ *
+ * SLE4432 synchronous memory cards ('type sle4432'):
+ *
+ *   atr <4 bytes>        First 4 bytes of memory, which are the ATR
+ *   mem <addr> <bytes>   Main memory contents (default FF)
+ *   protect <4 bytes>    Protection memory: a 0 bit protects the byte
+ *                        (default FF FF FF FF)
+ */
+
+#include <string>
+#include <vector>
+#include "sim.h"
+
+
+/**
+ * A card set up from a script.
+ */
+class SimScriptCard : public SimCard {
+public:
+	/**
+	 * Apply a script line.
+	 *
+	 * @param	words	The line, split at spaces
+	 * @return Error message, or empty on success
+	 */
+	virtual std::string config(const std::vector<std::string> &words) = 0;
+
+	/// The whole script has been read. Returns an error message or empty.
+	virtual std::string finish(void) { return ""; }
+};
+
+
+/**
+ * Load a card from a script.
+ *
+ * @param		script	Script text
+ * @param[out]	err		Error message, with the line number
+ * @return The card, or NULL on error
+ */
+SimScriptCard *simCardLoad(const std::string &script, std::string *err);
+
+/// Script for a built-in card, or NULL if there isn't one by that name
+const char *simCardPersonality(const std::string &name);
+
+/// Names of the built-in cards, space separated
+std::string simCardPersonalities(void);
+
+#endif // SIMCARD_H
@@ -0,0 +1,3 @@
+# -c videocrypt -x 'ack one'
+on
+vcserial
@@ -0,0 +1,2 @@
+# -c cryptoworks
+cwinfo
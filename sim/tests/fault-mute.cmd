@@ -0,0 +1,5 @@
+# -c videocrypt -x 'fault mute 3'
+on
+vcdecoem
+on
+vcserial
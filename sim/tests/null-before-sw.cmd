@@ -0,0 +1,3 @@
+# -c videocrypt -x 'null 20000'
+on
+vcdecoem
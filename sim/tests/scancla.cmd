@@ -0,0 +1,4 @@
+# -c videocrypt
+on
+scancla 52 54
+scache
@@ -0,0 +1,4 @@
+# -c videocrypt
+on
+vcdecoem
+vcdecoem loop 3 0
@@ -0,0 +1,16 @@
+#ifndef SIM_UTIL_CRC16_H
+#define SIM_UTIL_CRC16_H
+
+#include <stdint.h>
+
+/// CRC-16 (poly 0xA001), as avr-libc
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t a)
+{
+	crc ^= a;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+	}
+	return crc;
+}
+
+#endif // SIM_UTIL_CRC16_H
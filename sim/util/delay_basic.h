@@ -0,0 +1,12 @@
+#ifndef SIM_UTIL_DELAY_BASIC_H
+#define SIM_UTIL_DELAY_BASIC_H
+
+#include <stdint.h>
+
+/// 3 CPU clocks per iteration, as on the AVR. 0 means 256.
+void _delay_loop_1(uint8_t count);
+
+/// 4 CPU clocks per iteration, as on the AVR. 0 means 65536.
+void _delay_loop_2(uint16_t count);
+
+#endif // SIM_UTIL_DELAY_BASIC_H
@@ -2,6 +2,9 @@
 #include "SoftwareSerialParity.h"
 #include "hardware.h"
 #include "smartcard.h"
+#include "timebase.h"
+#include "session.h"
+#include "stats.h"
 #include "utils.h"
 
 
@@ -9,15 +12,17 @@
 #define APDU_DEBUG_DATA
 
 
-// Card clock rate
-#define CARD_CLOCK_HZ (3579545)
-
-// Initial ATR baud rate. Always 372 clocks per Etu.
+// Initial ATR baud rate, 372 clocks per Etu. Used until TS has been measured.
 #define ATR_BAUD (CARD_CLOCK_HZ / 372)
 
+// Shortest and longest Etu accepted from the TS measurement, in card clocks
+#define TS_ETU_MIN 31
+#define TS_ETU_MAX 1024
+
 
-// Guard time. 372(etudiv) / 3.579545MHz = ~104us
-const unsigned int GUARDTIME = (104*5);
+// Guard time in microseconds, 5 Etu. 372(etudiv) / 3.579545MHz = ~104us
+// Updated by cardBaud().
+static unsigned int gGuardTime = (104*5);
 
 
 // Smartcard serial port
@@ -26,9 +31,28 @@ SoftwareSerialParity scSerial(CARD_DATA_RX_PIN, CARD_DATA_TX_PIN);
 // Byte convention -- TRUE for inverse, FALSE for direct
 static bool gInverseConvention = false;
 
+// Cold reset timing for cardColdReset()
+CARD_RESET_TIMING gResetTiming = CARD_RESET_TIMING_DEFAULT;
+
 // Current smartcard baud rate
 static uint32_t gBaudRate = ATR_BAUD;
 
+// ATR Etu in card clocks, measured from TS
+static uint16_t gAtrEtu = 372;
+
+/**
+ * This is the Waiting Time -- WT. ISO7816-3:2006 section 7.2 and 10.2.
+ * 
+ * WT = WI x 960 x (Fi/f)
+ * WT = WI x 960 x (372 / 3579545)
+ * WT = 10 x 960 x (372 / 3579545)
+ * WT = 1 second
+ *
+ * Fi/f is the Etu measured from TS. Never less than APDU_WT_MIN_MS.
+ */
+#define APDU_WT_MIN_MS 1000UL
+static unsigned long gWaitTime = APDU_WT_MIN_MS;
+
 
 /**
  * Convert inverse-convention to direct-convention
@@ -59,7 +83,7 @@ void cardInit(void)
 /**
  * Turn card power on/off
  */
-void cardPower(const uint8_t on)
+void cardPower(const uint8_t on, const bool holdReset)
 {
 	if (!on) {
 		// card power off
@@ -76,6 +100,33 @@ void cardPower(const uint8_t on)
 		scPower(true);
 		SCDATA(1);		// I/O in receive mode
 		scClockFreerun(true);
+		if (!holdReset) {
+			scReset(false);
+		}
+	}
+}
+
+
+void cardColdReset(const bool holdReset)
+{
+	// power off, reset, no clock
+	SCRST(0);
+	scClockFreerun(false);
+	SCVCC(0);
+
+	// let Vcc discharge
+	if (gResetTiming.offTime >= 1000) {
+		delay(gResetTiming.offTime / 1000);
+	}
+	delayMicroseconds(gResetTiming.offTime % 1000);
+
+	// power up with the card in reset, then start the clock
+	SCVCC(1);
+	SCDATA(1);		// I/O in receive mode
+	scClockFreerun(true);
+	scDelayClocks(gResetTiming.holdClocks);
+
+	if (!holdReset) {
 		scReset(false);
 	}
 }
@@ -87,6 +138,37 @@ void cardBaud(const uint32_t baud)
 	// Inverse convention uses odd parity
 	scSerial.begin(baud, gInverseConvention ? ODD : EVEN, 2);
 	gBaudRate = baud;
+	gGuardTime = (5 * 1000000UL) / baud;
+}
+
+
+void cardSetGuardTime(const uint16_t us)
+{
+	gGuardTime = us;
+}
+
+
+void cardSetWaitTime(const unsigned long ms)
+{
+	gWaitTime = ms;
+}
+
+
+uint16_t cardGetGuardTime(void)
+{
+	return gGuardTime;
+}
+
+
+unsigned long cardGetWaitTime(void)
+{
+	return gWaitTime;
+}
+
+
+uint16_t cardGetAtrEtu(void)
+{
+	return gAtrEtu;
 }
 
 
@@ -94,20 +176,33 @@ void cardBaud(const uint32_t baud)
 /**
  * Read byte from smartcard
  */
-int scReadByte(int timeout_ms)
+int scReadByte(int timeout_ms, uint32_t *timestamp)
 {
 	unsigned long tdone = millis() + timeout_ms;	// FIXME need to figure out what the procedure byte timeout should be
+	uint32_t t;
 	int val = -1;
 	
 	while ((millis() < tdone) && (val == -1)) {
-		val = scSerial.read();
+		val = scSerial.read(&t);
+		if (val == -1) {
+			SESSION_DRAIN();
+		}
 	}
 	if (millis() >= tdone) {
 		// timeout
 		return -1;
 	} else {
+		// The receive timestamp is in the middle of the parity bit,
+		// 9.5 Etu after the leading edge of the start bit
+		t -= (19 * (CARD_CLOCK_HZ / gBaudRate)) / 2;
+		if (timestamp != NULL) {
+			*timestamp = t;
+		}
+
 		// TODO if Direct convention, return without inverting byte/bit convention
-		return gInverseConvention ? _inverse(val) : val;
+		val = gInverseConvention ? _inverse(val) : val;
+		SESSION_LOG(SE_RX, val, t);
+		return val;
 	}
 }
 
@@ -117,6 +212,8 @@ int scReadByte(int timeout_ms)
  */
 void scWriteByte(uint8_t b)
 {
+	SESSION_LOG(SE_TX, b, tbNow());
+
 	// If Direct convention, send without inverting byte/bit convention
 	if (gInverseConvention) {
 		scSerial.write(_inverse(b));
@@ -129,6 +226,82 @@ void scWriteByte(uint8_t b)
 // debug: trigger the scope on the first ATR byte
 //#define ATR_SCOPE_TRIG_FIRSTBYTE
 
+/// Card I/O line state (true = high)
+#define RXPIN() ((CARD_DATA_RX_RPORT & _BV(CARD_DATA_RX_BIT)) != 0)
+
+/**
+ * Receive TS, measuring the Etu from its edges.
+ *
+ * TS starts with the same pattern in both conventions: the start bit (low),
+ * two high bits, then a low bit. The time from the first rising edge to the
+ * next falling edge is exactly 2 Etu. The bit 4.5 Etu in gives the convention
+ * -- high for direct (3B), low for inverse (3F).
+ *
+ * Returns after the parity bit, with the card serial port not listening.
+ *
+ * @param		atrWait		millis() time to give up waiting for the start bit
+ * @param[out]	ts			TS value
+ * @param[out]	tStart		Time of the leading edge of the start bit
+ * @return Etu in card clocks, or 0 if TS didn't arrive or was out of range
+ */
+static uint16_t receiveTs(const unsigned long atrWait, uint8_t *ts, uint32_t *tStart)
+{
+	uint32_t tRise, tFall, etu2;
+	uint16_t etu, n;
+	bool direct;
+
+	// Wait for the start bit
+	while (RXPIN()) {
+		if (timeAfter(millis(), atrWait)) {
+			return 0;
+		}
+	}
+
+	// Timing critical from here. The start bit has to end within about
+	// 23ms, and the next bit within the same again.
+	noInterrupts();
+
+	n = 0;
+	while (!RXPIN()) {
+		if (++n == 0) {
+			goto fail;
+		}
+	}
+	tRise = tbNow();
+
+	n = 0;
+	while (RXPIN()) {
+		if (++n == 0) {
+			goto fail;
+		}
+	}
+	tFall = tbNow();
+
+	etu2 = tFall - tRise;
+	if ((etu2 < (2 * TS_ETU_MIN)) || (etu2 > (2 * TS_ETU_MAX))) {
+		goto fail;
+	}
+	etu = (etu2 + 1) / 2;
+
+	// Middle of the bit after the low bit (4.5 Etu in)
+	while ((tbNow() - tFall) < (etu + (etu / 2))) { }
+	direct = RXPIN();
+
+	interrupts();
+
+	// Wait for the end of the parity bit (10 Etu in), plus half an Etu
+	while ((tbNow() - tFall) < (uint32_t)((7 * etu) + (etu / 2))) { }
+
+	*ts = direct ? 0x3B : 0x3F;
+	*tStart = tRise - etu;
+	return etu;
+
+fail:
+	interrupts();
+	return 0;
+}
+
+
 // ATR state machine states
 typedef enum {
 	ATRS_TS,
@@ -137,16 +310,21 @@ typedef enum {
 	ATRS_TB,
 	ATRS_TC,
 	ATRS_TD,
+	ATRS_HIST,		///< Historical characters and TCK
 } ATR_STATE;
 
-int cardGetAtr(uint8_t *buf)
+int cardGetAtr(uint8_t *buf, const bool quiet, const unsigned int timeout_ms, ATR_TIMING *timing)
 {
 	int val;					// current incoming data byte
+	uint32_t t;					// current byte timestamp
 	int n = 0;					// byte count
 	int atrLen = 2;				// TS and T0 are mandatory
 	ATR_STATE state = ATRS_TS;	// ATR state machine state variable
+	uint8_t ts;					// TS value, from receiveTs()
+	uint16_t etu;				// measured Etu
 	uint8_t histLen = 0;		// historical character length
 	uint8_t tdFlags = 0;		// flags from most recent TDn
+	bool hasTck = false;		// TCK is on the end? (a protocol other than T=0)
 	uint8_t atr_ta;				// TA1 value
 	bool atr_has_ta = false;	// has TA1? (atr_ta is valid)
 
@@ -156,10 +334,45 @@ int cardGetAtr(uint8_t *buf)
 	// (we double this for safety)
 	// Increased (again!!!) to 500ms because Cryptoworks cards are slow to start up
 	//   CW ROM 01 and 03 take 300ms... 05 takes almost a full second!
-	unsigned long atrWait = millis() + 1000;
+	// (ATR_TIMEOUT_MS unless the caller knows better)
+	unsigned long atrWait = millis() + timeout_ms;
+	uint32_t tStart = tbNow();
 
-	// reset to ATR baud rate
-	cardBaud(ATR_BAUD);
+	SESSION_LOG(SE_RESET, 0, tStart);
+
+	// cardBaud() starts the serial port listening, so a baud change since
+	// the last ATR would have it take TS as well
+	scSerial.stopListening();
+
+	// Measure the Etu from TS and set the baud rate from it. If TS didn't
+	// look right, fall back to the standard rate and hope for the best.
+	etu = receiveTs(atrWait, &ts, &t);
+	if (etu != 0) {
+		gAtrEtu = etu;
+		gInverseConvention = (ts == 0x3F);
+		cardBaud(CARD_CLOCK_HZ / etu);
+
+		tbEvent(TB_EV_ATR, t);
+		if (timing != NULL) {
+			timing->tFirst = timing->tLast = t;
+		}
+		buf[n++] = ts;
+		SESSION_LOG(SE_RX, ts, t);
+		state = ATRS_T0;
+
+		// same as for every other byte below
+		unsigned long now = millis();
+		if (timeAfter(now, atrWait - 10)) {
+			atrWait = now + 10;
+		}
+	} else {
+		gAtrEtu = 372;
+		cardBaud(ATR_BAUD);
+	}
+
+	// Waiting time, 960 x WI Etu (WI = 10). Never less than a second, as some
+	// cards take longer than they should.
+	gWaitTime = max(APDU_WT_MIN_MS, (9600UL * gAtrEtu) / (CARD_CLOCK_HZ / 1000));
 
 	// start listening for ATR data
 	scSerial.listen();
@@ -167,11 +380,24 @@ int cardGetAtr(uint8_t *buf)
 	// keep looping until we have the whole ATR
 	while ((millis() < atrWait) && (n < atrLen)) {
 		// read serial byte
-		val = scSerial.read();
+		val = scSerial.read(&t);
 		if (val == -1) {
+			SESSION_DRAIN();
 			continue;
 		}
 
+		// Move the timestamp back to the start bit (9.5 Etu)
+		t -= (19 * gAtrEtu) / 2;
+		if (n == 0) {
+			tbEvent(TB_EV_ATR, t);
+		}
+		if (timing != NULL) {
+			if (n == 0) {
+				timing->tFirst = t;
+			}
+			timing->tLast = t;
+		}
+
 		// extend wait time for every successful byte received
 		unsigned long now = millis();
 		if (timeAfter(now, atrWait - 10)) {
@@ -198,6 +424,7 @@ int cardGetAtr(uint8_t *buf)
 			}
 		}
 		buf[n++] = val;
+		SESSION_LOG(SE_RX, val, t);
 
 		// ATR decode
 		switch (state) {
@@ -220,6 +447,10 @@ int cardGetAtr(uint8_t *buf)
 				if (state == ATRS_T0) {
 					histLen = (val & 0x0F);
 					atrLen += histLen;
+				} else if (((val & 0x0F) != 0) && !hasTck) {
+					// TDn offers a protocol other than T=0, so TCK follows
+					hasTck = true;
+					atrLen++;
 				}
 
 				// next byte will be...
@@ -231,25 +462,34 @@ int cardGetAtr(uint8_t *buf)
 					state = ATRS_TC;
 				} else if (tdFlags & 0x80) {
 					state = ATRS_TD;
+				} else {
+					state = ATRS_HIST;
 				}
 				break;
 
 			case ATRS_TA:
-				if (!atr_has_ta) {
+				// Only TA1 sets the baud rate, and it always follows T0
+				if (n == 3) {
 					atr_ta = val;
 					atr_has_ta = true;
 				}
 			case ATRS_TB:
 			case ATRS_TC:
-				// advance
-				if ((tdFlags & 0x10) && (state < ATRS_TB)) {
+				// advance to the next interface byte flagged in T0/TDn
+				if ((tdFlags & 0x20) && (state < ATRS_TB)) {
 					state = ATRS_TB;
-				} else if ((tdFlags & 0x20) && (state < ATRS_TC)) {
+				} else if ((tdFlags & 0x40) && (state < ATRS_TC)) {
 					state = ATRS_TC;
-				} else if ((tdFlags & 0x40) && (state < ATRS_TD)) {
+				} else if ((tdFlags & 0x80) && (state < ATRS_TD)) {
 					state = ATRS_TD;
+				} else {
+					state = ATRS_HIST;
 				}
-				break;	
+				break;
+
+			case ATRS_HIST:
+				// Nothing to decode, the length is already known
+				break;
 		}
 	}
 
@@ -265,54 +505,115 @@ int cardGetAtr(uint8_t *buf)
 		uint32_t baud;
 
 		if ((di == 0) || (fi == 0)) {
-			Serial.print(F("ERROR: Card has invalid Ta1=0x"));
-			Serial.println(atr_ta, HEX);
+			if (!quiet) {
+				Serial.print(F("ERROR: Card has invalid Ta1=0x"));
+				Serial.println(atr_ta, HEX);
+			}
 		} else {
- 			baud = (CARD_CLOCK_HZ * di) / fi;
- 			Serial.print(F("Card TA1 config: TA1=0x"));
- 			Serial.print(atr_ta, HEX);
- 			Serial.print(F(" Di="));
- 			Serial.print(di);
- 			Serial.print(F(" Fi="));
- 			Serial.print(fi);
- 			Serial.print(F(" Fclk(max)="));
- 			Serial.print(freq / 10);
- 			Serial.print('.');
- 			Serial.print(freq % 10);
- 			Serial.print(F(" MHz -- Etu/clk="));
- 			Serial.print(fi / di);
- 			Serial.print(F("; calculated Baud="));
- 			Serial.println(baud);
- 			cardBaud(baud);
+			// Fi/Di are relative to the Etu the card used for the ATR
+			baud = (((CARD_CLOCK_HZ * di) / fi) * 372UL) / gAtrEtu;
+			if (!quiet) {
+				Serial.print(F("Card TA1 config: TA1=0x"));
+				Serial.print(atr_ta, HEX);
+				Serial.print(F(" Di="));
+				Serial.print(di);
+				Serial.print(F(" Fi="));
+				Serial.print(fi);
+				Serial.print(F(" Fclk(max)="));
+				Serial.print(freq / 10);
+				Serial.print('.');
+				Serial.print(freq % 10);
+				Serial.print(F(" MHz -- Etu/clk="));
+				Serial.print(((uint32_t)fi * gAtrEtu) / (di * 372UL));
+				Serial.print(F("; calculated Baud="));
+				Serial.println(baud);
+			}
+			cardBaud(baud);
 		}
 	}
 
+	if (!quiet && (etu != 0)) {
+		Serial.print(F("TS: Etu="));
+		Serial.print(gAtrEtu);
+		Serial.print(F(" clocks, "));
+		Serial.print(CARD_CLOCK_HZ / gAtrEtu);
+		Serial.println(F(" baud"));
+	}
+
 	// stop listening
 	scSerial.stopListening();
+	if (n > 0) {
+		SESSION_LOG(SE_NOTE, NOTE_ATR, t);
+	}
+	SESSION_FLUSH();
+	STATS_RX_ERRORS(scSerial);
+	STATS_ATR(tStart);
 
 	// return number of bytes received
 	return n;
 }
 
+
 /**
- * This is the Waiting Time -- WT. ISO7816-3:2006 section 7.2 and 10.2.
- * 
- * WT = WI x 960 x (Fi/f)
- * WT = WI x 960 x (372 / 3579545)
- * WT = 10 x 960 x (372 / 3579545)
- * WT = 1 second
+ * Send an APDU header, then switch back to listen mode to get the procedure byte.
  */
-#define APDU_RX_TIMEOUT 1000
+static void sendHeader(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len)
+{
+	scSerial.stopListening();
+	scWriteByte(cla);
+	scWriteByte(ins);
+	scWriteByte(p1);
+	scWriteByte(p2);
+	scWriteByte(len);
+
+	scSerial.listen();
+}
+
+/**
+ * Read a byte from the card and add it to the APDU timing log.
+ *
+ * @param	tPrev	Start time of the previous character (or the end of the
+ * 					header). Updated with the start time of this character.
+ */
+static int readLogged(APDU_TIMING *timing, uint32_t *tPrev)
+{
+	uint32_t t;
+	int val = scReadByte(gWaitTime, &t);	// FIXME need to figure out what the byte timeout should be
+
+	if ((timing != NULL) && (val != -1)) {
+		uint32_t gap = t - *tPrev;
+		uint16_t gap16 = (gap > 0xFFFF) ? 0xFFFF : gap;
+
+		if ((timing->nChars > 0) && (gap16 > timing->gapMax)) {
+			timing->gapMax = gap16;
+			timing->gapMaxIdx = timing->nChars;
+		}
+		if ((timing->rxTimes != NULL) && (timing->nChars < timing->rxTimesMax)) {
+			timing->rxTimes[timing->nChars] = gap16;
+		}
+		timing->nChars++;
+
+		*tPrev = t;
+	}
+
+	return val;
+}
 
 /**
  * Send an APDU to the card.
  */
-uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len, uint8_t *buf, bool isSend, uint8_t *procByte, bool debug)
+uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len, uint8_t *buf, bool isSend, uint8_t *procByte, bool debug, APDU_TIMING *timing)
 {
 	int val;
 	uint8_t n = 0;
 	uint8_t ntt = 0;
 	uint16_t sw;
+	uint32_t tHeader;
+	uint32_t tPrev;
+	uint32_t tStart;
+	uint32_t tSend;
+	uint8_t result = STATS_APDU_OK;
+	bool gotProc = false;
 
 	if (debug) {
 		// Debug, print apdu header
@@ -329,23 +630,32 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 		Serial.println();
 	}
 
-	// Send ISO7816 APDU header -- CLA, INS, P1, P2, LEN
-	scSerial.stopListening();
-	scWriteByte(cla);
-	scWriteByte(ins);
-	scWriteByte(p1);
-	scWriteByte(p2);
-	scWriteByte(len);
+	if (timing != NULL) {
+		timing->tProc = 0;
+		timing->tLastData = 0;
+		timing->tSw1 = 0;
+		timing->gapMax = 0;
+		timing->gapMaxIdx = 0;
+		timing->nChars = 0;
+	}
 
-	// Switch back to listen mode to get the procedure byte
-	scSerial.listen();
+	// Send ISO7816 APDU header -- CLA, INS, P1, P2, LEN
+	tStart = tbNow();
+	sendHeader(cla, ins, p1, p2, len);
+	tHeader = tPrev = tbNow();
+	tSend = tHeader - tStart;
 		
 	while (n < len) {
 		// clear byte transfer count
 		ntt = 0;
 		
 		// read procedure byte
-		val = scReadByte(APDU_RX_TIMEOUT);	// FIXME need to figure out what the byte timeout should be
+		val = readLogged(timing, &tPrev);
+
+		if ((timing != NULL) && !gotProc && (val != -1)) {
+			timing->tProc = tPrev - tHeader;
+			gotProc = true;
+		}
 
 		if (procByte != NULL) {
 			*procByte = val;
@@ -357,6 +667,7 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 				Serial.println("[PROC tmo]");
 			}
 			sw = 0xFFFF;		// procedure-byte timeout
+			result = STATS_TMO_PROC;
 			goto done;
 		}
 
@@ -365,12 +676,13 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 			Serial.print(" ");
 		}
 
-		if ((val == ~ins) || (val == ~(ins+1))) {
+		if ((val == (uint8_t)~ins) || (val == (uint8_t)~(ins+1))) {
 			// Transfer one data byte
 			// TODO: vpp
 			if (debug) {
 				Serial.print("[XFER 1] ");
 			}
+			SESSION_LOG(SE_NOTE, NOTE_PROC, tPrev);
 			ntt = 1;
 		} else if ((val == ins) || (val == (ins+1))) {
 			// All remaining data bytes are transferred.
@@ -378,12 +690,14 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 			if (debug) {
 				Serial.print("[XFER ALL] ");
 			}
+			SESSION_LOG(SE_NOTE, NOTE_PROC, tPrev);
 			ntt = (len - n);
 		} else if (val == 0x60) {
 			// NOP, wait for another procedure byte
 			if (debug) {
 				Serial.print("[NOP/BUSY] ");
 			}
+			SESSION_LOG(SE_NOTE, NOTE_PROC, tPrev);
 			continue;
 		} else if (((val & 0xF0) == 0x60) || ((val & 0xF0) == 0x90)) {
 			if (debug) {
@@ -391,8 +705,14 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 			}
 
 			// SW1 received... save SW1 in MSB and receive SW2
+			if (timing != NULL) {
+				timing->tSw1 = tPrev - tHeader;
+			}
 			sw = (val << 8);
-			val = scReadByte(APDU_RX_TIMEOUT);	// FIXME need to figure out what the byte timeout should be
+			val = readLogged(timing, &tPrev);
+			if (val == -1) {
+				result = STATS_TMO_SW;
+			}
 
 			if (debug) {
 				printHex(val);
@@ -408,11 +728,14 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 		while (ntt > 0) {
 			if (isSend) {
 				// transmit
-				delayMicroseconds(GUARDTIME);
+				uint32_t t = tbNow();
+				SESSION_DRAIN();
+				delayMicroseconds(gGuardTime);
 				scWriteByte(buf[n++]);
+				tSend += tbNow() - t;
 			} else {
 				// receive
-				val = scReadByte(APDU_RX_TIMEOUT); // FIXME need to figure out what the byte timeout should be
+				val = readLogged(timing, &tPrev);
 				if (val == -1) {
 					// Timeout
 					if (debug) {
@@ -422,6 +745,9 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 					break;
 				} else {
 					buf[n++] = val;
+					if (timing != NULL) {
+						timing->tLastData = tPrev - tHeader;
+					}
 					if (debug) {
 						printHex(val);
 						Serial.print(" ");
@@ -445,13 +771,26 @@ uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t
 	if (ntt > 0) {
 		// Insufficient bytes received, rx timeout
 		sw = 0xFFFE;
+		result = STATS_TMO_DATA;
 	} else {
-		// payload is followed by SW1:SW2
-		val = scReadByte(APDU_RX_TIMEOUT);	// FIXME need to figure out what the byte timeout should be
+		// payload is followed by SW1:SW2, and the card may send NULLs while
+		// it works on the data
+		while ((val = readLogged(timing, &tPrev)) == 0x60) {
+			SESSION_LOG(SE_NOTE, NOTE_PROC, tPrev);
+		}
+		if ((timing != NULL) && (val != -1)) {
+			timing->tSw1 = tPrev - tHeader;
+		}
 		sw = (val << 8);
+		if (val == -1) {
+			result = STATS_TMO_SW;
+		}
 	
 		// receive SW2
-		val = scReadByte(APDU_RX_TIMEOUT);	// FIXME need to figure out what the byte timeout should be
+		val = readLogged(timing, &tPrev);
+		if (val == -1) {
+			result = STATS_TMO_SW;
+		}
 	
 		sw = sw | val;
 	}
@@ -466,10 +805,66 @@ done:
 	}
 
 	scSerial.stopListening();
+	if (result == STATS_APDU_OK) {
+		SESSION_LOG(SE_NOTE, NOTE_SW, tPrev);
+	} else {
+		SESSION_LOG(SE_NOTE, NOTE_TIMEOUT, tbNow());
+	}
+	SESSION_FLUSH();
+	STATS_RX_ERRORS(scSerial);
+	STATS_APDU(result, tStart, tSend, tPrev);
 	
 	return sw;
 }
 
+/**
+ * Send an APDU header and its data, without waiting for the response.
+ */
+bool cardSendCommand(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len, const uint8_t *data)
+{
+	int val;
+
+	sendHeader(cla, ins, p1, p2, len);
+
+	if (data == NULL) {
+		return true;
+	}
+
+	// wait for the procedure byte, skipping NULLs
+	do {
+		val = scReadByte(gWaitTime);
+	} while (val == 0x60);
+
+	// only "transfer all" is supported
+	if ((val != ins) && (val != (ins+1))) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < len; i++) {
+		delayMicroseconds(gGuardTime);
+		scWriteByte(data[i]);
+	}
+
+	return true;
+}
+
+/**
+ * Start listening to the card, to read what it sends after scWriteByte().
+ */
+void cardListen(void)
+{
+	scSerial.listen();
+}
+
+/**
+ * Stop listening to the card, after reading a response left open by
+ * cardSendCommand().
+ */
+void cardStopListening(void)
+{
+	scSerial.stopListening();
+}
+
 // Get card convention (autodetected during ATR)
 bool scGetInverseConvention(void)
 {
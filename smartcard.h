@@ -5,29 +5,115 @@
 
 //extern SoftwareSerialParity scSerial;
 
+/// Default time to wait for the ATR to start. Cryptoworks cards are slow.
+#define ATR_TIMEOUT_MS 1000
+
 void cardInit(void);
 
 /**
  * Turn card power on/off
+ *
+ * @param	on			Nonzero to power up the card, zero to power it down.
+ * @param	holdReset	Leave the card in reset after powering up. The caller
+ * 						releases it with SCRST(1) when it is ready.
+ */
+void cardPower(const uint8_t on, const bool holdReset = false);
+
+/**
+ * Cold reset timing, for cardColdReset()
+ */
+typedef struct {
+	uint16_t offTime;		///< Vcc off time before powering up, microseconds
+	uint16_t holdClocks;	///< Reset hold after the clock starts, card clocks
+	uint16_t atrTimeout;	///< Time to wait for the ATR to start, ms
+} CARD_RESET_TIMING;
+
+/// Safe cold reset timing, the same as cardPower()
+#define CARD_RESET_TIMING_DEFAULT { 12000, 400, ATR_TIMEOUT_MS }
+
+/// Cold reset timing used by cardColdReset(). Learned by 'rlearn'.
+extern CARD_RESET_TIMING gResetTiming;
+
+/**
+ * Fast cold reset for campaigns, using gResetTiming.
+ *
+ * Powers the card off, waits for Vcc to discharge, powers it up, starts the
+ * clock and holds reset for the learned time, all with direct port I/O.
+ *
+ * @param	holdReset	Leave the card in reset. The caller releases it with
+ * 						SCRST(1) when it is ready (the hold time has
+ * 						already passed).
  */
-void cardPower(const uint8_t on);
+void cardColdReset(const bool holdReset = false);
 
 /**
  * Force card baud rate
  */
 void cardBaud(const uint32_t baud);
 
+/**
+ * Override the guard time set by cardBaud()
+ *
+ * @param	us	Guard time in microseconds
+ */
+void cardSetGuardTime(const uint16_t us);
+
+/**
+ * Override the waiting time set by cardGetAtr()
+ *
+ * @param	ms	Waiting time in milliseconds
+ */
+void cardSetWaitTime(const unsigned long ms);
+
+/// Get the guard time, microseconds
+uint16_t cardGetGuardTime(void);
+
+/// Get the waiting time, milliseconds
+unsigned long cardGetWaitTime(void);
+
+/**
+ * Get the Etu the card used for its ATR, in card clocks, as measured from TS
+ * by cardGetAtr(). 372 for most cards.
+ */
+uint16_t cardGetAtrEtu(void);
+
+
+
+/**
+ * ATR timing -- start of the first and last characters, in card clocks
+ * (tbNow() time, see timebase.h).
+ */
+typedef struct {
+	uint32_t tFirst;
+	uint32_t tLast;
+} ATR_TIMING;
 
 /**
  * Get the ATR from the card.
  * 
- * @param[out]	buf		Storage buffer. ATR will be stored here.
+ * @param[out]	buf			Storage buffer. ATR will be stored here.
+ * @param		quiet		Don't print the TA1 decode.
+ * @param		timeout_ms	Time to wait for the ATR to start.
+ * @param[out]	timing		If not NULL, timing of the ATR. Only valid if
+ * 							some ATR bytes were received.
  * @return Number of ATR bytes
  */
-int cardGetAtr(uint8_t *buf);
+int cardGetAtr(uint8_t *buf, const bool quiet = false, const unsigned int timeout_ms = ATR_TIMEOUT_MS, ATR_TIMING *timing = NULL);
+
+/// The ATR read by the last 'on' or 'reset' command (glitcher.ino)
+extern uint8_t atr[32];
+extern uint8_t atrLen;
 
 // FIXME figure out default timeout
-int scReadByte(int timeout_ms = 50);
+/**
+ * Read a byte from the card.
+ *
+ * @param		timeout_ms	Timeout in milliseconds
+ * @param[out]	timestamp	If not NULL, the time the character started (leading
+ * 							edge of the start bit), in card clocks (see timebase.h)
+ * @return Byte value, or -1 on timeout
+ */
+int scReadByte(int timeout_ms = 50, uint32_t *timestamp = NULL);
 
 void scWriteByte(uint8_t b);
 
@@ -35,7 +121,49 @@ void scWriteByte(uint8_t b);
 #define APDU_SEND true
 #define APDU_RECV false
 
-uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len, uint8_t *buf, bool isSend, uint8_t *procByte=NULL, bool debug=false);
+/**
+ * APDU timing, in card clocks (see timebase.h).
+ *
+ * Times are measured from the end of the APDU header to the start of the
+ * character. Zero if the character was never received.
+ *
+ * Every character received (procedure bytes, data, SW1 and SW2) can also be
+ * logged: set rxTimes to a buffer of rxTimesMax entries, or NULL if not
+ * needed. Each entry is the time from the start of the previous character
+ * (or the end of the header, for the first one), saturating at 0xFFFF.
+ */
+typedef struct {
+	uint32_t tProc;			///< First procedure byte
+	uint32_t tLastData;		///< Last data byte received (receive APDUs only)
+	uint32_t tSw1;			///< SW1
+	uint16_t gapMax;		///< Longest gap between two characters
+	uint16_t gapMaxIdx;		///< Index of the character after the longest gap
+	uint16_t nChars;		///< Number of characters received
+
+	uint16_t *rxTimes;		///< Optional per-character log
+	uint16_t rxTimesMax;	///< Size of rxTimes
+} APDU_TIMING;
+
+uint16_t cardSendApdu(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len, uint8_t *buf, bool isSend, uint8_t *procByte=NULL, bool debug=false, APDU_TIMING *timing=NULL);
+
+/**
+ * Send an APDU header and its data, without waiting for the response.
+ *
+ * Used to synchronise a capture or glitch with the card starting to execute
+ * the command. The card port is left listening, so the response can still be
+ * read with scReadByte().
+ *
+ * @param	data	Command data (len bytes), or NULL to send the header only.
+ * @return <b>true</b> if the command was sent, <b>false</b> if the card didn't
+ * 		ask for the data.
+ */
+bool cardSendCommand(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t len, const uint8_t *data = NULL);
+
+/// Start listening to the card, for reading it with scReadByte() after writing to it
+void cardListen(void);
+
+/// Stop listening to the card, once a response left open by cardSendCommand() has been read
+void cardStopListening(void);
 
 
 // Get card convention (autodetected during ATR)
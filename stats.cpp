@@ -0,0 +1,189 @@
+#include "config.h"
+#include "hardware.h"
+#include "timebase.h"
+#include "hostlink.h"
+#include "stats.h"
+#include "utils.h"
+
+#ifdef ENABLE_STATS
+
+/// Payload length of FRAME_STATS
+#define STATS_FRAME_LEN		76
+
+
+STATS gStats;
+
+/// End of the last APDU, for the gap to the next one
+static uint32_t gLastEnd;
+
+/// gLastEnd is valid (an APDU has been sent in this command)
+static bool gLastEndValid = false;
+
+/// millis() when the current command started. Commands can run for longer
+/// than tbNow() takes to wrap.
+static unsigned long gCommandStart;
+
+
+void statsApdu(const uint8_t result, const uint32_t tStart, const uint32_t tSend, const uint32_t tLast)
+{
+	uint32_t tEnd = tbNow();
+	uint32_t tWait = tEnd - tStart - tSend;
+
+	gStats.apdus++;
+	gStats.tSend += tSend;
+
+	switch (result) {
+		case STATS_TMO_PROC: gStats.tmoProc++; break;
+		case STATS_TMO_DATA: gStats.tmoData++; break;
+		case STATS_TMO_SW:   gStats.tmoSw++;   break;
+	}
+
+	// The time since the last character from the card was spent waiting
+	// for one which never came
+	if (result != STATS_APDU_OK) {
+		uint32_t tLost = min(tEnd - tLast, tWait);
+		gStats.tTimeout += tLost;
+		tWait -= tLost;
+	}
+	gStats.tCard += tWait;
+
+	if (gLastEndValid) {
+		gStats.gapMax = max(gStats.gapMax, tStart - gLastEnd);
+	}
+	gLastEnd = tEnd;
+	gLastEndValid = true;
+}
+
+
+void statsAtr(const uint32_t tStart)
+{
+	gStats.atrs++;
+	gStats.tAtr += tbNow() - tStart;
+}
+
+
+void statsRxErrors(const bool overflow, const uint8_t parityErrors)
+{
+	if (overflow && (gStats.rxOverflows != 0xFFFF)) {
+		gStats.rxOverflows++;
+	}
+	if ((uint32_t)gStats.parityErrors + parityErrors > 0xFFFF) {
+		gStats.parityErrors = 0xFFFF;
+	} else {
+		gStats.parityErrors += parityErrors;
+	}
+}
+
+
+void statsCommandStart(void)
+{
+	gLastEndValid = false;
+	gCommandStart = millis();
+}
+
+
+void statsCommandEnd(void)
+{
+	gStats.tCommand += ((uint64_t)(millis() - gCommandStart) * CARD_CLOCK_HZ) / 1000;
+}
+
+
+/// Write a 64-bit payload value to the current frame
+static void statsFrameWriteU64(const uint64_t val)
+{
+	hostFrameWriteU32((uint32_t)val);
+	hostFrameWriteU32((uint32_t)(val >> 32));
+}
+
+
+/**
+ * Print a phase time in milliseconds, and as a percentage of the command time.
+ */
+static void statsPrintPhase(const __FlashStringHelper *name, const uint64_t t)
+{
+	Serial.print(name);
+	Serial.print((uint32_t)(t / (CARD_CLOCK_HZ / 1000)));
+	Serial.print(F(" ms"));
+	if (gStats.tCommand > 0) {
+		Serial.print(F(" ("));
+		Serial.print((uint32_t)((t * 100) / gStats.tCommand));
+		Serial.print(F("%)"));
+	}
+	Serial.println();
+}
+
+
+void handle_stats(String *cmdline)
+{
+	String sub;
+
+	popWord(cmdline, &sub);
+
+	if (sub.equals(F("reset"))) {
+		memset(&gStats, 0, sizeof(gStats));
+		Serial.println(F("Statistics cleared"));
+		return;
+	} else if (sub.length() > 0) {
+		Serial.println(F("**ERROR: Syntax = stats [reset]"));
+		return;
+	}
+
+	if (gBinaryFrames) {
+		hostFrameBegin(FRAME_STATS, STATS_FRAME_LEN);
+		hostFrameWriteU32(gStats.apdus);
+		hostFrameWriteU32(gStats.tmoProc);
+		hostFrameWriteU32(gStats.tmoData);
+		hostFrameWriteU32(gStats.tmoSw);
+		hostFrameWriteU32(gStats.commsResets);
+		hostFrameWriteU32(gStats.atrs);
+		hostFrameWriteU16(gStats.rxOverflows);
+		hostFrameWriteU16(gStats.parityErrors);
+		hostFrameWriteU16(gStats.ppsOk);
+		hostFrameWriteU16(gStats.ppsFail);
+		hostFrameWriteU32(gStats.gapMax);
+		statsFrameWriteU64(gStats.tAtr);
+		statsFrameWriteU64(gStats.tSend);
+		statsFrameWriteU64(gStats.tCard);
+		statsFrameWriteU64(gStats.tTimeout);
+		statsFrameWriteU64(gStats.tCommand);
+		hostFrameEnd();
+	}
+
+	Serial.print(F("APDUs:          "));
+	Serial.println(gStats.apdus);
+	Serial.print(F("Timeouts:       proc "));
+	Serial.print(gStats.tmoProc);
+	Serial.print(F(", data "));
+	Serial.print(gStats.tmoData);
+	Serial.print(F(", SW "));
+	Serial.println(gStats.tmoSw);
+	Serial.print(F("ATRs:           "));
+	Serial.print(gStats.atrs);
+	Serial.print(F(", "));
+	Serial.print(gStats.commsResets);
+	Serial.println(F(" after comms errors"));
+	Serial.print(F("RX errors:      "));
+	Serial.print(gStats.rxOverflows);
+	Serial.print(F(" overflows, "));
+	Serial.print(gStats.parityErrors);
+	Serial.println(F(" parity"));
+	Serial.print(F("PPS:            "));
+	Serial.print(gStats.ppsOk);
+	Serial.print(F(" ok, "));
+	Serial.print(gStats.ppsFail);
+	Serial.println(F(" failed"));
+	Serial.print(F("Longest gap:    "));
+	Serial.print(gStats.gapMax);
+	Serial.println(F(" clocks"));
+
+	// Time not accounted for by the card phases is ours
+	uint64_t tCardPhases = gStats.tAtr + gStats.tSend + gStats.tCard + gStats.tTimeout;
+	statsPrintPhase(F("Command time:   "), gStats.tCommand);
+	statsPrintPhase(F("  ATR           "), gStats.tAtr);
+	statsPrintPhase(F("  sending       "), gStats.tSend);
+	statsPrintPhase(F("  card          "), gStats.tCard);
+	statsPrintPhase(F("  timeouts      "), gStats.tTimeout);
+	statsPrintPhase(F("  other         "), (gStats.tCommand > tCardPhases) ? (gStats.tCommand - tCardPhases) : 0);
+}
+
+#endif // ENABLE_STATS
@@ -0,0 +1,119 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/***
+ * Runtime statistics
+ *
+ * Counters for everything which makes a long scan slower than it should be:
+ * timeouts, comms error resets, receive overflows and parity errors, and
+ * where the time goes. They count from power-up or the last 'stats reset'.
+ *
+ * Time is split into phases, all in card clocks:
+ *
+ *   tAtr		Reading ATRs (after the reset has been released)
+ *   tSend		Sending APDU headers and data to the card
+ *   tCard		Waiting for the card and receiving its replies
+ *   tTimeout	Waiting for characters which never came
+ *   tCommand	Running commands. What's left after the other phases is
+ *   			our own overhead: printing, resets, the gap between commands.
+ *
+ * gapMax is the longest time from the end of one APDU to the start of the
+ * next within a command.
+ *
+ * 'stats' prints the counters, and sends them as a FRAME_STATS frame if
+ * binary frames are on:
+ *
+ *   u32 apdus, u32 tmoProc, u32 tmoData, u32 tmoSw, u32 commsResets,
+ *   u32 atrs, u16 rxOverflows, u16 parityErrors, u16 ppsOk, u16 ppsFail,
+ *   u32 gapMax, u64 tAtr, u64 tSend, u64 tCard, u64 tTimeout, u64 tCommand
+ *
+ * There is no PPS exchange in this firmware (the card's TA1 rate is used
+ * straight after the ATR), so ppsOk and ppsFail are always zero for now.
+ */
+
+// APDU results for statsApdu()
+#define STATS_APDU_OK		0x00	///< SW received
+#define STATS_TMO_PROC		0x01	///< Timeout waiting for a procedure byte
+#define STATS_TMO_DATA		0x02	///< Timeout receiving data
+#define STATS_TMO_SW		0x03	///< Timeout receiving SW1 SW2
+
+/// Statistics counters, see above
+typedef struct {
+	uint32_t apdus;			///< APDUs sent
+	uint32_t tmoProc;		///< Procedure byte timeouts
+	uint32_t tmoData;		///< Data timeouts
+	uint32_t tmoSw;			///< SW1 SW2 timeouts
+	uint32_t commsResets;	///< Card resets after a comms error
+	uint32_t atrs;			///< ATRs read
+	uint16_t rxOverflows;	///< APDUs or ATRs where the receive buffer overflowed
+	uint16_t parityErrors;	///< Characters received with bad parity
+	uint16_t ppsOk;			///< PPS exchanges accepted by the card
+	uint16_t ppsFail;		///< PPS exchanges refused or failed
+	uint32_t gapMax;		///< Longest gap between APDUs, card clocks
+	uint64_t tAtr;			///< Phase times, card clocks
+	uint64_t tSend;
+	uint64_t tCard;
+	uint64_t tTimeout;
+	uint64_t tCommand;
+} STATS;
+
+#ifdef ENABLE_STATS
+
+/// The counters
+extern STATS gStats;
+
+/**
+ * Count an APDU.
+ *
+ * @param	result	STATS_APDU_OK or STATS_TMO_xxx
+ * @param	tStart	When the header started, tbNow()
+ * @param	tSend	Time spent sending, card clocks
+ * @param	tLast	When the last character from the card started. Time after
+ * 					this is counted as timeout if the APDU timed out.
+ */
+void statsApdu(const uint8_t result, const uint32_t tStart, const uint32_t tSend, const uint32_t tLast);
+
+/**
+ * Count an ATR.
+ *
+ * @param	tStart	When the ATR read started, tbNow()
+ */
+void statsAtr(const uint32_t tStart);
+
+/**
+ * Count receive errors from the card serial port. Call when it stops
+ * listening.
+ */
+void statsRxErrors(const bool overflow, const uint8_t parityErrors);
+
+/// A command is starting. Gaps between APDUs are only counted within a command.
+void statsCommandStart(void);
+
+/// The command has finished
+void statsCommandEnd(void);
+
+/**
+ * Command handler: stats [reset]
+ *
+ * Show (and send) the statistics counters, or clear them.
+ */
+void handle_stats(String *cmdline);
+
+#define STATS_COUNT(field)						do { gStats.field++; } while (0)
+#define STATS_APDU(result, tStart, tSend, tLast)	statsApdu((result), (tStart), (tSend), (tLast))
+#define STATS_ATR(tStart)						statsAtr(tStart)
+#define STATS_RX_ERRORS(port)					statsRxErrors((port).overflow(), (port).parityErrors())
+
+#else
+
+#define STATS_COUNT(field)
+#define STATS_APDU(result, tStart, tSend, tLast)	do { (void)(result); (void)(tStart); (void)(tSend); (void)(tLast); } while (0)
+#define STATS_ATR(tStart)						do { (void)(tStart); } while (0)
+#define STATS_RX_ERRORS(port)
+
+#endif // ENABLE_STATS
+
+#endif // STATS_H
@@ -0,0 +1,221 @@
+#include <Arduino.h>
+#include "hardware.h"
+#include "timebase.h"
+
+// Timer0 overflow counter and millisecond count, maintained by the Arduino
+// core (wiring.c) for micros() and millis()
+extern volatile unsigned long timer0_overflow_count;
+extern volatile unsigned long timer0_millis;
+
+/// Timer0 prescaler -- CPU clocks per Timer0 tick
+#define TB_T0_PRESCALE		64
+
+/// Event log entry
+typedef struct {
+	uint8_t type;
+	uint32_t t;
+} TB_EVENT_ENTRY;
+
+static TB_EVENT_ENTRY gEvents[TB_EVENT_LOG];
+static uint8_t gEventNext = 0;
+
+/// Microseconds of caught-up overflows not yet added to timer0_millis
+static uint16_t gCatchUpUs = 0;
+
+
+void tbInit(void)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+
+	// Stop the prescalers so Timer0 and Timer2 start together
+	GTCCR = _BV(TSM) | _BV(PSRASY) | _BV(PSRSYNC);
+
+	// Timer2: CTC, TOP = 63, no prescaler -- counts CPU clocks within each
+	// Timer0 tick. No outputs, no interrupts.
+	TIMSK2 = 0;
+	TCCR2A = _BV(WGM21);
+	TCCR2B = _BV(CS20);
+	OCR2A = TB_T0_PRESCALE - 1;
+	TCNT2 = 0;
+
+	// Go. The Timer0 prescaler restarts from zero, so the next Timer0 tick
+	// is 64 CPU clocks away -- exactly when Timer2 wraps.
+	GTCCR = 0;
+
+	SREG = oldSREG;
+}
+
+
+uint32_t tbNow(void)
+{
+	uint8_t oldSREG = SREG;
+	uint32_t m;
+	uint8_t t, s;
+
+	cli();
+
+	// Timer2 must be read in the same Timer0 tick as TCNT0
+	do {
+		t = TCNT0;
+		s = TCNT2;
+	} while (TCNT0 != t);
+
+	// Timer0 runs at CPU/64 for millis(). Same trick as micros() -- if the
+	// overflow interrupt is pending, the count hasn't been updated yet.
+	m = timer0_overflow_count;
+	if ((TIFR0 & _BV(TOV0)) && (t < 255)) {
+		m++;
+	}
+	SREG = oldSREG;
+
+	// One Timer0 tick = 64 CPU clocks = 16 card clocks
+	return (((m << 8) + t) * (TB_T0_PRESCALE / 4)) + (s / 4);
+}
+
+
+void tbCatchUp(const uint32_t tStart, const uint32_t clocks)
+{
+	uint8_t oldSREG = SREG;
+	uint32_t expect, ticks, lost;
+	uint8_t t, pending;
+	int32_t diff;
+
+	cli();
+
+	do {
+		t = TCNT0;
+		pending = (TIFR0 & _BV(TOV0)) ? 1 : 0;
+	} while (TCNT0 != t);
+
+	// Timer0 ticks now, from the length of the wait. tbNow() keeps the tick
+	// count to 28 bits, so the arithmetic here is mod 2^28.
+	expect = ((tStart + clocks) / (TB_T0_PRESCALE / 4)) & 0x0FFFFFFFUL;
+
+	// The exact count has TCNT0 as its low byte: take the nearest one
+	ticks = (expect & 0x0FFFFF00UL) | t;
+	diff = (int32_t)((ticks - expect) << 4) >> 4;
+	if (diff > 128) {
+		ticks -= 256;
+	} else if (diff < -128) {
+		ticks += 256;
+	}
+
+	// Overflows which should have been counted, less those which have been
+	// or will be when interrupts go back on
+	lost = ((ticks >> 8) - (timer0_overflow_count + pending)) & 0x000FFFFFUL;
+	if (lost < 0x80000UL) {
+		uint32_t us = (lost * (TB_T0_PRESCALE * 256UL / (F_CPU / 1000000UL))) + gCatchUpUs;
+
+		timer0_overflow_count += lost;
+		timer0_millis += us / 1000;
+		gCatchUpUs = us % 1000;
+	}
+
+	SREG = oldSREG;
+}
+
+
+void tbEvent(const TB_EVENT type, const uint32_t t)
+{
+	uint8_t oldSREG = SREG;
+	cli();
+
+	gEvents[gEventNext].type = type;
+	gEvents[gEventNext].t = t;
+	gEventNext = (gEventNext + 1) % TB_EVENT_LOG;
+
+	SREG = oldSREG;
+}
+
+
+void handle_tbcal(String *cmdline)
+{
+	uint32_t t0, t1;
+	unsigned long us0, us1;
+	bool clockWasOn, loopback;
+
+	// Timebase against micros() over about a second. Both come from the same
+	// crystal, so this checks the timer setup and overflow handling, not the
+	// crystal itself.
+	us0 = micros();
+	t0 = tbNow();
+	delay(1000);
+	us1 = micros();
+	t1 = tbNow();
+
+	uint32_t clocks = t1 - t0;
+	uint32_t expect = ((uint64_t)(us1 - us0) * CARD_CLOCK_HZ) / 1000000UL;
+	int32_t err = clocks - expect;
+
+	Serial.print(F("Timebase: "));
+	Serial.print(clocks);
+	Serial.print(F(" clocks in "));
+	Serial.print(us1 - us0);
+	Serial.print(F("us, expected "));
+	Serial.print(expect);
+	Serial.print(F(" ("));
+	Serial.print(((float)err * 1e6) / expect, 1);
+	Serial.println(F(" ppm)"));
+
+	// Card clock loopback. The clock from OC1A comes back into ICP1; with the
+	// clock running, every rising edge sets the input capture flag. Start the
+	// clock for a moment if the card is off.
+	clockWasOn = (TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) != 0;
+	if (!clockWasOn) {
+		scClockFreerun(true);
+	}
+	TCCR1B |= _BV(ICES1);
+	TIFR1 = _BV(ICF1);
+	_delay_loop_2(2);
+	loopback = (TIFR1 & _BV(ICF1)) != 0;
+	if (!clockWasOn) {
+		scClockFreerun(false);
+	}
+
+	Serial.print(F("Card clock loopback (ICP1): "));
+	Serial.println(loopback ? F("OK") : F("no clock"));
+
+	Serial.print(F("Nominal card clock: "));
+	Serial.print(CARD_CLOCK_HZ);
+	Serial.print(F("Hz ("));
+	Serial.print(F_CPU);
+	Serial.println(F("Hz / 4)"));
+}
+
+
+void handle_tbevents(String *cmdline)
+{
+	uint8_t i = gEventNext;
+	uint32_t tFirst = 0;
+	bool first = true;
+
+	do {
+		const TB_EVENT_ENTRY *e = &gEvents[i];
+		i = (i + 1) % TB_EVENT_LOG;
+
+		if (e->type == 0) {
+			continue;
+		}
+		if (first) {
+			tFirst = e->t;
+			first = false;
+		}
+
+		Serial.print(e->t);
+		Serial.print(F("  +"));
+		Serial.print(e->t - tFirst);
+		Serial.print(F("  "));
+		switch (e->type) {
+			case TB_EV_RESET:	Serial.println(F("reset released")); break;
+			case TB_EV_ATR:		Serial.println(F("ATR start")); break;
+			case TB_EV_GLITCH:	Serial.println(F("glitch")); break;
+			case TB_EV_TRIGGER:	Serial.println(F("trigger")); break;
+			default:			Serial.println(e->type); break;
+		}
+	} while (i != gEventNext);
+
+	if (first) {
+		Serial.println(F("No events"));
+	}
+}
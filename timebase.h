@@ -0,0 +1,86 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <Arduino.h>
+
+/***
+ * Card clock timebase
+ *
+ * Timestamps are in card clocks. The free-running card clock is the CPU
+ * clock divided by 4 (Timer1 PWM), so the timebase is built from the CPU
+ * clock rather than by counting clock edges: Timer0 (millis) counts blocks
+ * of 16 card clocks, and Timer2, started in step with Timer0's prescaler,
+ * counts the CPU clocks within each block.
+ */
+
+/// Card clock rate
+#define CARD_CLOCK_HZ		(3579545)
+
+/// Timebase resolution in card clocks
+#define TB_RESOLUTION		1
+
+/// Event types for tbEvent()
+typedef enum {
+	TB_EV_RESET = 1,		///< Card released from reset
+	TB_EV_ATR,				///< ATR started (leading edge of TS)
+	TB_EV_GLITCH,			///< Glitch fired
+	TB_EV_TRIGGER,			///< Scope trigger
+} TB_EVENT;
+
+/// Number of events kept by tbEvent()
+#define TB_EVENT_LOG		8
+
+/**
+ * Start the timebase. Call once at startup, after the Arduino core has
+ * started Timer0.
+ */
+void tbInit(void);
+
+/**
+ * Get the current time in card clocks.
+ *
+ * Wraps after 2^32 clocks (about 20 minutes). Use timeAfter() (utils.h) or
+ * unsigned subtraction to compare timestamps. Safe to call from an ISR.
+ */
+uint32_t tbNow(void);
+
+/**
+ * Catch up on Timer0 overflows missed while interrupts were off.
+ *
+ * Timer0 overflows every 16384 CPU clocks, and only one overflow can be
+ * pending while interrupts are off, so a longer wait with interrupts off
+ * (a glitch delay) leaves tbNow(), millis() and micros() behind. This puts
+ * the missed overflows back. Call it before turning interrupts back on.
+ *
+ * @param	tStart	tbNow() when the wait started
+ * @param	clocks	Length of the wait in card clocks. Only needs to be right
+ * 					to within about 2000 card clocks: the exact time comes
+ * 					from Timer0.
+ */
+void tbCatchUp(const uint32_t tStart, const uint32_t clocks);
+
+/**
+ * Log an event in the event ring (the last TB_EVENT_LOG are kept).
+ *
+ * Safe to call from an ISR.
+ *
+ * @param	type	Event type
+ * @param	t		Time of the event, from tbNow()
+ */
+void tbEvent(const TB_EVENT type, const uint32_t t);
+
+/**
+ * Command handler: tbcal
+ *
+ * Check the timebase against the CPU clock and the card clock loopback.
+ */
+void handle_tbcal(String *cmdline);
+
+/**
+ * Command handler: tbevents
+ *
+ * Show the event log.
+ */
+void handle_tbevents(String *cmdline);
+
+#endif // TIMEBASE_H
@@ -0,0 +1,380 @@
+#include "config.h"
+#include "hardware.h"
+#include "smartcard.h"
+#include "cardprofile.h"
+#include "timebase.h"
+#include "hostlink.h"
+#include "utils.h"
+
+#ifdef ENABLE_TIMESCAN
+
+/// Maximum template APDU data length
+#define TS_MAX_DATA			16
+
+/// Gap between commands. Sky cards need 10ms.
+#define TS_CMD_GAP_MS		10
+
+/// Default standout threshold (robust z-score)
+#define TS_DEFAULT_THRESHOLD	5
+
+/// Maximum number of standout candidates to report per byte
+#define TS_MAX_REPORT		8
+
+/// Standard deviation of a candidate which couldn't be measured
+#define TS_SD_FAILED		0xFF
+
+// Latency being measured
+typedef enum {
+	TSM_PROC,		// End of header to first procedure byte
+	TSM_SW1,		// End of header to SW1
+} TS_METRIC;
+
+// Per-candidate results. Kept off the stack, which can't spare 768 bytes.
+static uint16_t gTsMean[256];		// Mean latency above the base, card clocks
+static uint8_t gTsSd[256];			// Standard deviation, or TS_SD_FAILED
+
+
+/**
+ * Select the median of the candidates' means -- or, if dev is set, the
+ * median absolute deviation from center. Failed candidates are left out.
+ *
+ * Binary search on the value rather than sorting, so the means stay in
+ * candidate order and no scratch buffer is needed.
+ *
+ * @param	nValid	Number of candidates which didn't fail (at least 1)
+ */
+static uint16_t tsMedian(const uint16_t center, const bool dev, const uint16_t nValid)
+{
+	uint16_t lo = 0;
+	uint16_t hi = 0xFFFF;
+
+	while (lo < hi) {
+		uint16_t mid = lo + ((hi - lo) / 2);
+		uint16_t n = 0;
+
+		for (int i = 0; i < 256; i++) {
+			uint16_t x = gTsMean[i];
+			if (gTsSd[i] == TS_SD_FAILED) {
+				continue;
+			}
+			if (dev) {
+				x = (x > center) ? (x - center) : (center - x);
+			}
+			if (x <= mid) {
+				n++;
+			}
+		}
+
+		if (n >= ((nValid + 1) / 2)) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return lo;
+}
+
+
+/**
+ * Send the template APDU once and measure it.
+ *
+ * Resets the card and retries on a comms error.
+ *
+ * @param[out]	lat		Latency in card clocks, if it worked
+ * @return SW1SW2, or a comms error (SW >= FFF0) if all the tries failed.
+ * 		There's no latency then: a card which doesn't answer isn't fast.
+ */
+static uint16_t tsMeasure(const uint8_t *apdu, const uint8_t dataLen, const TS_METRIC metric, uint32_t *lat)
+{
+	uint8_t buf[TS_MAX_DATA];
+	uint8_t atrbuf[32];
+	APDU_TIMING timing;
+	uint16_t sw;
+
+	timing.rxTimes = NULL;
+
+	for (uint8_t retry = 0; retry < 3; retry++) {
+		if (dataLen > 0) {
+			memcpy(buf, &apdu[5], dataLen);
+		}
+
+		sw = cardSendApdu(apdu[0], apdu[1], apdu[2], apdu[3], apdu[4], buf,
+				(dataLen > 0) ? APDU_SEND : APDU_RECV, NULL, false, &timing);
+
+		delay(TS_CMD_GAP_MS);
+
+		if (sw < 0xFFF0) {
+			*lat = (metric == TSM_PROC) ? timing.tProc : timing.tSw1;
+			return sw;
+		}
+
+		// comms error, reboot the card
+		cardColdReset();
+		cardGetAtr(atrbuf, true, gResetTiming.atrTimeout);
+		cardProfileRestore();
+	}
+
+	return sw;
+}
+
+
+/**
+ * Command handler: tscan <pos> <k> [proc|sw] [auto] <cla> <ins> <p1> <p2> <len> [data...]
+ *
+ * Timing side channel scan.
+ *
+ * Byte <pos> of the template APDU (0-3 = header, 5 onwards = data) is set to
+ * each value 00..FF in turn, and each candidate is sent <k> times. The
+ * latency from the end of the header to the first procedure byte ('proc')
+ * or to SW1 ('sw', the default) is recorded, and each candidate's mean and
+ * standard deviation are kept.
+ *
+ * Candidates whose mean is more than TS_DEFAULT_THRESHOLD robust standard
+ * deviations (median absolute deviation based) from the median of all the
+ * candidates are reported. The per-candidate means are also sent to the host
+ * as a FRAME_TSCAN binary frame:
+ *
+ *   u8 pos, u16 k, u32 base, u16 mean[256], u8 sd[256]
+ *
+ * Means are in card clocks above <base>, standard deviations in card clocks
+ * (saturating at 254). A candidate with a comms error on any of its samples,
+ * even after resetting the card, has an sd of 255 and is left out of the
+ * statistics; it's reported separately.
+ *
+ * With 'auto', if exactly one candidate is slower than the rest, it is
+ * written into the template and the scan moves on to the next byte. The
+ * length byte (pos 4) is skipped, so after P2 it goes on to the data, or
+ * stops if there is none. It also stops at the end of the APDU, when there's
+ * no clear winner, or when a candidate gets a 9000 response (if the template
+ * didn't already).
+ *
+ * <pos> and <k> are decimal, everything else is hex.
+ */
+void handle_tscan(String *cmdline)
+{
+	uint8_t apdu[5 + TS_MAX_DATA];
+	uint8_t atrbuf[32];
+	uint8_t n;
+	String word;
+	long val, pos, k;
+	int dataLen;
+	TS_METRIC metric = TSM_SW1;
+	bool autoAdvance = false;
+	int found9000 = -1;
+
+	if (!popArg(cmdline, &pos, 10) || !popArg(cmdline, &k, 10)) {
+		Serial.println(F("**ERROR: Syntax = tscan <pos> <k> [proc|sw] [auto] <cla> <ins> <p1> <p2> <len> [data...]"));
+		return;
+	}
+
+	// options, then the APDU header
+	dataLen = 0;
+	while (popWord(cmdline, &word)) {
+		if (word.equals("proc")) {
+			metric = TSM_PROC;
+		} else if (word.equals("sw")) {
+			metric = TSM_SW1;
+		} else if (word.equals("auto")) {
+			autoAdvance = true;
+		} else {
+			// first word of the APDU
+			apdu[0] = strtol(word.c_str(), NULL, 16);
+			break;
+		}
+	}
+
+	for (int i = 1; i < 5; i++) {
+		if (!popArg(cmdline, &val)) {
+			Serial.println(F("**ERROR: Need <cla> <ins> <p1> <p2> <len>"));
+			return;
+		}
+		apdu[i] = val;
+	}
+
+	dataLen = popHexBytes(cmdline, &apdu[5], TS_MAX_DATA);
+	if ((dataLen < 0) || ((dataLen > 0) && (dataLen != apdu[4])) || ((dataLen == 0) && (apdu[4] > TS_MAX_DATA))) {
+		Serial.println(F("**ERROR: data length must match <len>, max 16 bytes"));
+		return;
+	}
+
+	// The length byte sizes the buffers, so it can't be a candidate (use scanlen)
+	if ((k < 1) || (k > 1000) || (pos < 0) || (pos == 4) || (pos >= (5 + dataLen))) {
+		Serial.println(F("**ERROR: k must be 1..1000 and pos must be inside the APDU, but not 4"));
+		return;
+	}
+
+	cardPower(0);
+	cardPower(1);
+	n = cardGetAtr(atrbuf, true);
+	if (n == 0) {
+		Serial.println(F("**ERROR: No ATR"));
+		return;
+	}
+	cardProfileApply(atrbuf, n, true);
+
+	while (pos < (5 + dataLen)) {
+		uint32_t base = 0xFFFFFFFF;
+		uint32_t lat;
+		uint16_t baseSw = 0;
+		uint16_t nValid = 0;
+
+		Serial.print(F("Scanning byte "));
+		Serial.print(pos);
+		Serial.print(F(", "));
+		Serial.print(k);
+		Serial.println(F(" samples per candidate"));
+
+		// Baseline: the fastest of a few runs of the current template
+		for (uint8_t i = 0; i < 4; i++) {
+			uint16_t sw = tsMeasure(apdu, dataLen, metric, &lat);
+			if (sw < 0xFFF0) {
+				baseSw = sw;
+				base = min(base, lat);
+			}
+		}
+		if (base == 0xFFFFFFFF) {
+			Serial.println(F("**ERROR: The template APDU gets no answer"));
+			break;
+		}
+		base = (base > 256) ? (base - 256) : 0;
+
+		for (int c = 0; c < 256; c++) {
+			float sum = 0, sumSq = 0;
+			bool failed = false;
+
+			apdu[pos] = c;
+
+			for (long i = 0; i < k; i++) {
+				uint16_t sw = tsMeasure(apdu, dataLen, metric, &lat);
+
+				if (sw >= 0xFFF0) {
+					failed = true;
+					break;
+				}
+				if ((sw == 0x9000) && (baseSw != 0x9000) && (found9000 == -1)) {
+					found9000 = c;
+				}
+
+				float x = (lat > base) ? (float)(lat - base) : 0.0f;
+				sum += x;
+				sumSq += x * x;
+			}
+
+			if (failed) {
+				gTsMean[c] = 0;
+				gTsSd[c] = TS_SD_FAILED;
+				continue;
+			}
+
+			float m = sum / k;
+			float var = (sumSq / k) - (m * m);
+			float s = (var > 0) ? sqrt(var) : 0;
+
+			gTsMean[c] = (m > 65535.0f) ? 65535 : (uint16_t)(m + 0.5f);
+			gTsSd[c] = (s > 254.0f) ? 254 : (uint8_t)(s + 0.5f);
+			nValid++;
+		}
+
+		// Robust z-score: distance from the median in units of the
+		// (scaled) median absolute deviation
+		uint16_t med = nValid ? tsMedian(0, false, nValid) : 0;
+		uint16_t mad = nValid ? tsMedian(med, true, nValid) : 0;
+		float sigma = 1.4826f * ((mad > 0) ? mad : 1);
+
+		hostFrameBegin(FRAME_TSCAN, 7 + (256 * 3));
+		hostFrameWriteByte(pos);
+		hostFrameWriteU16(k);
+		hostFrameWriteU32(base);
+		for (int c = 0; c < 256; c++) {
+			hostFrameWriteU16(gTsMean[c]);
+		}
+		hostFrameWrite(gTsSd, 256);
+		hostFrameEnd();
+
+		Serial.println();
+		Serial.print(F("Median "));
+		Serial.print(base + med);
+		Serial.print(F(" clocks, MAD "));
+		Serial.println(mad);
+
+		if (nValid < 256) {
+			Serial.print(256 - nValid);
+			Serial.print(F(" candidates failed:"));
+			for (int c = 0; c < 256; c++) {
+				if (gTsSd[c] == TS_SD_FAILED) {
+					Serial.print(' ');
+					printHex(c);
+				}
+			}
+			Serial.println();
+		}
+
+		int nReported = 0;
+		int nSlow = 0;
+		int slowest = -1;
+		for (int c = 0; (c < 256) && (nReported < TS_MAX_REPORT); c++) {
+			float z = ((float)gTsMean[c] - med) / sigma;
+
+			if (gTsSd[c] == TS_SD_FAILED) {
+				continue;
+			}
+
+			if ((z < TS_DEFAULT_THRESHOLD) && (z > -TS_DEFAULT_THRESHOLD)) {
+				continue;
+			}
+
+			if (z > 0) {
+				nSlow++;
+				slowest = c;
+			}
+
+			Serial.print(F("  Candidate "));
+			printHex(c);
+			Serial.print(F(": mean "));
+			Serial.print(base + gTsMean[c]);
+			Serial.print(F(" sd "));
+			Serial.print(gTsSd[c]);
+			Serial.print(F(" z="));
+			Serial.println(z, 1);
+			nReported++;
+		}
+
+		if (nReported == 0) {
+			Serial.println(F("  No candidates stand out."));
+		}
+
+		if (found9000 != -1) {
+			Serial.print(F("Candidate "));
+			printHex(found9000);
+			Serial.println(F(" got SW 9000."));
+			apdu[pos] = found9000;
+			break;
+		}
+
+		if (!autoAdvance || (nSlow != 1)) {
+			break;
+		}
+
+		Serial.print(F("Byte "));
+		Serial.print(pos);
+		Serial.print(F(" = "));
+		printHex(slowest);
+		Serial.println();
+
+		apdu[pos++] = slowest;
+
+		// Never the length byte, see above; with no data that's the end
+		if (pos == 4) {
+			pos = 5;
+		}
+	}
+
+	Serial.print(F("\nAPDU: "));
+	printHexBuf(apdu, 5 + dataLen);
+	Serial.println(F("\nAll done."));
+
+	cardPower(0);
+}
+
+#endif // ENABLE_TIMESCAN
@@ -0,0 +1,10 @@
+#ifndef TIMESCAN_H
+#define TIMESCAN_H
+
+#ifdef ENABLE_TIMESCAN
+
+void handle_tscan(String *cmdline);
+
+#endif // ENABLE_TIMESCAN
+
+#endif // TIMESCAN_H
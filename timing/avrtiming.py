@@ -0,0 +1,427 @@
+#!/usr/bin/env python3
+"""
+Cycle-accurate timing checks for the firmware, under simavr.
+
+Runs the firmware ELF in the timing harness (harness.c) with a scripted card,
+and measures, to the CPU clock:
+
+    tx       Reader character bit timing, at 372 and 93 clocks per Etu
+    rx       Where in each bit the firmware samples the card's characters
+    trigger  Reset release to scope trigger, 'ptrace atr' (ENABLE_POWERTRACE)
+    glitch   Glitch offset and width, 'gatr' (ENABLE_GLITCH)
+    gprog    Glitch program edges against gpasm.py's timeline (ENABLE_GLITCH)
+
+Each check has fixed limits (a bit edge more than 5% of a bit out, a sample
+point outside the middle 60% of the bit, a glitch width that isn't the one
+asked for ...). Every measurement must also be in the baseline, and within
+--tolerance CPU clocks of it, so a change which moves any of them shows up even when it's
+still inside the limits. The baseline is timing/baseline.json unless
+--baseline says otherwise; record a new one with --record after a change
+which is meant to move the timing. Checks for features the firmware wasn't
+built with are skipped.
+
+Examples:
+    avrtiming.py build/glitcher.ino.elf
+    avrtiming.py build/glitcher.ino.elf --record timing/baseline.json
+    avrtiming.py build/glitcher.ino.elf --no-baseline --only rx,glitch -v
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools'))
+import gpasm
+
+HARNESS = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'harness')
+BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'baseline.json')
+
+# CPU clocks per card clock
+CPU_PER_CLOCK = 4
+
+# ATRs for the two bit rates: 372 card clocks per Etu, and TA1=13 (93)
+ATR_SLOW = '3B 00'
+ATR_FAST = '3B 10 13'
+RATES = [('372', ATR_SLOW, 372 * CPU_PER_CLOCK), ('93', ATR_FAST, 93 * CPU_PER_CLOCK)]
+
+# vcserial: 53 70 00 00 06, answered with INS, 6 bytes and 9000
+VCSERIAL_HEADER = [0x53, 0x70, 0x00, 0x00, 0x06]
+VCSERIAL_REPLY = '70 00 00 00 00 00 00 90 00'
+VCSERIAL_PROBE = '70 FF 00 00 00 00 00 90 00'
+
+# Glitch program for the gprog check
+GPROG_SOURCE = """
+trig
+clock manual
+clk 4
+glitch 5
+wait 100
+glh
+wait 20
+gll
+clock free
+trig
+"""
+
+# Manual card clock period, CPU clocks
+GP_CLK_PERIOD = 8
+
+# Limits
+TX_EDGE_LIMIT = 0.05
+RX_SAMPLE_MIN = 0.20
+RX_SAMPLE_MAX = 0.80
+GPROG_LIMIT = 2
+
+
+class Run:
+    """One harness run: pin edges, characters the card heard, console lines."""
+
+    def __init__(self, text):
+        self.edges = []
+        self.chars = []
+        self.lines = []
+        self.end = None
+
+        for line in text.splitlines():
+            words = line.split(' ', 2)
+            if words[0] == 'E':
+                self.edges.append((int(words[1]), words[2].split()[0], int(words[2].split()[1])))
+            elif words[0] == 'C':
+                self.chars.append((int(words[1]), int(words[2], 16)))
+            elif words[0] == 'U':
+                self.lines.append((int(words[1]), words[2] if len(words) > 2 else ''))
+            elif words[0] == 'END':
+                self.end = int(words[1])
+
+    def pin(self, name, after=0):
+        """Edges on one pin, as (clock, level)."""
+        return [(t, v) for (t, p, v) in self.edges if (p == name) and (t >= after)]
+
+    def commands(self):
+        """Command names in the firmware's command list."""
+        return set(m.group(1) for m in (re.match(r'^   (\S+)\s{2,}', l) for (_, l) in self.lines) if m)
+
+    def echo(self, command):
+        """When the firmware echoed a command line, i.e. started on it."""
+        for t, l in self.lines:
+            if l == command:
+                return t
+        raise RuntimeError('firmware never got the command: ' + command)
+
+    def find(self, pattern):
+        """Console lines matching a regex, as match objects."""
+        return [m for m in (re.search(pattern, l) for (_, l) in self.lines) if m]
+
+
+class Checker:
+    """Collects measurements and failures, and checks them against a baseline."""
+
+    def __init__(self, baseline, tolerance, verbose):
+        self.baseline = baseline
+        self.tolerance = tolerance
+        self.verbose = verbose
+        self.results = {}
+        self.failures = []
+
+    def fail(self, msg):
+        self.failures.append(msg)
+        print('  FAIL: ' + msg)
+
+    def measure(self, name, value, tolerance=None):
+        """Record a measurement, in CPU clocks, and check it against the baseline."""
+        self.results[name] = value
+        tol = self.tolerance if tolerance is None else tolerance
+        if self.verbose:
+            print('  %-32s %d' % (name, value))
+        if (self.baseline is not None) and (name not in self.baseline):
+            self.fail('%s is %d, and not in the baseline (record a new one)' % (name, value))
+        elif self.baseline is not None:
+            if abs(value - self.baseline[name]) > tol:
+                self.fail('%s is %d, baseline %d (tolerance %d)' % (name, value, self.baseline[name], tol))
+
+
+def harness(elf, commands, atr=None, replies=(), timeout=60, verbose=False):
+    """
+    Run the firmware in the harness.
+
+    @param replies    list of (reply hex, probe) where probe is None or (bit, clocks)
+    """
+    args = [HARNESS, '-t', str(timeout)]
+    if atr is not None:
+        args += ['-a', atr]
+    for reply, probe in replies:
+        args += ['-r', reply]
+        if probe is not None:
+            args += ['-p', '%d:%d' % probe]
+    for c in commands:
+        args += ['-c', c]
+    args.append(elf)
+
+    if verbose:
+        print('  $ ' + ' '.join(("'%s'" % a) if ' ' in a else a for a in args))
+    p = subprocess.run(args, stdout=subprocess.PIPE, universal_newlines=True)
+    run = Run(p.stdout)
+    if run.end is None:
+        raise RuntimeError('harness run failed (exit status %d): %s' % (p.returncode, ' '.join(commands)))
+    return run
+
+
+def char_bits(val):
+    """Line levels of a direct-convention character: start, data, even parity, stop."""
+    bits = [(val >> i) & 1 for i in range(8)]
+    return [0] + bits + [sum(bits) & 1, 1]
+
+
+def check_tx(elf, chk):
+    """Reader character bit timing."""
+    for rate, atr, etu in RATES:
+        run = harness(elf, ['on', 'vcserial'], atr, [(VCSERIAL_REPLY, None)], verbose=chk.verbose)
+
+        heard = [v for (_, v) in run.chars]
+        if heard[:5] != VCSERIAL_HEADER:
+            chk.fail('etu %s: card heard %s, not the vcserial header' % (rate, ' '.join('%02X' % v for v in heard)))
+            continue
+
+        tx = run.pin('IO_TX')
+        worst = 0
+        for start, val in run.chars[:5]:
+            # Every edge in the character, against the bit grid from its start bit
+            levels = char_bits(val)
+            edges = [(t - start, v) for (t, v) in tx if start <= t < start + (11 * etu)]
+            expected = [(i * etu, levels[i]) for i in range(len(levels)) if (i == 0) or (levels[i] != levels[i - 1])]
+            if [v for (_, v) in edges] != [v for (_, v) in expected]:
+                chk.fail('etu %s: character %02X has the wrong edges' % (rate, val))
+                continue
+            for (t, _), (e, _) in zip(edges, expected):
+                worst = max(worst, abs(t - e))
+
+        chk.measure('tx.%s.edge_error' % rate, worst)
+        if worst > TX_EDGE_LIMIT * etu:
+            chk.fail('etu %s: bit edge %d clocks out (limit %d)' % (rate, worst, TX_EDGE_LIMIT * etu))
+
+        starts = [t for (t, _) in run.chars[:5]]
+        spacing = [b - a for (a, b) in zip(starts, starts[1:])]
+        chk.measure('tx.%s.char_min' % rate, min(spacing))
+        chk.measure('tx.%s.char_max' % rate, max(spacing))
+        if min(spacing) < (12 - TX_EDGE_LIMIT) * etu:
+            chk.fail('etu %s: characters %d clocks apart, less than 12 Etu' % (rate, min(spacing)))
+
+
+def check_rx(elf, chk):
+    """Receive sampling point of each bit, by binary search on a shortened low bit."""
+    for rate, atr, etu in RATES:
+        # For each bit: longest low time read as 1, shortest read as 0
+        lo = [0] * 8
+        hi = [etu] * 8
+
+        while any(h - l > 1 for (l, h) in zip(lo, hi)):
+            probes = [(l + h) // 2 for (l, h) in zip(lo, hi)]
+            replies = [(VCSERIAL_PROBE, (k, probes[k])) for k in range(8)]
+            run = harness(elf, ['on'] + ['vcserial'] * 8, atr, replies, verbose=chk.verbose)
+
+            data = run.find(r'^Hex data:\s+([0-9A-F]{2})')
+            if len(data) != 8:
+                chk.fail('etu %s: %d of 8 vcserial commands worked' % (rate, len(data)))
+                return
+
+            for k in range(8):
+                if (int(data[k].group(1), 16) >> k) & 1:
+                    lo[k] = probes[k]
+                else:
+                    hi[k] = probes[k]
+
+        for k in range(8):
+            # The firmware read the pin in the last clock the line was still low
+            sample = hi[k] - 1
+            chk.measure('rx.%s.bit%d' % (rate, k), sample)
+            if not (RX_SAMPLE_MIN * etu <= sample <= RX_SAMPLE_MAX * etu):
+                chk.fail('etu %s: bit %d sampled %d clocks (%.0f%%) into the bit' % (rate, k, sample, (100.0 * sample) / etu))
+
+
+def rising_after(run, pin, t0):
+    """First rising edge on a pin at or after t0."""
+    for t, v in run.pin(pin, t0):
+        if v:
+            return t
+    return None
+
+
+def check_trigger(elf, chk):
+    """Reset release to scope trigger, against the delay asked for."""
+    latency = {}
+    for delay in (100, 1100):
+        run = harness(elf, ['ptrace atr 1 %d 64' % delay], ATR_SLOW, verbose=chk.verbose)
+        trig = rising_after(run, 'TRIG', run.echo('ptrace atr 1 %d 64' % delay))
+        rst = [t for (t, v) in run.pin('RST') if v and (trig is not None) and (t < trig)]
+        if (trig is None) or not rst:
+            chk.fail('ptrace: no reset release and trigger (delay %d)' % delay)
+            return
+        rst = rst[-1]
+        latency[delay] = trig - rst
+
+    per_clock = (latency[1100] - latency[100]) / 1000.0
+    chk.measure('trigger.overhead', latency[100] - (100 * CPU_PER_CLOCK))
+    if per_clock != CPU_PER_CLOCK:
+        chk.fail('ptrace: trigger delay is %.3f CPU clocks per card clock, not %d' % (per_clock, CPU_PER_CLOCK))
+
+
+def check_glitch(elf, chk):
+    """Glitch offset and width from 'gatr'."""
+    offsets = [4000, 4200, 4400]
+
+    for width in (2, 9, 17):
+        run = harness(elf, ['gatr 4000 4400 200 %d 1' % width], ATR_SLOW, verbose=chk.verbose)
+
+        # The glitched attempts are the last three resets
+        releases = [t for (t, v) in run.pin('RST') if v][-len(offsets):]
+        if len(releases) != len(offsets):
+            chk.fail('gatr: %d resets, expected at least %d' % (len(releases), len(offsets)))
+            return
+
+        overheads = []
+        for offset, rst in zip(offsets, releases):
+            glitch = run.pin('GLITCH', rst)
+            if (len(glitch) < 2) or (glitch[0][1] != 1) or (glitch[1][1] != 0):
+                chk.fail('gatr: no glitch pulse at offset %d, width %d' % (offset, width))
+                return
+            overheads.append(glitch[0][0] - rst - offset)
+            if glitch[1][0] - glitch[0][0] != width:
+                chk.fail('gatr: width %d gave a %d clock pulse' % (width, glitch[1][0] - glitch[0][0]))
+
+        chk.measure('glitch.w%d.overhead' % width, overheads[0])
+        if len(set(overheads)) != 1:
+            chk.fail('gatr: offset error changes with the offset, width %d: %s' % (width, overheads))
+
+
+def check_gprog(elf, chk):
+    """Glitch program pin edges against gpasm.py's timeline."""
+    prog = gpasm.assemble(GPROG_SOURCE)
+    gpasm.check(prog)
+    total, events, _ = gpasm.simulate(prog)
+    load = 'gprog load ' + ' '.join('%02X' % b for b in gpasm.encode(prog))
+
+    run = harness(elf, [load, 'gprog run'], verbose=chk.verbose)
+    trig = run.pin('TRIG', run.echo('gprog run'))
+    if len(trig) < 2:
+        chk.fail("gprog: program didn't toggle the trigger twice")
+        return
+
+    # Everything relative to the first trigger toggle
+    t0 = trig[0][0]
+    t_trig = [t for (t, e) in events if e == 'trigger toggle'][0]
+    glitch = run.pin('GLITCH', t0)
+
+    # Manual clock pulses, between the switches to and from the manual clock
+    manual = [t - t_trig for (t, e) in events if e == 'clock manual'][0]
+    free = [t - t_trig for (t, e) in events if e == 'clock free-running'][0]
+    clk = [t for (t, v) in run.pin('CLK', t0 + manual + GPROG_LIMIT + 1) if v and (t < t0 + free - GPROG_LIMIT)]
+
+    def at(name, got, want):
+        chk.measure('gprog.' + name, got)
+        if abs(got - want) > GPROG_LIMIT:
+            chk.fail('gprog: %s at %d, gpasm.py says %d' % (name, got, want))
+
+    for t, e in events:
+        want = t - t_trig
+        if e.endswith('clock pulses'):
+            n = int(e.split()[0])
+            if len(clk) != n:
+                chk.fail('gprog: %d clock pulses, expected %d' % (len(clk), n))
+                continue
+            at('clk_first', clk[0] - t0, want)
+            period = [b - a for (a, b) in zip(clk, clk[1:])]
+            if any(p != GP_CLK_PERIOD for p in period):
+                chk.fail('gprog: clock periods %s, expected %d' % (period, GP_CLK_PERIOD))
+        elif e.startswith('glitch pulse'):
+            width = int(e.split()[-1])
+            if len(glitch) < 2:
+                chk.fail('gprog: no glitch pulse')
+                return
+            at('glp_start', glitch[0][0] - t0, want)
+            chk.measure('gprog.glp_width', glitch[1][0] - glitch[0][0], 0)
+            if glitch[1][0] - glitch[0][0] != width:
+                chk.fail('gprog: glitch pulse %d clocks, expected %d' % (glitch[1][0] - glitch[0][0], width))
+        elif e == 'glitch high':
+            if len(glitch) < 4:
+                chk.fail('gprog: no glh/gll pulse')
+                return
+            at('glh', glitch[2][0] - t0, want)
+        elif e.startswith('glitch low'):
+            at('gll', glitch[3][0] - t0, want)
+        elif (e == 'trigger toggle') and (want > 0):
+            at('trig_end', trig[1][0] - t0, want)
+
+
+CHECKS = [
+    ('tx', None, check_tx),
+    ('rx', None, check_rx),
+    ('trigger', 'ptrace', check_trigger),
+    ('glitch', 'gatr', check_glitch),
+    ('gprog', 'gprog', check_gprog),
+]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('elf', help='firmware ELF (arduino-cli compile --output-dir ...)')
+    ap.add_argument('--baseline', help='fail if any measurement drifts from this baseline (default %s)' % os.path.relpath(BASELINE))
+    ap.add_argument('--no-baseline', action='store_true', help='only check the fixed limits')
+    ap.add_argument('--record', help='save the measurements as a baseline')
+    ap.add_argument('--tolerance', type=int, default=2, help='drift allowed from the baseline, CPU clocks (default 2)')
+    ap.add_argument('--only', help='comma separated checks to run (%s)' % ','.join(c[0] for c in CHECKS))
+    ap.add_argument('-v', '--verbose', action='store_true', help='show harness runs and every measurement')
+    args = ap.parse_args()
+
+    if not os.path.exists(HARNESS):
+        sys.exit('%s not built, run make in %s' % (HARNESS, os.path.dirname(HARNESS)))
+
+    # Recording a new baseline doesn't compare with the old one unless asked
+    baseline = None
+    path = args.baseline
+    if (path is None) and not args.record and not args.no_baseline:
+        path = BASELINE
+        if not os.path.exists(path):
+            sys.exit('No baseline (%s): record one with --record, or check the limits only with --no-baseline'
+                     % os.path.relpath(path))
+    if path is not None:
+        with open(path) as f:
+            baseline = json.load(f)
+
+    only = args.only.split(',') if args.only else None
+    chk = Checker(baseline, args.tolerance, args.verbose)
+
+    # What the firmware was built with
+    features = harness(args.elf, [], verbose=args.verbose).commands()
+
+    for name, command, check in CHECKS:
+        if (only is not None) and (name not in only):
+            continue
+        if (command is not None) and (command not in features):
+            print('%s: skipped, no %s command' % (name, command))
+            continue
+
+        print('%s:' % name)
+        n = len(chk.failures)
+        try:
+            check(args.elf, chk)
+        except RuntimeError as e:
+            chk.fail(str(e))
+        if len(chk.failures) == n:
+            print('  ok')
+
+    if args.record:
+        with open(args.record, 'w') as f:
+            json.dump(chk.results, f, indent=1, sort_keys=True)
+        print('Baseline saved to %s' % args.record)
+
+    if chk.failures:
+        print('\n%d failure(s)' % len(chk.failures))
+        sys.exit(1)
+    print('\nAll timing checks passed')
+
+
+if __name__ == '__main__':
+    main()
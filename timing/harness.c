@@ -0,0 +1,517 @@
+/***
+ * Timing harness: runs the firmware ELF under simavr, with a scripted card on
+ * the I/O line, and logs every edge on the pins whose timing matters, to the
+ * CPU clock.
+ *
+ * The card is as simple as it can be: it sends its ATR (direct convention,
+ * 372 clocks per Etu) 10000 card clocks after reset is released, switches to
+ * the rate in TA1, and answers every 5th character from the reader with the
+ * next reply in its list. A reply's second character can be a "probe": an
+ * FF whose bit k is only low for the first c CPU clocks of its bit time, to
+ * find where the firmware samples that bit.
+ *
+ * Console commands are typed in at the firmware's prompt, one at a time.
+ *
+ * Output, one line per event, CPU clocks from reset:
+ *   E <clock> <pin> <level>	Pin edge: IO_TX, RST, TRIG, VCC, GLITCH, CLK
+ *								(CLK only while Timer1 isn't driving it)
+ *   C <clock> <hex>			Character from the reader, as the card heard it
+ *   U <clock> <text>			Console output line
+ *   END <clock>				Last command done
+ *   TIMEOUT <clock>
+ *
+ * See avrtiming.py, which runs this and checks the results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+
+#define F_CPU			14318180UL
+
+/// CPU clocks per card clock
+#define CPU_PER_CLOCK	4
+
+/// Reset released to the start of TS, card clocks
+#define ATR_DELAY		10000
+
+/// Start of the reader's last header character to the card's reply, Etu
+#define TURNAROUND		16
+
+/// Timer1 control register A (data space address) and its OC1A mode bits
+#define REG_TCCR1A		0x80
+#define COM1A_MASK		0xC0
+
+#define MAX_REPLIES		32
+#define MAX_COMMANDS	32
+#define MAX_EVENTS		4096
+
+/// A level change the card puts on the I/O line
+typedef struct {
+	avr_cycle_count_t t;
+	uint8_t level;
+} LINE_EVENT;
+
+/// A scripted reply, and its probe
+typedef struct {
+	uint8_t data[64];
+	int len;
+	int probeBit;				///< -1 = no probe
+	uint32_t probeClocks;
+} REPLY;
+
+static avr_t *avr;
+
+// Card
+static uint8_t gAtr[33];
+static int gAtrLen = 0;
+static REPLY gReplies[MAX_REPLIES];
+static int gNumReplies = 0, gNextReply = 0;
+static uint32_t gEtu = 372 * CPU_PER_CLOCK;	///< Card's bit time, CPU clocks
+static uint32_t gRunEtu;					///< Bit time after the ATR
+
+static LINE_EVENT gEvents[MAX_EVENTS];
+static int gEvHead = 0, gEvTail = 0;
+static uint8_t gCardLevel = 1, gTxLevel = 1;
+static uint8_t gPowered = 0, gRst = 0;
+
+// Card receiver
+static int gRxBusy = 0, gRxBit = 0;
+static uint16_t gRxVal = 0;
+static avr_cycle_count_t gRxStart = 0;
+static int gRxCount = 0;
+
+// Console
+static const char *gCommands[MAX_COMMANDS];
+static int gNumCommands = 0, gNextCommand = 0;
+static char gLine[1024];
+static int gLineLen = 0;
+static char gLast[3] = { 0, 0, 0 };
+static const char *gTyping = NULL;
+static int gXoff = 0;
+static int gDone = 0;
+
+static avr_irq_t *gRxPinIrq, *gUartInIrq;
+
+
+/****************************************************************************
+ * I/O line
+ */
+
+/// The firmware's RX pin sees the card and its own TX pin (open drain)
+static void lineUpdate(void)
+{
+	avr_raise_irq(gRxPinIrq, gCardLevel && gTxLevel);
+}
+
+static avr_cycle_count_t cardLineTimer(avr_t *a, avr_cycle_count_t when, void *param)
+{
+	(void)a; (void)when; (void)param;
+
+	while ((gEvTail != gEvHead) && (gEvents[gEvTail].t <= avr->cycle)) {
+		gCardLevel = gEvents[gEvTail].level;
+		gEvTail = (gEvTail + 1) % MAX_EVENTS;
+	}
+	lineUpdate();
+
+	return (gEvTail != gEvHead) ? gEvents[gEvTail].t : 0;
+}
+
+static void cardLine(avr_cycle_count_t t, uint8_t level)
+{
+	int wasEmpty = (gEvTail == gEvHead);
+
+	gEvents[gEvHead].t = t;
+	gEvents[gEvHead].level = level;
+	gEvHead = (gEvHead + 1) % MAX_EVENTS;
+
+	if (wasEmpty) {
+		avr_cycle_timer_register(avr, (t > avr->cycle) ? (t - avr->cycle) : 1, cardLineTimer, NULL);
+	}
+}
+
+/**
+ * Queue a character: start bit, 8 data bits, even parity, 2 Etu guard.
+ *
+ * @param	probeBit	Bit to probe, or -1
+ * @return Start of the next character
+ */
+static avr_cycle_count_t cardChar(avr_cycle_count_t t, uint8_t val, int probeBit, uint32_t probeClocks)
+{
+	uint8_t parity = 0;
+
+	cardLine(t, 0);
+	for (int i = 0; i < 8; i++) {
+		avr_cycle_count_t cell = t + ((avr_cycle_count_t)(i + 1) * gEtu);
+
+		if (i == probeBit) {
+			// FF with this bit low for only part of its time
+			cardLine(cell, probeClocks ? 0 : 1);
+			cardLine(cell + probeClocks, 1);
+		} else {
+			cardLine(cell, (val >> i) & 1);
+		}
+		parity ^= (val >> i) & 1;
+	}
+	cardLine(t + (9 * (avr_cycle_count_t)gEtu), parity);
+	cardLine(t + (10 * (avr_cycle_count_t)gEtu), 1);
+
+	return t + (12 * (avr_cycle_count_t)gEtu);
+}
+
+static void cardReset(void)
+{
+	avr_cycle_timer_cancel(avr, cardLineTimer, NULL);
+	gEvHead = gEvTail = 0;
+	gCardLevel = 1;
+	gEtu = 372 * CPU_PER_CLOCK;
+	gRxBusy = 0;
+	gRxCount = 0;
+	lineUpdate();
+}
+
+static void cardAtr(void)
+{
+	avr_cycle_count_t t = avr->cycle + ((avr_cycle_count_t)ATR_DELAY * CPU_PER_CLOCK);
+
+	for (int i = 0; i < gAtrLen; i++) {
+		t = cardChar(t, gAtr[i], -1, 0);
+	}
+	gEtu = gRunEtu;
+}
+
+static void cardReply(avr_cycle_count_t t)
+{
+	REPLY *r;
+
+	if (gNumReplies == 0) {
+		return;
+	}
+	r = &gReplies[(gNextReply < gNumReplies) ? gNextReply : (gNumReplies - 1)];
+	gNextReply++;
+
+	for (int i = 0; i < r->len; i++) {
+		if ((i == 1) && (r->probeBit >= 0)) {
+			t = cardChar(t, 0xFF, r->probeBit, r->probeClocks);
+		} else {
+			t = cardChar(t, r->data[i], -1, 0);
+		}
+	}
+}
+
+/// Card receiver: sample the reader's character in the middle of each bit
+static avr_cycle_count_t cardRxTimer(avr_t *a, avr_cycle_count_t when, void *param)
+{
+	(void)a; (void)param;
+
+	gRxVal |= (uint16_t)gTxLevel << gRxBit;
+	if (++gRxBit < 9) {
+		return when + gEtu;
+	}
+
+	printf("C %llu %02X\n", (unsigned long long)gRxStart, gRxVal & 0xFF);
+	gRxBusy = 0;
+	if (++gRxCount == 5) {
+		gRxCount = 0;
+		cardReply(gRxStart + ((avr_cycle_count_t)TURNAROUND * gEtu));
+	}
+	return 0;
+}
+
+
+/****************************************************************************
+ * Pins
+ */
+
+static void logEdge(const char *name, uint32_t value)
+{
+	printf("E %llu %s %u\n", (unsigned long long)avr->cycle, name, value ? 1 : 0);
+}
+
+static void txPinChanged(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq; (void)param;
+
+	logEdge("IO_TX", value);
+	gTxLevel = value ? 1 : 0;
+	lineUpdate();
+
+	if (!value && !gRxBusy && gPowered && gRst) {
+		gRxBusy = 1;
+		gRxBit = 0;
+		gRxVal = 0;
+		gRxStart = avr->cycle;
+		avr_cycle_timer_register(avr, (3 * gEtu) / 2, cardRxTimer, NULL);
+	}
+}
+
+static void rstPinChanged(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq; (void)param;
+
+	logEdge("RST", value);
+	gRst = value ? 1 : 0;
+	cardReset();
+	if (gRst && gPowered && (gAtrLen > 0)) {
+		cardAtr();
+	}
+}
+
+static void vccPinChanged(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq; (void)param;
+
+	// Active low
+	logEdge("VCC", !value);
+	gPowered = !value;
+	if (!gPowered) {
+		cardReset();
+	}
+}
+
+static void namedPinChanged(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq;
+	logEdge((const char *)param, value);
+}
+
+static void clkPinChanged(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq; (void)param;
+
+	// Only the manual clock -- the free-running one would drown everything
+	if (!(avr->data[REG_TCCR1A] & COM1A_MASK)) {
+		logEdge("CLK", value);
+	}
+}
+
+
+/****************************************************************************
+ * Console
+ */
+
+static void typeMore(void)
+{
+	while ((gTyping != NULL) && !gXoff) {
+		avr_raise_irq(gUartInIrq, (uint8_t)*gTyping);
+		if (*gTyping == '\n') {
+			gTyping = NULL;
+		} else {
+			gTyping++;
+		}
+	}
+}
+
+static void uartOutput(avr_irq_t *irq, uint32_t value, void *param)
+{
+	char c = (char)value;
+	static char cmd[1100];
+
+	(void)irq; (void)param;
+
+	if (c == '\n') {
+		gLine[gLineLen] = '\0';
+		printf("U %llu %s\n", (unsigned long long)avr->cycle, gLine);
+		gLineLen = 0;
+	} else if ((c != '\r') && (gLineLen < (int)sizeof(gLine) - 1)) {
+		gLine[gLineLen++] = c;
+	}
+
+	gLast[0] = gLast[1];
+	gLast[1] = gLast[2];
+	gLast[2] = c;
+
+	// At the prompt: type the next command, or stop
+	if (memcmp(gLast, "\n> ", 3) == 0) {
+		if (gNextCommand < gNumCommands) {
+			snprintf(cmd, sizeof(cmd), "%s\n", gCommands[gNextCommand++]);
+			gTyping = cmd;
+			typeMore();
+		} else {
+			printf("END %llu\n", (unsigned long long)avr->cycle);
+			gDone = 1;
+		}
+	}
+}
+
+static void uartXon(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq; (void)value; (void)param;
+	gXoff = 0;
+	typeMore();
+}
+
+static void uartXoff(avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq; (void)value; (void)param;
+	gXoff = 1;
+}
+
+
+/****************************************************************************
+ * Main
+ */
+
+/// Parse hex bytes, with or without spaces. Returns the count or -1.
+static int parseHex(const char *s, uint8_t *buf, int maxLen)
+{
+	int n = 0;
+	unsigned int val;
+
+	while (*s != '\0') {
+		if (*s == ' ') {
+			s++;
+			continue;
+		}
+		if ((n >= maxLen) || (sscanf(s, "%2x", &val) != 1)) {
+			return -1;
+		}
+		buf[n++] = val;
+		s += ((s[1] != '\0') && (s[1] != ' ')) ? 2 : 1;
+	}
+	return n;
+}
+
+/// Card bit time after the ATR, from TA1
+static uint32_t atrRunEtu(void)
+{
+	static const uint16_t DI_TABLE[16] = { 0, 1, 2, 4, 8, 16, 32, 64, 12, 20, 0, 0, 0, 0, 0, 0 };
+	static const uint16_t FI_TABLE[16] = { 372, 372, 558, 744, 1116, 1488, 1860, 0, 0, 512, 768, 1024, 1536, 2048, 0, 0 };
+
+	if ((gAtrLen >= 3) && (gAtr[1] & 0x10)) {
+		uint16_t di = DI_TABLE[gAtr[2] & 0x0F];
+		uint16_t fi = FI_TABLE[gAtr[2] >> 4];
+
+		if ((di != 0) && (fi != 0)) {
+			return (fi * CPU_PER_CLOCK) / di;
+		}
+	}
+	return 372 * CPU_PER_CLOCK;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <firmware.elf>\n"
+		"\n"
+		"  -c <line>     Console command, typed at the prompt (repeatable, in order)\n"
+		"  -a <hex>      Card ATR (direct convention). No card without it.\n"
+		"  -r <hex>      Reply to the next APDU header (repeatable; the last repeats)\n"
+		"  -p <k>:<n>    Probe for the last -r: its second character is FF with\n"
+		"                bit k low for the first n CPU clocks of the bit\n"
+		"  -t <seconds>  Give up after this much simulated time (default 60)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	elf_firmware_t fw;
+	double maxSeconds = 60;
+	avr_cycle_count_t maxCycles;
+	int opt, state;
+
+	while ((opt = getopt(argc, argv, "c:a:r:p:t:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				if (gNumCommands < MAX_COMMANDS) {
+					gCommands[gNumCommands++] = optarg;
+				}
+				break;
+			case 'a':
+				gAtrLen = parseHex(optarg, gAtr, sizeof(gAtr));
+				if (gAtrLen < 2) {
+					fprintf(stderr, "Bad ATR: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'r':
+				if (gNumReplies >= MAX_REPLIES) {
+					fprintf(stderr, "Too many replies\n");
+					return 1;
+				}
+				gReplies[gNumReplies].len = parseHex(optarg, gReplies[gNumReplies].data, sizeof(gReplies[0].data));
+				gReplies[gNumReplies].probeBit = -1;
+				if (gReplies[gNumReplies].len < 2) {
+					fprintf(stderr, "Bad reply: %s\n", optarg);
+					return 1;
+				}
+				gNumReplies++;
+				break;
+			case 'p':
+				if ((gNumReplies == 0) ||
+						(sscanf(optarg, "%d:%u", &gReplies[gNumReplies - 1].probeBit, &gReplies[gNumReplies - 1].probeClocks) != 2) ||
+						(gReplies[gNumReplies - 1].probeBit < 0) || (gReplies[gNumReplies - 1].probeBit > 7)) {
+					fprintf(stderr, "Bad probe (needs a reply first): %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 't':
+				maxSeconds = atof(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(argv[optind], &fw) != 0) {
+		fprintf(stderr, "Can't read %s\n", argv[optind]);
+		return 1;
+	}
+	fw.frequency = F_CPU;
+
+	avr = avr_make_mcu_by_name("atmega328p");
+	if (avr == NULL) {
+		fprintf(stderr, "simavr doesn't know the ATmega328P\n");
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;
+	gRunEtu = atrRunEtu();
+
+	// Pins
+	gRxPinIrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 3), txPinChanged, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 4), rstPinChanged, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 7), namedPinChanged, (void *)"TRIG");
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 2), vccPinChanged, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('C'), 3), namedPinChanged, (void *)"GLITCH");
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 1), clkPinChanged, NULL);
+	lineUpdate();
+
+	// Console, without simavr echoing it to stdout
+	uint32_t flags = 0;
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+	gUartInIrq = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT), uartOutput, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XON), uartXon, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUT_XOFF), uartXoff, NULL);
+
+	maxCycles = (avr_cycle_count_t)(maxSeconds * F_CPU);
+	do {
+		state = avr_run(avr);
+	} while (!gDone && (state != cpu_Done) && (state != cpu_Crashed) && (avr->cycle < maxCycles));
+
+	if (!gDone) {
+		printf("TIMEOUT %llu\n", (unsigned long long)avr->cycle);
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""
+Differential execution against a golden card ('diff' command, needs
+ENABLE_DIFF).
+
+Runs an APDU sequence on a golden card and saves its results, then runs the
+same sequence on another card and prints only the steps which differ. The
+firmware keeps a hash of each golden response and only sends the steps
+which don't match. The golden response data is kept here, so differing data
+can be shown byte by byte.
+
+Sequence file, one APDU per line, '#' starts a comment:
+
+    recv 53 70 00 00 06
+    send 53 72 00 00 04 01 02 03 04
+
+Examples:
+    apdiff.py /dev/ttyUSB0 record seq.txt golden.json     # golden card
+    apdiff.py /dev/ttyUSB0 compare seq.txt golden.json    # card under test
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+from glitcher import Glitcher, FRAME_DIFF
+
+DIFF_SW = 0x01
+DIFF_DATA = 0x02
+DIFF_CHARS = 0x04
+DIFF_TIME = 0x08
+
+
+def decode_diff(payload):
+    step, flags, sw, crc, nchars, t, ndata = struct.unpack_from('<BBHHHIB', payload)
+    return {
+        'step': step, 'flags': flags, 'sw': sw, 'crc': crc, 'nchars': nchars,
+        't': t, 'data': list(payload[13:13 + ndata]),
+    }
+
+
+def load_sequence(path):
+    seq = []
+    for line in open(path):
+        line = line.split('#')[0].strip()
+        if not line:
+            continue
+        words = line.split()
+        if words[0] not in ('send', 'recv'):
+            sys.exit('%s: bad line: %s' % (path, line))
+        seq.append(' '.join(words))
+    return seq
+
+
+def upload_sequence(g, seq):
+    g.command('diff clear')
+    g.wait_for(b'> ')
+    for apdu in seq:
+        g.command('diff add ' + apdu)
+        text = g.wait_for(b'> ').decode('ascii', 'replace')
+        if 'ERROR' in text:
+            sys.exit('%s: %s' % (apdu, text.strip()))
+
+
+def step_name(seq, step):
+    return 'ATR' if step == 0 else seq[step - 1]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('port')
+    ap.add_argument('mode', choices=('record', 'compare'))
+    ap.add_argument('sequence', help='APDU sequence file')
+    ap.add_argument('golden', help='golden results (JSON), written by record')
+    ap.add_argument('--tolerance', type=int, help='timing tolerance, card clocks')
+    args = ap.parse_args()
+
+    seq = load_sequence(args.sequence)
+    g = Glitcher(args.port)
+    g.command('binary 1')
+    g.wait_for(b'> ')
+    upload_sequence(g, seq)
+
+    if args.mode == 'record':
+        g.command('diff golden')
+        steps = [decode_diff(g.expect_frame(FRAME_DIFF, timeout=30)) for _ in range(len(seq) + 1)]
+        json.dump({'sequence': seq, 'steps': steps}, open(args.golden, 'w'), indent=1)
+        print('Recorded %d steps' % len(seq))
+        return
+
+    golden = json.load(open(args.golden))
+    if golden['sequence'] != seq:
+        sys.exit('golden results are for a different sequence')
+    for s in golden['steps']:
+        g.command('diff load %d %X %X %d %d' % (s['step'], s['sw'], s['crc'], s['nchars'], s['t']))
+        g.wait_for(b'> ')
+
+    g.command('diff run' + (' %d' % args.tolerance if args.tolerance is not None else ''))
+    # Frames only come for the steps which differ
+    while b'Steps differing' not in g.text:
+        try:
+            ftype, payload = g.read_frame(timeout=5)
+        except TimeoutError:
+            continue
+        if ftype != FRAME_DIFF:
+            continue
+
+        d = decode_diff(payload)
+        gs = golden['steps'][d['step']]
+        out = ['step %d (%s):' % (d['step'], step_name(seq, d['step']))]
+        if d['flags'] & DIFF_SW:
+            out.append('%s %04X -> %04X' % ('conv' if d['step'] == 0 else 'SW', gs['sw'], d['sw']))
+        if d['flags'] & DIFF_CHARS:
+            out.append('chars %d -> %d' % (gs['nchars'], d['nchars']))
+        if d['flags'] & DIFF_TIME:
+            out.append('time %+d clocks' % (d['t'] - gs['t']))
+        print(' '.join(out))
+
+        if d['flags'] & DIFF_DATA:
+            for i, (a, b) in enumerate(zip(gs['data'], d['data'])):
+                if a != b:
+                    print('    [%3d] %02X -> %02X' % (i, a, b))
+            if len(gs['data']) != len(d['data']):
+                print('    length %d -> %d' % (len(gs['data']), len(d['data'])))
+
+    text = g.wait_for(b'> ').decode('ascii', 'replace')
+    print([l for l in text.splitlines() if l.startswith('Steps differing')][0])
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""
+Throughput and latency benchmarks ('bench' command, needs ENABLE_BENCH).
+
+Runs a set of benchmarks on a glitcher board, or on the host build with a
+simulated card, and writes one JSON object per benchmark per line, so runs
+before and after a change can be compared.
+
+Benchmarks:
+    apdu_recv   Case 2 APDUs (card sends data) per second
+    apdu_send   Case 3 APDUs (card receives data) per second
+    reset_cold  Cold resets per second, and reset release to ATR latency
+    reset_warm  Warm resets per second, and reset release to ATR latency
+    scancla     'scancla' wall time for one class
+    link        Host link bytes per second, timed by the firmware and here
+    glitch      Glitched cold resets per second, as 'gatr' does them
+                (only if the firmware has ENABLE_GLITCH)
+
+Each result has the benchmark name, the target, the optional tag, the count
+'n' and failures 'fail', 'elapsed_us' (firmware time), 'rate' (n per second),
+the per-operation times 't_min_us', 't_mean_us' and 't_max_us' where they
+apply, and 'host_s', the wall time the host waited. On the host build, the
+firmware times are simulated time; host_s is how long the simulation took.
+
+'scancla' uses the scan cache as usual: a class which has been scanned
+before is only verified. --fresh-scan clears the cache first (all of it).
+
+Examples:
+    bench.py --port /dev/ttyUSB0 --tag before >> results.jsonl
+    bench.py --sim -c videocrypt --tag after >> results.jsonl
+    bench.py --sim -c videocrypt --only apdu_recv,link
+"""
+
+import argparse
+import datetime
+import json
+import struct
+import sys
+import time
+
+from glitcher import Glitcher, SimPort, FRAME_BENCH, FRAME_BENCH_DATA
+
+CARD_CLOCK_HZ = 3579545
+
+# Benchmark numbers -- keep in sync with bench.h
+BENCH_NAMES = {
+    0x01: 'apdu_recv', 0x02: 'apdu_send', 0x03: 'reset_cold', 0x04: 'reset_warm',
+    0x05: 'scancla', 0x06: 'link', 0x07: 'glitch',
+}
+
+ALL = ['apdu_recv', 'apdu_send', 'reset_cold', 'reset_warm', 'scancla', 'link', 'glitch']
+
+# Long enough for a full class scan on a slow card
+BENCH_TIMEOUT = 900.0
+
+
+def decode_bench(payload):
+    test, n, fail, elapsed, t_min, t_mean, t_max = struct.unpack_from('<B6I', payload)
+    return {
+        'test': test, 'n': n, 'fail': fail, 'elapsed': elapsed,
+        't_min': t_min, 't_mean': t_mean, 't_max': t_max,
+    }
+
+
+def clocks_to_us(t):
+    return round((t * 1e6) / CARD_CLOCK_HZ, 1)
+
+
+def run_bench(g, command):
+    """
+    Run one 'bench' command.
+
+    @return (result dict, host seconds, host link bytes per second or None)
+    """
+    t0 = time.monotonic()
+    g.command(command)
+
+    data_bytes = 0
+    t_first = t_last = None
+    while True:
+        ftype, payload = g.read_frame(BENCH_TIMEOUT)
+        if ftype == FRAME_BENCH_DATA:
+            # Rate from the end of the first frame to the end of the last
+            t_last = time.monotonic()
+            if t_first is None:
+                t_first = t_last
+            else:
+                data_bytes += len(payload) + 5
+        elif ftype == FRAME_BENCH:
+            break
+    host_s = time.monotonic() - t0
+    g.wait_for(b'> ', BENCH_TIMEOUT)
+
+    host_rate = None
+    if (t_first is not None) and (t_last > t_first):
+        host_rate = round(data_bytes / (t_last - t_first), 1)
+    return decode_bench(payload), host_s, host_rate
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    target = ap.add_mutually_exclusive_group(required=True)
+    target.add_argument('--port', help='glitcher serial port')
+    target.add_argument('--sim', nargs=argparse.REMAINDER,
+                        help='run sim/glitcher-sim with the rest of the arguments (its card options)')
+    ap.add_argument('--tag', help='added to every result, e.g. a git commit')
+    ap.add_argument('--only', help='comma separated benchmarks to run (default all)')
+    ap.add_argument('-n', '--count', type=int, default=50, help='APDUs or resets per benchmark (default 50)')
+    ap.add_argument('--recv', default='53 70 00 00 06', help="case 2 APDU header (default VideoCrypt serial number)")
+    ap.add_argument('--send', default='53 72 00 00 10', help="case 3 APDU header, zeros are sent (default VideoCrypt message)")
+    ap.add_argument('--cla', default='53', help="class for 'scancla' (default 53)")
+    ap.add_argument('--fresh-scan', action='store_true', help='clear the scan cache before scancla')
+    ap.add_argument('--link-bytes', type=int, default=20000, help='bytes for the link benchmark (default 20000)')
+    ap.add_argument('--glitch', default='4000 9', help="glitch '<offset> <width>' (default '4000 9')")
+    ap.add_argument('-v', '--verbose', action='store_true', help='copy the console to stderr')
+    args = ap.parse_args()
+
+    only = args.only.split(',') if args.only else ALL
+    for name in only:
+        if name not in ALL:
+            sys.exit('Unknown benchmark: %s' % name)
+
+    if args.sim is not None:
+        port = SimPort(args.sim)
+        target_name = 'sim ' + ' '.join(args.sim)
+    else:
+        port = args.port
+        target_name = args.port
+
+    g = Glitcher(port, echo=args.verbose)
+    try:
+        menu = g.wait_for(b'\n> ').decode('ascii', 'replace')
+        if ' bench ' not in menu:
+            sys.exit("The firmware has no 'bench' command (ENABLE_BENCH)")
+        g.command('binary 1')
+        g.wait_for(b'> ')
+
+        commands = {
+            'apdu_recv': 'bench apdu recv %d %s' % (args.count, args.recv),
+            'apdu_send': 'bench apdu send %d %s' % (args.count, args.send),
+            'reset_cold': 'bench reset cold %d' % args.count,
+            'reset_warm': 'bench reset warm %d' % args.count,
+            'scancla': 'bench scancla %s' % args.cla,
+            'link': 'bench link %d' % args.link_bytes,
+            'glitch': 'bench glitch %d %s' % (args.count, args.glitch),
+        }
+
+        for name in only:
+            if (name == 'glitch') and (' gatr ' not in menu):
+                print("glitch: skipped, the firmware has no 'gatr' (ENABLE_GLITCH)", file=sys.stderr)
+                continue
+            if (name == 'scancla') and args.fresh_scan:
+                g.command('scache clear')
+                g.wait_for(b'> ')
+
+            res, host_s, host_rate = run_bench(g, commands[name])
+            if BENCH_NAMES.get(res['test']) != name:
+                sys.exit('%s: got a result for benchmark %d' % (name, res['test']))
+
+            out = {
+                'bench': name,
+                'target': target_name,
+                'tag': args.tag,
+                'time': datetime.datetime.now().isoformat(timespec='seconds'),
+                'command': commands[name],
+                'n': res['n'],
+                'fail': res['fail'],
+                'elapsed_us': res['elapsed'],
+                'rate': round((res['n'] * 1e6) / max(res['elapsed'], 1), 2),
+                'host_s': round(host_s, 3),
+            }
+            if res['t_max'] != 0:
+                out['t_min_us'] = clocks_to_us(res['t_min'])
+                out['t_mean_us'] = clocks_to_us(res['t_mean'])
+                out['t_max_us'] = clocks_to_us(res['t_max'])
+            if host_rate is not None:
+                out['host_rate'] = host_rate
+
+            print(json.dumps(out))
+            sys.stdout.flush()
+    finally:
+        g.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,340 @@
+#!/usr/bin/env python3
+"""
+Assembler and uploader for card scripts ('cscript', needs ENABLE_CARDSCRIPT).
+
+A card script is a bytecode program run by the firmware which talks to the
+card (see cardscript.h): APDUs, status word checks, branches, loops, and
+results sent back to the host. This assembles and checks a script, and
+optionally uploads it to the board's EEPROM and runs it.
+
+Source syntax, one instruction per line, ';' or '#' starts a comment. APDU
+bytes, status words, data, masks and values are hex; buffer offsets (@n),
+counts, delays, tags and codes are decimal.
+
+    label:                      A jump target (may share a line)
+    reset                       Cold reset, ATR into the buffer at @0
+    send CLA INS P1 P2 LEN [@N] APDU sending LEN bytes from the buffer at @N
+    recv CLA INS P1 P2 LEN [@N] APDU receiving LEN bytes into the buffer at @N
+    data @N BYTES...            Put bytes in the buffer
+    expect SW                   Stop with an error unless the last SW was SW
+    jsw SW LABEL                Jump if the last SW was SW
+    jnsw SW LABEL               Jump unless the last SW was SW
+    jbyte @N MASK VAL LABEL     Jump if (buffer[N] & MASK) == VAL
+    jmp LABEL
+    loop N / next               Run the instructions in between N times (1..256)
+    delay MS                    Wait (0..65535 ms)
+    emit TAG @N LEN             Send LEN buffer bytes from @N to the host
+    fail CODE                   Stop with an error code (0..255)
+    end                         Stop
+
+The buffer is 64 bytes. The VideoCrypt decoder emulation ('vcdecoem'),
+cut down to issue 9 cards:
+
+        reset
+        recv 53 70 00 00 06             ; serial number
+        expect 9000
+        emit 1 @0 6
+        jbyte @0 0F 09 issue9
+        fail 1                          ; no message for this issue
+    issue9:
+        data @0 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00
+        send 53 72 00 00 10             ; message from the old card
+        expect 9000
+        data @0 E8 43 66 3E C6 1A 0C 9F 8F 32 6D 6C 6C 6C 6C 6C
+        data @16 6C 6C 6C 6C 6C 6C 6C 6C 6C 6C 6C 67 E9 44 BC 68
+        send 53 74 00 00 20             ; the decoder's message
+        expect 9000
+        recv 53 78 00 00 08             ; seed
+        expect 9000
+        emit 2 @0 8
+        recv 53 7C 00 00 10             ; message for the next card
+        emit 3 @0 16
+
+Examples:
+    csasm.py vcdecoem.cs                            # listing
+    csasm.py vcdecoem.cs --port /dev/ttyUSB0 --run
+    csasm.py vcdecoem.cs --port 'sim:-c videocrypt' --run 10
+"""
+
+import argparse
+import shlex
+import sys
+
+from glitcher import Glitcher, SimPort, decode_cscript, FRAME_CSCRIPT
+
+# Opcodes -- keep in sync with cardscript.h
+CS_END = 0x00
+CS_SEND = 0x01
+CS_RECV = 0x02
+CS_DATA = 0x03
+CS_EXPECT = 0x04
+CS_JSW = 0x05
+CS_JNSW = 0x06
+CS_JBYTE = 0x07
+CS_JMP = 0x08
+CS_LOOP = 0x09
+CS_NEXT = 0x0A
+CS_DELAY = 0x0B
+CS_RESET = 0x0C
+CS_EMIT = 0x0D
+CS_FAIL = 0x0E
+
+CS_MAX_LEN = 254
+CS_BUF_SIZE = 64
+CS_MAX_LOOPS = 4
+
+# Bytes per 'cscript load'
+LOAD_CHUNK = 32
+
+MNEMONICS = {
+    CS_END: 'END', CS_SEND: 'SEND', CS_RECV: 'RECV', CS_DATA: 'DATA', CS_EXPECT: 'EXPECT',
+    CS_JSW: 'JSW', CS_JNSW: 'JNSW', CS_JBYTE: 'JBYTE', CS_JMP: 'JMP', CS_LOOP: 'LOOP',
+    CS_NEXT: 'NEXT', CS_DELAY: 'DELAY', CS_RESET: 'RESET', CS_EMIT: 'EMIT', CS_FAIL: 'FAIL',
+}
+
+
+class AsmError(Exception):
+    pass
+
+
+def parse_hex(word, lo=0, hi=0xFF):
+    n = int(word, 16)
+    if not lo <= n <= hi:
+        raise AsmError('%s out of range (%X..%X)' % (word, lo, hi))
+    return n
+
+
+def parse_dec(word, lo, hi):
+    n = int(word, 10)
+    if not lo <= n <= hi:
+        raise AsmError('%d out of range (%d..%d)' % (n, lo, hi))
+    return n
+
+
+def parse_offset(word):
+    if not word.startswith('@'):
+        raise AsmError("buffer offset must be '@<n>', not '%s'" % word)
+    return parse_dec(word[1:], 0, CS_BUF_SIZE - 1)
+
+
+def buffer_range(off, n):
+    if off + n > CS_BUF_SIZE:
+        raise AsmError('@%d+%d is outside the %d-byte buffer' % (off, n, CS_BUF_SIZE))
+
+
+class Insn:
+    """One instruction: opcode, operand bytes, and a label to fill in as the last operand."""
+
+    def __init__(self, op, operands, label, lineno, src):
+        self.op = op
+        self.operands = operands
+        self.label = label
+        self.lineno = lineno
+        self.src = src
+        self.addr = None
+
+    def size(self):
+        return 1 + len(self.operands) + (1 if self.label else 0)
+
+
+def parse_line(mn, args):
+    """@return (opcode, operand bytes, label or None)"""
+
+    def need(lo, hi=None):
+        if not lo <= len(args) <= (lo if hi is None else hi):
+            raise AsmError('%s takes %s argument(s)' % (mn, lo if hi is None else '%d-%d' % (lo, hi)))
+
+    if mn in ('end', 'next', 'reset'):
+        need(0)
+        return {'end': CS_END, 'next': CS_NEXT, 'reset': CS_RESET}[mn], [], None
+    if mn in ('send', 'recv'):
+        need(5, 6)
+        hdr = [parse_hex(a) for a in args[:5]]
+        off = parse_offset(args[5]) if len(args) > 5 else 0
+        buffer_range(off, hdr[4])
+        return (CS_SEND if mn == 'send' else CS_RECV), hdr + [off], None
+    if mn == 'data':
+        if len(args) < 2:
+            raise AsmError('data takes an offset and at least one byte')
+        off = parse_offset(args[0])
+        data = [parse_hex(a) for a in args[1:]]
+        buffer_range(off, len(data))
+        return CS_DATA, [off, len(data)] + data, None
+    if mn == 'expect':
+        need(1)
+        sw = parse_hex(args[0], 0, 0xFFFF)
+        return CS_EXPECT, [sw >> 8, sw & 0xFF], None
+    if mn in ('jsw', 'jnsw'):
+        need(2)
+        sw = parse_hex(args[0], 0, 0xFFFF)
+        return (CS_JSW if mn == 'jsw' else CS_JNSW), [sw >> 8, sw & 0xFF], args[1]
+    if mn == 'jbyte':
+        need(4)
+        return CS_JBYTE, [parse_offset(args[0]), parse_hex(args[1]), parse_hex(args[2])], args[3]
+    if mn == 'jmp':
+        need(1)
+        return CS_JMP, [], args[0]
+    if mn == 'loop':
+        need(1)
+        return CS_LOOP, [parse_dec(args[0], 1, 256) & 0xFF], None
+    if mn == 'delay':
+        need(1)
+        ms = parse_dec(args[0], 0, 0xFFFF)
+        return CS_DELAY, [ms & 0xFF, ms >> 8], None
+    if mn == 'emit':
+        need(3)
+        off, n = parse_offset(args[1]), parse_dec(args[2], 0, CS_BUF_SIZE)
+        buffer_range(off, n)
+        return CS_EMIT, [parse_dec(args[0], 0, 255), off, n], None
+    if mn == 'fail':
+        need(1)
+        return CS_FAIL, [parse_dec(args[0], 0, 255)], None
+    raise AsmError("unknown instruction '%s'" % mn)
+
+
+def assemble(text):
+    """
+    Assemble a card script.
+
+    @return (list of Insn, bytes)
+    """
+    prog = []
+    labels = {}
+    addr = 0
+    for lineno, line in enumerate(text.splitlines(), 1):
+        src = line.split(';')[0].split('#')[0].strip()
+        try:
+            while ':' in src:
+                label, src = src.split(':', 1)
+                label, src = label.strip(), src.strip()
+                if not label.isidentifier():
+                    raise AsmError("bad label '%s'" % label)
+                if label in labels:
+                    raise AsmError("label '%s' is already defined" % label)
+                labels[label] = addr
+            if not src:
+                continue
+            words = src.split()
+            op, operands, label = parse_line(words[0].lower(), words[1:])
+        except (AsmError, ValueError) as e:
+            raise AsmError('line %d: %s' % (lineno, e))
+
+        insn = Insn(op, operands, label, lineno, line.strip())
+        insn.addr = addr
+        addr += insn.size()
+        prog.append(insn)
+
+    if addr > CS_MAX_LEN:
+        raise AsmError('script is %d bytes, the limit is %d' % (addr, CS_MAX_LEN))
+
+    code = []
+    for insn in prog:
+        code.append(insn.op)
+        code += insn.operands
+        if insn.label:
+            if insn.label not in labels:
+                raise AsmError("line %d: unknown label '%s'" % (insn.lineno, insn.label))
+            code.append(labels[insn.label])
+    return prog, bytes(code)
+
+
+def check(prog):
+    """
+    Check things the firmware only finds out when the script runs.
+
+    @return list of warnings
+    """
+    warnings = []
+    depth = 0
+    for insn in prog:
+        if insn.op == CS_LOOP:
+            depth += 1
+            if depth > CS_MAX_LOOPS:
+                warnings.append('line %d: loops nested more than %d deep' % (insn.lineno, CS_MAX_LOOPS))
+        elif insn.op == CS_NEXT:
+            if depth == 0:
+                warnings.append('line %d: next without loop' % insn.lineno)
+            else:
+                depth -= 1
+        elif insn.label and depth:
+            warnings.append('line %d: a jump out of a loop leaves the loop running' % insn.lineno)
+    if depth:
+        warnings.append('loop without next')
+    if not any(insn.op == CS_RESET for insn in prog):
+        warnings.append("no reset: the card must already be powered up ('on')")
+    return warnings
+
+
+def upload(g, code):
+    """Upload a script and save it."""
+    for off in range(0, len(code), LOAD_CHUNK):
+        chunk = code[off:off + LOAD_CHUNK]
+        g.command('cscript load %X %s' % (off, ' '.join('%02X' % b for b in chunk)))
+        text = g.wait_for(b'\n> ').decode('ascii', 'replace')
+        if 'ERROR' in text:
+            sys.exit(text.strip())
+    g.command('cscript save %d' % len(code))
+    text = g.wait_for(b'\n> ').decode('ascii', 'replace')
+    if 'ERROR' in text:
+        sys.exit(text.strip())
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('source', help="script source ('-' for stdin)")
+    ap.add_argument('-p', '--port', help="upload to the glitcher on this serial port, or 'sim:<glitcher-sim options>'")
+    ap.add_argument('--run', type=int, nargs='?', const=1, metavar='COUNT',
+                    help="run the script after uploading, COUNT times (default once)")
+    ap.add_argument('-q', '--quiet', action='store_true', help="don't print the listing")
+    args = ap.parse_args()
+
+    text = sys.stdin.read() if args.source == '-' else open(args.source).read()
+    try:
+        prog, code = assemble(text)
+    except AsmError as e:
+        sys.exit('error: %s' % e)
+
+    if not args.quiet:
+        print('Listing:')
+        pos = 0
+        for insn in prog:
+            size = insn.size()
+            data = ' '.join('%02X' % b for b in code[pos:pos + size])
+            if len(data) > 23:
+                data = data[:20] + '...'
+            print('  %02X  %-23s  %-6s  %s' % (insn.addr, data, MNEMONICS[insn.op], insn.src))
+            pos += size
+        print('\n%d bytes' % len(code))
+
+    for w in check(prog):
+        print('warning: %s' % w, file=sys.stderr)
+
+    if args.port is None:
+        return
+
+    port = SimPort(shlex.split(args.port[4:])) if args.port.startswith('sim:') else args.port
+    g = Glitcher(port)
+    try:
+        g.wait_for(b'\n> ')
+        upload(g, code)
+        print('Uploaded %d bytes' % len(code))
+
+        if args.run:
+            g.command('binary 1')
+            g.wait_for(b'\n> ')
+            g.command('cscript run %d' % args.run)
+            for ftype, payload in g.read_frames_until(timeout=60.0):
+                if ftype == FRAME_CSCRIPT:
+                    r = decode_cscript(payload)
+                    print('emit %d SW=%04X: %s' % (r['tag'], r['sw'], r['data'].hex(' ').upper()))
+            lines = g.text.decode('ascii', 'replace').splitlines()
+            result = [ln for ln in lines if ('Script OK' in ln) or ('ERROR' in ln)]
+            print('\n'.join(result))
+            if not any('Script OK' in ln for ln in result):
+                sys.exit(1)
+    finally:
+        g.close()
+
+
+if __name__ == '__main__':
+    main()
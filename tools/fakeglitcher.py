@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+"""
+Scripted stand-in glitcher boards on pseudo terminals, for testing host
+tools (orchestrate.py) without hardware.
+
+Each fake board is a pseudo terminal which talks like the firmware: the
+sign-on banner when the port is opened (as the board resets on DTR), the
+command list and prompt, 'binary', and 'gatr' with FRAME_GATR frames. Glitch
+results come from a script, so a campaign has known answers. Other commands
+get "Bad command".
+
+The slave paths are printed, one per line, and the fakes run until killed.
+A fake only sees the port being closed if it stays closed for a moment, so
+leave 0.1s or so before opening it again, or there will be no banner.
+
+Script, one setting per line ('#' starts a comment):
+
+    atr <hex>                       Golden ATR (default a VideoCrypt one)
+    attempt-ms <ms>                 Time per glitch attempt (default 2)
+    glitch <offset> <width>|* <flags> [<atr hex>]
+                                    A deviation at this offset (and width):
+                                    flags are GATR_xxx (1 mute, 2 length,
+                                    4 data, 8 convention, 16 timing)
+    fault <first> <last> <width>|* <percent> <flags> [<atr hex>]
+                                    The same at random, on this percentage
+                                    of attempts at offsets first to last
+
+Faults, for testing recovery:
+    --faulty 0,2 --die-after 3      Boards 0 and 2 go away (the pty is
+                                    closed) on their 3rd command
+    --faulty 1 --hang-after 2       Board 1 stops answering on its 2nd command
+
+Examples:
+    fakeglitcher.py -n 4 --script glitches.txt
+    fakeglitcher.py -n 3 --faulty 1 --die-after 2 --link /tmp/fakeglitcher
+"""
+
+import argparse
+import os
+import random
+import select
+import struct
+import sys
+import threading
+import time
+import tty
+
+FRAME_SOF = 0xA5
+FRAME_GATR = 0x04
+
+GATR_MUTE = 0x01
+
+DEFAULT_ATR = '3F 78 13 25 04 40 B0 09 4A 50 01 4E 5A'
+
+# Golden ATR timing reported in frames, card clocks
+T_FIRST = 11996
+T_LAST = 65562
+
+BANNER = b'>> GLITCHER (fake)\r\n'
+
+MENU = (b'\r\nCommand list:\r\n'
+        b'   binary              param 0/1: binary frames off/on\r\n'
+        b'   gatr                Glitch: during ATR\r\n'
+        b'\r\n> ')
+
+
+class Script:
+    def __init__(self):
+        self.atr = bytes.fromhex(DEFAULT_ATR)
+        self.attempt_ms = 2.0
+        self.glitches = {}      # (offset, width or None) -> (flags, atr)
+        self.faults = []        # (first, last, width or None, percent, flags, atr)
+
+    def load(self, path):
+        for n, line in enumerate(open(path), 1):
+            words = line.split('#')[0].split()
+            if not words:
+                continue
+            try:
+                if words[0] == 'atr':
+                    self.atr = bytes.fromhex(''.join(words[1:]))
+                elif words[0] == 'attempt-ms':
+                    self.attempt_ms = float(words[1])
+                elif words[0] == 'glitch':
+                    offset = int(words[1])
+                    width = None if words[2] == '*' else int(words[2])
+                    flags = int(words[3], 0)
+                    atr = bytes.fromhex(''.join(words[4:])) if len(words) > 4 else b''
+                    self.glitches[(offset, width)] = (flags, atr)
+                elif words[0] == 'fault':
+                    first, last = int(words[1]), int(words[2])
+                    width = None if words[3] == '*' else int(words[3])
+                    percent = float(words[4])
+                    flags = int(words[5], 0)
+                    atr = bytes.fromhex(''.join(words[6:])) if len(words) > 6 else b''
+                    self.faults.append((first, last, width, percent, flags, atr))
+                else:
+                    raise ValueError('unknown setting %s' % words[0])
+            except (IndexError, ValueError) as e:
+                sys.exit('%s:%d: %s' % (path, n, e))
+
+    def deviation(self, offset, width):
+        dev = self.glitches.get((offset, width)) or self.glitches.get((offset, None))
+        if dev is not None:
+            return dev
+        for first, last, fwidth, percent, flags, atr in self.faults:
+            if (first <= offset <= last) and (fwidth in (None, width)) and (random.uniform(0, 100) < percent):
+                return flags, atr
+        return None
+
+
+def frame(ftype, payload):
+    body = bytes([ftype]) + struct.pack('<H', len(payload)) + payload
+    return bytes([FRAME_SOF]) + body + bytes([(-sum(body)) & 0xFF])
+
+
+class Hangup(Exception):
+    """The host closed the port."""
+
+
+class FakeBoard(threading.Thread):
+    def __init__(self, index, script, die_after=None, hang_after=None):
+        super().__init__(daemon=True)
+        self.index = index
+        self.script = script
+        self.die_after = die_after
+        self.hang_after = hang_after
+        self.master, slave = os.openpty()
+        tty.setraw(slave)
+        self.path = os.ttyname(slave)
+        # Nobody has the slave open until the host opens it
+        os.close(slave)
+
+    def run(self):
+        ncommands = 0
+        while True:
+            self.wait_for_open()
+            binary = False
+            try:
+                self.send(BANNER + MENU)
+                while True:
+                    line = self.read_line()
+                    ncommands += 1
+                    if (self.die_after is not None) and (ncommands >= self.die_after):
+                        os.close(self.master)
+                        return
+                    if (self.hang_after is not None) and (ncommands >= self.hang_after):
+                        while True:
+                            time.sleep(1)
+                    self.send(line.encode('ascii', 'replace') + b'\r\n\r\n')
+                    binary = self.command(line, binary)
+                    self.send(MENU)
+            except Hangup:
+                pass
+
+    def wait_for_open(self):
+        """Wait for the host to open the slave (the master stops seeing a hangup)."""
+        p = select.poll()
+        p.register(self.master, select.POLLHUP)
+        while p.poll(0):
+            time.sleep(0.05)
+
+    def send(self, data):
+        while data:
+            data = data[os.write(self.master, data):]
+
+    def read_line(self):
+        line = bytearray()
+        while True:
+            try:
+                b = os.read(self.master, 1)
+            except OSError:
+                b = b''
+            if not b:
+                raise Hangup()
+            if b == b'\n':
+                return line.decode('ascii', 'replace').strip()
+            line += b
+
+    def command(self, line, binary):
+        words = line.split()
+        if not words:
+            return binary
+        if words[0] == 'binary' and len(words) == 2:
+            binary = (words[1] != '0')
+            self.send(b'Binary frames ' + (b'on' if binary else b'off') + b'\r\n')
+        elif words[0] == 'gatr':
+            self.gatr(words[1:], binary)
+        else:
+            self.send(b"Bad command '" + words[0].encode('ascii', 'replace') + b"'\r\n")
+        return binary
+
+    def gatr(self, args, binary):
+        try:
+            start, end, step, width = (int(a) for a in args[:4])
+            repeats = int(args[4]) if len(args) > 4 else 1
+        except ValueError:
+            args = []
+        if len(args) < 4:
+            self.send(b'**ERROR: Syntax = gatr <start> <end> <step> <width> [<repeats>]\r\n')
+            return
+
+        atr = self.script.atr
+        self.send(b'Golden ATR: ' + atr.hex(' ').upper().encode('ascii') + b' \r\n'
+                  b'Convention inverse, TS at %d clocks (+/-372), last byte at %d\r\n\r\n' % (T_FIRST, T_LAST))
+
+        n = ndev = nmute = 0
+        t0 = time.monotonic()
+        for offset in range(start, end + 1, step):
+            for attempt in range(repeats):
+                time.sleep(self.script.attempt_ms / 1000.0)
+                n += 1
+                dev = self.script.deviation(offset, width)
+                if dev is None:
+                    continue
+                flags, datr = dev
+                ndev += 1
+                if flags & GATR_MUTE:
+                    nmute += 1
+                    datr = b''
+                if binary:
+                    self.send(frame(FRAME_GATR, struct.pack('<IBHBBIIB', offset, width & 0xFF, attempt, flags, 1,
+                                                            T_FIRST, T_LAST, len(datr)) + datr))
+                self.send(b'Offset %d try %d -- flags %02X %s\r\n' % (offset, attempt, flags,
+                                                                  datr.hex(' ').upper().encode('ascii')))
+
+        elapsed = max(time.monotonic() - t0, 0.001)
+        self.send(b'\r\n%d attempts, %d deviations (%d mute), %.1f resets/sec\r\n' % (n, ndev, nmute, n / elapsed))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('-n', '--boards', type=int, default=1, help='number of fake boards (default 1)')
+    ap.add_argument('--script', help='glitch script (see above)')
+    ap.add_argument('--faulty', default='', help='comma separated boards which get the fault')
+    ap.add_argument('--die-after', type=int, help='faulty boards go away on this command')
+    ap.add_argument('--hang-after', type=int, help='faulty boards stop answering on this command')
+    ap.add_argument('--link', help='also make symlinks <LINK>0, <LINK>1, ... to the ptys')
+    args = ap.parse_args()
+
+    script = Script()
+    if args.script:
+        script.load(args.script)
+    faulty = {int(i) for i in args.faulty.split(',') if i != ''}
+
+    boards = []
+    for i in range(args.boards):
+        fault = i in faulty
+        b = FakeBoard(i, script, args.die_after if fault else None, args.hang_after if fault else None)
+        boards.append(b)
+        path = b.path
+        if args.link:
+            path = '%s%d' % (args.link, i)
+            if os.path.lexists(path):
+                os.unlink(path)
+            os.symlink(b.path, path)
+        print(path)
+    sys.stdout.flush()
+
+    for b in boards:
+        b.start()
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if args.link:
+            for i in range(args.boards):
+                path = '%s%d' % (args.link, i)
+                if os.path.islink(path):
+                    os.unlink(path)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,286 @@
+"""
+Host-side interface to the glitcher firmware.
+
+The firmware talks plain text on its serial console, with bulk data sent as
+binary frames mixed in with the text (see hostlink.h):
+
+    SOF(0xA5) TYPE LEN_L LEN_H PAYLOAD[LEN] CHK
+
+Console text is 7-bit ASCII, so a byte with bit 7 set always starts a frame.
+
+The host build (sim/glitcher-sim) can stand in for a board: see SimPort.
+
+Requires pyserial, except with a SimPort. Without pyserial, ports are opened
+as plain POSIX ttys, which is enough for pseudo terminals (fakeglitcher.py).
+"""
+
+import os
+import select
+import struct
+import subprocess
+import sys
+import time
+import tty
+
+FRAME_SOF = 0xA5
+
+# Frame types -- keep in sync with hostlink.h
+FRAME_PTRACE = 0x01
+FRAME_TSCAN = 0x02
+FRAME_APDU = 0x03
+FRAME_GATR = 0x04
+FRAME_GREAD_DATA = 0x05
+FRAME_GREAD = 0x06
+FRAME_DIFF = 0x07
+FRAME_SESSION = 0x08
+FRAME_BENCH = 0x09
+FRAME_BENCH_DATA = 0x0A
+FRAME_STATS = 0x0B
+FRAME_CSCRIPT = 0x0C
+FRAME_VCSEED = 0x0D
+
+
+class FrameError(Exception):
+    pass
+
+
+def decode_apdu(payload):
+    """Decode a FRAME_APDU payload into a dict. Times are in card clocks."""
+    (cla, ins, p1, p2, le, sw, proc, t_proc, t_last_data, t_sw1,
+     gap_max, gap_max_idx, nchars, ntimes) = struct.unpack_from('<5BHBIIIHHHB', payload)
+    rx_times = struct.unpack_from('<%dH' % ntimes, payload, 27)
+    return {
+        'header': (cla, ins, p1, p2, le), 'sw': sw, 'proc': proc,
+        't_proc': t_proc, 't_last_data': t_last_data, 't_sw1': t_sw1,
+        'gap_max': gap_max, 'gap_max_idx': gap_max_idx,
+        'nchars': nchars, 'rx_times': list(rx_times),
+    }
+
+
+def decode_gatr(payload):
+    """Decode a FRAME_GATR payload into a dict. Times are in card clocks."""
+    (offset, width, attempt, flags, inverse, t_first, t_last,
+     length) = struct.unpack_from('<IBHBBIIB', payload)
+    atr = payload[18:18 + length]
+    return {
+        'offset': offset, 'width': width, 'attempt': attempt, 'flags': flags,
+        'inverse': inverse, 't_first': t_first, 't_last': t_last,
+        'atr': atr.hex(' ').upper(),
+    }
+
+
+STATS_FIELDS = (
+    'apdus', 'tmo_proc', 'tmo_data', 'tmo_sw', 'comms_resets', 'atrs',
+    'rx_overflows', 'parity_errors', 'pps_ok', 'pps_fail', 'gap_max',
+    't_atr', 't_send', 't_card', 't_timeout', 't_command',
+)
+
+
+def decode_stats(payload):
+    """Decode a FRAME_STATS payload into a dict. Times are in card clocks."""
+    return dict(zip(STATS_FIELDS, struct.unpack_from('<6I4HI5Q', payload)))
+
+
+def decode_cscript(payload):
+    """Decode a FRAME_CSCRIPT payload (a card script EMIT) into a dict."""
+    tag, sw, length = struct.unpack_from('<BHB', payload)
+    return {'tag': tag, 'sw': sw, 'data': bytes(payload[4:4 + length])}
+
+
+def decode_vcseed(payload):
+    """Decode a FRAME_VCSEED payload ('vcdecoem loop'). Times are in microseconds."""
+    cycle, start, duration = struct.unpack_from('<III', payload)
+    return {'cycle': cycle, 'start': start, 'duration': duration, 'seed': bytes(payload[12:20])}
+
+
+class SimPort:
+    """
+    The host build of the firmware, run as a subprocess, in place of a
+    serial port. Only what Glitcher uses is here.
+    """
+
+    def __init__(self, args, path=None):
+        """
+        @param args  glitcher-sim options, e.g. ['-c', 'videocrypt']
+        @param path  glitcher-sim binary (default: the one in sim/)
+        """
+        if path is None:
+            path = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'sim', 'glitcher-sim')
+        self.proc = subprocess.Popen([path] + list(args), stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+
+    def read(self, n):
+        """Read up to n bytes, waiting at most 0.1s (as the serial port does)."""
+        if not select.select([self.proc.stdout], [], [], 0.1)[0]:
+            return b''
+        data = os.read(self.proc.stdout.fileno(), n)
+        if not data:
+            raise EOFError('glitcher-sim exited')
+        return data
+
+    def write(self, data):
+        self.proc.stdin.write(data)
+        self.proc.stdin.flush()
+
+    def close(self):
+        self.proc.stdin.close()
+        self.proc.wait()
+
+
+class TtyPort:
+    """
+    A POSIX tty opened without pyserial, in place of a serial port. The baud
+    rate isn't set, so this is only any use for pseudo terminals. Only what
+    Glitcher uses is here.
+    """
+
+    def __init__(self, path):
+        self.path = path
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+
+    def read(self, n):
+        """Read up to n bytes, waiting at most 0.1s (as the serial port does)."""
+        if not select.select([self.fd], [], [], 0.1)[0]:
+            return b''
+        try:
+            data = os.read(self.fd, n)
+        except OSError:
+            # EIO: the other end has gone
+            data = b''
+        if not data:
+            raise EOFError('%s has closed' % self.path)
+        return data
+
+    def write(self, data):
+        while data:
+            data = data[os.write(self.fd, data):]
+
+    def close(self):
+        os.close(self.fd)
+
+
+class Glitcher:
+    """A glitcher board on a serial port."""
+
+    def __init__(self, port, baud=57600, timeout=10.0, echo=False):
+        """
+        Open the board's serial port and wait for the firmware to start.
+
+        Opening the port resets the board (DTR), so this waits for the
+        sign-on banner.
+
+        @param port  Serial port name, or a SimPort
+        @param echo  Copy console text to stderr as it arrives.
+        """
+        if isinstance(port, SimPort):
+            self.ser = port
+        else:
+            try:
+                import serial
+            except ImportError:
+                self.ser = TtyPort(port)
+            else:
+                self.ser = serial.Serial(port, baud, timeout=0.1)
+        self.timeout = timeout
+        self.echo = echo
+        self.text = bytearray()
+        self.wait_for(b'>> GLITCHER')
+        self.wait_for(b'> ')
+
+    def close(self):
+        self.ser.close()
+
+    def command(self, line):
+        """Send a command line. Doesn't wait for a response."""
+        self.text.clear()
+        self.ser.write(line.encode('ascii') + b'\n')
+
+    def _read(self, n, deadline):
+        buf = bytearray()
+        while len(buf) < n:
+            if time.monotonic() > deadline:
+                raise TimeoutError('timed out waiting for the glitcher')
+            buf += self.ser.read(n - len(buf))
+        return bytes(buf)
+
+    def _text_byte(self, b):
+        self.text.append(b)
+        if self.echo:
+            sys.stderr.write(chr(b))
+            sys.stderr.flush()
+
+    def wait_for(self, marker, timeout=None):
+        """Read console text until it contains marker (bytes)."""
+        deadline = time.monotonic() + (timeout or self.timeout)
+        while marker not in self.text:
+            b = self._read(1, deadline)[0]
+            if b == FRAME_SOF:
+                raise FrameError('unexpected binary frame')
+            self._text_byte(b)
+        return bytes(self.text)
+
+    def read_frame(self, timeout=None):
+        """
+        Read the next binary frame, collecting console text on the way.
+
+        @return (type, payload)
+        """
+        deadline = time.monotonic() + (timeout or self.timeout)
+        while True:
+            b = self._read(1, deadline)[0]
+            if b == FRAME_SOF:
+                break
+            self._text_byte(b)
+
+        return self._read_frame_body(deadline)
+
+    def read_frames_until(self, marker=b'\n> ', timeout=None):
+        """
+        Read binary frames until the console text ends with marker: by
+        default the prompt, which means the command has finished.
+
+        @return list of (type, payload)
+        """
+        deadline = time.monotonic() + (timeout or self.timeout)
+        frames = []
+        while not self.text.endswith(marker):
+            b = self._read(1, deadline)[0]
+            if b == FRAME_SOF:
+                frames.append(self._read_frame_body(deadline))
+            else:
+                self._text_byte(b)
+        return frames
+
+    def iter_frames_until(self, marker=b'\n> ', timeout=None):
+        """
+        Like read_frames_until(), but yields each frame as it arrives, for
+        commands which stream. The timeout is for the gap between frames.
+        """
+        timeout = timeout or self.timeout
+        deadline = time.monotonic() + timeout
+        while not self.text.endswith(marker):
+            b = self._read(1, deadline)[0]
+            if b == FRAME_SOF:
+                yield self._read_frame_body(deadline)
+                deadline = time.monotonic() + timeout
+            else:
+                self._text_byte(b)
+
+    def _read_frame_body(self, deadline):
+        """Read the rest of a frame, after the SOF."""
+        ftype, length = struct.unpack('<BH', self._read(3, deadline))
+        payload = self._read(length, deadline)
+        chk = self._read(1, deadline)[0]
+
+        total = ftype + (length & 0xFF) + (length >> 8) + sum(payload) + chk
+        if total & 0xFF:
+            raise FrameError('bad checksum on frame type 0x%02X' % ftype)
+
+        return ftype, payload
+
+    def expect_frame(self, ftype, timeout=None):
+        """Read frames until one of the given type arrives."""
+        while True:
+            t, payload = self.read_frame(timeout)
+            if t == ftype:
+                return payload
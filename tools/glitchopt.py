@@ -0,0 +1,443 @@
+#!/usr/bin/env python3
+"""
+Adaptive search for ATR glitch parameters ('gatr', needs ENABLE_GLITCH).
+
+A grid sweep spends nearly all of its attempts where nothing ever happens.
+This models the fault and crash (mute card) probability of each region of
+the offset x width space from the results so far, and picks the next batch
+of parameters by Thompson sampling: each region's probabilities are drawn
+from their posteriors (Beta distributions) and the batch goes to the regions
+which drew best, so attempts pile up where faults cluster while regions
+which have seen little get tried now and then.
+
+A region is --region consecutive offsets at one width. Within the chosen
+region an offset is picked the same way, from its own results plus half
+of its neighbours', starting from the region's rate. Crashes are bad for
+business (a mute card costs an ATR timeout and teaches nothing), so a
+region's score is its fault probability divided by (1 + --crash-cost x its
+crash probability).
+
+The search stops at a reliable glitch: an offset and width which has been
+tried at least --confirm times and faulted on at least --target of them.
+
+  run       Search on a board. Each proposal is one 'gatr <offset> <offset>
+            1 <width> <repeats>'. Every proposal's result is appended to
+            --log, and a log from an earlier run is read back in first, so
+            the search carries on where it stopped.
+  simulate  Search against a synthetic card with fault clusters at random
+            places, alongside a plain grid sweep (offsets inside widths, with
+            --grid-repeats attempts at each, and a faulting offset tried up
+            to --confirm times before moving on), and report how many
+            attempts each took to the first fault and to a reliable glitch.
+
+A fault is a deviation with any of the --fault-flags (default LEN, DATA and
+CONV; TIMING-only deviations are usually jitter). A crash is MUTE.
+
+Examples:
+    glitchopt.py --offsets 3000 9000 4 --widths 4-12 run -d /dev/ttyUSB0 --log search.jsonl
+    glitchopt.py --offsets 0 20000 10 --widths 2-17 simulate --trials 20
+"""
+
+import argparse
+import json
+import math
+import random
+import statistics
+import sys
+import time
+
+from glitcher import Glitcher, decode_gatr, FRAME_GATR
+
+# ATR deviation flags -- keep in sync with glitch.cpp
+GATR_MUTE = 0x01
+GATR_LEN = 0x02
+GATR_DATA = 0x04
+GATR_CONV = 0x08
+GATR_TIMING = 0x10
+
+# Prior for a region's fault probability: most of the space never faults
+PRIOR_FAULT = (0.05, 2.45)
+# Prior for a region's crash probability
+PRIOR_CRASH = (1.0, 1.0)
+# Weight of neighbouring regions' results: faults cluster
+NEIGHBOUR_WEIGHT = 0.25
+# Weight of the region's rate when picking an offset within it
+CELL_PRIOR_WEIGHT = 2.0
+
+
+class Space:
+    """The offsets and widths to search, and their grouping into regions."""
+
+    def __init__(self, start, end, step, widths, region):
+        self.offsets = list(range(start, end + 1, step))
+        self.widths = widths
+        self.region = region
+        self.nregions_w = (len(self.offsets) + region - 1) // region
+
+    def cells(self):
+        """All (offset index, width index), in grid order: offsets inside widths"""
+        return [(o, w) for w in range(len(self.widths)) for o in range(len(self.offsets))]
+
+    def params(self, cell):
+        return self.offsets[cell[0]], self.widths[cell[1]]
+
+    def region_of(self, cell):
+        return cell[1] * self.nregions_w + (cell[0] // self.region)
+
+    def region_cells(self, r):
+        w, first = r // self.nregions_w, (r % self.nregions_w) * self.region
+        return [(o, w) for o in range(first, min(first + self.region, len(self.offsets)))]
+
+
+class Model:
+    """Attempt, fault and crash counts per offset and width, and per region."""
+
+    def __init__(self, space, crash_cost, rng):
+        self.space = space
+        self.crash_cost = crash_cost
+        self.rng = rng
+        self.cells = {}         # cell -> [n, faults, crashes]
+        nregions = space.nregions_w * len(space.widths)
+        self.regions = [[0, 0, 0] for i in range(nregions)]
+        self.tried = [[] for i in range(nregions)]
+        self.attempts = 0
+
+    def observe(self, cell, n, faults, crashes):
+        r = self.space.region_of(cell)
+        if cell not in self.cells:
+            self.cells[cell] = [0, 0, 0]
+            self.tried[r].append(cell)
+        for counts in (self.cells[cell], self.regions[r]):
+            counts[0] += n
+            counts[1] += faults
+            counts[2] += crashes
+        self.attempts += n
+
+    def _score(self, n, faults, crashes, prior):
+        """Draw a fault and crash probability from their posteriors and score them"""
+        pf = self.rng.betavariate(prior[0] + faults, prior[1] + n - faults)
+        pc = self.rng.betavariate(PRIOR_CRASH[0] + crashes, PRIOR_CRASH[1] + n - crashes)
+        return pf / (1.0 + self.crash_cost * pc)
+
+    def _region_counts(self, r):
+        """A region's counts, plus its neighbours' in offset and width at NEIGHBOUR_WEIGHT"""
+        n, faults, crashes = self.regions[r]
+        nw = self.space.nregions_w
+        neighbours = [r - nw, r + nw]
+        if r % nw:
+            neighbours.append(r - 1)
+        if (r + 1) % nw:
+            neighbours.append(r + 1)
+        for nb in neighbours:
+            if 0 <= nb < len(self.regions):
+                counts = self.regions[nb]
+                n += counts[0] * NEIGHBOUR_WEIGHT
+                faults += counts[1] * NEIGHBOUR_WEIGHT
+                crashes += counts[2] * NEIGHBOUR_WEIGHT
+        return n, faults, crashes
+
+    def _cell_counts(self, cell):
+        """A cell's counts, plus half of the offsets either side"""
+        n, faults, crashes = self.cells[cell]
+        for d in (-1, 1):
+            nb = self.cells.get((cell[0] + d, cell[1]))
+            if nb is not None:
+                n += nb[0] / 2.0
+                faults += nb[1] / 2.0
+                crashes += nb[2] / 2.0
+        return n, faults, crashes
+
+    def propose(self, k):
+        """
+        Thompson sampling: one draw for each offset tried so far, and one for
+        each region standing for its offsets not tried yet.
+
+        @return up to k cells to try next, best first
+        """
+        draws = []
+        for r in range(len(self.regions)):
+            n, faults, crashes = self._region_counts(r)
+            if n == 0:
+                prior = PRIOR_FAULT
+            else:
+                # Untried offsets start from the region's rate
+                mean = (PRIOR_FAULT[0] + faults) / (PRIOR_FAULT[0] + PRIOR_FAULT[1] + n)
+                prior = (mean * CELL_PRIOR_WEIGHT, (1.0 - mean) * CELL_PRIOR_WEIGHT)
+
+            if len(self.tried[r]) < len(self.space.region_cells(r)):
+                pf = self.rng.betavariate(*prior)
+                pc = self.rng.betavariate(PRIOR_CRASH[0] + crashes, PRIOR_CRASH[1] + n - crashes)
+                draws.append((pf / (1.0 + self.crash_cost * pc), r, None))
+            for cell in self.tried[r]:
+                draws.append((self._score(*self._cell_counts(cell), prior), r, cell))
+
+        draws.sort(key=lambda d: d[0], reverse=True)
+        picked = []
+        for _, r, cell in draws[:k]:
+            if cell is None:
+                untried = [c for c in self.space.region_cells(r) if (c not in self.cells) and (c not in picked)]
+                if not untried:
+                    continue
+                cell = self.rng.choice(untried)
+            picked.append(cell)
+        return picked
+
+    def is_reliable(self, cell, confirm, target):
+        n, faults, _ = self.cells.get(cell, (0, 0, 0))
+        return (n >= confirm) and (faults >= target * n)
+
+    def reliable(self, confirm, target):
+        """@return the most reliable cell which meets the criteria, or None"""
+        best = None
+        for cell, (n, faults, _) in self.cells.items():
+            if (n >= confirm) and (faults >= target * n):
+                if (best is None) or (faults / n > best[1]):
+                    best = (cell, faults / n)
+        return best and best[0]
+
+    def top(self, k):
+        """@return the k cells with the best observed fault rate (at least 2 attempts)"""
+        cells = [(f / n, n, cell) for cell, (n, f, c) in self.cells.items() if (n >= 2) and (f > 0)]
+        cells.sort(reverse=True)
+        return [cell for _, _, cell in cells[:k]]
+
+
+class SyntheticCard:
+    """
+    A made-up card: fault clusters, each a Gaussian bump in offset and width
+    at a random place, and crashes which get more likely with width.
+    """
+
+    def __init__(self, space, rng, clusters, sigma, peak):
+        self.space = space
+        self.rng = rng
+        self.sigma = sigma
+        self.peak = peak
+        self.centres = [(rng.choice(space.offsets), rng.choice(space.widths)) for i in range(clusters)]
+        self.crash_width = space.widths[(len(space.widths) * 3) // 4]
+
+    def p_fault(self, offset, width):
+        p_none = 1.0
+        for co, cw in self.centres:
+            d = ((offset - co) / self.sigma) ** 2 + ((width - cw) / 1.5) ** 2
+            p_none *= 1.0 - self.peak * math.exp(-d / 2)
+        return 1.0 - p_none
+
+    def p_crash(self, offset, width):
+        return 0.01 + 0.9 / (1.0 + math.exp(self.crash_width - width))
+
+    def attempt(self, cell, n):
+        """@return (faults, crashes) from n attempts"""
+        offset, width = self.space.params(cell)
+        pf, pc = self.p_fault(offset, width), self.p_crash(offset, width)
+        faults = crashes = 0
+        for i in range(n):
+            r = self.rng.random()
+            if r < pc:
+                crashes += 1
+            elif r < pc + (1.0 - pc) * pf:
+                faults += 1
+        return faults, crashes
+
+
+def search_adaptive(space, card, args, rng):
+    """@return (attempts to the first fault, attempts to a reliable glitch); None if not reached"""
+    model = Model(space, args.crash_cost, rng)
+    first = None
+    while model.attempts < args.budget:
+        for cell in model.propose(args.batch):
+            faults, crashes = card.attempt(cell, args.repeats)
+            model.observe(cell, args.repeats, faults, crashes)
+            if (first is None) and faults:
+                first = model.attempts
+            if model.is_reliable(cell, args.confirm, args.target):
+                return first, model.attempts
+    return first, None
+
+
+def search_grid(space, card, args):
+    attempts = 0
+    first = None
+    for cell in space.cells():
+        n = args.grid_repeats
+        faults, _ = card.attempt(cell, n)
+        attempts += n
+        if faults:
+            if first is None:
+                first = attempts
+            # Try it again, until it can't make the target
+            while (n < args.confirm) and (faults + (args.confirm - n) >= args.target * args.confirm):
+                f, _ = card.attempt(cell, 1)
+                faults += f
+                n += 1
+                attempts += 1
+            if faults >= args.target * n:
+                return first, attempts
+        if attempts >= args.budget:
+            break
+    return first, None
+
+
+def summarise(name, results, trials):
+    firsts = [f for f, _ in results if f is not None]
+    reached = [r for _, r in results if r is not None]
+    out = {'method': name, 'trials': trials, 'reached': len(reached)}
+    if firsts:
+        out['first_fault_median'] = statistics.median(firsts)
+    if reached:
+        out['reliable_median'] = statistics.median(reached)
+        out['reliable_mean'] = round(statistics.mean(reached), 1)
+    return out
+
+
+def do_simulate(space, args):
+    results = {'adaptive': [], 'grid': []}
+    for trial in range(args.trials):
+        seed = args.seed + trial
+        # Same card for both methods
+        card = SyntheticCard(space, random.Random(seed), args.clusters, args.sigma, args.peak)
+        results['adaptive'].append(search_adaptive(space, card, args, random.Random(seed + 1000000)))
+        card.rng = random.Random(seed + 2000000)
+        results['grid'].append(search_grid(space, card, args))
+        if args.verbose:
+            print('trial %d: clusters at %s: adaptive %s, grid %s' %
+                  (trial, card.centres, results['adaptive'][-1], results['grid'][-1]), file=sys.stderr)
+
+    summary = [summarise(name, res, args.trials) for name, res in results.items()]
+    for s in summary:
+        print(json.dumps(s))
+    a, g = summary
+    if ('reliable_median' in a) and ('reliable_median' in g):
+        print('Adaptive search reached a reliable glitch in %.1fx fewer attempts than the grid (median), %.1fx (mean)' %
+              (g['reliable_median'] / a['reliable_median'], g['reliable_mean'] / a['reliable_mean']), file=sys.stderr)
+
+
+def do_run(space, args):
+    rng = random.Random(args.seed)
+    model = Model(space, args.crash_cost, rng)
+    index = {p: i for i, p in enumerate(space.offsets)}
+    windex = {w: i for i, w in enumerate(space.widths)}
+
+    # Carry on from an earlier run
+    try:
+        with open(args.log) as f:
+            for line in f:
+                try:
+                    rec = json.loads(line)
+                except ValueError:
+                    continue
+                cell = (index.get(rec['offset']), windex.get(rec['width']))
+                if None not in cell:
+                    model.observe(cell, rec['n'], rec['faults'], rec['crashes'])
+        print('%d attempts read from %s' % (model.attempts, args.log), file=sys.stderr)
+    except FileNotFoundError:
+        pass
+    log = open(args.log, 'a')
+
+    g = Glitcher(args.device, echo=args.verbose)
+    try:
+        g.wait_for(b'\n> ')
+        g.command('binary 1')
+        g.read_frames_until()
+
+        start = model.attempts
+        t0 = time.monotonic()
+        while model.attempts - start < args.budget:
+            found = model.reliable(args.confirm, args.target)
+            if found is not None:
+                break
+            for cell in model.propose(args.batch):
+                offset, width = space.params(cell)
+                g.command('gatr %d %d 1 %d %d' % (offset, offset, width, args.repeats))
+                faults = crashes = 0
+                for ftype, payload in g.read_frames_until(timeout=args.timeout):
+                    if ftype != FRAME_GATR:
+                        continue
+                    flags = decode_gatr(payload)['flags']
+                    if flags & GATR_MUTE:
+                        crashes += 1
+                    elif flags & args.fault_flags:
+                        faults += 1
+                if b'**ERROR' in g.text:
+                    sys.exit(g.text.decode('ascii', 'replace').strip())
+                model.observe(cell, args.repeats, faults, crashes)
+                log.write(json.dumps({'offset': offset, 'width': width, 'n': args.repeats,
+                                      'faults': faults, 'crashes': crashes}) + '\n')
+                log.flush()
+                if faults:
+                    print('offset %d width %d: %d/%d faults, %d crashes' %
+                          (offset, width, faults, args.repeats, crashes), file=sys.stderr)
+    finally:
+        g.close()
+        log.close()
+
+    elapsed = time.monotonic() - t0
+    print('%d attempts in %.1f s' % (model.attempts - start, elapsed), file=sys.stderr)
+    found = model.reliable(args.confirm, args.target)
+    if found is not None:
+        n, faults, crashes = model.cells[found]
+        offset, width = space.params(found)
+        print(json.dumps({'reliable': True, 'offset': offset, 'width': width,
+                          'n': n, 'faults': faults, 'crashes': crashes}))
+    else:
+        print('No reliable glitch yet', file=sys.stderr)
+    for cell in model.top(args.show):
+        n, faults, crashes = model.cells[cell]
+        offset, width = space.params(cell)
+        print(json.dumps({'offset': offset, 'width': width, 'n': n, 'faults': faults, 'crashes': crashes}))
+    if found is None:
+        sys.exit(1)
+
+
+def parse_widths(s):
+    widths = []
+    for part in s.split(','):
+        if '-' in part:
+            a, b = part.split('-')
+            widths.extend(range(int(a), int(b) + 1))
+        else:
+            widths.append(int(part))
+    return widths
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('--offsets', type=int, nargs=3, required=True, metavar=('START', 'END', 'STEP'),
+                    help='glitch offsets, CPU clocks after reset release')
+    ap.add_argument('--widths', type=parse_widths, required=True, help="glitch widths, e.g. '4-12' or '5,7,9'")
+    ap.add_argument('--region', type=int, default=16, help='offsets per region (default 16)')
+    ap.add_argument('--batch', type=int, default=4, help='proposals between model updates (default 4)')
+    ap.add_argument('--repeats', type=int, default=2, help='attempts per proposal (default 2)')
+    ap.add_argument('--confirm', type=int, default=8, help='attempts needed at a reliable glitch (default 8)')
+    ap.add_argument('--target', type=float, default=0.5, help='fault rate of a reliable glitch (default 0.5)')
+    ap.add_argument('--crash-cost', type=float, default=1.0, help='how much crashes count against a region (default 1)')
+    ap.add_argument('--budget', type=int, default=200000, help='most attempts to make (default 200000)')
+    ap.add_argument('--seed', type=int, default=1, help='random seed (default 1)')
+    ap.add_argument('-v', '--verbose', action='store_true')
+    sub = ap.add_subparsers(dest='mode', required=True)
+
+    p = sub.add_parser('run', help='search on a board')
+    p.add_argument('-d', '--device', required=True, help='glitcher serial port')
+    p.add_argument('--log', required=True, help='results log (JSON lines), read back and appended to')
+    p.add_argument('--fault-flags', type=lambda s: int(s, 0), default=GATR_LEN | GATR_DATA | GATR_CONV,
+                   help='GATR_xxx flags which make a fault (default 0x0E)')
+    p.add_argument('--timeout', type=float, default=60.0, help='seconds one proposal may take (default 60)')
+    p.add_argument('--show', type=int, default=5, help='best offsets to print at the end (default 5)')
+
+    p = sub.add_parser('simulate', help='compare with a grid sweep on synthetic cards')
+    p.add_argument('--trials', type=int, default=10, help='synthetic cards (default 10)')
+    p.add_argument('--clusters', type=int, default=2, help='fault clusters per card (default 2)')
+    p.add_argument('--sigma', type=float, default=30.0, help='cluster size, offset standard deviation (default 30)')
+    p.add_argument('--peak', type=float, default=0.8, help='fault probability at a cluster centre (default 0.8)')
+    p.add_argument('--grid-repeats', type=int, default=1, help='grid attempts per offset (default 1)')
+
+    args = ap.parse_args()
+    space = Space(*args.offsets, args.widths, args.region)
+    if args.mode == 'run':
+        do_run(space, args)
+    else:
+        do_simulate(space, args)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+"""
+Assembler, checker and timeline calculator for glitch programs ('gprog').
+
+A glitch program is a list of instructions run by the firmware's glitch
+program interpreter (glitchprog.S), each taking a fixed number of CPU clocks
+(see glitchprog.h). This assembles a program, checks it, works out exactly
+when everything happens, and optionally uploads it.
+
+Source syntax, one instruction per line, ';' or '#' starts a comment:
+
+    clock manual|free   CKM: switch the card clock pin to manual/Timer1
+    clk N               CLK: N manual card clock pulses (1..256)
+    glh / gll           Glitch pin high / low
+    glitch N            GLP: glitch pulse, high for 3N+1 CPU clocks (1..256)
+    wait C              Delay for exactly C CPU clocks (at least 16). This may
+                        take more than one instruction.
+    trig                Toggle the scope trigger pin
+    sample              Sample the card I/O pin
+    mark N / loop       Run the instructions in between N times (1..256)
+    reset hold|run      Card reset pin
+    end                 Stop (optional at the end of the program)
+
+Examples:
+    gpasm.py boot.gp                    # listing and timeline
+    gpasm.py boot.gp --port /dev/ttyUSB0 --run
+"""
+
+import argparse
+import sys
+
+# Opcodes -- keep in sync with glitchprog.h
+GP_END = 0
+GP_CLK = 1
+GP_CKM = 2
+GP_GLH = 3
+GP_GLL = 4
+GP_GLP = 5
+GP_WAIT = 6
+GP_WAIT1 = 7
+GP_WAIT2 = 8
+GP_TRIG = 9
+GP_SMP = 10
+GP_MARK = 11
+GP_LOOP = 12
+GP_RST = 13
+
+GP_MAX_OPS = 48
+
+F_CPU = 14318180
+CPU_CLOCKS_PER_CARD_CLOCK = 4
+
+MNEMONICS = {
+    GP_END: 'END', GP_CLK: 'CLK', GP_CKM: 'CKM', GP_GLH: 'GLH', GP_GLL: 'GLL',
+    GP_GLP: 'GLP', GP_WAIT: 'WAIT', GP_WAIT1: 'WAIT1', GP_WAIT2: 'WAIT2',
+    GP_TRIG: 'TRIG', GP_SMP: 'SMP', GP_MARK: 'MARK', GP_LOOP: 'LOOP', GP_RST: 'RST',
+}
+
+
+def count(arg):
+    """Loop count of an 8-bit argument: zero means 256."""
+    return arg if arg else 256
+
+
+def cycles(op, arg):
+    """CPU clocks taken by one instruction, including fetch and dispatch."""
+    n = count(arg)
+    return {
+        GP_CLK: 8 * n + 13,
+        GP_CKM: 19,
+        GP_GLH: 16,
+        GP_GLL: 16,
+        GP_GLP: 3 * n + 17,
+        GP_WAIT: 3 * n + 13,
+        GP_WAIT1: 3 * n + 14,
+        GP_WAIT2: 3 * n + 15,
+        GP_TRIG: 16,
+        GP_SMP: 18,
+        GP_MARK: 16,
+        GP_LOOP: 17,
+        GP_RST: 19,
+    }[op]
+
+
+class AsmError(Exception):
+    pass
+
+
+def wait_ops(c):
+    """Split a delay of exactly c CPU clocks into WAIT instructions."""
+    if c < 16:
+        raise AsmError('wait must be at least 16 CPU clocks')
+
+    ops = []
+    while c > 0:
+        # WAITk n takes 3n+13+k clocks, for n = 1..256
+        if c <= 3 * 256 + 15:
+            chunk = c
+        else:
+            # Take the longest chunk which leaves at least 16 clocks
+            chunk = min(3 * 256 + 15, c - 16)
+        k = (chunk - 13) % 3
+        n = (chunk - 13 - k) // 3
+        ops.append((GP_WAIT + k, n & 0xFF))
+        c -= chunk
+    return ops
+
+
+def parse_count(word, lo=1, hi=256):
+    n = int(word, 0)
+    if not lo <= n <= hi:
+        raise AsmError('%d out of range (%d..%d)' % (n, lo, hi))
+    return n & 0xFF
+
+
+def assemble(text):
+    """
+    Assemble a glitch program.
+
+    @return list of (opcode, arg, line number, source line)
+    """
+    prog = []
+    for lineno, line in enumerate(text.splitlines(), 1):
+        src = line.split(';')[0].split('#')[0].strip()
+        if not src:
+            continue
+        words = src.lower().split()
+        mn, args = words[0], words[1:]
+
+        try:
+            def need(nargs):
+                if len(args) != nargs:
+                    raise AsmError('%s takes %d argument(s)' % (mn, nargs))
+
+            if mn == 'end':
+                need(0)
+                ops = [(GP_END, 0)]
+            elif mn == 'clk':
+                need(1)
+                ops = [(GP_CLK, parse_count(args[0]))]
+            elif mn == 'clock':
+                need(1)
+                if args[0] not in ('manual', 'free'):
+                    raise AsmError("clock mode must be 'manual' or 'free'")
+                ops = [(GP_CKM, 1 if args[0] == 'free' else 0)]
+            elif mn == 'glh':
+                need(0)
+                ops = [(GP_GLH, 0)]
+            elif mn == 'gll':
+                need(0)
+                ops = [(GP_GLL, 0)]
+            elif mn == 'glitch':
+                need(1)
+                ops = [(GP_GLP, parse_count(args[0]))]
+            elif mn == 'wait':
+                need(1)
+                ops = wait_ops(int(args[0], 0))
+            elif mn == 'trig':
+                need(0)
+                ops = [(GP_TRIG, 0)]
+            elif mn == 'sample':
+                need(0)
+                ops = [(GP_SMP, 0)]
+            elif mn == 'mark':
+                need(1)
+                ops = [(GP_MARK, parse_count(args[0]))]
+            elif mn == 'loop':
+                need(0)
+                ops = [(GP_LOOP, 0)]
+            elif mn == 'reset':
+                need(1)
+                if args[0] not in ('hold', 'run'):
+                    raise AsmError("reset must be 'hold' or 'run'")
+                ops = [(GP_RST, 1 if args[0] == 'run' else 0)]
+            else:
+                raise AsmError("unknown instruction '%s'" % mn)
+        except (AsmError, ValueError) as e:
+            raise AsmError('line %d: %s' % (lineno, e))
+
+        prog += [(op, arg, lineno, line.strip()) for op, arg in ops]
+
+    return prog
+
+
+def check(prog):
+    """
+    Check a program the same way the firmware does, plus a few things the
+    firmware can't know about.
+
+    @return list of warnings. Raises AsmError for fatal problems.
+    """
+    warnings = []
+    in_loop = False
+    n_ops = len(prog)
+
+    for i, (op, arg, lineno, _) in enumerate(prog):
+        if op == GP_MARK:
+            if in_loop:
+                raise AsmError("line %d: loops can't be nested" % lineno)
+            in_loop = True
+        elif op == GP_LOOP:
+            if not in_loop:
+                raise AsmError('line %d: loop without mark' % lineno)
+            in_loop = False
+        elif op == GP_END:
+            if i != len(prog) - 1:
+                warnings.append('line %d: instructions after end are never run' % lineno)
+            n_ops = i
+            break
+    if in_loop:
+        raise AsmError('mark without loop')
+
+    if n_ops > GP_MAX_OPS:
+        raise AsmError('program is %d instructions, the limit is %d' % (n_ops, GP_MAX_OPS))
+
+    return warnings
+
+
+def simulate(prog):
+    """
+    Work out the program's timeline.
+
+    @return (total CPU clocks, list of (cpu clock, event), warnings)
+    """
+    events = []
+    warnings = []
+    t = 0
+    pc = 0
+    loop_start = loop_count = None
+    manual_clock = False
+    glitch = False
+    glitch_start = 0
+    n_samples = 0
+
+    while pc < len(prog):
+        op, arg, lineno, _ = prog[pc]
+        pc += 1
+        if op == GP_END:
+            break
+
+        if op == GP_CLK:
+            if not manual_clock:
+                warnings.append('line %d: clk has no effect while the clock is free-running' % lineno)
+            events.append((t + 14, '%d clock pulses' % count(arg)))
+        elif op == GP_CKM:
+            manual_clock = (arg == 0)
+            events.append((t + 17, 'clock %s' % ('manual' if manual_clock else 'free-running')))
+        elif op == GP_GLH:
+            glitch, glitch_start = True, t + 14
+            events.append((glitch_start, 'glitch high'))
+        elif op == GP_GLL:
+            if glitch:
+                events.append((t + 14, 'glitch low (width %d)' % (t + 14 - glitch_start)))
+            glitch = False
+        elif op == GP_GLP:
+            events.append((t + 14, 'glitch pulse, width %d' % (3 * count(arg) + 1)))
+        elif op == GP_TRIG:
+            events.append((t + 14, 'trigger toggle'))
+        elif op == GP_SMP:
+            events.append((t + 14, 'sample %d' % n_samples))
+            n_samples += 1
+        elif op == GP_MARK:
+            loop_start, loop_count = pc, count(arg)
+        elif op == GP_LOOP:
+            loop_count -= 1
+            if loop_count:
+                pc = loop_start
+        elif op == GP_RST:
+            events.append((t + 15 if arg else t + 17, 'reset %s' % ('run' if arg else 'hold')))
+
+        t += cycles(op, arg)
+
+    if glitch:
+        warnings.append('glitch pin is still high at the end (the firmware turns it off)')
+    if manual_clock:
+        warnings.append('clock is still manual at the end (the firmware restores the clock mode)')
+    if n_samples > 16:
+        warnings.append('%d samples taken, only the last 16 are returned' % n_samples)
+
+    return t, events, warnings
+
+
+def encode(prog):
+    """Bytes to upload: opcode, argument pairs, without the final END."""
+    out = []
+    for op, arg, _, _ in prog:
+        if op == GP_END:
+            break
+        out += [op, arg]
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('source', help="program source ('-' for stdin)")
+    ap.add_argument('--port', help='upload to the glitcher on this serial port')
+    ap.add_argument('--run', action='store_true', help="run the program once after uploading ('gprog run')")
+    ap.add_argument('-q', '--quiet', action='store_true', help="don't print the listing and timeline")
+    args = ap.parse_args()
+
+    text = sys.stdin.read() if args.source == '-' else open(args.source).read()
+    try:
+        prog = assemble(text)
+        warnings = check(prog)
+    except AsmError as e:
+        sys.exit('error: %s' % e)
+
+    total, events, sim_warnings = simulate(prog)
+    warnings += sim_warnings
+
+    if not args.quiet:
+        print('Listing (CPU clocks per instruction):')
+        for op, arg, lineno, src in prog:
+            cost = '-' if op == GP_END else str(cycles(op, arg))
+            print('  %02X %02X  %-6s %3d  %6s   %s' % (op, arg, MNEMONICS[op], arg, cost, src))
+
+        print('\nTimeline (CPU clocks / card clocks / us from the start):')
+        for t, what in events:
+            print('  %8d %8.2f %10.3f  %s' % (t, t / CPU_CLOCKS_PER_CARD_CLOCK, t * 1e6 / F_CPU, what))
+        print('  %8d %8.2f %10.3f  end' % (total, total / CPU_CLOCKS_PER_CARD_CLOCK, total * 1e6 / F_CPU))
+
+    for w in warnings:
+        print('warning: %s' % w, file=sys.stderr)
+
+    data = encode(prog)
+    print('\ngprog load ' + ' '.join('%02X' % b for b in data))
+
+    if args.port:
+        from glitcher import Glitcher
+
+        g = Glitcher(args.port)
+        g.command('gprog load ' + ' '.join('%02X' % b for b in data))
+        text = g.wait_for(b'> ').decode('ascii', 'replace')
+        if 'ERROR' in text:
+            sys.exit(text.strip())
+        print('Uploaded %d instructions' % (len(data) // 2))
+
+        if args.run:
+            g.command('gprog run')
+            print(g.wait_for(b'> ').decode('ascii', 'replace').strip())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,383 @@
+#!/usr/bin/env python3
+"""
+Run one glitch or fuzz campaign across several glitcher boards.
+
+The campaign's parameter space is split into chunks, which are dealt out to
+the boards evenly at the start. A board which runs out of work steals a chunk
+from the board with the most left. If a board goes away (the port closes, a
+frame is corrupted, or a chunk takes longer than --timeout), its chunk is put
+back for the others and the board is dropped, or reconnected if --reconnect
+allows.
+
+Results from all the boards are merged into one store, a JSON lines file,
+without duplicates. The store also records finished chunks, so running the
+same campaign with the same store again carries on where it stopped.
+
+Campaigns:
+    gatr <start> <end> <step> <width> [--repeats N]
+                Glitch the ATR ('gatr', needs ENABLE_GLITCH). Chunks are
+                --chunk offsets. A result is a deviation from the golden
+                ATR: offset, width, flags and ATR.
+    fuzz <first> <last> <cases>
+                Fuzz APDUs ('fuzz run', needs ENABLE_FUZZ), once for each
+                RNG seed from first to last. Chunks are --chunk seeds. A
+                result is a new response class: header, SW, procedure byte
+                and character count. Give the fuzzer its seeds with --setup.
+
+Boards (-d, repeatable) are serial ports, or 'sim:<glitcher-sim options>'
+for the host build. fakeglitcher.py makes stand-in boards for testing.
+
+Examples:
+    orchestrate.py -d /dev/ttyUSB0 -d /dev/ttyUSB1 -o glitches.jsonl gatr 3000 9000 1 9 --repeats 4
+    orchestrate.py -d 'sim:-c videocrypt' -d 'sim:-c videocrypt' -o fuzz.jsonl \\
+        --setup 'fuzz seed recv 53 70 00 00 06' fuzz 1 20 200
+"""
+
+import argparse
+import collections
+import json
+import shlex
+import sys
+import threading
+import time
+
+from glitcher import Glitcher, SimPort, FrameError, decode_apdu, decode_gatr, FRAME_GATR, FRAME_APDU
+
+
+class GatrCampaign:
+    """Glitch the ATR at every offset in a range. Chunks are offset ranges."""
+
+    name = 'gatr'
+
+    def __init__(self, args):
+        self.start, self.end, self.step, self.width = args.start, args.end, args.step, args.width
+        self.repeats = args.repeats
+        self.params = {'start': self.start, 'end': self.end, 'step': self.step,
+                       'width': self.width, 'repeats': self.repeats}
+        self.chunk = args.chunk
+
+    def chunks(self):
+        offsets = range(self.start, self.end + 1, self.step)
+        return [(offsets[i], offsets[min(i + self.chunk, len(offsets)) - 1])
+                for i in range(0, len(offsets), self.chunk)]
+
+    def commands(self, chunk):
+        return ['gatr %d %d %d %d %d' % (chunk[0], chunk[1], self.step, self.width, self.repeats)]
+
+    def result(self, ftype, payload):
+        """@return (key, result dict), or None if the frame isn't a result"""
+        if ftype != FRAME_GATR:
+            return None
+        r = decode_gatr(payload)
+        # The width in the frame is only the low byte
+        r['width'] = self.width
+        del r['attempt']
+        return (r['offset'], r['width'], r['flags'], r['atr']), r
+
+
+class FuzzCampaign:
+    """Fuzz once with each RNG seed in a range. Chunks are seed ranges."""
+
+    name = 'fuzz'
+
+    def __init__(self, args):
+        self.first, self.last, self.cases = args.first, args.last, args.cases
+        self.params = {'first': self.first, 'last': self.last, 'cases': self.cases}
+        self.chunk = args.chunk
+
+    def chunks(self):
+        return [(s, min(s + self.chunk - 1, self.last)) for s in range(self.first, self.last + 1, self.chunk)]
+
+    def commands(self, chunk):
+        return ['fuzz run %d %d' % (self.cases, seed) for seed in range(chunk[0], chunk[1] + 1)]
+
+    def result(self, ftype, payload):
+        if ftype != FRAME_APDU:
+            return None
+        a = decode_apdu(payload)
+        r = {'header': ' '.join('%02X' % b for b in a['header']), 'sw': '%04X' % a['sw'],
+             'proc': '%02X' % a['proc'], 'nchars': a['nchars'], 't_sw1': a['t_sw1']}
+        return (r['header'], r['sw'], r['proc'], r['nchars']), r
+
+
+CAMPAIGNS = {'gatr': GatrCampaign, 'fuzz': FuzzCampaign}
+
+
+class Store:
+    """
+    The merged results: a JSON lines file of a 'campaign' record, 'result'
+    records (new keys only) and 'done' records for finished chunks.
+    """
+
+    def __init__(self, path, campaign):
+        self.lock = threading.Lock()
+        self.keys = set()
+        self.done = set()
+        self.hits = 0
+        head = {'type': 'campaign', 'campaign': campaign.name, 'params': campaign.params}
+
+        try:
+            f = open(path)
+        except FileNotFoundError:
+            f = None
+        if f is not None:
+            with f:
+                for n, line in enumerate(f, 1):
+                    try:
+                        rec = json.loads(line)
+                    except ValueError:
+                        # A line cut short when we were stopped
+                        print('%s:%d: skipping a bad record' % (path, n), file=sys.stderr)
+                        continue
+                    if rec['type'] == 'campaign':
+                        if (rec['campaign'], rec['params']) != (head['campaign'], head['params']):
+                            sys.exit('%s holds a different campaign: %s %s' % (path, rec['campaign'], rec['params']))
+                        head = None
+                    elif rec['type'] == 'result':
+                        self.keys.add(tuple(rec['key']))
+                    elif rec['type'] == 'done':
+                        self.done.add(tuple(rec['chunk']))
+
+        self.f = open(path, 'a')
+        if head is not None:
+            self._write(head)
+
+    def _write(self, rec):
+        self.f.write(json.dumps(rec) + '\n')
+        self.f.flush()
+
+    def add(self, key, result, device):
+        """Add a result. @return True if it's new."""
+        with self.lock:
+            self.hits += 1
+            if key in self.keys:
+                return False
+            self.keys.add(key)
+            self._write({'type': 'result', 'key': list(key), 'device': device,
+                         'time': round(time.time(), 3), **result})
+            return True
+
+    def chunk_done(self, chunk, device):
+        with self.lock:
+            self.done.add(chunk)
+            self._write({'type': 'done', 'chunk': list(chunk), 'device': device})
+
+    def close(self):
+        self.f.close()
+
+
+class WorkQueues:
+    """
+    One deque of chunks for each device. A device takes from the front of its
+    own, and when that is empty, steals from the back of the longest one.
+    Chunks given back by a device which went away go to 'orphans', which
+    every device takes from first.
+    """
+
+    def __init__(self, chunks, ndevices):
+        self.cond = threading.Condition()
+        self.queues = [collections.deque() for i in range(ndevices)]
+        self.orphans = collections.deque()
+        for i, c in enumerate(chunks):
+            self.queues[(i * ndevices) // len(chunks)].append(c)
+        self.busy = 0
+
+    def take(self, dev):
+        """
+        Take the next chunk for a device. With nothing left to take, this
+        waits until the chunks being run have finished, as one could be given
+        back.
+
+        @return (chunk, stolen), or (None, False) when the work is done
+        """
+        with self.cond:
+            while True:
+                if self.orphans:
+                    chunk, stolen = self.orphans.popleft(), True
+                    break
+                if self.queues[dev]:
+                    chunk, stolen = self.queues[dev].popleft(), False
+                    break
+                victim = max(self.queues, key=len)
+                if victim:
+                    chunk, stolen = victim.pop(), True
+                    break
+                if self.busy == 0:
+                    return None, False
+                self.cond.wait()
+            self.busy += 1
+            return chunk, stolen
+
+    def finished(self):
+        with self.cond:
+            self.busy -= 1
+            self.cond.notify_all()
+
+    def give_back(self, dev, chunk):
+        """A device has gone away: its chunk and its queue go to the others."""
+        with self.cond:
+            if chunk is not None:
+                self.orphans.append(chunk)
+                self.busy -= 1
+            self.orphans.extend(self.queues[dev])
+            self.queues[dev].clear()
+            self.cond.notify_all()
+
+    def remaining(self):
+        with self.cond:
+            return self.busy + len(self.orphans) + sum(len(q) for q in self.queues)
+
+
+class Device(threading.Thread):
+    def __init__(self, index, spec, args, campaign, work, store):
+        super().__init__(daemon=True)
+        self.index = index
+        self.spec = spec
+        self.args = args
+        self.campaign = campaign
+        self.work = work
+        self.store = store
+        self.g = None
+        self.chunks = self.steals = self.lost = self.results = self.new = 0
+        self.gone = False
+
+    def log(self, msg):
+        print('[%d %s] %s' % (self.index, self.spec, msg), file=sys.stderr)
+        sys.stderr.flush()
+
+    def connect(self):
+        if self.spec.startswith('sim:'):
+            port = SimPort(shlex.split(self.spec[4:]))
+        else:
+            port = self.spec
+        g = Glitcher(port, echo=self.args.verbose)
+        g.wait_for(b'\n> ')
+        for line in ['binary 1'] + self.args.setup:
+            g.command(line)
+            g.read_frames_until(timeout=self.args.timeout)
+        self.g = g
+
+    def disconnect(self):
+        if self.g is not None:
+            try:
+                self.g.close()
+            except OSError:
+                pass
+            self.g = None
+
+    def run_chunk(self, chunk):
+        for line in self.campaign.commands(chunk):
+            self.g.command(line)
+            for ftype, payload in self.g.read_frames_until(timeout=self.args.timeout):
+                res = self.campaign.result(ftype, payload)
+                if res is None:
+                    continue
+                self.results += 1
+                if self.store.add(res[0], res[1], self.spec):
+                    self.new += 1
+
+    def run(self):
+        retries = self.args.reconnect
+        chunk = None
+        try:
+            while True:
+                try:
+                    if self.g is None:
+                        self.connect()
+                    chunk, stolen = self.work.take(self.index)
+                    if chunk is None:
+                        return
+                    self.steals += stolen
+                    self.run_chunk(chunk)
+                    self.store.chunk_done(chunk, self.spec)
+                    self.work.finished()
+                    self.chunks += 1
+                    chunk = None
+                except (EOFError, OSError, TimeoutError, FrameError) as e:
+                    self.disconnect()
+                    if chunk is not None:
+                        self.log('lost chunk %s: %s' % (chunk, e or type(e).__name__))
+                        self.lost += 1
+                    else:
+                        self.log('failed: %s' % (e or type(e).__name__))
+                    if retries == 0:
+                        self.gone = True
+                        self.work.give_back(self.index, chunk)
+                        return
+                    # Keep the chunk's place in the work, but let someone else have it
+                    self.work.give_back(self.index, chunk)
+                    chunk = None
+                    retries -= 1
+                    time.sleep(1)
+        finally:
+            self.disconnect()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('-d', '--device', action='append', required=True,
+                    help="glitcher serial port, or 'sim:<glitcher-sim options>' (repeatable)")
+    ap.add_argument('-o', '--store', required=True, help='results file (JSON lines), appended to')
+    ap.add_argument('--setup', action='append', default=[],
+                    help='command to run on each board when it connects (repeatable)')
+    ap.add_argument('--chunk', type=int, default=16, help='offsets or seeds per chunk (default 16)')
+    ap.add_argument('--timeout', type=float, default=600.0,
+                    help='seconds one command may take before the board is given up on (default 600)')
+    ap.add_argument('--reconnect', type=int, default=0,
+                    help='times to reconnect to a board which has gone away (default 0)')
+    ap.add_argument('-v', '--verbose', action='store_true', help='copy the consoles to stderr')
+    sub = ap.add_subparsers(dest='campaign', required=True)
+
+    p = sub.add_parser('gatr', help='glitch the ATR')
+    p.add_argument('start', type=int)
+    p.add_argument('end', type=int)
+    p.add_argument('step', type=int)
+    p.add_argument('width', type=int)
+    p.add_argument('--repeats', type=int, default=1, help='attempts at each offset (default 1)')
+
+    p = sub.add_parser('fuzz', help='fuzz APDUs')
+    p.add_argument('first', type=int, help='first RNG seed (not 0)')
+    p.add_argument('last', type=int, help='last RNG seed')
+    p.add_argument('cases', type=int, help='cases for each seed')
+
+    args = ap.parse_args()
+    if args.chunk < 1:
+        sys.exit('--chunk must be at least 1')
+
+    campaign = CAMPAIGNS[args.campaign](args)
+    store = Store(args.store, campaign)
+    chunks = [c for c in campaign.chunks() if c not in store.done]
+    if not chunks:
+        print('Nothing to do: the campaign is finished', file=sys.stderr)
+        return
+    print('%d chunks to run (%d done before) on %d boards' %
+          (len(chunks), len(store.done), len(args.device)), file=sys.stderr)
+
+    work = WorkQueues(chunks, len(args.device))
+    devices = [Device(i, spec, args, campaign, work, store) for i, spec in enumerate(args.device)]
+    t0 = time.monotonic()
+    for d in devices:
+        d.start()
+    try:
+        for d in devices:
+            while d.is_alive():
+                d.join(1.0)
+    except KeyboardInterrupt:
+        print('Stopped', file=sys.stderr)
+    finally:
+        store.close()
+
+    elapsed = time.monotonic() - t0
+    for d in devices:
+        print('[%d %s] %d chunks (%d stolen), %d lost, %d results, %d new%s' %
+              (d.index, d.spec, d.chunks, d.steals, d.lost, d.results, d.new, ' -- gone' if d.gone else ''),
+              file=sys.stderr)
+    left = work.remaining()
+    print('%d results, %d unique in the store, %.1f s%s' %
+          (store.hits, len(store.keys), elapsed, (', %d chunks not run' % left) if left else ''), file=sys.stderr)
+    if left:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
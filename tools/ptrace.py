@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""
+Capture an averaged power trace with the 'ptrace' command and save it as CSV.
+
+Examples:
+    ptrace.py /dev/ttyUSB0 atr 64 0 256 -o boot.csv
+    ptrace.py /dev/ttyUSB0 apdu 128 100 256 53 70 00 00 06 -o serial.csv
+
+The CSV has one row per sample: card clock offset (from the sync point) and
+the averaged ADC reading (0..255).
+"""
+
+import argparse
+import struct
+import sys
+
+from glitcher import Glitcher, FRAME_PTRACE
+
+
+def decode_ptrace(payload):
+    mode, traces, delay, clocks_per_sample, nsamples = struct.unpack_from('<BHIHH', payload)
+    raw = struct.unpack_from('<%dH' % nsamples, payload, 11)
+    samples = [v / 256.0 for v in raw]
+    return mode, traces, delay, clocks_per_sample, samples
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('port')
+    ap.add_argument('mode', choices=('atr', 'apdu'))
+    ap.add_argument('traces', type=int)
+    ap.add_argument('delay', help='card clocks from the sync point to the first sample')
+    ap.add_argument('samples', type=int)
+    ap.add_argument('apdu', nargs='*', help='apdu mode: CLA INS P1 P2 LEN [DATA...] (hex)')
+    ap.add_argument('-o', '--output', help='CSV file (default stdout)')
+    ap.add_argument('--plot', action='store_true', help='plot the trace (needs matplotlib)')
+    args = ap.parse_args()
+
+    g = Glitcher(args.port)
+    cmd = ['ptrace', args.mode, str(args.traces), args.delay, str(args.samples)] + args.apdu
+    g.command(' '.join(cmd))
+
+    # Allow a second or so per trace for the resets
+    payload = g.expect_frame(FRAME_PTRACE, timeout=10 + args.traces)
+    mode, traces, delay, cps, samples = decode_ptrace(payload)
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    out.write('clock,adc\n')
+    for i, v in enumerate(samples):
+        out.write('%d,%.3f\n' % (delay + i * cps, v))
+    if args.output:
+        out.close()
+
+    if args.plot:
+        import matplotlib.pyplot as plt
+        plt.plot([delay + i * cps for i in range(len(samples))], samples)
+        plt.xlabel('card clocks')
+        plt.ylabel('ADC (average of %d)' % traces)
+        plt.show()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,357 @@
+#!/usr/bin/env python3
+"""
+Record, dump and replay card sessions ('session' command, needs
+ENABLE_SESSION).
+
+record: runs glitcher commands with session recording on, and saves every
+character to and from the card with its card clock timestamp.
+
+dump: prints a recorded session, one event per line.
+
+log: prints a recorded session, one line per ATR or APDU: the header,
+procedure bytes, data and SW, split up using the firmware's annotations.
+
+pcap: converts a recorded session to a PCAP file for Wireshark and the like.
+There is no link type for raw ISO7816 T=0, so each ATR and APDU is sent as a
+GSMTAP SIM message (as SIMtrace does), in IPv4/UDP to port 4729. Wireshark
+decodes them with its GSM SIM and ISO7816 dissectors. Timestamps are from
+the start of the recording (1 Jan 1970), with nanosecond resolution.
+
+replay: loads the session back into the glitcher a piece at a time and
+replays it, with the recorded timing or as fast as possible (--fast),
+stopping at the first place the card does something different.
+
+Session file: b'GSES', a version byte (1), then the events as sent in
+FRAME_SESSION frames (see session.h).
+
+Examples:
+    session.py record vc.ses --port /dev/ttyUSB0 on vcserial vcdecoem
+    session.py record vc.ses on vcserial --sim -c videocrypt
+    session.py dump vc.ses
+    session.py log vc.ses
+    session.py pcap vc.ses vc.pcap
+    session.py replay vc.ses --port /dev/ttyUSB0
+"""
+
+import argparse
+import struct
+import sys
+
+from glitcher import Glitcher, SimPort, FRAME_SESSION
+
+MAGIC = b'GSES\x01'
+
+SE_TX = 0x00
+SE_RX = 0x01
+SE_RESET = 0x02
+SE_NOTE = 0x03
+
+EVENT_NAMES = {SE_TX: 'TX', SE_RX: 'RX', SE_RESET: 'RESET', SE_NOTE: 'NOTE'}
+
+# Annotations -- keep in sync with session.h
+NOTE_ATR = 0x01
+NOTE_PROC = 0x02
+NOTE_SW = 0x03
+NOTE_PPS = 0x04
+NOTE_TIMEOUT = 0x05
+
+NOTE_NAMES = {NOTE_ATR: 'ATR', NOTE_PROC: 'PROC', NOTE_SW: 'SW', NOTE_PPS: 'PPS', NOTE_TIMEOUT: 'TIMEOUT'}
+
+# GSMTAP, as used by SIMtrace
+GSMTAP_PORT = 4729
+GSMTAP_TYPE_SIM = 0x04
+GSMTAP_SIM_APDU = 0x00
+GSMTAP_SIM_ATR = 0x01
+
+LINKTYPE_RAW = 101
+
+# Keep in sync with session.cpp
+SESSION_REPLAY_MAX = 256
+
+# Bytes per 'session load' command
+LOAD_CHUNK = 32
+
+CARD_CLOCK_HZ = 3579545
+
+
+def decode_events(data):
+    """
+    Split session data into events.
+
+    @return list of (type, value, delta, raw bytes)
+    """
+    events = []
+    pos = 0
+    while pos + 2 < len(data):
+        start = pos
+        etype, val = data[pos], data[pos + 1]
+        pos += 2
+        delta = shift = 0
+        while True:
+            b = data[pos]
+            pos += 1
+            delta |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        events.append((etype, val, delta, data[start:pos]))
+    return events
+
+
+def pieces(events):
+    """
+    Split a session into pieces which can be replayed one at a time: at
+    resets, and where the host starts talking after the card.
+    """
+    out = []
+    cur = []
+    prev = None
+    for ev in events:
+        if cur and (ev[0] == SE_RESET or (ev[0] == SE_TX and prev == SE_RX)):
+            out.append(cur)
+            cur = []
+        cur.append(ev)
+        if ev[0] != SE_NOTE:
+            prev = ev[0]
+    if cur:
+        out.append(cur)
+    return out
+
+
+def record(args):
+    g = Glitcher(args.target, echo=True)
+    g.command('binary 1')
+    g.wait_for(b'> ')
+    g.command('session rec on')
+    text = g.wait_for(b'> ').decode('ascii', 'replace')
+    if 'ERROR' in text:
+        sys.exit(text.strip())
+
+    data = bytearray()
+    for cmd in args.commands + ['session rec off']:
+        g.command(cmd)
+        # Collect frames until the command finishes
+        while not g.text.endswith(b'> '):
+            try:
+                ftype, payload = g.read_frame(timeout=2)
+            except TimeoutError:
+                continue
+            if ftype == FRAME_SESSION:
+                data += payload
+
+    with open(args.file, 'wb') as f:
+        f.write(MAGIC + data)
+    print('\nRecorded %d events' % len(decode_events(data)), file=sys.stderr)
+
+
+def load(path):
+    data = open(path, 'rb').read()
+    if not data.startswith(MAGIC):
+        sys.exit('%s is not a session file' % path)
+    return decode_events(data[len(MAGIC):])
+
+
+def dump(args):
+    t = 0
+    for n, (etype, val, delta, _) in enumerate(load(args.file)):
+        t += delta
+        name = EVENT_NAMES.get(etype, '?%02X' % etype)
+        if etype == SE_RESET:
+            value = ''
+        elif etype == SE_NOTE:
+            value = NOTE_NAMES.get(val, '?%02X' % val)
+        else:
+            value = '%02X' % val
+        print('%6d %12d %10.3fms %+9d  %-5s %s' % (n, t, t * 1000.0 / CARD_CLOCK_HZ, delta, name, value))
+
+
+def messages(events):
+    """
+    Group a session's characters into resets, ATRs and APDUs.
+
+    Received characters are data unless a note says they were a procedure
+    byte or the SW. Sessions recorded without notes come out with everything
+    the card sent as data.
+
+    @return list of dicts: 'kind' ('reset', 'atr' or 'apdu'), 't' and 't_end'
+            (card clocks), and for an ATR 'atr'; for an APDU 'header',
+            'data', 'proc', 'sw' and 'timeout'.
+    """
+    out = []
+    atr = None
+    apdu = None
+    t = 0
+
+    def end_apdu():
+        nonlocal apdu
+        if apdu is not None:
+            apdu['data'] = apdu.pop('tx') + apdu.pop('rx')
+            out.append(apdu)
+            apdu = None
+
+    for etype, val, delta, _ in events:
+        t += delta
+        if etype == SE_RESET:
+            end_apdu()
+            out.append({'kind': 'reset', 't': t, 't_end': t})
+            atr = {'kind': 'atr', 't': None, 't_end': t, 'atr': []}
+        elif etype == SE_TX:
+            atr = None
+            # Characters from the card, then from us: a new command
+            if (apdu is None) or apdu['rx']:
+                end_apdu()
+                apdu = {'kind': 'apdu', 't': t, 't_end': t, 'header': [], 'tx': [], 'rx': [],
+                        'proc': [], 'sw': [], 'timeout': False}
+            (apdu['header'] if len(apdu['header']) < 5 else apdu['tx']).append(val)
+            apdu['t_end'] = t
+        elif etype == SE_RX:
+            if atr is not None:
+                if atr['t'] is None:
+                    atr['t'] = t
+                atr['atr'].append(val)
+                atr['t_end'] = t
+            elif apdu is not None:
+                apdu['rx'].append(val)
+                apdu['t_end'] = t
+        elif etype == SE_NOTE:
+            if val == NOTE_ATR and atr is not None:
+                out.append(atr)
+                atr = None
+            elif apdu is not None:
+                if val == NOTE_PROC and apdu['rx']:
+                    apdu['proc'].append(apdu['rx'].pop())
+                elif val == NOTE_SW and len(apdu['rx']) >= 2:
+                    apdu['sw'] = apdu['rx'][-2:]
+                    del apdu['rx'][-2:]
+                    end_apdu()
+                elif val == NOTE_TIMEOUT:
+                    apdu['timeout'] = True
+                    apdu['t_end'] = t
+                    end_apdu()
+    end_apdu()
+    return out
+
+
+def hexs(data):
+    return ' '.join('%02X' % b for b in data)
+
+
+def ms(t):
+    return t * 1000.0 / CARD_CLOCK_HZ
+
+
+def log(args):
+    for m in messages(load(args.file)):
+        if m['kind'] == 'reset':
+            print('%10.3fms  RESET' % ms(m['t']))
+        elif m['kind'] == 'atr':
+            print('%10.3fms  ATR   %s' % (ms(m['t']), hexs(m['atr'])))
+        else:
+            print('%10.3fms  APDU  %s | %s | %s | %s  (%.3fms)' % (
+                ms(m['t']), hexs(m['header']), hexs(m['proc']), hexs(m['data']),
+                'TIMEOUT' if m['timeout'] else hexs(m['sw']), ms(m['t_end'] - m['t'])))
+
+
+def ip_checksum(hdr):
+    s = sum(struct.unpack('!%dH' % (len(hdr) // 2), hdr))
+    while s >> 16:
+        s = (s & 0xFFFF) + (s >> 16)
+    return ~s & 0xFFFF
+
+
+def gsmtap_packet(sub_type, payload):
+    """An IPv4/UDP packet to the GSMTAP port with a GSMTAP SIM message in it."""
+    # GSMTAP v2 header: version, length in words, type, timeslot, ARFCN,
+    # signal, SNR, frame number, sub type, antenna, sub slot, reserved
+    gsmtap = struct.pack('!BBBBHbbIBBBB', 2, 4, GSMTAP_TYPE_SIM, 0, 0, 0, 0, 0, sub_type, 0, 0, 0) + bytes(payload)
+    udp = struct.pack('!HHHH', GSMTAP_PORT, GSMTAP_PORT, 8 + len(gsmtap), 0) + gsmtap
+    ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, 20 + len(udp), 0, 0, 64, 17, 0,
+                     bytes([127, 0, 0, 1]), bytes([127, 0, 0, 1]))
+    ip = ip[:10] + struct.pack('!H', ip_checksum(ip)) + ip[12:]
+    return ip + udp
+
+
+def pcap(args):
+    msgs = messages(load(args.file))
+    with open(args.out, 'wb') as f:
+        # Nanosecond-resolution PCAP
+        f.write(struct.pack('<IHHiIII', 0xA1B23C4D, 2, 4, 0, 0, 65535, LINKTYPE_RAW))
+        n = 0
+        for m in msgs:
+            if m['kind'] == 'atr':
+                pkt = gsmtap_packet(GSMTAP_SIM_ATR, m['atr'])
+            elif m['kind'] == 'apdu':
+                pkt = gsmtap_packet(GSMTAP_SIM_APDU, m['header'] + m['data'] + m['sw'])
+            else:
+                continue
+            ns = (m['t'] * 1000000000) // CARD_CLOCK_HZ
+            f.write(struct.pack('<IIII', ns // 1000000000, ns % 1000000000, len(pkt), len(pkt)) + pkt)
+            n += 1
+    print('Wrote %d packets to %s' % (n, args.out), file=sys.stderr)
+
+
+def replay(args):
+    g = Glitcher(args.target)
+    opts = (' fast' if args.fast else '') + (' %d' % args.tolerance if args.tolerance is not None else '')
+    events = load(args.file)
+
+    # Pack as many whole pieces as fit into each replay
+    batches = [bytearray()]
+    for piece in pieces(events):
+        raw = b''.join(ev[3] for ev in piece)
+        if len(raw) > SESSION_REPLAY_MAX:
+            sys.exit('a single exchange is too long to replay (%d bytes)' % len(raw))
+        if len(batches[-1]) + len(raw) > SESSION_REPLAY_MAX:
+            batches.append(bytearray())
+        batches[-1] += raw
+
+    done = 0
+    for batch in batches:
+        g.command('session clear')
+        g.wait_for(b'> ')
+        for i in range(0, len(batch), LOAD_CHUNK):
+            g.command('session load ' + ' '.join('%02X' % b for b in batch[i:i + LOAD_CHUNK]))
+            g.wait_for(b'> ')
+
+        g.command('session replay' + opts)
+        text = g.wait_for(b'> ', timeout=60).decode('ascii', 'replace')
+        # Event numbers are from the start of the batch
+        for line in text.splitlines():
+            if line.startswith(('Timing:', 'DIVERGED')):
+                print('[events from %d] %s' % (done, line))
+        if 'DIVERGED' in text:
+            sys.exit(1)
+        done += len(decode_events(batch))
+
+    print('Replay OK, %d events' % done)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('mode', choices=('record', 'dump', 'log', 'pcap', 'replay'))
+    ap.add_argument('file', help='session file')
+    ap.add_argument('commands', nargs='*', help='glitcher commands to record (pcap: the output file)')
+    ap.add_argument('--port', help='glitcher serial port')
+    ap.add_argument('--sim', nargs=argparse.REMAINDER,
+                    help='run sim/glitcher-sim with the rest of the arguments (its card options)')
+    ap.add_argument('--fast', action='store_true', help="replay as fast as possible, don't check the card's timing")
+    ap.add_argument('--tolerance', type=int, help='replay timing tolerance, card clocks')
+    args = ap.parse_args()
+
+    if args.mode in ('record', 'replay'):
+        if args.sim is not None:
+            args.target = SimPort(args.sim)
+        elif args.port:
+            args.target = args.port
+        else:
+            sys.exit('--port or --sim is needed to %s' % args.mode)
+    elif args.mode == 'pcap':
+        if len(args.commands) != 1:
+            sys.exit('pcap needs an output file')
+        args.out = args.commands[0]
+
+    {'record': record, 'dump': dump, 'log': log, 'pcap': pcap, 'replay': replay}[args.mode](args)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""
+Run a timing side channel scan ('tscan' command) and save the per-candidate
+statistics as CSV.
+
+Example -- recover a 4-byte PIN one byte at a time:
+    tscan.py /dev/ttyUSB0 5 32 auto 00 20 00 01 04 00 00 00 00 -o pin.csv
+
+The firmware does the statistics and prints the standout candidates; this
+saves the full per-candidate means (one CSV block per byte position) for a
+closer look. Candidates which couldn't be measured (comms errors) have empty
+mean and sd columns.
+"""
+
+import argparse
+import struct
+import sys
+
+from glitcher import Glitcher, FRAME_TSCAN
+
+# sd of a candidate which couldn't be measured
+SD_FAILED = 255
+
+
+def decode_tscan(payload):
+    pos, k, base = struct.unpack_from('<BHI', payload)
+    means = struct.unpack_from('<256H', payload, 7)
+    sds = payload[7 + 512:7 + 768]
+    return pos, k, base, means, sds
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('port')
+    ap.add_argument('args', nargs='+', help='tscan arguments: <pos> <k> [proc|sw] [auto] <cla> <ins> <p1> <p2> <len> [data...]')
+    ap.add_argument('-o', '--output', help='CSV file (default stdout)')
+    args = ap.parse_args()
+
+    g = Glitcher(args.port, echo=True)
+    g.command('tscan ' + ' '.join(args.args))
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    out.write('pos,candidate,mean_clocks,sd_clocks\n')
+
+    # One frame per byte position, until the firmware says it's finished
+    while True:
+        try:
+            ftype, payload = g.read_frame(timeout=60)
+        except TimeoutError:
+            if b'All done.' in g.text:
+                break
+            continue
+        if ftype != FRAME_TSCAN:
+            continue
+        pos, k, base, means, sds = decode_tscan(payload)
+        for c in range(256):
+            if sds[c] == SD_FAILED:
+                out.write('%d,%d,,\n' % (pos, c))
+            else:
+                out.write('%d,%d,%d,%d\n' % (pos, c, base + means[c], sds[c]))
+        out.flush()
+
+    if args.output:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()
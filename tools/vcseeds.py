@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Stream VideoCrypt seeds from a card with 'vcdecoem loop', and save them with
+their timing as CSV.
+
+The board powers the card up, then runs the decoder's CMD72/74/78/7C
+exchange over and over, at the real decoder cadence or as fast as the card
+allows (--period 0), and sends each seed as a binary frame. At the end this
+prints the board's sustained rate and jitter figures, and how many cycles
+were lost on the way to the host. Ctrl-C stops the run early.
+
+Examples:
+    vcseeds.py /dev/ttyUSB0 100 -o seeds.csv
+    vcseeds.py /dev/ttyUSB0 1000 --period 0
+    vcseeds.py 'sim:-c videocrypt' 20 --period 0
+
+The CSV has one row per cycle: cycle number, start time (microseconds after
+the first cycle), cycle duration (microseconds) and the seed (hex).
+"""
+
+import argparse
+import shlex
+import signal
+import sys
+
+from glitcher import Glitcher, SimPort, decode_vcseed, FRAME_VCSEED
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('port', help="serial port, or 'sim:<glitcher-sim options>'")
+    ap.add_argument('cycles', type=int, nargs='?', default=0, help='cycles to run (default 0: until Ctrl-C)')
+    ap.add_argument('--period', type=int, help='ms between cycle starts (default: the firmware\'s, 2500)')
+    ap.add_argument('-o', '--output', help='CSV file (default stdout)')
+    args = ap.parse_args()
+
+    port = SimPort(shlex.split(args.port[4:])) if args.port.startswith('sim:') else args.port
+    g = Glitcher(port)
+    g.wait_for(b'\n> ')
+    g.command('binary 1')
+    g.wait_for(b'\n> ')
+    g.command('on')
+    text = g.wait_for(b'\n> ').decode('ascii', 'replace')
+    if 'ATR:' not in text:
+        sys.exit('No ATR from the card')
+
+    cmd = 'vcdecoem loop %d' % args.cycles
+    if args.period is not None:
+        cmd += ' %d' % args.period
+    g.command(cmd)
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    out.write('cycle,start_us,duration_us,seed\n')
+    n = lost = 0
+    expect = 0
+    stop = []
+
+    # Ctrl-C sends the board a character, which stops the loop; it then
+    # prints its summary. A second Ctrl-C gives up on that.
+    def interrupt(signum, frame):
+        if stop:
+            raise KeyboardInterrupt
+        stop.append(True)
+        g.ser.write(b'\n')
+    signal.signal(signal.SIGINT, interrupt)
+
+    # Allow for the slowest period the firmware takes, plus the card
+    timeout = 10.0 + (args.period or 2500) / 1000.0
+    for ftype, payload in g.iter_frames_until(timeout=timeout):
+        if ftype != FRAME_VCSEED:
+            continue
+
+        r = decode_vcseed(payload)
+        lost += r['cycle'] - expect
+        expect = r['cycle'] + 1
+        n += 1
+        out.write('%d,%d,%d,%s\n' % (r['cycle'], r['start'], r['duration'], r['seed'].hex().upper()))
+        out.flush()
+
+    if args.output:
+        out.close()
+
+    # The firmware's summary is the text after the last seed
+    lines = g.text.decode('ascii', 'replace').splitlines()
+    for line in lines:
+        if line.startswith(('Cycles=', 'Interval:', 'Late=')) or ('FAILED' in line) or ('ERROR' in line):
+            print(line, file=sys.stderr)
+    print('%d seeds received, %d lost' % (n, lost), file=sys.stderr)
+    g.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -19,3 +19,49 @@ void printHexBuf(const uint8_t *buf, int len)
 		}
 	}
 }
+
+bool popWord(String *cmdline, String *word)
+{
+	cmdline->trim();
+	if (cmdline->length() == 0) {
+		return false;
+	}
+
+	int ofs = cmdline->indexOf(' ');
+	if (ofs == -1) {
+		*word = *cmdline;
+		*cmdline = "";
+	} else {
+		*word = cmdline->substring(0, ofs);
+		cmdline->remove(0, ofs+1);
+	}
+
+	return true;
+}
+
+bool popArg(String *cmdline, long *val, int base)
+{
+	String word;
+
+	if (!popWord(cmdline, &word)) {
+		return false;
+	}
+
+	*val = strtol(word.c_str(), NULL, base);
+	return true;
+}
+
+int popHexBytes(String *cmdline, uint8_t *buf, int maxLen)
+{
+	long val;
+	int n = 0;
+
+	while (popArg(cmdline, &val)) {
+		if (n >= maxLen) {
+			return -1;
+		}
+		buf[n++] = val;
+	}
+
+	return n;
+}
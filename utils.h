@@ -1,9 +1,40 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <Arduino.h>
+
 void printHex(const uint8_t val);
 void printHexBuf(const uint8_t *buf, int len);
 
+/**
+ * Remove the next space-separated word from the front of a command line.
+ *
+ * @param		cmdline	Command line. The word is removed from the front.
+ * @param[out]	word	The word which was removed.
+ * @return <b>true</b> if a word was found.
+ */
+bool popWord(String *cmdline, String *word);
+
+/**
+ * Remove the next space-separated numeric argument from a command line.
+ *
+ * @param		cmdline	Command line. The argument is removed from the front.
+ * @param[out]	val		Parsed value.
+ * @param		base	Number base -- 16 for hex, 10 for decimal.
+ * @return <b>true</b> if an argument was found.
+ */
+bool popArg(String *cmdline, long *val, int base = 16);
+
+/**
+ * Parse the rest of a command line as hex bytes.
+ *
+ * @param		cmdline	Command line. All parsed bytes are removed.
+ * @param[out]	buf		Output buffer.
+ * @param		maxLen	Size of the output buffer.
+ * @return Number of bytes parsed, or -1 if there were more than maxLen.
+ */
+int popHexBytes(String *cmdline, uint8_t *buf, int maxLen);
+
 // From https://www.freertos.org/FreeRTOS_Support_Forum_Archive/February_2012/freertos_Tick_count_overflow_5005076.html
 
 /*  Determine if time a is "after" time b.
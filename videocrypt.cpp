@@ -1,5 +1,7 @@
 #include "hardware.h"
 #include "smartcard.h"
+#include "hostlink.h"
+#include "videocrypt.h"
 #include "utils.h"
 
 /**
@@ -118,10 +120,14 @@ void handle_vcserial(String *cmdline)
 }
 
 /**
- * Command handler: vcdecoem
+ * Command handler: vcdecoem [loop [<cycles> [<period ms>]]]
  * 
  * Based on DECOEM.C
  * VideoCrypt Decoder Emulator
+ *
+ * With 'loop', runs continuously (see vcDecoemLoop()). The counts are
+ * decimal: <cycles> 0 (the default) runs until a key is pressed, <period> is
+ * VC_DECODER_PERIOD by default and 0 runs as fast as the card allows.
  */
 
 static const PROGMEM uint8_t MSG_P6[] = {
@@ -144,9 +150,207 @@ static const PROGMEM uint8_t MSG_P9[] = {
     0x6c, 0x6c, 0x6c, 0x67, 0xe9, 0x44, 0xbc, 0x68
 };
 
+/**
+ * Get the CMD74 message a decoder would send to a card of this issue.
+ *
+ * @param	msg		32-byte buffer for the message
+ * @return false if there isn't one for this issue.
+ */
+static bool vcDecoderMessage(const uint8_t cardIssue, uint8_t *msg)
+{
+	switch (cardIssue) {
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+			memcpy_P(msg, MSG_P6, 32);
+			return true;
+
+		case 7:
+			memcpy_P(msg, MSG_P7, 32);
+			return true;
+
+		case 9:
+			memcpy_P(msg, MSG_P9, 32);
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/// Send a CMD72..7C APDU, and print an error if it fails
+static bool vcDecoemApdu(const uint8_t ins, const uint8_t len, uint8_t *buf, const bool send)
+{
+	uint16_t sw = cardSendApdu(0x53, ins, 0, 0, len, buf, send);
+
+	if (sw != 0x9000) {
+		Serial.print(F("CMD"));
+		Serial.print(ins, HEX);
+		Serial.print(F(" **FAILED** sw="));
+		Serial.println(sw, HEX);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * vcdecoem loop: run the decoder's side of the exchange continuously, the
+ * way a decoder does while it is showing a channel. The card stays powered
+ * and is sent CMD72 (the previous CMD7C answer), CMD74, CMD78 and CMD7C each
+ * cycle. Cycles start every <period> ms on a fixed schedule, or back to back
+ * if the period is 0.
+ *
+ * Each cycle's seed is printed, or sent as a FRAME_VCSEED frame instead in
+ * binary mode so the serial link isn't what limits the rate:
+ *
+ *   u32 cycle, u32 start (us after the first cycle), u32 duration (us), u8 seed[8]
+ *
+ * At the end the sustained rate and the jitter of the cycle start times are
+ * printed, and with a period, how many cycles started late.
+ */
+static void vcDecoemLoop(uint32_t cycles, const uint32_t period)
+{
+	uint8_t msg[32];
+	uint8_t seed[8];
+	uint8_t msgprev[16];
+	uint8_t cardIssue = 0xFF;
+	const uint32_t periodUs = period * 1000UL;
+	unsigned long tFirst, tPrev = 0;
+	uint32_t n = 0, nLate = 0, lateMax = 0;
+	uint32_t intMin = 0xFFFFFFFF, intMax = 0;
+	float intMean = 0, intM2 = 0;
+
+	doSerialNumber(&cardIssue);
+	if (!vcDecoderMessage(cardIssue, msg)) {
+		Serial.println(F("Sorry, I don't have a CMD74 for this card issue."));
+		return;
+	}
+
+	Serial.print(F("Running "));
+	if (cycles) {
+		Serial.print(cycles);
+		Serial.print(F(" cycles"));
+	} else {
+		Serial.print(F("until a key is pressed"));
+	}
+	Serial.print(F(", period "));
+	Serial.print(period);
+	Serial.println(F(" ms"));
+
+	memset(msgprev, '\0', sizeof(msgprev));
+	tFirst = micros();
+
+	while ((cycles == 0) || (n < cycles)) {
+		unsigned long tStart, tDue = tFirst + (n * periodUs);
+		uint32_t tCycle;
+
+		// Wait for this cycle's slot. A cycle which is due already has been
+		// held up by the one before.
+		if ((period > 0) && (n > 0)) {
+			while ((long)(micros() - tDue) < 0) {
+				if (Serial.available()) {
+					break;
+				}
+			}
+		}
+		if (Serial.available()) {
+			break;
+		}
+
+		tStart = micros();
+		if ((period > 0) && (n > 0) && (tStart - tDue > VC_LATE_US)) {
+			nLate++;
+			lateMax = max(lateMax, (uint32_t)(tStart - tDue));
+		}
+
+		if (!vcDecoemApdu(0x72, 16, msgprev, APDU_SEND) ||
+				!vcDecoemApdu(0x74, 32, msg, APDU_SEND) ||
+				!vcDecoemApdu(0x78, 8, seed, APDU_RECV) ||
+				!vcDecoemApdu(0x7C, 16, msgprev, APDU_RECV)) {
+			break;
+		}
+		tCycle = micros() - tStart;
+
+		// Start-to-start intervals (Welford's running variance). The rate is
+		// worked out from these too, as micros() wraps after about 71 minutes.
+		if (n > 0) {
+			uint32_t interval = tStart - tPrev;
+			float delta = (float)interval - intMean;
+
+			intMin = min(intMin, interval);
+			intMax = max(intMax, interval);
+			intMean += delta / n;
+			intM2 += delta * ((float)interval - intMean);
+		}
+		tPrev = tStart;
+
+		if (gBinaryFrames) {
+			hostFrameBegin(FRAME_VCSEED, 20);
+			hostFrameWriteU32(n);
+			hostFrameWriteU32(tStart - tFirst);
+			hostFrameWriteU32(tCycle);
+			hostFrameWrite(seed, sizeof(seed));
+			hostFrameEnd();
+		} else {
+			Serial.print(n);
+			Serial.print(F(": "));
+			printHexBuf(seed, sizeof(seed));
+			Serial.print(F(" in "));
+			Serial.print(tCycle);
+			Serial.println(F("us"));
+		}
+		n++;
+	}
+
+	Serial.println();
+	Serial.print(F("Cycles="));
+	Serial.print(n);
+	if (n > 1) {
+		Serial.print(F(" Rate="));
+		Serial.print(1000000.0 / max(intMean, 1.0f), 2);
+		Serial.println(F("/sec"));
+		Serial.print(F("Interval: min "));
+		Serial.print(intMin);
+		Serial.print(F(", mean "));
+		Serial.print(intMean, 0);
+		Serial.print(F(", max "));
+		Serial.print(intMax);
+		Serial.print(F(" us, jitter (std dev) "));
+		Serial.print((n > 2) ? sqrt(intM2 / (n - 2)) : 0, 0);
+		Serial.println(F(" us"));
+	} else {
+		Serial.println();
+	}
+	if (period > 0) {
+		Serial.print(F("Late="));
+		Serial.print(nLate);
+		Serial.print(F(" Worst="));
+		Serial.print(lateMax);
+		Serial.println(F("us"));
+	}
+}
+
  
 void handle_vcdecoem(String *cmdline)
 {
+	String sub;
+
+	if (popWord(cmdline, &sub)) {
+		long cycles = 0, period = VC_DECODER_PERIOD;
+
+		popArg(cmdline, &cycles, 10);
+		popArg(cmdline, &period, 10);
+		if (!sub.equals(F("loop")) || (cycles < 0) || (period < 0)) {
+			Serial.println(F("**ERROR: Syntax = vcdecoem [loop [<cycles> [<period ms>]]]"));
+			return;
+		}
+		vcDecoemLoop(cycles, period);
+		return;
+	}
+
 	const bool debug = false;
 	bool ok = false;
 
@@ -184,31 +388,9 @@ void handle_vcdecoem(String *cmdline)
 	// Main processing loop...
 	
 	// CMD 0x74 -- Send Message
-	switch (cardIssue) {
-		case 1:
-		case 2:
-		case 3:
-		case 4:
-		case 5:
-		case 6:
-			memcpy_P(msg, MSG_P6, sizeof(msg));
-			ok = true;
-			break;
-		
-		case 7:
-			memcpy_P(msg, MSG_P7, sizeof(msg));
-			ok = true;
-			break;
-
-		case 9:
-			memcpy_P(msg, MSG_P9, sizeof(msg));
-			ok = true;
-			break;
-
-		default:
-			Serial.println(F("Sorry, I don't have a CMD74 for this card issue."));
-			ok = false;
-			break;
+	ok = vcDecoderMessage(cardIssue, msg);
+	if (!ok) {
+		Serial.println(F("Sorry, I don't have a CMD74 for this card issue."));
 	}
 
 	if (ok) {
@@ -1,6 +1,12 @@
 #ifndef VIDEOCRYPT_H
 #define VIDEOCRYPT_H
 
+/// How often a decoder fetches a new seed ('vcdecoem loop' default), ms
+#define VC_DECODER_PERIOD	2500
+
+/// A cycle starting this late or more counts as late, microseconds
+#define VC_LATE_US			1000
+
 void handle_vcosd(String *cmdline);
 void handle_vcserial(String *cmdline);
 void handle_vcdecoem(String *cmdline);